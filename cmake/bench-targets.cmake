@@ -0,0 +1,69 @@
+# ---- Benchmarks ----
+
+# The harness forks clox and reads its resource usage with POSIX calls
+if(NOT UNIX)
+    message(STATUS "bench targets disabled: the harness needs a POSIX system")
+    return()
+endif()
+
+add_executable(clox_bench src/bench/main.c)
+target_compile_features(clox_bench PRIVATE c_std_99)
+
+# Timings only compare on the machine they were taken on, so the baseline
+# lives in the build tree until bench-baseline records one
+set(
+    BENCH_BASELINE "${PROJECT_BINARY_DIR}/bench-baseline.txt"
+    CACHE FILEPATH "Results the bench target compares against"
+)
+set(BENCH_RUNS 3 CACHE STRING "Runs of each benchmark, the fastest is kept")
+set(BENCH_ARGS "" CACHE STRING "; separated clox options to benchmark with, e.g. --jit")
+
+# Developer mode traces execution, so benchmarks run on a separate Release
+# build with the same VM options
+set(bench_dir "${PROJECT_BINARY_DIR}/bench-release")
+
+add_custom_target(
+    bench-clox
+    COMMAND "${CMAKE_COMMAND}"
+    -S "${PROJECT_SOURCE_DIR}"
+    -B "${bench_dir}"
+    -D CMAKE_BUILD_TYPE=Release
+    -D CLOX_DEVELOPER_MODE=OFF
+    -D "CLOX_THREADED_DISPATCH=${CLOX_THREADED_DISPATCH}"
+    -D "CLOX_REGISTER_VM=${CLOX_REGISTER_VM}"
+    -D "CLOX_JIT=${CLOX_JIT}"
+    -D "CLOX_POOL_ALLOCATOR=${CLOX_POOL_ALLOCATOR}"
+    COMMAND "${CMAKE_COMMAND}" --build "${bench_dir}" --config Release --target clox
+    COMMENT "Building clox for benchmarking"
+    VERBATIM
+)
+
+add_custom_target(
+    bench
+    COMMAND clox_bench
+    --runs "${BENCH_RUNS}"
+    --baseline "${BENCH_BASELINE}"
+    "${bench_dir}/clox"
+    "${PROJECT_SOURCE_DIR}/bench"
+    -- ${BENCH_ARGS}
+    WORKING_DIRECTORY "${PROJECT_BINARY_DIR}"
+    COMMENT "Running benchmarks"
+    VERBATIM
+)
+
+add_custom_target(
+    bench-baseline
+    COMMAND clox_bench
+    --runs "${BENCH_RUNS}"
+    --baseline "${BENCH_BASELINE}"
+    --update
+    "${bench_dir}/clox"
+    "${PROJECT_SOURCE_DIR}/bench"
+    -- ${BENCH_ARGS}
+    WORKING_DIRECTORY "${PROJECT_BINARY_DIR}"
+    COMMENT "Storing benchmark results as the baseline"
+    VERBATIM
+)
+
+add_dependencies(bench clox_bench bench-clox)
+add_dependencies(bench-baseline clox_bench bench-clox)
@@ -8,5 +8,6 @@ add_custom_target(
 
 add_dependencies(run clox)
 
+include(cmake/bench-targets.cmake)
 include(cmake/lint-targets.cmake)
 include(cmake/spell-targets.cmake)
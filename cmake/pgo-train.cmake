@@ -0,0 +1,60 @@
+cmake_minimum_required(VERSION 3.21)
+
+macro(default name)
+    if(NOT DEFINED "${name}")
+        set("${name}" "${ARGN}")
+    endif()
+endmacro()
+
+default(CLOX clox)
+default(BENCH_DIR bench)
+default(PROFILE_DIR pgo-profile)
+default(LLVM_PROFDATA "")
+default(PROFDATA "")
+default(MODES "")
+
+# Profiles of earlier sources would only be rejected as mismatched
+file(REMOVE_RECURSE "${PROFILE_DIR}")
+file(MAKE_DIRECTORY "${PROFILE_DIR}")
+
+file(GLOB scripts "${BENCH_DIR}/*.lox")
+
+# Comma separated clox options to run each script with, empty for none
+string(REPLACE "," ";" modes "${MODES}")
+
+foreach(script IN LISTS scripts)
+    foreach(mode IN LISTS modes)
+        execute_process(
+            COMMAND "${CLOX}" ${mode} "${script}"
+            RESULT_VARIABLE result
+            OUTPUT_QUIET
+        )
+
+        if(NOT result EQUAL "0")
+            message(FATAL_ERROR "'${script}' ${mode}: clox returned with ${result}")
+        endif()
+    endforeach()
+endforeach()
+
+# Threads running scripts side by side and marking in parallel
+execute_process(
+    COMMAND "${CLOX}" --jobs 4 ${scripts}
+    RESULT_VARIABLE result
+    OUTPUT_QUIET
+)
+
+if(NOT result EQUAL "0")
+    message(FATAL_ERROR "--jobs 4: clox returned with ${result}")
+endif()
+
+if(NOT LLVM_PROFDATA STREQUAL "")
+    file(GLOB raw_profiles "${PROFILE_DIR}/*.profraw")
+    execute_process(
+        COMMAND "${LLVM_PROFDATA}" merge "-output=${PROFDATA}" ${raw_profiles}
+        RESULT_VARIABLE result
+    )
+
+    if(NOT result EQUAL "0")
+        message(FATAL_ERROR "llvm-profdata returned with ${result}")
+    endif()
+endif()
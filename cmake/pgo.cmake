@@ -0,0 +1,87 @@
+# ---- Profile guided optimization ----
+
+# GENERATE instruments clox and adds a pgo-train target running the benchmark
+# corpus, USE rebuilds it from the profiles. GCC keys its profiles by object
+# path, so both stages must use the same build directory.
+if(NOT CLOX_PGO MATCHES "^(GENERATE|USE)$")
+    message(FATAL_ERROR "CLOX_PGO must be empty, GENERATE or USE, not '${CLOX_PGO}'")
+endif()
+
+include(CheckCCompilerFlag)
+
+if(CMAKE_C_COMPILER_ID STREQUAL "GNU")
+    if(CLOX_PGO STREQUAL "GENERATE")
+        # --jobs and parallel marking run instrumented code on several threads
+        set(pgo_flags "-fprofile-generate=${CLOX_PGO_DIR}" -fprofile-update=atomic)
+    else()
+        set(pgo_flags "-fprofile-use=${CLOX_PGO_DIR}" -fprofile-correction)
+
+        # Keep code the corpus never reaches optimized for speed rather than size
+        check_c_compiler_flag(-fprofile-partial-training HAVE_PROFILE_PARTIAL_TRAINING)
+
+        if(HAVE_PROFILE_PARTIAL_TRAINING)
+            list(APPEND pgo_flags -fprofile-partial-training)
+        endif()
+    endif()
+elseif(CMAKE_C_COMPILER_ID MATCHES "Clang")
+    set(pgo_profdata "${CLOX_PGO_DIR}/clox.profdata")
+    get_filename_component(compiler_dir "${CMAKE_C_COMPILER}" DIRECTORY)
+    find_program(LLVM_PROFDATA NAMES llvm-profdata HINTS "${compiler_dir}")
+
+    if(NOT LLVM_PROFDATA)
+        message(FATAL_ERROR "PGO with Clang needs llvm-profdata to merge profiles")
+    endif()
+
+    if(CLOX_PGO STREQUAL "GENERATE")
+        set(pgo_flags "-fprofile-instr-generate=${CLOX_PGO_DIR}/clox-%p.profraw")
+    else()
+        set(pgo_flags "-fprofile-instr-use=${pgo_profdata}")
+    endif()
+else()
+    message(FATAL_ERROR "PGO is only supported with GCC and Clang")
+endif()
+
+if(CMAKE_C_COMPILER_ID STREQUAL "GNU" AND CLOX_PGO STREQUAL "USE")
+    # With its profile and LTO, GCC 12 made compiling large scripts twice as
+    # slow, while the compiler runs too briefly to gain from one
+    get_target_property(lib_sources clox_lib SOURCES)
+    list(REMOVE_ITEM lib_sources src/lib/compiler.c)
+    set_property(SOURCE ${lib_sources} APPEND PROPERTY COMPILE_OPTIONS ${pgo_flags})
+else()
+    target_compile_options(clox_lib PRIVATE ${pgo_flags})
+endif()
+
+target_compile_options(clox PRIVATE ${pgo_flags})
+target_link_options(clox PRIVATE ${pgo_flags})
+
+if(CLOX_PGO STREQUAL "GENERATE")
+    # Every tier built is trained so none of them is laid out as cold code,
+    # passed comma separated as the command would split a list
+    set(pgo_modes ",-O,--gc-full")
+    get_target_property(lib_definitions clox_lib COMPILE_DEFINITIONS)
+
+    if("CLOX_REGISTER_VM" IN_LIST lib_definitions)
+        string(APPEND pgo_modes ",--regvm")
+    endif()
+
+    if("CLOX_JIT" IN_LIST lib_definitions)
+        string(APPEND pgo_modes ",--jit")
+    endif()
+
+    add_custom_target(
+        pgo-train
+        COMMAND "${CMAKE_COMMAND}"
+        -D "CLOX=$<TARGET_FILE:clox>"
+        -D "BENCH_DIR=${PROJECT_SOURCE_DIR}/bench"
+        -D "MODES=${pgo_modes}"
+        -D "PROFILE_DIR=${CLOX_PGO_DIR}"
+        -D "LLVM_PROFDATA=${LLVM_PROFDATA}"
+        -D "PROFDATA=${pgo_profdata}"
+        -P "${PROJECT_SOURCE_DIR}/cmake/pgo-train.cmake"
+        WORKING_DIRECTORY "${PROJECT_BINARY_DIR}"
+        COMMENT "Training clox on the benchmark corpus"
+        VERBATIM
+    )
+
+    add_dependencies(pgo-train clox)
+endif()
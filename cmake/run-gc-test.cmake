@@ -0,0 +1,39 @@
+cmake_minimum_required(VERSION 3.21)
+
+# Runs SCRIPT with CLOX with a small and a large --gc-initial heap. The script
+# keeps little alive, so each cycle should only start once about the initial
+# heap size has been allocated since the last one, rather than a multiple of
+# the few bytes that survived it.
+
+function(check_cycles initial bytes)
+    set(stats "${CMAKE_CURRENT_BINARY_DIR}/gc-cycles-${initial}.json")
+
+    execute_process(
+        COMMAND "${CLOX}" --gc-initial "${initial}" --gc-stats "${stats}" "${SCRIPT}"
+        RESULT_VARIABLE result
+        OUTPUT_QUIET
+        ERROR_VARIABLE error
+    )
+
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Exited with ${result}:\n${error}")
+    endif()
+
+    file(READ "${stats}" json)
+    file(REMOVE "${stats}")
+    string(JSON cycles GET "${json}" 0 gc cycles)
+    string(JSON freed GET "${json}" 0 gc bytesFreed)
+    string(JSON live GET "${json}" 0 gc bytesAllocated)
+
+    # Twice the cycles it takes to allocate it all, incremental cycles finish
+    # some way past where they start
+    math(EXPR limit "2 * (${freed} + ${live}) / ${bytes} + 1")
+
+    if(cycles GREATER limit)
+        message(FATAL_ERROR "${cycles} cycles with a ${initial} initial heap, expected "
+                            "at most ${limit}")
+    endif()
+endfunction()
+
+check_cycles(1M 1048576)
+check_cycles(16M 16777216)
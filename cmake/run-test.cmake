@@ -0,0 +1,70 @@
+cmake_minimum_required(VERSION 3.21)
+
+# Runs SCRIPT with CLOX. Its standard output must be the text of the
+# `// expect: ` comments in the script, one line each. A script containing
+# `// expect error: MESSAGE` must fail, compiling or running, with MESSAGE as
+# the first line of its standard error. Further `// expect error: ` comments
+# give the lines following it, such as those of the stack trace.
+
+file(READ "${SCRIPT}" source)
+
+set(expected "")
+string(REGEX MATCHALL "// expect: [^\n]*" expectations "${source}")
+
+foreach(expectation IN LISTS expectations)
+    string(REGEX REPLACE "^// expect: " "" line "${expectation}")
+    string(APPEND expected "${line}\n")
+endforeach()
+
+set(expected_error "")
+set(expected_error_lines 0)
+set(rest "${source}")
+
+# Matched one at a time, a list of them would split messages at semicolons
+while(rest MATCHES "// expect error: ([^\n]*)(.*)")
+    string(APPEND expected_error "${CMAKE_MATCH_1}\n")
+    set(rest "${CMAKE_MATCH_2}")
+    math(EXPR expected_error_lines "${expected_error_lines} + 1")
+endwhile()
+
+execute_process(
+    COMMAND "${CLOX}" "${SCRIPT}"
+    RESULT_VARIABLE result
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE error
+)
+
+if(NOT output STREQUAL expected)
+    message(FATAL_ERROR "Expected output:\n${expected}\nGot:\n${output}\n${error}")
+endif()
+
+if(expected_error STREQUAL "")
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Exited with ${result}:\n${error}")
+    endif()
+else()
+    # As many lines of the standard error as there are expectations
+    set(error_head "")
+    set(rest "${error}")
+
+    foreach(idx RANGE 1 ${expected_error_lines})
+        string(FIND "${rest}" "\n" end)
+
+        if(end EQUAL -1)
+            string(APPEND error_head "${rest}\n")
+            set(rest "")
+        else()
+            string(SUBSTRING "${rest}" 0 ${end} line)
+            string(APPEND error_head "${line}\n")
+            math(EXPR end "${end} + 1")
+            string(SUBSTRING "${rest}" ${end} -1 rest)
+        endif()
+    endforeach()
+
+    if(result EQUAL 0 OR NOT error_head STREQUAL expected_error)
+        message(
+            FATAL_ERROR
+            "Expected error '${expected_error}', exited with ${result}:\n${error}"
+        )
+    endif()
+endif()
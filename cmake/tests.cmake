@@ -0,0 +1,32 @@
+# Every script under test/ is run by clox and its output compared with the
+# `// expect: ` comments it contains, see cmake/run-test.cmake
+file(GLOB_RECURSE test_scripts CONFIGURE_DEPENDS "${PROJECT_SOURCE_DIR}/test/*.lox")
+
+foreach(script IN LISTS test_scripts)
+    file(RELATIVE_PATH name "${PROJECT_SOURCE_DIR}/test" "${script}")
+    string(REGEX REPLACE "\\.lox$" "" name "${name}")
+
+    add_test(
+        NAME "${name}"
+        COMMAND "${CMAKE_COMMAND}"
+        -D "CLOX=$<TARGET_FILE:clox>"
+        -D "SCRIPT=${script}"
+        -P "${PROJECT_SOURCE_DIR}/cmake/run-test.cmake"
+    )
+
+    # Compiler bugs tend to show up as endless loops rather than crashes
+    set_tests_properties("${name}" PROPERTIES TIMEOUT 10)
+endforeach()
+
+# Stress testing collects at every allocation whatever the heap size
+if(NOT CLOX_DEVELOPER_MODE)
+    add_test(
+        NAME gc/min-heap
+        COMMAND "${CMAKE_COMMAND}"
+        -D "CLOX=$<TARGET_FILE:clox>"
+        -D "SCRIPT=${PROJECT_SOURCE_DIR}/test/gc/instantiation.lox"
+        -P "${PROJECT_SOURCE_DIR}/cmake/run-gc-test.cmake"
+    )
+
+    set_tests_properties(gc/min-heap PROPERTIES TIMEOUT 10)
+endif()
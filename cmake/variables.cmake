@@ -8,6 +8,51 @@ if(PROJECT_IS_TOP_LEVEL)
     option(CLOX_DEVELOPER_MODE "Enable developer mode" OFF)
 endif()
 
+# ---- VM options ----
+
+option(
+    CLOX_THREADED_DISPATCH
+    "Use computed-goto dispatch in the VM when the compiler supports it"
+    ON
+)
+
+option(
+    CLOX_REGISTER_VM
+    "Build the register bytecode interpreter, selected at run time with --regvm"
+    ON
+)
+
+option(
+    CLOX_JIT
+    "Build the x86-64 baseline JIT, enabled at run time with --jit"
+    ON
+)
+
+option(
+    CLOX_POOL_ALLOCATOR
+    "Allocate heap objects from size-class pools instead of malloc"
+    ON
+)
+
+# ---- Optimization options ----
+
+option(
+    CLOX_LTO
+    "Link clox with interprocedural optimization across clox_lib and the executable"
+    OFF
+)
+
+set(
+    CLOX_PGO "" CACHE STRING
+    "Profile guided optimization stage: empty, GENERATE to train or USE to apply"
+)
+set_property(CACHE CLOX_PGO PROPERTY STRINGS "" GENERATE USE)
+
+set(
+    CLOX_PGO_DIR "${PROJECT_BINARY_DIR}/pgo-profile" CACHE PATH
+    "Directory the PGO training runs write their profiles to"
+)
+
 # ---- Warning guard ----
 
 # target_include_directories with the SYSTEM modifier will request the compiler
@@ -40,6 +40,7 @@ typedef enum {
     OP_PRINT,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE,
     OP_LOOP,
     OP_CALL,
     OP_INVOKE,
@@ -50,18 +51,115 @@ typedef enum {
     OP_CLASS,
     OP_INHERIT,
     OP_METHOD,
+    OP_LIST,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    // Wide forms, only emitted when the operand doesn't fit the short form
+    OP_CONSTANT_LONG,      // 24 bit constant index
+    OP_GET_LOCAL_LONG,     // 16 bit slot
+    OP_SET_LOCAL_LONG,     // 16 bit slot
+    OP_GET_GLOBAL_LONG,    // 24 bit slot
+    OP_DEFINE_GLOBAL_LONG, // 24 bit slot
+    OP_SET_GLOBAL_LONG,    // 24 bit slot
+    OP_JUMP_LONG,          // 24 bit offset, as are the jumps below
+    OP_JUMP_IF_FALSE_LONG,
+    OP_JUMP_IF_TRUE_LONG,
+    OP_LOOP_LONG,
+    OP_GET_UPVALUE_LONG,  // 16 bit slot
+    OP_SET_UPVALUE_LONG,  // 16 bit slot
+    OP_GET_PROPERTY_LONG, // 24 bit constant index, as are the ones below
+    OP_SET_PROPERTY_LONG,
+    OP_GET_SUPER_LONG,
+    OP_INVOKE_LONG,
+    OP_SUPER_INVOKE_LONG,
+    OP_CLOSURE_LONG,
+    OP_CLASS_LONG,
+    OP_METHOD_LONG,
+    // Superinstructions selected by the optimizer for hot sequences
+    OP_GET_LOCAL_0,
+    OP_GET_LOCAL_1,
+    OP_GET_LOCAL_2,
+    OP_GET_LOCAL_3,
+    OP_ADD_LOCAL_CONST,
+    OP_INCREMENT_LOCAL,
+    OP_LESS_LOCAL_LOCAL_JUMP,
+    // Quickened forms the interpreter rewrites sites seeing only numbers to,
+    // never emitted by the compiler
+    OP_GREATER_NUM,
+    OP_LESS_NUM,
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
 } OpCode;
 
+/**
+ * @brief Maximum number of receiver shapes an inline cache remembers before the
+ * access site is considered megamorphic and falls back to plain lookups.
+ */
+#define INLINE_CACHE_WAYS 4
+
+// Forward declare object types referenced by inline caches
+typedef struct ObjClosure ObjClosure;
+typedef struct ObjShape ObjShape;
+
+/**
+ * @brief Result of a property lookup for one receiver shape.
+ *
+ * @details Field entries hold the slot the field lives in. Method entries hold
+ * the resolved closure and the class' method table version it was resolved
+ * against. `OP_SET_PROPERTY` entries that add a field also hold the shape the
+ * instance transitions to.
+ */
+typedef struct {
+    ObjShape *shape;
+    ObjShape *transition;
+    ObjClosure *method;
+    uint32_t version;
+    uint32_t slot;
+} InlineCacheEntry;
+
+/**
+ * @brief Per-instruction lookup cache used by property and invoke opcodes.
+ *
+ * @details Caches are keyed by the receiver's shape, which fixes both its class
+ * and its field layout. A site is monomorphic until a second shape is seen and
+ * polymorphic up to `INLINE_CACHE_WAYS` shapes.
+ */
+typedef struct {
+    uint8_t count;
+    InlineCacheEntry entries[INLINE_CACHE_WAYS];
+} InlineCache;
+
+/**
+ * @brief Run of bytecode compiled from the same source line.
+ *
+ * @details A run starts at `offset` and extends up to the start of the next
+ * run or the end of the chunk.
+ */
+typedef struct {
+    size_t offset;
+    size_t line;
+} LineStart;
+
 /**
  * @brief Dynamic array of opcodes. An array is considered a 'Chunk' of the larger
  * bytecode program.
+ *
+ * @details Code and lines with no capacity are borrowed from a bytecode cache
+ * file and aren't owned by the chunk.
  */
 typedef struct {
     size_t count;
     size_t capacity;
     uint8_t *code;
-    size_t *lines;
+    size_t lineCount;
+    size_t lineCapacity;
+    LineStart *lines;
     ValueArray constants;
+    size_t cacheCount;
+    size_t cacheCapacity;
+    InlineCache *caches;
 } Chunk;
 
 /**
@@ -74,10 +172,47 @@ void initChunk(Chunk *chunk);
  */
 void writeChunk(VM *vm, Compiler *compiler, Chunk *chunk, uint8_t byte, size_t line);
 
+/**
+ * @brief Length in bytes of the instruction at `offset`, including operands.
+ */
+size_t instructionLength(Chunk *chunk, size_t offset);
+
+/**
+ * @brief Generic opcode a quickened `op` was rewritten from, `op` itself when
+ * it isn't quickened.
+ */
+uint8_t genericOpcode(uint8_t op);
+
+/**
+ * @brief Computes the most stack slots a call running the code of `chunk`
+ * uses at once, counting the callee and its `arity` arguments.
+ *
+ * @returns 0 for code popping the callee, which only a corrupt cache file holds
+ */
+size_t stackDepth(VM *vm, Compiler *compiler, Chunk *chunk, uint8_t arity);
+
+/**
+ * @brief Looks up the source line the byte at `offset` was compiled from.
+ */
+size_t getLine(Chunk *chunk, size_t offset);
+
+/**
+ * @brief Looks up the line of the run covering `offset` in a run-length line
+ * table of `lineCount` runs.
+ */
+size_t findLine(const LineStart *lines, size_t lineCount, size_t offset);
+
 /**
  * @brief Adds constant to bytecode chunk's value pool.
  */
-uint8_t addConstant(VM *vm, Compiler *compiler, Chunk *chunk, Value value);
+size_t addConstant(VM *vm, Compiler *compiler, Chunk *chunk, Value value);
+
+/**
+ * @brief Reserves a new inline cache in the chunk's cache pool.
+ *
+ * @returns index of the cache, referenced by the instruction's operand
+ */
+size_t addInlineCache(VM *vm, Compiler *compiler, Chunk *chunk);
 
 /**
  * @brief Frees chunk.
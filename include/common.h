@@ -12,6 +12,8 @@
 #include <stdint.h>
 
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT16_COUNT (UINT16_MAX + 1)
+#define UINT24_MAX 0xffffff
 
 // Forward declare VM type
 typedef struct VM VM;
@@ -22,8 +24,48 @@ typedef struct Compiler Compiler;
 // Forward declare ClassCompiler type
 typedef struct ClassCompiler ClassCompiler;
 
+// Forward declare Image type
+typedef struct Image Image;
+
+// Forward declare Profiler type
+typedef struct Profiler Profiler;
+
 #define NAN_BOXING
 
+// Computed-goto dispatch is only available with GNU C compatible compilers,
+// otherwise `run()' falls back to the portable switch loop.
+#if defined(CLOX_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define THREADED_DISPATCH
+#endif
+
+// Number of objects traced or swept by each incremental garbage collector step,
+// bounding the pause a single allocation can incur.
+#ifndef GC_STEP_SIZE
+#define GC_STEP_SIZE 256
+#endif
+
+// Heap size the first collection starts at, and the factor later
+// collections grow the live heap by to find where the next one starts.
+#ifndef GC_INITIAL_HEAP
+#define GC_INITIAL_HEAP (4 * 1024 * 1024)
+#endif
+
+#ifndef GC_HEAP_GROW_FACTOR
+#define GC_HEAP_GROW_FACTOR 2
+#endif
+
+// Marking can be spread over threads with POSIX threads and the GNU C atomic
+// builtins used to claim mark bits.
+#if defined(CLOX_THREADS) && (defined(__GNUC__) || defined(__clang__))
+#define PARALLEL_MARK
+#endif
+
+// Heap size below which marking stays on one thread, as starting the others
+// would take longer than tracing a small heap.
+#ifndef GC_PARALLEL_THRESHOLD
+#define GC_PARALLEL_THRESHOLD (1024 * 1024)
+#endif
+
 #ifdef CLOX_DEVELOPER_MODE
 #undef DEBUG_TRACE_EXECUTION
 #define DEBUG_TRACE_EXECUTION
@@ -11,6 +11,7 @@
 #include "object.h"
 #include "scanner.h"
 #include <stdint.h>
+#include <stdio.h>
 
 /**
  * @brief Parser type.
@@ -20,6 +21,7 @@ typedef struct {
     Token previous;
     bool hadError;
     bool panicMode;
+    FILE *err; // The VM's error stream
 } Parser;
 
 /**
@@ -52,7 +54,7 @@ typedef struct {
  * @brief Represents variables closed over by closures
  */
 typedef struct {
-    uint8_t index;
+    uint16_t index;
     bool isLocal;
 } Upvalue;
 
@@ -72,9 +74,11 @@ struct Compiler {
     ObjFunction *func;
     FunctionType ftype;
 
-    Local locals[UINT8_COUNT];
+    Local *locals;
     intmax_t localCount;
-    Upvalue upvalues[UINT8_COUNT];
+    intmax_t localCapacity;
+    Upvalue *upvalues;
+    size_t upvalueCapacity;
     intmax_t scopeDepth;
 };
 
@@ -9,6 +9,13 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "regvm.h"
+
+/**
+ * @brief Obtains the name of a stack bytecode opcode, "OP_UNKNOWN" for bytes
+ * that aren't one.
+ */
+const char *opcodeName(uint8_t opcode);
 
 /**
  * @brief Disassembles bytecode chunks.
@@ -20,4 +27,15 @@ void disassembleChunk(Chunk *chunk, const char *name);
  */
 size_t disassembleInstruction(Chunk *chunk, size_t offset);
 
+/**
+ * @brief Disassembles the register code of a function, `chunk` is its stack
+ * chunk holding the constants.
+ */
+void disassembleRegChunk(RegChunk *reg, Chunk *chunk, const char *name);
+
+/**
+ * @brief Disassembles an individual register instruction
+ */
+size_t disassembleRegInstruction(RegChunk *reg, Chunk *chunk, size_t index);
+
 #endif // clox_debug_h
@@ -0,0 +1,97 @@
+/**
+ * @brief String hashing used for interning
+ *
+ * @file hash.h
+ */
+
+#ifndef clox_hash_h
+#define clox_hash_h
+
+#include "common.h"
+#include <string.h>
+
+/**
+ * @brief Base of the polynomial string hash, odd so it's invertible mod 2^64.
+ */
+#define HASH_BASE ((uint64_t)0x100000001b3)
+
+/**
+ * @brief Powers of `HASH_BASE` used to fold eight bytes per step.
+ */
+#define HASH_BASE2 (HASH_BASE * HASH_BASE)
+#define HASH_BASE4 (HASH_BASE2 * HASH_BASE2)
+#define HASH_BASE8 (HASH_BASE4 * HASH_BASE4)
+
+/**
+ * @brief Computes the polynomial hash `sum(chars[i] * HASH_BASE^(length-1-i))`
+ * of a string, modulo 2^64.
+ *
+ * @details Eight bytes are folded in per iteration so the multiplications of a
+ * step are independent of each other and only one sits on the loop carried
+ * dependency chain. Being polynomial, the hash of a concatenation can be
+ * derived from the hashes of its parts, see `hashConcat()`.
+ */
+static inline uint64_t hashChars(const char *chars, size_t length) {
+    const unsigned char *bytes = (const unsigned char *)chars;
+    uint64_t hash = 0;
+    size_t idx = 0;
+
+    for (; idx + 8 <= length; idx += 8) {
+        uint64_t hi = bytes[idx] * HASH_BASE2 * HASH_BASE + bytes[idx + 1] * HASH_BASE2 +
+                      bytes[idx + 2] * HASH_BASE + bytes[idx + 3];
+        uint64_t lo = bytes[idx + 4] * HASH_BASE2 * HASH_BASE +
+                      bytes[idx + 5] * HASH_BASE2 + bytes[idx + 6] * HASH_BASE +
+                      bytes[idx + 7];
+        hash = hash * HASH_BASE8 + hi * HASH_BASE4 + lo;
+    }
+
+    for (; idx < length; idx++) {
+        hash = hash * HASH_BASE + bytes[idx];
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Computes `HASH_BASE^exponent` modulo 2^64.
+ */
+static inline uint64_t hashBasePow(size_t exponent) {
+    uint64_t result = 1;
+    uint64_t base = HASH_BASE;
+
+    while (exponent > 0) {
+        if (exponent & 1) {
+            result *= base;
+        }
+
+        base *= base;
+        exponent >>= 1;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Hash of the concatenation of two strings given their hashes, taking
+ * O(log `lengthB`) time instead of rehashing the result.
+ */
+static inline uint64_t hashConcat(uint64_t hashA, uint64_t hashB, size_t lengthB) {
+    return hashA * hashBasePow(lengthB) + hashB;
+}
+
+/**
+ * @brief Mixes a polynomial hash into the 32 bit hash used by tables.
+ *
+ * @details The polynomial hash has weak low bits, which are exactly the bits
+ * tables index with, so it is passed through the murmur3 64 bit finalizer.
+ */
+static inline uint32_t hashFinalize(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= (uint64_t)0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= (uint64_t)0xc4ceb9fe1a85ec53;
+    hash ^= hash >> 33;
+    return (uint32_t)hash;
+}
+
+#endif // clox_hash_h
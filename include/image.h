@@ -0,0 +1,53 @@
+/**
+ * @brief Compiled code and strings frozen for sharing between VMs
+ *
+ * @file image.h
+ */
+
+#ifndef clox_image_h
+#define clox_image_h
+
+#include "common.h"
+#include "scanner.h"
+#include "vm.h"
+
+/**
+ * @brief Script compiled once and shared read-only by any number of VMs,
+ * which may run on separate threads.
+ *
+ * @details The image's functions and strings belong to `vm`, which compiled
+ * them and is never run. They are permanently marked, so the collectors of
+ * the VMs using the image neither trace nor sweep them. VMs intern strings
+ * against the image's `strings` before their own, so names compiled into the
+ * image stay identical to the ones they create, and give the image's globals
+ * the slots its code was compiled with. Mutable per-function state is kept out
+ * of frozen functions: each VM has its own copy of their inline caches, based
+ * at `cacheBase` of the function, and they are never compiled by the JIT.
+ */
+struct Image {
+    VM vm;
+    ObjFunction *script;
+    size_t cacheCount;
+};
+
+/**
+ * @brief Compiles `source` into a new image, reporting errors to stderr.
+ *
+ * @details Compilation uses the `-O` and `--regvm` options given.
+ *
+ * @returns the image or NULL if the source didn't compile
+ */
+Image *newImage(Scanner *scanner, const char *source, bool optimize, bool registerVM);
+
+/**
+ * @brief Releases an image once no VM uses it anymore.
+ */
+void freeImage(Image *image);
+
+/**
+ * @brief Runs the top level code of the VM's image, defining its globals in
+ * the VM.
+ */
+InterpreterResult interpretImage(VM *vm);
+
+#endif // clox_image_h
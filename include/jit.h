@@ -0,0 +1,148 @@
+/**
+ * @brief Baseline template JIT compiling stack bytecode to machine code
+ *
+ * @file jit.h
+ */
+
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+/**
+ * @brief Calls plus loop back edges a function runs in the stack interpreter
+ * before it is compiled to machine code.
+ */
+#define JIT_HOT_THRESHOLD 1000
+
+/**
+ * @brief Marks bytecode offsets that don't start an instruction.
+ */
+#define JIT_NO_ENTRY UINT32_MAX
+
+/**
+ * @brief How generated code, or a runtime helper it called, left off.
+ */
+typedef enum {
+    JIT_CONTINUE, // Keep running generated code, only returned by helpers
+    JIT_SWITCH,   // The top frame changed, resume whichever tier runs it
+    JIT_DEOPT,    // Resume the frame in the stack interpreter at its `ip'
+    JIT_ERROR,    // A runtime error has been reported
+    JIT_DONE,     // The script returned
+} JitStatus;
+
+/**
+ * @brief Machine code of a function.
+ *
+ * @details `entries` maps every bytecode offset starting an instruction to the
+ * offset of its template in `code`, so a frame can enter at whatever `ip` the
+ * stack interpreter or a returning callee left it at. `hotness` counts calls
+ * and loop back edges towards `JIT_HOT_THRESHOLD`. `failed` is set once
+ * compilation was attempted and didn't succeed, so it isn't retried.
+ */
+typedef struct {
+    uint8_t *code;
+    size_t size;
+    uint32_t *entries;
+    size_t entryCount;
+    uint32_t hotness;
+    bool failed;
+} JitCode;
+
+/**
+ * @brief Initializes empty machine code.
+ */
+void initJitCode(JitCode *jit);
+
+/**
+ * @brief Releases the machine code and entry table.
+ */
+void freeJitCode(VM *vm, Compiler *compiler, JitCode *jit);
+
+/**
+ * @brief Compiles the bytecode of `chunk` into machine code, one template per
+ * instruction.
+ *
+ * @details Generated code keeps the operand stack in `vm->stack` and writes
+ * `vm->stackTop` and the frame's `ip` back before calling into the VM, so
+ * calls, `closeUpvalues()` and garbage collection see the same state the
+ * stack interpreter would leave. Constants and inline caches are embedded by
+ * address and stay reachable through the function. Instructions without a
+ * template, or whose operands fail the template's type guards, leave the
+ * frame to the stack interpreter.
+ *
+ * @returns false, marking `jit` as failed, if the platform has no templates
+ * or the code couldn't be mapped executable
+ */
+bool jitCompile(VM *vm, Compiler *compiler, Chunk *chunk, JitCode *jit);
+
+/**
+ * @brief Runs the machine code of the top frame from its current `ip` until it
+ * leaves the frame, the script returns or an error occurs.
+ */
+JitStatus jitEnter(VM *vm);
+
+// Runtime support called from generated code, implemented by the VM. Each
+// helper expects `vm->stackTop' and the top frame's `ip' to be up to date.
+
+/**
+ * @brief Calls the value `argCount` slots below the top of the stack.
+ */
+JitStatus jitCall(VM *vm, uint8_t argCount);
+
+/**
+ * @brief Invokes method `name` on the receiver `argCount` slots below the top.
+ */
+JitStatus jitInvoke(VM *vm, ObjString *name, uint8_t argCount, InlineCache *cache);
+
+/**
+ * @brief Replaces the instance on top of the stack with its property `name`.
+ */
+JitStatus jitGetProperty(VM *vm, ObjString *name, InlineCache *cache);
+
+/**
+ * @brief Stores the top of the stack into property `name` of the instance
+ * below it, leaving the value.
+ */
+JitStatus jitSetProperty(VM *vm, ObjString *name, InlineCache *cache);
+
+/**
+ * @brief Replaces the `count` values on top of the stack with a list of them.
+ */
+JitStatus jitList(VM *vm, uint8_t count);
+
+/**
+ * @brief Replaces the list and index on top of the stack with the element.
+ */
+JitStatus jitGetIndex(VM *vm);
+
+/**
+ * @brief Stores the top of the stack into the element of the list and index
+ * below it, leaving the value.
+ */
+JitStatus jitSetIndex(VM *vm);
+
+/**
+ * @brief Stores the top of the stack into upvalue `slot` of the closure.
+ */
+JitStatus jitSetUpvalue(VM *vm, uint16_t slot);
+
+/**
+ * @brief Closes the upvalue capturing the top of the stack and pops it.
+ */
+JitStatus jitCloseUpvalue(VM *vm);
+
+/**
+ * @brief Returns the top of the stack from the top frame.
+ */
+JitStatus jitReturn(VM *vm);
+
+/**
+ * @brief Pops the value on top of the stack and prints it on its own line of
+ * the VM's output.
+ */
+JitStatus jitPrint(VM *vm);
+
+#endif // clox_jit_h
@@ -0,0 +1,48 @@
+/**
+ * @brief Precompiled bytecode cache files (.loxc)
+ *
+ * @file loxc.h
+ */
+
+#ifndef clox_loxc_h
+#define clox_loxc_h
+
+#include "common.h"
+#include "scanner.h"
+#include "vm.h"
+
+/**
+ * @brief Version of the cache file layout, bumped whenever it or the bytecode
+ * changes.
+ */
+#define LOXC_VERSION 5
+
+/**
+ * @brief Obtains the cache file path for the script at `path`, allocated
+ * with `malloc()`.
+ *
+ * @details Without `cacheDir` the cache is written next to the script with a
+ * `.loxc` extension, otherwise it is named after the hash of `source` within
+ * `cacheDir`.
+ */
+char *loxcPath(const char *path, const char *cacheDir, const char *source);
+
+/**
+ * @brief Interprets `source`, running the bytecode cached at `cachePath`
+ * when it was compiled from the same source with the same options.
+ *
+ * @details Otherwise the source is compiled and the cache is rewritten. Code
+ * and line tables are used in place from the mapped file; strings are
+ * interned into `vm->strings` again and global variables get their slots
+ * from `vm->globals` as if compiled.
+ */
+InterpreterResult interpretCached(VM *vm, Scanner *scanner, const char *source,
+                                  const char *cachePath);
+
+/**
+ * @brief Releases all cache files loaded by the VM. Functions loaded from
+ * them must be freed first.
+ */
+void freeMappedFiles(VM *vm, Compiler *compiler);
+
+#endif // clox_loxc_h
@@ -23,7 +23,7 @@
  * @brief Frees Lox objects
  */
 #define FREE(vm, compiler, type, pointer)                                                \
-    reallocate(vm, compiler, pointer, sizeof(type), 0)
+    freeObjectMemory(vm, compiler, pointer, sizeof(type))
 
 /**
  * @brief Grows a dynamic array using `reallocate()`.
@@ -50,6 +50,20 @@
 void *reallocate(VM *vm, Compiler *compiler, void *pointer, size_t oldSize,
                  size_t newSize);
 
+/**
+ * @brief Allocates memory for a heap object.
+ *
+ * @details Objects are carved from the VM's size-class pool when built with
+ * `CLOX_POOL_ALLOCATOR`, otherwise this is `reallocate()`. Either way the
+ * allocation is accounted for and may trigger a collection.
+ */
+void *allocateObjectMemory(VM *vm, Compiler *compiler, size_t size);
+
+/**
+ * @brief Frees memory obtained from `allocateObjectMemory()`.
+ */
+void freeObjectMemory(VM *vm, Compiler *compiler, void *pointer, size_t size);
+
 /**
  * @brief Marks a Lox Obj to not be swept by GC
  */
@@ -61,13 +75,72 @@ void markObject(VM *vm, Obj *object);
 void markValue(VM *vm, Value value);
 
 /**
- * @brief Cleans up unused memory using mark-sweep GC
+ * @brief Write barrier for values stored into heap objects.
+ *
+ * @details While the incremental collector is marking, storing a reference
+ * into an object that has already been traced would hide it from the
+ * collector. Every such store must be followed by a barrier on the stored
+ * value, which greys it. Stores into the roots (stack, globals) don't need one
+ * as the roots are rescanned before marking finishes.
+ */
+static inline void writeBarrier(VM *vm, Value value) {
+    if (vm->gcPhase == GC_MARK) {
+        markValue(vm, value);
+    }
+}
+
+/**
+ * @brief Write barrier for object references, see `writeBarrier()`.
+ */
+static inline void writeBarrierObject(VM *vm, Obj *object) {
+    if (vm->gcPhase == GC_MARK) {
+        markObject(vm, object);
+    }
+}
+
+/**
+ * @brief Fails the running script with "Out of memory." once the system has
+ * refused an allocation.
+ *
+ * @details Raises `vm->heapExhausted` and unwinds to the interpreter loop,
+ * which reports it like any other runtime error. Without a script running, as
+ * while compiling, the process exits instead.
+ */
+void outOfMemory(VM *vm);
+
+/**
+ * @brief Performs a full mark-sweep collection, completing any incremental
+ * cycle in progress first.
  */
 void collectGarbage(VM *vm, Compiler *compiler);
 
+/**
+ * @brief Performs one bounded slice of incremental collection work.
+ *
+ * @details Starts a cycle when idle, otherwise traces or sweeps up to
+ * `vm->gcStepSize` objects. Called by `reallocate()` while a cycle is in
+ * progress or the heap has grown past `vm->nextGC`.
+ */
+void stepGarbage(VM *vm, Compiler *compiler);
+
 /**
  * @brief Free heap objects from VM
  */
 void freeObjects(VM *vm, Compiler *compiler);
 
+/**
+ * @brief Copies the collector statistics of the VM, filling in the current
+ * heap size, collection threshold and string table occupancy.
+ */
+void getGCStats(VM *vm, GCStats *stats);
+
+/**
+ * @brief Writes statistics as a single line JSON object.
+ *
+ * @details Times are in nanoseconds and sizes in bytes. `pauseHistogram` has
+ * the `GC_PAUSE_BUCKETS` buckets of `GCStats`, `live` holds the object count
+ * and bytes of each type and `history` the most recent cycles, oldest first.
+ */
+void writeGCStats(const GCStats *stats, FILE *out);
+
 #endif // clox_memory_h
@@ -3,6 +3,8 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "jit.h"
+#include "regvm.h"
 #include "table.h"
 #include "value.h"
 #include <stdint.h>
@@ -37,11 +39,26 @@
  */
 #define IS_INSTANCE(value) isObjType(value, OBJ_INSTANCE)
 
+/**
+ * @brief Checks if value is a list
+ */
+#define IS_LIST(value) isObjType(value, OBJ_LIST)
+
 /**
  * brief Checks if value is a native OS function
  */
 #define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
 
+/**
+ * @brief Checks if value is a rope, a string concatenation not yet flattened
+ */
+#define IS_ROPE(value) isObjType(value, OBJ_ROPE)
+
+/**
+ * @brief Checks if value is an instance shape
+ */
+#define IS_SHAPE(value) isObjType(value, OBJ_SHAPE)
+
 /**
  * @brief Checks if value is a string
  */
@@ -72,12 +89,27 @@
  */
 #define AS_INSTANCE(value) ((ObjInstance *)AS_OBJ(value))
 
+/**
+ * @brief Helper macro for casting value to a list object
+ */
+#define AS_LIST(value) ((ObjList *)AS_OBJ(value))
+
 /**
  * brief Helper macro for casting value to native function object
  */
 #define AS_NATIVE_OBJ(value) ((ObjNative *)AS_OBJ(value))
 #define AS_NATIVE(value) (((ObjNative *)AS_OBJ(value))->func)
 
+/**
+ * @brief Helper macro for casting value to a rope object
+ */
+#define AS_ROPE(value) ((ObjRope *)AS_OBJ(value))
+
+/**
+ * @brief Helper macro for casting value to an instance shape
+ */
+#define AS_SHAPE(value) ((ObjShape *)AS_OBJ(value))
+
 /**
  * @brief Helper macros for extracting Lox strings and string data
  */
@@ -93,11 +125,19 @@ typedef enum {
     OBJ_CLOSURE,
     OBJ_FUNCTION,
     OBJ_INSTANCE,
+    OBJ_LIST,
     OBJ_NATIVE,
+    OBJ_ROPE,
+    OBJ_SHAPE,
     OBJ_STRING,
     OBJ_UPVALUE,
 } ObjType;
 
+/**
+ * @brief Number of object types.
+ */
+#define OBJ_TYPE_COUNT (OBJ_UPVALUE + 1)
+
 /**
  * @brief Heap allocated objects in Lox
  */
@@ -109,19 +149,32 @@ struct Obj {
 
 /**
  * @brief Function object type with it's own bytecode chunk
+ *
+ * @details `reg` holds the register translation of the chunk when the
+ * function runs on the register interpreter, it is empty otherwise. `jit`
+ * holds machine code once the function got hot in the stack interpreter.
  */
 typedef struct {
     Obj obj;
     uint8_t arity;
     size_t upvalueCount;
+    size_t stackSize; // Stack slots a call uses at most, see `stackDepth()`
     Chunk chunk;
+    RegChunk reg;
+    JitCode jit;
     ObjString *name;
+    bool frozen;      // Part of an image, see image.h
+    size_t cacheBase; // First of its caches in `VM.imageCaches` when frozen
 } ObjFunction;
 
 /**
  * @brief Type of native/OS functions hoisted from C into Lox
+ *
+ * @details Natives are passed the calling VM, so any state they keep belongs
+ * in it rather than in C globals. A native that fails reports the error with
+ * `runtimeError()` and returns `UNDEFINED_VAL`.
  */
-typedef Value (*NativeFn)(size_t argCount, Value *arg);
+typedef Value (*NativeFn)(VM *vm, size_t argCount, Value *arg);
 
 /**
  * @brief Native function object
@@ -134,14 +187,25 @@ typedef struct {
 
 /**
  * @brief Lox internal representation of strings
+ *
+ * @details Characters are stored inline after the header and are always null
+ * terminated, see `STRING_SIZE()`. `poly` is the polynomial hash of the
+ * characters, kept so concatenations can be hashed without rescanning, and
+ * `hash` is its finalized form used by tables.
  */
 struct ObjString {
     Obj obj;
     size_t length;
-    char *chars;
+    uint64_t poly;
     uint32_t hash;
+    char chars[];
 };
 
+/**
+ * @brief Bytes occupied by a string object of `length` characters
+ */
+#define STRING_SIZE(length) (sizeof(ObjString) + (length) + 1)
+
 /**
  * @brief Lox internal representation of Upvalues using the Object System
  * such that values are hooked into the GC.
@@ -156,23 +220,59 @@ typedef struct {
 /**
  * @brief Lox internal representation of closures
  */
-typedef struct {
+struct ObjClosure {
     Obj obj;
     ObjFunction *func;
     ObjUpvalue **upvalues;
     size_t upvalueCount;
-} ObjClosure;
+};
 
+/**
+ * @brief Hidden class describing the field layout of instances.
+ *
+ * @details Shapes form a tree rooted at each class' empty shape. Every shape
+ * adds one field, `key`, stored in slot `slotCount - 1`, to the layout of its
+ * `parent`. Instances that add the same fields in the same order end up in the
+ * same shape, shared through the `transitions` table which maps a field name
+ * to the child shape adding it.
+ */
+struct ObjShape {
+    Obj obj;
+    ObjShape *parent;
+    ObjString *key;
+    uint32_t slotCount;
+    Table transitions;
+};
+
+/**
+ * @brief Lox internal representation of classes.
+ *
+ * @details `version` is bumped whenever `methods` changes so inline caches
+ * holding methods of this class know to refresh. `fieldCapacity` is the most
+ * fields any instance of the class has grown to and is used to size the field
+ * storage of new instances up front.
+ */
 typedef struct {
     Obj obj;
     ObjString *name;
     Table methods;
+    uint32_t version;
+    ObjShape *rootShape;
+    uint32_t fieldCapacity;
 } ObjClass;
 
+/**
+ * @brief Lox internal representation of class instances.
+ *
+ * @details Field values live in a flat array indexed by the slots described in
+ * `shape`, which only ever has `shape->slotCount` live entries.
+ */
 typedef struct {
     Obj obj;
     ObjClass *klass;
-    Table fields;
+    ObjShape *shape;
+    uint32_t capacity;
+    Value *fields;
 } ObjInstance;
 
 typedef struct {
@@ -181,6 +281,43 @@ typedef struct {
     ObjClosure *method;
 } ObjBoundMethod;
 
+/**
+ * @brief Lox internal representation of lists.
+ *
+ * @details Elements are stored contiguously in `items`, the first `count` of
+ * its `capacity` slots being live.
+ */
+typedef struct {
+    Obj obj;
+    size_t count;
+    size_t capacity;
+    Value *items;
+} ObjList;
+
+/**
+ * @brief Lox internal representation of a string concatenation whose
+ * characters are only gathered once needed.
+ *
+ * @details `left` and `right` are each a string or another rope. `poly` is the
+ * polynomial hash of the whole text, combined from those of the pieces. Once
+ * the rope is flattened `flat` holds the interned string and the pieces are
+ * dropped.
+ */
+typedef struct {
+    Obj obj;
+    size_t length;
+    uint64_t poly;
+    Obj *left;
+    Obj *right;
+    ObjString *flat;
+} ObjRope;
+
+/**
+ * @brief Concatenations shorter than this are copied right away rather than
+ * made into ropes.
+ */
+#define ROPE_MIN_LENGTH 64
+
 /**
  * @brief Constructs a new bound method object
  */
@@ -202,6 +339,54 @@ ObjInstance *newInstance(VM *vm, Compiler *compiler, ObjClass *klass);
  */
 ObjClass *newClass(VM *vm, Compiler *compiler, ObjString *name);
 
+/**
+ * @brief Looks up the slot of field `key` in `shape`.
+ *
+ * @returns the slot or -1 if the shape has no such field
+ */
+int64_t shapeFind(ObjShape *shape, ObjString *key);
+
+/**
+ * @brief Obtains the shape that results from adding field `key` to `shape`,
+ * creating it on first use.
+ */
+ObjShape *shapeTransition(VM *vm, Compiler *compiler, ObjShape *shape, ObjString *key);
+
+/**
+ * @brief Moves instance to `shape`, which must add exactly one field to the
+ * instance's current shape, and stores `value` in the new slot.
+ */
+void instanceAddField(VM *vm, Compiler *compiler, ObjInstance *instance,
+                      ObjShape *shape, Value value);
+
+/**
+ * @brief Sets field `key` of instance, adding the field if it doesn't exist.
+ */
+void instanceSetField(VM *vm, Compiler *compiler, ObjInstance *instance,
+                      ObjString *key, Value value);
+
+/**
+ * @brief Constructs an empty list object with room for `capacity` elements
+ */
+ObjList *newList(VM *vm, Compiler *compiler, size_t capacity);
+
+/**
+ * @brief Appends `value` to the end of list, growing its storage if needed.
+ */
+void listAppend(VM *vm, Compiler *compiler, ObjList *list, Value value);
+
+/**
+ * @brief Constructs a rope joining `left` and `right`, each a string or a rope
+ * that must stay reachable
+ */
+ObjRope *newRope(VM *vm, Compiler *compiler, Obj *left, Obj *right);
+
+/**
+ * @brief Obtains the interned string with the characters of `rope`, which
+ * must stay reachable, building it on first use.
+ */
+ObjString *flattenRope(VM *vm, Compiler *compiler, ObjRope *rope);
+
 /**
  * @brief Constructs a closure object
  */
@@ -213,7 +398,26 @@ ObjClosure *newClosure(VM *vm, Compiler *compiler, ObjFunction *func);
 ObjNative *newNative(VM *vm, Compiler *compiler, NativeFn func, uint8_t arity);
 
 /**
- * @brief Takes ownership of raw char data it is passed
+ * @brief Allocates a string of `length` characters for the caller to fill in.
+ *
+ * @details The string isn't a live object until it is passed to
+ * `internString()` so it must not be exposed to the VM before then. The
+ * terminating null character is already written.
+ */
+ObjString *reserveString(VM *vm, Compiler *compiler, size_t length);
+
+/**
+ * @brief Interns a string obtained from `reserveString()` whose characters
+ * have the polynomial hash `poly`, see `hashChars()`.
+ *
+ * @returns the interned string, which is `string` unless an equal string was
+ * already interned in which case `string` is freed
+ */
+ObjString *internString(VM *vm, Compiler *compiler, ObjString *string, uint64_t poly);
+
+/**
+ * @brief Takes ownership of raw char data it is passed, freeing it once the
+ * characters have been copied into a string object
  */
 ObjString *takeString(VM *vm, Compiler *compiler, size_t length, char *chars);
 
@@ -222,15 +426,34 @@ ObjString *takeString(VM *vm, Compiler *compiler, size_t length, char *chars);
  */
 ObjString *copyString(VM *vm, Compiler *compiler, size_t length, const char *chars);
 
+/**
+ * @brief Like `copyString()` for characters whose polynomial hash `poly` is
+ * already known, such as scanned identifiers.
+ */
+ObjString *copyHashedString(VM *vm, Compiler *compiler, size_t length, const char *chars,
+                            uint64_t poly);
+
 /**
  * @brief Constructs an Upvalue from a variable
  */
 ObjUpvalue *newUpvalue(VM *vm, Compiler *compiler, Value *slot);
 
 /**
- * @brief Helper function for displaying objects.
+ * @brief Lists nested deeper than this, and lists containing themselves, are
+ * printed as `[...]`.
+ */
+#define LIST_PRINT_DEPTH 16
+
+/**
+ * @brief Helper function for displaying objects to `out`.
+ */
+void printObject(FILE *out, Value value);
+
+/**
+ * @brief Obtains the camel case name of an object type, such as
+ * "boundMethod".
  */
-void printObject(Value value);
+const char *objTypeName(ObjType type);
 
 static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && OBJ_TYPE(value) == type;
@@ -0,0 +1,26 @@
+/**
+ * @brief Bytecode optimization pass
+ *
+ * @file optimizer.h
+ */
+
+#ifndef clox_optimizer_h
+#define clox_optimizer_h
+
+#include "chunk.h"
+#include "common.h"
+
+/**
+ * @brief Runs peephole optimizations over a freshly compiled chunk.
+ *
+ * @details Hot sequences of local loads, additions and comparisons are always
+ * replaced by superinstructions. When `vm->optimize` is set the pass also folds
+ * arithmetic, comparisons and negations of constants, fuses `OP_NOT` with a
+ * following conditional jump, drops values that are pushed only to be popped
+ * and removes redundant local, upvalue and global reloads. Jump offsets and
+ * line information are rebuilt for the resulting code. No sequence is
+ * rewritten if a jump lands in its middle.
+ */
+void optimizeChunk(VM *vm, Compiler *compiler, Chunk *chunk);
+
+#endif // clox_optimizer_h
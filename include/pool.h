@@ -0,0 +1,81 @@
+/**
+ * @brief Size-class pool allocator for heap objects
+ *
+ * @file pool.h
+ */
+
+#ifndef clox_pool_h
+#define clox_pool_h
+
+#include "common.h"
+
+/**
+ * @brief Size classes are multiples of `POOL_GRANULE` bytes up to
+ * `POOL_MAX_SIZE`, larger requests are passed through to `malloc()`.
+ */
+#define POOL_GRANULE 16
+#define POOL_CLASSES 8
+#define POOL_MAX_SIZE (POOL_GRANULE * POOL_CLASSES)
+
+/**
+ * @brief Bytes requested from the system whenever a size class runs dry.
+ */
+#define POOL_SLAB_SIZE (64 * 1024)
+
+/**
+ * @brief Free block, linked through its own storage.
+ */
+typedef struct PoolBlock {
+    struct PoolBlock *next;
+} PoolBlock;
+
+/**
+ * @brief Header of a slab of memory carved into equally sized blocks.
+ */
+typedef struct PoolSlab {
+    struct PoolSlab *next;
+} PoolSlab;
+
+/**
+ * @brief Blocks of one size class.
+ *
+ * @details Freed blocks are reused first, after which blocks are carved off
+ * the unused tail of the newest slab between `bump` and `end`.
+ */
+typedef struct {
+    PoolBlock *freeList;
+    char *bump;
+    char *end;
+} PoolClass;
+
+/**
+ * @brief Pool of size classes, owning every slab it has allocated.
+ */
+typedef struct {
+    PoolClass classes[POOL_CLASSES];
+    PoolSlab *slabs;
+} Pool;
+
+/**
+ * @brief Initializes an empty pool.
+ */
+void initPool(Pool *pool);
+
+/**
+ * @brief Allocates `size` bytes from the pool.
+ *
+ * @returns NULL when the system refuses more memory
+ */
+void *poolAlloc(Pool *pool, size_t size);
+
+/**
+ * @brief Returns memory obtained from `poolAlloc()` with the same `size`.
+ */
+void poolFree(Pool *pool, void *pointer, size_t size);
+
+/**
+ * @brief Releases every slab back to the system.
+ */
+void freePool(Pool *pool);
+
+#endif // clox_pool_h
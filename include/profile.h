@@ -0,0 +1,126 @@
+/**
+ * @brief Opcode counters and sampling profiler for the stack interpreter
+ *
+ * @file profile.h
+ */
+
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "vm.h"
+
+/**
+ * @brief Number of opcodes counted, one past the last opcode.
+ */
+#define PROFILE_OPCODES (OP_DIVIDE_NUM + 1)
+
+/**
+ * @brief Power of two buckets of an opcode's cycle histogram, the last one
+ * holding everything from `2^(PROFILE_BUCKETS - 1)` cycles up.
+ */
+#define PROFILE_BUCKETS 20
+
+/**
+ * @brief On average one in this many executed instructions is timed, as
+ * reading the cycle counter costs more than most instructions. The gaps are
+ * random so the timed ones don't fall in step with a loop.
+ */
+#define PROFILE_TIMING_PERIOD 16
+
+/**
+ * @brief Default CPU time between two stack samples, in microseconds.
+ */
+#define PROFILE_INTERVAL 1000
+
+/**
+ * @brief Stack sampled at least once, as folded frames.
+ */
+typedef struct {
+    char *frames; // `script;outer:12;inner:3`, outermost first
+    uint64_t hash;
+    uint64_t count;
+} ProfileSample;
+
+/**
+ * @brief Execution profile of the stack interpreter.
+ *
+ * @details `counts` holds how often each opcode ran. `cycles` holds how long
+ * the timed runs took until the next instruction was dispatched, including any
+ * call into natives or the collector. Cycles are read from the CPU's time
+ * stamp counter when there is one and are nanoseconds otherwise. `samples` is
+ * a hash set of the call stacks seen whenever the sampling timer went off.
+ */
+struct Profiler {
+    uint64_t counts[PROFILE_OPCODES];
+    uint64_t cycles[PROFILE_OPCODES][PROFILE_BUCKETS];
+    uint32_t countdown; // Instructions until the next one is timed
+    uint64_t random;    // State of the generator picking the gaps
+    int previous;       // Opcode being timed, -1 when none is
+    uint64_t start;
+
+    ProfileSample *samples;
+    size_t sampleCount;
+    size_t sampleCapacity;
+    uint64_t sampleTotal;
+};
+
+/**
+ * @brief Initializes an empty profile.
+ */
+void initProfiler(Profiler *profiler);
+
+/**
+ * @brief Releases the samples of a profile.
+ */
+void freeProfiler(Profiler *profiler);
+
+/**
+ * @brief Starts the process wide timer requesting a stack sample every
+ * `interval` microseconds of CPU time.
+ *
+ * @details Only one profiled VM should run at a time, as whichever profiled
+ * VM dispatches next takes the sample.
+ *
+ * @returns false if the platform has no interval timer, opcodes are still
+ * counted and timed
+ */
+bool startSampling(uint32_t interval);
+
+/**
+ * @brief Stops the sampling timer.
+ */
+void stopSampling(void);
+
+/**
+ * @brief Stops timing the current opcode, so time spent outside the stack
+ * interpreter isn't charged to it.
+ */
+static inline void profilePause(Profiler *profiler) { profiler->previous = -1; }
+
+/**
+ * @brief Accounts for dispatching `opcode` in the top frame of `vm`, taking a
+ * stack sample if one is due.
+ *
+ * @details The `ip` of every frame, the top one included, must be stored and
+ * point past the opcode of the instruction the frame is at. Kept out of line
+ * so the interpreter loop doesn't grow when it isn't profiling.
+ */
+void profileInstruction(VM *vm, Profiler *profiler, uint8_t opcode);
+
+/**
+ * @brief Writes the sampled stacks in the folded format taken by flame graph
+ * tools, one `frames count` line per distinct stack.
+ */
+void writeFoldedStacks(Profiler *profiler, FILE *out);
+
+/**
+ * @brief Writes a table of the executed opcodes, most frequent first, with
+ * their cycle histograms.
+ */
+void writeOpcodeProfile(Profiler *profiler, FILE *out);
+
+#endif // clox_profile_h
@@ -0,0 +1,119 @@
+/**
+ * @brief Register bytecode translated from stack bytecode
+ *
+ * @file regvm.h
+ */
+
+#ifndef clox_regvm_h
+#define clox_regvm_h
+
+#include "chunk.h"
+#include "common.h"
+
+/**
+ * @brief Register bytecode opcode values.
+ *
+ * @details Registers are the slots of the call frame, so locals keep their
+ * stack slot and temporaries live right above them. `RK()` operands name a
+ * register below `RK_CONSTANT` and a constant of the chunk at or above it.
+ */
+typedef enum {
+    REG_MOVE,                // R[a] = RK(b)
+    REG_NIL,                 // R[a] = nil
+    REG_TRUE,                // R[a] = true
+    REG_FALSE,               // R[a] = false
+    REG_GET_GLOBAL,          // R[a] = G[b]
+    REG_DEFINE_GLOBAL,       // G[b] = RK(c)
+    REG_SET_GLOBAL,          // G[b] = RK(c), G[b] must be defined
+    REG_GET_UPVALUE,         // R[a] = U[b]
+    REG_SET_UPVALUE,         // U[b] = RK(c)
+    REG_EQUAL,               // R[a] = RK(b) == RK(c)
+    REG_GREATER,             // R[a] = RK(b) > RK(c)
+    REG_LESS,                // R[a] = RK(b) < RK(c)
+    REG_ADD,                 // R[a] = RK(b) + RK(c)
+    REG_SUBTRACT,            // R[a] = RK(b) - RK(c)
+    REG_MULTIPLY,            // R[a] = RK(b) * RK(c)
+    REG_DIVIDE,              // R[a] = RK(b) / RK(c)
+    REG_NOT,                 // R[a] = !RK(b)
+    REG_NEGATE,              // R[a] = -RK(b)
+    REG_PRINT,               // print RK(b)
+    REG_JUMP,                // pc += d
+    REG_JUMP_IF_FALSE,       // if RK(b) is falsey, pc += d
+    REG_JUMP_IF_TRUE,        // if RK(b) is truthy, pc += d
+    REG_JUMP_IF_EQUAL,       // if RK(b) == RK(c), pc += d
+    REG_JUMP_IF_NOT_EQUAL,   // if !(RK(b) == RK(c)), pc += d
+    REG_JUMP_IF_GREATER,     // if RK(b) > RK(c), pc += d
+    REG_JUMP_IF_NOT_GREATER, // if !(RK(b) > RK(c)), pc += d
+    REG_JUMP_IF_LESS,        // if RK(b) < RK(c), pc += d
+    REG_JUMP_IF_NOT_LESS,    // if !(RK(b) < RK(c)), pc += d
+    REG_CALL,                // R[a] = R[a](R[a + 1], ..., R[a + b])
+    REG_RETURN,              // return RK(b)
+} RegOpCode;
+
+/**
+ * @brief First `RK()` operand value referring to a constant instead of a
+ * register.
+ */
+#define RK_CONSTANT UINT8_COUNT
+
+/**
+ * @brief Three address register instruction.
+ *
+ * @details Jump offsets in `d` are relative to the following instruction.
+ */
+typedef struct {
+    uint8_t op;
+    uint8_t a;
+    uint16_t b;
+    uint16_t c;
+    int16_t d;
+} RegInstr;
+
+/**
+ * @brief Register code of a function.
+ *
+ * @details Constants are shared with the function's stack chunk. `frameSize`
+ * is the number of registers the function needs, including its arguments.
+ * An empty chunk means the function only has stack code.
+ */
+typedef struct {
+    size_t count;
+    size_t capacity;
+    RegInstr *code;
+    size_t lineCount;
+    size_t lineCapacity;
+    LineStart *lines;
+    size_t frameSize;
+} RegChunk;
+
+/**
+ * @brief Initializes an empty register chunk.
+ */
+void initRegChunk(RegChunk *reg);
+
+/**
+ * @brief Releases register chunk memory.
+ */
+void freeRegChunk(VM *vm, Compiler *compiler, RegChunk *reg);
+
+/**
+ * @brief Obtains the source line of the register instruction at `index`.
+ */
+size_t getRegLine(RegChunk *reg, size_t index);
+
+/**
+ * @brief Translates the stack bytecode of `chunk`, belonging to a function
+ * taking `arity` arguments, into register code.
+ *
+ * @details Loads of locals and constants aren't copied into temporaries but
+ * forwarded to the instruction consuming them, results are written straight
+ * into locals on assignment and comparisons feeding a conditional jump become
+ * a single compare and branch. Functions must not capture their own locals
+ * and may only use variables, arithmetic, control flow, calls and printing.
+ *
+ * @returns false, leaving `reg` empty, if the chunk can't be translated
+ */
+bool translateChunk(VM *vm, Compiler *compiler, Chunk *chunk, size_t arity,
+                    RegChunk *reg);
+
+#endif // clox_regvm_h
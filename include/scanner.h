@@ -27,6 +27,8 @@ typedef enum {
     TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE,
     TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET,
+    TOKEN_RIGHT_BRACKET,
 
     TOKEN_COMMA,
     TOKEN_DOT,
@@ -76,16 +78,25 @@ typedef enum {
 
 /**
  * @brief Token type.
+ *
+ * @details Identifier and keyword tokens carry the polynomial hash of their
+ * lexeme, see `hashChars()`, so names are interned without hashing them
+ * again. It is 0 for other tokens.
  */
 typedef struct {
     TokenType type;
     const char *start;
     size_t length;
     size_t line;
+    uint64_t hash;
 } Token;
 
 /**
  * @brief Initializes Scanner.
+ *
+ * @details `source` must be terminated by '\0'. The scanner may read the rest
+ * of the aligned 16 byte block holding the terminator, which never crosses a
+ * page boundary.
  */
 void initScanner(Scanner *scanner, const char *source);
 
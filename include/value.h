@@ -8,6 +8,7 @@
 #define clox_value_h
 
 #include "common.h"
+#include <stdio.h>
 #include <string.h>
 
 /**
@@ -33,6 +34,7 @@ typedef struct ObjString ObjString;
 #define TAG_NIL   1 // 01.
 #define TAG_FALSE 2 // 10.
 #define TAG_TRUE  3 // 11.
+#define TAG_UNDEF 4 // 100.
 
 typedef uint64_t  Value;
 
@@ -41,8 +43,10 @@ typedef uint64_t  Value;
  */
 #define IS_BOOL(value)      (((value) | 1) == TRUE_VAL)
 #define IS_NIL(value)       ((value) == NIL_VAL)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
 #define IS_NUMBER(value)    (((value) & QNAN) != QNAN)
 #define IS_OBJ(value)       (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_NUMBERS(a, b)    ((((a) & QNAN) != QNAN) & (((b) & QNAN) != QNAN))
 
 /**
  * @brief Extracts value from NaN-Boxed type 
@@ -58,6 +62,7 @@ typedef uint64_t  Value;
 #define FALSE_VAL           ((Value)(uint64_t)(QNAN | TAG_FALSE))
 #define TRUE_VAL            ((Value)(uint64_t)(QNAN | TAG_TRUE))
 #define NIL_VAL             ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define UNDEFINED_VAL       ((Value)(uint64_t)(QNAN | TAG_UNDEF))
 #define NUMBER_VAL(num)     numToValue(num)
 #define OBJ_VAL(obj)        (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
@@ -84,6 +89,7 @@ typedef enum {
     VAL_NIL,
     VAL_NUMBER,
     VAL_OBJ,
+    VAL_UNDEFINED,
 } ValueType;
 
 /**
@@ -103,8 +109,10 @@ typedef struct {
  */
 #define IS_BOOL(value)      ((value).type == VAL_BOOL)
 #define IS_NIL(value)       ((value).type == VAL_NIL)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 #define IS_NUMBER(value)    ((value).type == VAL_NUMBER)
 #define IS_OBJ(value)       ((value).type == VAL_OBJ)
+#define IS_NUMBERS(a, b)    (((a).type == VAL_NUMBER) & ((b).type == VAL_NUMBER))
 
 /**
  * @brief Extracts value from dynamic Lox type (tagged union)
@@ -118,19 +126,23 @@ typedef struct {
  */
 #define BOOL_VAL(value)     ((Value){VAL_BOOL, { .boolean = (value) }})
 #define NIL_VAL             ((Value){VAL_NIL, { .number = 0 }})
+#define UNDEFINED_VAL       ((Value){VAL_UNDEFINED, { .number = 0 }})
 #define NUMBER_VAL(value)   ((Value){VAL_NUMBER, { .number = (value) }})
 #define OBJ_VAL(object)     ((Value){VAL_OBJ, { .obj = (Obj *)(object) }})
 
 #endif // NAN_BOXING
 
+// `UNDEFINED_VAL' is never visible to Lox code, it marks global variable slots
+// that are resolved but not yet defined.
+
 // clang-format on
 
 /**
  * @brief Dynamic array of values.
  */
 typedef struct {
-    uint8_t capacity;
-    uint8_t count;
+    size_t capacity;
+    size_t count;
     Value *values;
 } ValueArray;
 
@@ -159,4 +171,9 @@ bool valuesEqual(Value a, Value b);
  */
 void printValue(Value value);
 
+/**
+ * @brief Prints Value to `out`.
+ */
+void fprintValue(FILE *out, Value value);
+
 #endif // clox_value_h
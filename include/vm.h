@@ -9,43 +9,215 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "jit.h"
 #include "object.h"
+#include "pool.h"
+#include "regvm.h"
 #include "scanner.h"
 #include "table.h"
 #include "value.h"
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+#include <setjmp.h>
+#include <stdio.h>
 
+/**
+ * @brief Default limit of nested calls, see `VM.maxFrames`.
+ */
+#define FRAMES_MAX 1024
+
+/**
+ * @brief Frames and stack slots a new VM has room for, both grow on demand.
+ */
+#define FRAMES_INITIAL 16
+#define STACK_INITIAL 256
+
+/**
+ * @brief Stack slots kept free past those a call uses, for natives and the
+ * runtime to push temporaries to.
+ */
+#define STACK_SLACK 16
+
+/**
+ * @brief Activation record of a function call.
+ *
+ * @details Frames of functions with register code track their position in
+ * `pc` instead of `ip`.
+ */
 typedef struct {
     ObjClosure *closure;
     uint8_t *ip;
+    RegInstr *pc;
     Value *slots;
+    InlineCache *caches;
 } CallFrame;
 
+/**
+ * @brief Phases of an incremental garbage collection cycle.
+ */
+typedef enum {
+    GC_IDLE,  // No collection in progress, waiting on allocation threshold
+    GC_MARK,  // Tracing grey objects a slice at a time, write barrier active
+    GC_SWEEP, // Freeing unmarked objects a slice at a time
+} GCPhase;
+
+/**
+ * @brief Buckets of the GC pause histogram. Bucket 0 counts pauses under a
+ * microsecond, bucket `k` those from `2^(k-1)` up to `2^k` microseconds and
+ * the last one everything longer.
+ */
+#define GC_PAUSE_BUCKETS 24
+
+/**
+ * @brief Number of most recent collection cycles kept in `GCStats`.
+ */
+#define GC_HISTORY 16
+
+/**
+ * @brief Outcome of one collection cycle.
+ */
+typedef struct {
+    size_t freed;  // Bytes freed by its sweep
+    size_t live;   // Bytes allocated once it finished
+    size_t nextGC; // Heap size it set for the next cycle to start at
+} GCCycle;
+
+/**
+ * @brief Statistics kept by the garbage collector, see `getGCStats()`.
+ *
+ * @details A pause is the time spent in one call to the collector, which is
+ * a whole collection when stop-the-world and one slice otherwise. Live bytes
+ * are counted by type during each sweep and include the arrays an object
+ * owns, objects allocated while the cycle was under way aren't swept and so
+ * aren't counted until the next cycle. `history[(cycles - 1) % GC_HISTORY]`
+ * is the latest cycle. The heap and string table fields are only filled in by
+ * `getGCStats()`.
+ */
+typedef struct {
+    uint64_t cycles;
+    uint64_t pauses;
+    uint64_t pauseTotal; // Nanoseconds
+    uint64_t pauseMax;   // Nanoseconds
+    uint64_t pauseHistogram[GC_PAUSE_BUCKETS];
+    uint64_t bytesFreed;
+    size_t liveBytes[OBJ_TYPE_COUNT];
+    size_t liveObjects[OBJ_TYPE_COUNT];
+    GCCycle history[GC_HISTORY];
+
+    size_t bytesAllocated;
+    size_t nextGC;
+    size_t stringCount;    // Interned strings
+    size_t stringEntries;  // Entries of `vm->strings`, interned or deleted
+    size_t stringCapacity; // Buckets of `vm->strings`
+
+    // Tallies of the cycle being swept
+    size_t sweepFreed;
+    size_t sweepBytes[OBJ_TYPE_COUNT];
+    size_t sweepObjects[OBJ_TYPE_COUNT];
+} GCStats;
+
+/**
+ * @brief Bytecode cache file kept loaded for the lifetime of a VM.
+ *
+ * @details Chunks loaded from the file point into `data` instead of owning
+ * their code and line tables. `mapped` tells whether `data` is a memory
+ * mapping or, where mapping isn't available, a heap copy.
+ */
+typedef struct {
+    void *data;
+    size_t size;
+    bool mapped;
+} MappedFile;
+
 /**
  * @brief VM structure.
+ *
+ * @details Global variables live in `globalValues`, indexed by the operand of
+ * the global opcodes. `globals` maps each name to its slot index and
+ * `globalNames` maps back from slot to name for error reporting.
+ *
+ * A VM shares no mutable state with other VMs: its heap, interned strings,
+ * globals and output streams are its own, so separate VMs can run on
+ * separate threads at the same time. A single VM must only be used by one
+ * thread at a time. Values and objects are never passed between VMs, except
+ * for the frozen ones of a shared `image`. `imageCaches` holds the VM's inline
+ * caches for the image's functions.
+ *
+ * The collector policy can be changed before running code: `nextGC` is where
+ * the first cycle starts, after which each cycle ends with `nextGC` set to
+ * `gcGrowFactor` times the live heap, but no lower than `gcMinHeap`. With `gcTargetRatio` set the factor is
+ * adapted after every cycle so roughly that share of the time between cycles
+ * is spent collecting. Allocating past `heapLimit` runs a full collection and,
+ * if the heap is still too large, fails the script with a runtime error at the
+ * next call or loop iteration.
+ *
+ * `frames` and `stack` start small and grow as calls need them. Every call
+ * makes sure the stack has room for the most slots its function uses, so
+ * pushing never checks for overflow. Growing the stack moves it, anything
+ * pointing into it has to be reloaded after a call. More than `maxFrames`
+ * nested calls fail with a stack overflow.
  */
 struct VM {
-    CallFrame frames[FRAMES_MAX];
+    CallFrame *frames;
     size_t frameCount;
+    size_t frameCapacity;
+    size_t maxFrames;
 
-    Value stack[STACK_MAX];
+    Value *stack;
     Value *stackTop;
+    size_t stackCapacity;
 
     Table globals;
+    Value *globalValues;
+    ObjString **globalNames;
+    size_t globalCount;
+    size_t globalCapacity;
+
     Table strings;
 
+    Image *image;
+    InlineCache *imageCaches;
+
+    MappedFile *mappedFiles;
+    size_t mappedCount;
+    size_t mappedCapacity;
+
+    FILE *out; // Receives `print` output
+    FILE *err; // Receives compile and runtime errors
+
     ObjString *initString;
+    bool optimize;
+    bool registerVM;
+    bool jit;
+    uint32_t jitThreshold;
+    Profiler *profiler; // Profiles the stack interpreter when set
     ObjUpvalue *openUpvalues;
 
     size_t bytesAllocated;
     size_t nextGC;
+    size_t gcMinHeap; // No cycle after the first starts below this heap size
     Obj *objects;
+    Pool pool;
+
+    GCPhase gcPhase;
+    bool gcIncremental;
+    size_t gcStepSize;
+    size_t gcThreads; // Threads marking a full trace, only used with PARALLEL_MARK
+    double gcGrowFactor;
+    double gcTargetRatio;   // 0 keeps `gcGrowFactor` fixed
+    size_t heapLimit;       // 0 for no limit
+    bool heapExhausted;     // Raised as an error at the next call or loop iteration
+    jmp_buf *outOfMemory;   // Where a refused allocation unwinds to, NULL outside `run()`
+    uint64_t gcEpoch;       // When the last cycle ended, in nanoseconds
+    uint64_t gcEpochPauses; // `gcStats.pauseTotal` when it did
+    Obj *sweepList;
+    GCStats gcStats;
+    Obj *survivors;
+    Obj **survivorsTail;
 
     size_t greyCount;
     size_t greyCapacity;
     Obj **greyStack;
+    bool greyOverflow; // A grey object was dropped because its stack couldn't grow
 };
 
 /**
@@ -62,16 +234,46 @@ typedef enum {
  */
 void initVM(VM *vm);
 
+/**
+ * @brief Initialize VM instance using the code and strings of `image`, which
+ * must outlive it.
+ */
+void initVMWithImage(VM *vm, Image *image);
+
 /**
  * @brief Cleans up VM instance.
  */
 void freeVM(VM *vm, Compiler *compiler);
 
+/**
+ * @brief Allocates and initializes a VM on the heap, e.g. one per worker
+ * thread, using `image` unless it is NULL.
+ *
+ * @returns the VM or NULL when out of memory
+ */
+VM *newVM(Image *image);
+
+/**
+ * @brief Cleans up and releases a VM obtained from `newVM()`.
+ */
+void destroyVM(VM *vm);
+
 /**
  * @brief Interprets a chunk of bytecode.
  */
 InterpreterResult interpret(VM *vm, Scanner *scanner, const char *source);
 
+/**
+ * @brief Runs a compiled script function.
+ */
+InterpreterResult interpretFunction(VM *vm, ObjFunction *func);
+
+/**
+ * @brief Obtains the slot of global variable `name`, reserving an undefined
+ * slot the first time a name is seen.
+ */
+size_t globalSlot(VM *vm, Compiler *compiler, ObjString *name);
+
 /**
  * @brief Push to VM stack.
  */
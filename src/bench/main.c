@@ -0,0 +1,482 @@
+// POSIX process, directory and clock functions aren't part of strict C99 headers
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX 64
+#define BENCH_NAME_MAX 64
+#define BENCH_PATH_MAX 4096
+#define BENCH_RUNS 3
+#define BENCH_THRESHOLD 10.0
+
+// Generated next to the results rather than kept in the corpus, as it is
+// mostly repetition. Functions are nested in groups so no chunk needs more
+// than 256 constants.
+#define COMPILE_NAME "compile"
+#define COMPILE_SOURCE "bench_compile.lox"
+#define COMPILE_GROUPS 100
+#define COMPILE_FUNCTIONS 100
+
+// Written by clox with --gc-stats and --profile, read back after each run
+#define GC_STATS_FILE "bench_gc.json"
+#define PROFILE_ERR_FILE "bench_profile.txt"
+
+/**
+ * @brief Measurements of one benchmark.
+ *
+ * @details `wallMs` is the fastest of the runs and `peakKb` the largest
+ * resident set of any of them. `instructions` counts the bytecode
+ * instructions the script executes, taken from a separate profiled run as
+ * profiling slows the interpreter down.
+ */
+typedef struct {
+    char name[BENCH_NAME_MAX];
+    char path[BENCH_PATH_MAX];
+    double wallMs;
+    uint64_t instructions;
+    long peakKb;
+    uint64_t gcCycles;
+    bool failed;
+} Benchmark;
+
+typedef struct {
+    const char *clox;
+    const char *dir;
+    const char *baseline;
+    char **cloxArgs; // Passed to clox ahead of the script
+    int cloxArgCount;
+    int runs;
+    double threshold; // Slowdown in percent reported as a regression
+    bool update;
+} Options;
+
+static double elapsedMs(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) * 1e3 +
+           (double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/**
+ * @brief Runs clox with `extra` options ahead of the configured ones and the
+ * script, discarding its output and sending its errors to `errPath`.
+ *
+ * @returns the exit status, -1 if clox couldn't be started or was killed
+ */
+static int runClox(const Options *options, const char **extra, int extraCount,
+                   const char *script, const char *errPath, double *wallMs,
+                   long *peakKb) {
+    size_t argvSize = (size_t)(extraCount + options->cloxArgCount + 3);
+    const char **argv = (const char **)malloc(sizeof(char *) * argvSize);
+
+    if (argv == NULL) {
+        return -1;
+    }
+
+    int argc = 0;
+    argv[argc++] = options->clox;
+
+    for (int idx = 0; idx < extraCount; idx++) {
+        argv[argc++] = extra[idx];
+    }
+
+    for (int idx = 0; idx < options->cloxArgCount; idx++) {
+        argv[argc++] = options->cloxArgs[idx];
+    }
+
+    argv[argc++] = script;
+    argv[argc] = NULL;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        int err = open(errPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (null < 0 || err < 0 || dup2(null, STDOUT_FILENO) < 0 ||
+            dup2(err, STDERR_FILENO) < 0) {
+            _exit(127);
+        }
+
+        // execv() takes the arguments as mutable strings but leaves them be
+        union {
+            const char **in;
+            char *const *out;
+        } args = {argv};
+
+        execv(options->clox, args.out);
+        _exit(127);
+    }
+
+    free(argv);
+
+    if (pid < 0) {
+        return -1;
+    }
+
+    int status;
+    struct rusage usage;
+
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        return -1;
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *wallMs = elapsedMs(&start, &end);
+
+#ifdef __APPLE__
+    *peakKb = usage.ru_maxrss / 1024;
+#else
+    *peakKb = usage.ru_maxrss;
+#endif // __APPLE__
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/**
+ * @brief Reads the number after the first occurrence of `key` in the file at
+ * `path`.
+ */
+static bool readCounter(const char *path, const char *key, uint64_t *value) {
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    char buffer[8192];
+    size_t length = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[length] = '\0';
+
+    char *found = strstr(buffer, key);
+
+    if (found == NULL) {
+        return false;
+    }
+
+    *value = strtoull(found + strlen(key), NULL, 10);
+    return true;
+}
+
+static void measure(const Options *options, Benchmark *bench) {
+    const char *statsArgs[] = {"--gc-stats", GC_STATS_FILE};
+    const char *profileArgs[] = {"--profile", "/dev/null"};
+    const char *path = bench->path;
+    long peakKb = 0;
+    double wallMs = 0;
+
+    bench->wallMs = 0;
+    bench->peakKb = 0;
+
+    for (int run = 0; run < options->runs; run++) {
+        if (runClox(options, statsArgs, 2, path, "/dev/null", &wallMs, &peakKb) != 0) {
+            bench->failed = true;
+            return;
+        }
+
+        if (run == 0 || wallMs < bench->wallMs) {
+            bench->wallMs = wallMs;
+        }
+
+        if (peakKb > bench->peakKb) {
+            bench->peakKb = peakKb;
+        }
+    }
+
+    // Collections of the last run, a script allocates the same every time
+    if (!readCounter(GC_STATS_FILE, "\"cycles\": ", &bench->gcCycles)) {
+        bench->gcCycles = 0;
+    }
+
+    // The opcode profile starts with `N instructions, M stack samples`
+    if (runClox(options, profileArgs, 2, path, PROFILE_ERR_FILE, &wallMs, &peakKb) != 0 ||
+        !readCounter(PROFILE_ERR_FILE, "", &bench->instructions)) {
+        bench->instructions = 0;
+    }
+}
+
+/**
+ * @brief Writes a script declaring `COMPILE_GROUPS` functions that each nest
+ * `COMPILE_FUNCTIONS` small functions, none of which is called, so running it
+ * is all scanning and compiling.
+ */
+static bool writeCompileSource(const char *path) {
+    FILE *file = fopen(path, "w");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "// Generated by clox_bench, only compiled\n");
+
+    for (int group = 0; group < COMPILE_GROUPS; group++) {
+        fprintf(file, "fun group%d() {\n", group);
+
+        for (int func = 0; func < COMPILE_FUNCTIONS; func++) {
+            fprintf(file,
+                    "  fun f%d(a, b) {\n"
+                    "    var total = a * %d + b;\n"
+                    "    for (var i = 0; i < b; i = i + 1) {\n"
+                    "      if (i > %d and total != nil) total = total - i / 2;\n"
+                    "      else total = total + \"s%d\" == \"x\";\n"
+                    "    }\n"
+                    "    while (total > a) { total = total - (a + %d.5); }\n"
+                    "    return total;\n"
+                    "  }\n",
+                    func, func, group, func, func);
+        }
+
+        fprintf(file, "  return f0(1, 2);\n}\n");
+    }
+
+    fprintf(file, "print \"compiled\";\n");
+    return fclose(file) == 0;
+}
+
+static int compareNames(const void *a, const void *b) {
+    return strcmp(((const Benchmark *)a)->name, ((const Benchmark *)b)->name);
+}
+
+/**
+ * @brief Adds every `.lox` script of `dir` followed by the generated compile
+ * benchmark.
+ *
+ * @returns the number of benchmarks, -1 on failure
+ */
+static int findBenchmarks(const char *dir, Benchmark *benches) {
+    DIR *handle = opendir(dir);
+
+    if (handle == NULL) {
+        fprintf(stderr, "Could not open benchmark directory \"%s\".\n", dir);
+        return -1;
+    }
+
+    int count = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(handle)) != NULL && count < BENCH_MAX - 1) {
+        size_t length = strlen(entry->d_name);
+
+        if (length <= 4 || length - 4 >= BENCH_NAME_MAX ||
+            strcmp(entry->d_name + length - 4, ".lox") != 0) {
+            continue;
+        }
+
+        Benchmark *bench = &benches[count++];
+        memset(bench, 0, sizeof(Benchmark));
+        memcpy(bench->name, entry->d_name, length - 4);
+        snprintf(bench->path, sizeof(bench->path), "%s/%s", dir, entry->d_name);
+    }
+
+    closedir(handle);
+    qsort(benches, (size_t)count, sizeof(Benchmark), compareNames);
+
+    if (!writeCompileSource(COMPILE_SOURCE)) {
+        fprintf(stderr, "Could not write \"%s\".\n", COMPILE_SOURCE);
+        return -1;
+    }
+
+    Benchmark *bench = &benches[count++];
+    memset(bench, 0, sizeof(Benchmark));
+    strcpy(bench->name, COMPILE_NAME);
+    strcpy(bench->path, COMPILE_SOURCE);
+    return count;
+}
+
+/**
+ * @brief Reads a baseline written by `writeBaseline()`, missing files give an
+ * empty baseline.
+ */
+static int readBaseline(const char *path, Benchmark *baseline) {
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    char line[512];
+    int count = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL && count < BENCH_MAX) {
+        Benchmark *bench = &baseline[count];
+        memset(bench, 0, sizeof(Benchmark));
+
+        if (line[0] != '#' &&
+            sscanf(line, "%63s %lf %" SCNu64 " %ld %" SCNu64, bench->name, &bench->wallMs,
+                   &bench->instructions, &bench->peakKb, &bench->gcCycles) == 5) {
+            count++;
+        }
+    }
+
+    fclose(file);
+    return count;
+}
+
+static bool writeBaseline(const char *path, const Benchmark *benches, int count) {
+    FILE *file = fopen(path, "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "Could not write baseline \"%s\".\n", path);
+        return false;
+    }
+
+    fprintf(file, "# benchmark wall_ms instructions peak_rss_kb gc_cycles\n");
+
+    for (int idx = 0; idx < count; idx++) {
+        const Benchmark *bench = &benches[idx];
+
+        if (!bench->failed) {
+            fprintf(file, "%s %.1f %" PRIu64 " %ld %" PRIu64 "\n", bench->name,
+                    bench->wallMs, bench->instructions, bench->peakKb, bench->gcCycles);
+        }
+    }
+
+    return fclose(file) == 0;
+}
+
+static const Benchmark *findBaseline(const Benchmark *baseline, int count,
+                                     const char *name) {
+    for (int idx = 0; idx < count; idx++) {
+        if (strcmp(baseline[idx].name, name) == 0) {
+            return &baseline[idx];
+        }
+    }
+
+    return NULL;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: clox_bench [options] CLOX DIR [-- clox options...]\n"
+            "Runs every .lox script in DIR and a generated compile benchmark.\n"
+            "Options:\n"
+            "  --runs N          Runs of each script, the fastest is kept (default %d)\n"
+            "  --baseline FILE   Compare against the results stored in FILE\n"
+            "  --threshold PCT   Slowdown reported as a regression (default %.0f)\n"
+            "  --update          Store the results as the new baseline\n",
+            BENCH_RUNS, BENCH_THRESHOLD);
+    exit(64);
+}
+
+int main(int argc, char *argv[]) {
+    Options options = {
+        .clox = NULL,
+        .dir = NULL,
+        .baseline = NULL,
+        .cloxArgs = NULL,
+        .cloxArgCount = 0,
+        .runs = BENCH_RUNS,
+        .threshold = BENCH_THRESHOLD,
+        .update = false,
+    };
+
+    int idx = 1;
+
+    for (; idx < argc; idx++) {
+        if (strcmp(argv[idx], "--runs") == 0 && idx + 1 < argc) {
+            options.runs = atoi(argv[++idx]);
+
+            if (options.runs <= 0) {
+                usage();
+            }
+        } else if (strcmp(argv[idx], "--baseline") == 0 && idx + 1 < argc) {
+            options.baseline = argv[++idx];
+        } else if (strcmp(argv[idx], "--threshold") == 0 && idx + 1 < argc) {
+            options.threshold = atof(argv[++idx]);
+        } else if (strcmp(argv[idx], "--update") == 0) {
+            options.update = true;
+        } else if (strcmp(argv[idx], "--") == 0) {
+            idx++;
+            break;
+        } else if (argv[idx][0] == '-') {
+            usage();
+        } else if (options.clox == NULL) {
+            options.clox = argv[idx];
+        } else if (options.dir == NULL) {
+            options.dir = argv[idx];
+        } else {
+            usage();
+        }
+    }
+
+    if (options.clox == NULL || options.dir == NULL ||
+        (options.update && options.baseline == NULL)) {
+        usage();
+    }
+
+    options.cloxArgs = argv + idx;
+    options.cloxArgCount = argc - idx;
+
+    static Benchmark benches[BENCH_MAX];
+    static Benchmark baseline[BENCH_MAX];
+    int count = findBenchmarks(options.dir, benches);
+
+    if (count < 0) {
+        return 74;
+    }
+
+    int baselineCount = options.baseline != NULL && !options.update
+                            ? readBaseline(options.baseline, baseline)
+                            : 0;
+    int status = 0;
+
+    printf("%-22s %10s %10s %8s %10s %12s %10s\n", "benchmark", "time ms", "baseline",
+           "change", "Minstr/s", "peak RSS KB", "GC cycles");
+
+    for (int bench = 0; bench < count; bench++) {
+        Benchmark *result = &benches[bench];
+        measure(&options, result);
+
+        if (result->failed) {
+            printf("%-22s FAILED\n", result->name);
+            status = 1;
+            continue;
+        }
+
+        printf("%-22s %10.1f ", result->name, result->wallMs);
+        const Benchmark *base = findBaseline(baseline, baselineCount, result->name);
+        bool slower = false;
+
+        if (base != NULL && base->wallMs > 0) {
+            double change = 100.0 * (result->wallMs - base->wallMs) / base->wallMs;
+            slower = change > options.threshold;
+            printf("%10.1f %+7.1f%%", base->wallMs, change);
+        } else {
+            printf("%10s %8s", "-", "-");
+        }
+
+        printf(" %10.1f %12ld %10" PRIu64 "%s\n",
+               (double)result->instructions / (result->wallMs * 1e3), result->peakKb,
+               result->gcCycles, slower ? "  SLOWER" : "");
+
+        if (slower) {
+            status = 1;
+        }
+
+        fflush(stdout);
+    }
+
+    remove(GC_STATS_FILE);
+    remove(PROFILE_ERR_FILE);
+
+    if (options.update && !writeBaseline(options.baseline, benches, count)) {
+        return 74;
+    }
+
+    return status;
+}
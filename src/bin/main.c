@@ -1,11 +1,30 @@
+// POSIX file and mapping functions aren't part of strict C99 headers
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "common.h"
+#include "image.h"
+#include "loxc.h"
+#include "memory.h"
+#include "profile.h"
 #include "scanner.h"
 #include "vm.h"
 
+#ifdef CLOX_THREADS
+#include <pthread.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CLOX_MMAP_SOURCE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 static void repl(VM *vm, Scanner *scanner) {
     char line[1024];
 
@@ -21,12 +40,86 @@ static void repl(VM *vm, Scanner *scanner) {
     }
 }
 
-static char *readFile(const char *path) {
+/**
+ * @brief Source text of a script, terminated by the '\0' the scanner stops at.
+ *
+ * @details `mapped` is set when `text` is a read-only mapping of `size` bytes
+ * rather than a heap buffer.
+ */
+typedef struct {
+    char *text;
+    size_t size;
+    bool mapped;
+} SourceFile;
+
+#ifdef CLOX_MMAP_SOURCE
+/**
+ * @brief Maps the file read-only, followed by at least one zeroed byte.
+ *
+ * @details The whole range is reserved as anonymous zero pages first and the
+ * file is mapped over its start, so the byte after the last one is '\0' even
+ * when the size is a multiple of the page size.
+ */
+static bool mapFile(const char *path, SourceFile *source) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+
+    size_t fileSize = (size_t)st.st_size;
+    char *text = mmap(NULL, fileSize + 1, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool ok = text != MAP_FAILED;
+
+    if (ok && fileSize > 0) {
+        ok = mmap(text, fileSize, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED;
+
+        if (ok) {
+            // The scanner reads the source front to back exactly once
+            posix_madvise(text, fileSize, POSIX_MADV_SEQUENTIAL);
+        } else {
+            munmap(text, fileSize + 1);
+        }
+    }
+
+    // The mapping outlives the descriptor
+    close(fd);
+
+    if (!ok) {
+        return false;
+    }
+
+    source->text = text;
+    source->size = fileSize + 1;
+    source->mapped = true;
+    return true;
+}
+#endif // CLOX_MMAP_SOURCE
+
+/**
+ * @brief Reads the script at `path`, reporting failures to `err`.
+ *
+ * @returns false if the file couldn't be read
+ */
+static bool readFile(const char *path, SourceFile *source, FILE *err) {
+#ifdef CLOX_MMAP_SOURCE
+    if (mapFile(path, source)) {
+        return true;
+    }
+#endif // CLOX_MMAP_SOURCE
+
     FILE *file = fopen(path, "rb");
 
     if (file == NULL) {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);
+        fprintf(err, "Could not open file \"%s\".\n", path);
+        return false;
     }
 
     fseek(file, 0, SEEK_END);
@@ -36,53 +129,648 @@ static char *readFile(const char *path) {
     char *buffer = (char *)malloc(fileSize + 1);
 
     if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+        fprintf(err, "Not enough memory to read \"%s\".\n", path);
+        fclose(file);
+        return false;
     }
 
     size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
+    fclose(file);
 
     if (bytesRead < fileSize) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
-        exit(74);
+        fprintf(err, "Could not read file \"%s\".\n", path);
+        free(buffer);
+        return false;
     }
 
     buffer[bytesRead] = '\0';
 
-    fclose(file);
-    return buffer;
+    source->text = buffer;
+    source->size = fileSize + 1;
+    source->mapped = false;
+    return true;
+}
+
+static void freeFile(SourceFile *source) {
+#ifdef CLOX_MMAP_SOURCE
+    if (source->mapped) {
+        munmap(source->text, source->size);
+        return;
+    }
+#endif // CLOX_MMAP_SOURCE
+
+    free(source->text);
 }
 
-static void runFile(VM *vm, Scanner *scanner, const char *path) {
-    char *source = readFile(path);
-    InterpreterResult result = interpret(vm, scanner, source);
-    free(source);
+/**
+ * @brief Command line options applied to every VM.
+ */
+typedef struct {
+    bool optimize;
+    bool registerVM;
+    bool jit;
+    uint32_t jitThreshold;
+    size_t maxFrames;
+    bool gcIncremental;
+    size_t gcStepSize;
+    size_t gcThreads;
+    double gcGrowFactor;
+    double gcTargetRatio;
+    size_t gcInitialHeap;
+    size_t heapLimit;
+    bool useCache;
+    const char *cacheDir;
+    Image *image;       // Compiled from --preload, run in every VM first
+    Profiler *profiler; // Set by --profile
+    FILE *gcStats;      // Receives GC statistics of every VM with --gc-stats
+} Options;
+
+static void applyOptions(VM *vm, const Options *options) {
+    vm->optimize = options->optimize;
+    vm->registerVM = options->registerVM;
+    vm->jit = options->jit;
+    vm->jitThreshold = options->jitThreshold;
+    vm->maxFrames = options->maxFrames;
+    vm->profiler = options->profiler;
+    vm->gcIncremental = options->gcIncremental;
+    vm->gcStepSize = options->gcStepSize;
+    vm->gcThreads = options->gcThreads;
+    vm->gcGrowFactor = options->gcGrowFactor;
+    vm->gcTargetRatio = options->gcTargetRatio;
+    vm->nextGC = options->gcInitialHeap;
+    vm->gcMinHeap = options->gcInitialHeap;
+    vm->heapLimit = options->heapLimit;
+}
+
+/**
+ * @brief Runs the script at `path`.
+ *
+ * @returns the process exit status for its outcome
+ */
+static int runFile(VM *vm, Scanner *scanner, const char *path, const Options *options) {
+    if (vm->image != NULL && interpretImage(vm) != INTERPRETER_OK) {
+        return 70;
+    }
+
+    SourceFile source;
+
+    if (!readFile(path, &source, vm->err)) {
+        return 74;
+    }
+
+    char *cachePath =
+        options->useCache ? loxcPath(path, options->cacheDir, source.text) : NULL;
+    InterpreterResult result = cachePath != NULL
+                                   ? interpretCached(vm, scanner, source.text, cachePath)
+                                   : interpret(vm, scanner, source.text);
+    free(cachePath);
+    freeFile(&source);
 
     if (result == INTERPRETER_COMPILE_ERR) {
-        exit(65);
+        return 65;
     }
 
     if (result == INTERPRETER_RUNTIME_ERR) {
-        exit(70);
+        return 70;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Script run in a VM of its own.
+ *
+ * @details With more than one worker, `out` and `err` are temporary files
+ * holding the script's output until it is copied to the process' streams in
+ * the order scripts were given.
+ */
+typedef struct {
+    const char *path;
+    FILE *out;
+    FILE *err;
+    int status;
+    bool done;
+    GCStats gcStats;
+} Job;
+
+static void runJob(Job *job, const Options *options) {
+    VM *vm = newVM(options->image);
+
+    if (vm == NULL) {
+        fprintf(job->err, "Not enough memory to run \"%s\".\n", job->path);
+        job->status = 70;
+        return;
+    }
+
+    applyOptions(vm, options);
+    vm->out = job->out;
+    vm->err = job->err;
+
+    Scanner scanner;
+    job->status = runFile(vm, &scanner, job->path, options);
+
+    if (options->gcStats != NULL) {
+        getGCStats(vm, &job->gcStats);
+    }
+
+    destroyVM(vm);
+    fflush(job->out);
+}
+
+#ifdef CLOX_THREADS
+/**
+ * @brief Scripts shared by the worker threads, taken in order.
+ */
+typedef struct {
+    Job *jobs;
+    size_t count;
+    size_t next;
+    const Options *options;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} JobQueue;
+
+static void *worker(void *arg) {
+    JobQueue *queue = (JobQueue *)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        Job *job = queue->next < queue->count ? &queue->jobs[queue->next++] : NULL;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (job == NULL) {
+            return NULL;
+        }
+
+        job->out = tmpfile();
+        job->err = tmpfile();
+
+        if (job->out == NULL || job->err == NULL) {
+            fprintf(stderr, "Could not buffer the output of \"%s\".\n", job->path);
+            job->status = 74;
+        } else {
+            runJob(job, queue->options);
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        job->done = true;
+        pthread_cond_broadcast(&queue->finished);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+static void copyStream(FILE *from, FILE *to) {
+    char buffer[4096];
+    size_t count;
+
+    rewind(from);
+
+    while ((count = fread(buffer, 1, sizeof(buffer), from)) > 0) {
+        fwrite(buffer, 1, count, to);
+    }
+
+    fclose(from);
+}
+
+/**
+ * @brief Runs the jobs on `threadCount` worker threads, printing the output of
+ * each job as soon as it and all jobs before it have finished.
+ *
+ * @returns false if no thread could be started
+ */
+static bool runParallel(Job *jobs, size_t count, size_t threadCount,
+                        const Options *options) {
+    JobQueue queue;
+    queue.jobs = jobs;
+    queue.count = count;
+    queue.next = 0;
+    queue.options = options;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.finished, NULL);
+
+    pthread_t *threads = (pthread_t *)malloc(threadCount * sizeof(pthread_t));
+    size_t started = 0;
+
+    while (threads != NULL && started < threadCount &&
+           pthread_create(&threads[started], NULL, worker, &queue) == 0) {
+        started++;
+    }
+
+    if (started > 0) {
+        for (size_t idx = 0; idx < count; idx++) {
+            pthread_mutex_lock(&queue.lock);
+
+            while (!jobs[idx].done) {
+                pthread_cond_wait(&queue.finished, &queue.lock);
+            }
+
+            pthread_mutex_unlock(&queue.lock);
+
+            if (jobs[idx].out != NULL) {
+                copyStream(jobs[idx].out, stdout);
+            }
+
+            if (jobs[idx].err != NULL) {
+                copyStream(jobs[idx].err, stderr);
+            }
+
+            fflush(stdout);
+        }
+
+        for (size_t idx = 0; idx < started; idx++) {
+            pthread_join(threads[idx], NULL);
+        }
+    }
+
+    free(threads);
+    pthread_cond_destroy(&queue.finished);
+    pthread_mutex_destroy(&queue.lock);
+    return started > 0;
+}
+#endif // CLOX_THREADS
+
+/**
+ * @brief Writes one element of the --gc-stats array, `script` being NULL for
+ * the REPL.
+ */
+static void writeStatsEntry(FILE *out, const char *script, const GCStats *stats,
+                            bool first) {
+    fprintf(out, "%s{\"script\": ", first ? "\n" : ",\n");
+
+    if (script == NULL) {
+        fprintf(out, "null");
+    } else {
+        fputc('"', out);
+
+        for (const unsigned char *c = (const unsigned char *)script; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\') {
+                fprintf(out, "\\%c", *c);
+            } else if (*c < 0x20) {
+                fprintf(out, "\\u%04x", *c);
+            } else {
+                fputc(*c, out);
+            }
+        }
+
+        fputc('"', out);
     }
+
+    fprintf(out, ", \"gc\": ");
+    writeGCStats(stats, out);
+    fprintf(out, "}");
+}
+
+/**
+ * @brief Runs every script in a fresh VM, on up to `threadCount` threads.
+ *
+ * @returns the exit status of the first script that failed, or 0
+ */
+static int runFiles(const char **paths, size_t count, size_t threadCount,
+                    const Options *options) {
+    Job *jobs = (Job *)calloc(count, sizeof(Job));
+
+    if (jobs == NULL) {
+        fprintf(stderr, "Not enough memory to run %zu scripts.\n", count);
+        return 70;
+    }
+
+    for (size_t idx = 0; idx < count; idx++) {
+        jobs[idx].path = paths[idx];
+    }
+
+    bool parallel = false;
+
+#ifdef CLOX_THREADS
+    if (threadCount > 1 && count > 1) {
+        parallel = runParallel(jobs, count, threadCount < count ? threadCount : count,
+                               options);
+    }
+#endif // CLOX_THREADS
+
+    if (!parallel) {
+        for (size_t idx = 0; idx < count; idx++) {
+            jobs[idx].out = stdout;
+            jobs[idx].err = stderr;
+            runJob(&jobs[idx], options);
+        }
+    }
+
+    int status = 0;
+
+    for (size_t idx = 0; idx < count && status == 0; idx++) {
+        status = jobs[idx].status;
+    }
+
+    for (size_t idx = 0; idx < count && options->gcStats != NULL; idx++) {
+        writeStatsEntry(options->gcStats, jobs[idx].path, &jobs[idx].gcStats, idx == 0);
+    }
+
+    free(jobs);
+    return status;
+}
+
+/**
+ * @brief Parses a byte count with an optional `K`, `M` or `G` suffix.
+ */
+static bool parseSize(const char *text, size_t *size) {
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    unsigned shift = 0;
+
+    if (end == text) {
+        return false;
+    }
+
+    switch (*end) {
+        case 'K':
+        case 'k':
+            shift = 10;
+            break;
+        case 'M':
+        case 'm':
+            shift = 20;
+            break;
+        case 'G':
+        case 'g':
+            shift = 30;
+            break;
+        default:
+            break;
+    }
+
+    if (shift > 0) {
+        end++;
+    }
+
+    if (*end != '\0' || value > (SIZE_MAX >> shift)) {
+        return false;
+    }
+
+    *size = (size_t)value << shift;
+    return true;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: clox [options] [path...]\n"
+                    "Options:\n"
+                    "  -O              Run the peephole optimizer over compiled bytecode\n"
+#ifdef CLOX_REGISTER_VM
+                    "  --regvm         Run functions on the register interpreter\n"
+#endif // CLOX_REGISTER_VM
+#ifdef CLOX_JIT
+                    "  --jit           Compile hot functions to machine code\n"
+                    "  --jit-threshold N\n"
+                    "                  Calls and loop iterations before a function is compiled\n"
+#endif // CLOX_JIT
+                    "  --max-depth N   Fail with a stack overflow past N nested calls\n"
+                    "  --jobs N        Run up to N scripts at once, each in its own VM\n"
+                    "  --preload FILE  Compile FILE once and run it in every VM before its script\n"
+                    "  --profile FILE  Count opcodes and write sampled stacks to FILE, running\n"
+                    "                  scripts one at a time in the stack interpreter\n"
+                    "  --cache         Reuse bytecode cached in a .loxc file next to each script\n"
+                    "  --cache-dir DIR Reuse bytecode cached in DIR, named by source hash\n"
+                    "  --gc-full       Use stop-the-world garbage collection\n"
+                    "  --gc-stats FILE Write GC statistics of every script to FILE as JSON\n"
+#ifdef PARALLEL_MARK
+                    "  --gc-threads N  Threads marking the heap when a GC cycle finishes\n"
+#endif // PARALLEL_MARK
+                    "  --gc-step N     Objects traced or swept per incremental GC step\n"
+                    "  --gc-initial SIZE\n"
+                    "                  Smallest heap a GC cycle starts at, e.g. 16M\n"
+                    "  --gc-grow F     Start the next GC cycle at F times the live heap\n"
+                    "  --gc-target R   Adapt the growth to spend about R of the time in GC\n"
+                    "  --heap-limit SIZE\n"
+                    "                  Fail scripts whose live heap outgrows SIZE\n");
+    exit(64);
 }
 
 int main(int argc, char *argv[]) {
-    VM vm;
-    initVM(&vm);
+    Options options = {
+        .optimize = false,
+        .registerVM = false,
+        .jit = false,
+        .jitThreshold = JIT_HOT_THRESHOLD,
+        .maxFrames = FRAMES_MAX,
+        .gcIncremental = true,
+        .gcStepSize = GC_STEP_SIZE,
+        .gcThreads = 1,
+        .gcGrowFactor = GC_HEAP_GROW_FACTOR,
+        .gcTargetRatio = 0,
+        .gcInitialHeap = GC_INITIAL_HEAP,
+        .heapLimit = 0,
+        .useCache = false,
+        .cacheDir = NULL,
+        .image = NULL,
+        .profiler = NULL,
+        .gcStats = NULL,
+    };
+
+    const char **paths = (const char **)malloc((size_t)argc * sizeof(const char *));
+    size_t pathCount = 0;
+    size_t jobs = 1;
+    const char *preload = NULL;
+    const char *profilePath = NULL;
+    const char *gcStatsPath = NULL;
+
+    if (paths == NULL) {
+        fprintf(stderr, "Not enough memory to parse arguments.\n");
+        exit(70);
+    }
+
+    for (int idx = 1; idx < argc; idx++) {
+        if (strcmp(argv[idx], "-O") == 0) {
+            options.optimize = true;
+#ifdef CLOX_REGISTER_VM
+        } else if (strcmp(argv[idx], "--regvm") == 0) {
+            options.registerVM = true;
+#endif // CLOX_REGISTER_VM
+#ifdef CLOX_JIT
+        } else if (strcmp(argv[idx], "--jit") == 0) {
+            options.jit = true;
+        } else if (strcmp(argv[idx], "--jit-threshold") == 0 && idx + 1 < argc) {
+            char *end;
+            unsigned long threshold = strtoul(argv[++idx], &end, 10);
+
+            if (*end != '\0' || threshold > UINT32_MAX) {
+                usage();
+            }
+
+            options.jitThreshold = (uint32_t)threshold;
+#endif // CLOX_JIT
+        } else if (strcmp(argv[idx], "--max-depth") == 0 && idx + 1 < argc) {
+            char *end;
+            unsigned long depth = strtoul(argv[++idx], &end, 10);
+
+            if (*end != '\0' || depth == 0) {
+                usage();
+            }
+
+            options.maxFrames = (size_t)depth;
+        } else if (strcmp(argv[idx], "--jobs") == 0 && idx + 1 < argc) {
+            char *end;
+            unsigned long count = strtoul(argv[++idx], &end, 10);
+
+            if (*end != '\0' || count == 0) {
+                usage();
+            }
+
+            jobs = (size_t)count;
+        } else if (strcmp(argv[idx], "--preload") == 0 && idx + 1 < argc) {
+            preload = argv[++idx];
+        } else if (strcmp(argv[idx], "--profile") == 0 && idx + 1 < argc) {
+            profilePath = argv[++idx];
+        } else if (strcmp(argv[idx], "--gc-stats") == 0 && idx + 1 < argc) {
+            gcStatsPath = argv[++idx];
+        } else if (strcmp(argv[idx], "--cache") == 0) {
+            options.useCache = true;
+        } else if (strcmp(argv[idx], "--cache-dir") == 0 && idx + 1 < argc) {
+            options.useCache = true;
+            options.cacheDir = argv[++idx];
+        } else if (strcmp(argv[idx], "--gc-full") == 0) {
+            options.gcIncremental = false;
+        } else if (strcmp(argv[idx], "--gc-step") == 0 && idx + 1 < argc) {
+            char *end;
+            unsigned long step = strtoul(argv[++idx], &end, 10);
+
+            if (*end != '\0' || step == 0) {
+                usage();
+            }
+
+            options.gcStepSize = (size_t)step;
+#ifdef PARALLEL_MARK
+        } else if (strcmp(argv[idx], "--gc-threads") == 0 && idx + 1 < argc) {
+            char *end;
+            unsigned long count = strtoul(argv[++idx], &end, 10);
+
+            if (*end != '\0' || count == 0) {
+                usage();
+            }
+
+            options.gcThreads = (size_t)count;
+#endif // PARALLEL_MARK
+        } else if (strcmp(argv[idx], "--gc-initial") == 0 && idx + 1 < argc) {
+            if (!parseSize(argv[++idx], &options.gcInitialHeap)) {
+                usage();
+            }
+        } else if (strcmp(argv[idx], "--gc-grow") == 0 && idx + 1 < argc) {
+            char *end;
+            options.gcGrowFactor = strtod(argv[++idx], &end);
+
+            if (*end != '\0' || !(options.gcGrowFactor >= 1)) {
+                usage();
+            }
+        } else if (strcmp(argv[idx], "--gc-target") == 0 && idx + 1 < argc) {
+            char *end;
+            options.gcTargetRatio = strtod(argv[++idx], &end);
+
+            double ratio = options.gcTargetRatio;
+
+            if (*end != '\0' || !(ratio > 0 && ratio < 1)) {
+                usage();
+            }
+        } else if (strcmp(argv[idx], "--heap-limit") == 0 && idx + 1 < argc) {
+            if (!parseSize(argv[++idx], &options.heapLimit) || options.heapLimit == 0) {
+                usage();
+            }
+        } else if (argv[idx][0] == '-') {
+            usage();
+        } else {
+            paths[pathCount++] = argv[idx];
+        }
+    }
+
+    if (gcStatsPath != NULL) {
+        options.gcStats = fopen(gcStatsPath, "w");
+
+        if (options.gcStats == NULL) {
+            fprintf(stderr, "Could not open GC statistics \"%s\".\n", gcStatsPath);
+            exit(74);
+        }
+
+        fputc('[', options.gcStats);
+    }
+
+    Profiler profiler;
+    FILE *profileFile = NULL;
+
+    if (profilePath != NULL) {
+        profileFile = fopen(profilePath, "w");
+
+        if (profileFile == NULL) {
+            fprintf(stderr, "Could not open profile \"%s\".\n", profilePath);
+            exit(74);
+        }
+
+        // Only the stack interpreter is profiled, and samples are taken by
+        // whichever VM runs when the process wide timer goes off.
+        options.registerVM = false;
+        options.jit = false;
+        options.profiler = &profiler;
+        jobs = 1;
+        initProfiler(&profiler);
+    }
 
     Scanner scanner;
+    SourceFile source;
+
+    if (preload != NULL) {
+        if (!readFile(preload, &source, stderr)) {
+            exit(74);
+        }
+
+        options.image =
+            newImage(&scanner, source.text, options.optimize, options.registerVM);
+        freeFile(&source);
+
+        if (options.image == NULL) {
+            exit(65);
+        }
+    }
+
+    int status = 0;
+
+    if (profileFile != NULL && !startSampling(PROFILE_INTERVAL)) {
+        fprintf(stderr, "Stack sampling isn't supported, only counting opcodes.\n");
+    }
+
+    if (pathCount == 0) {
+        VM vm;
+        initVMWithImage(&vm, options.image);
+        applyOptions(&vm, &options);
 
-    if (argc == 1) {
-        repl(&vm, &scanner);
-    } else if (argc == 2) {
-        runFile(&vm, &scanner, argv[1]);
+        if (options.image == NULL || interpretImage(&vm) == INTERPRETER_OK) {
+            repl(&vm, &scanner);
+        }
+
+        if (options.gcStats != NULL) {
+            GCStats stats;
+            getGCStats(&vm, &stats);
+            writeStatsEntry(options.gcStats, NULL, &stats, true);
+        }
+
+        freeVM(&vm, NULL);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        status = runFiles(paths, pathCount, jobs, &options);
     }
 
-    freeVM(&vm, NULL);
+    if (options.gcStats != NULL) {
+        fprintf(options.gcStats, "\n]\n");
+        fclose(options.gcStats);
+    }
 
-    return 0;
+    if (profileFile != NULL) {
+        stopSampling();
+        writeFoldedStacks(&profiler, profileFile);
+        fclose(profileFile);
+        writeOpcodeProfile(&profiler, stderr);
+        freeProfiler(&profiler);
+    }
+
+    if (options.image != NULL) {
+        freeImage(options.image);
+    }
+
+    free(paths);
+
+    return status;
 }
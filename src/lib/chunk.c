@@ -1,5 +1,8 @@
+#include <string.h>
+
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 #include "vm.h"
 
@@ -7,8 +10,13 @@ void initChunk(Chunk *chunk) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    chunk->cacheCount = 0;
+    chunk->cacheCapacity = 0;
+    chunk->caches = NULL;
 }
 
 void writeChunk(VM *vm, Compiler *compiler, Chunk *chunk, uint8_t byte, size_t line) {
@@ -17,28 +25,370 @@ void writeChunk(VM *vm, Compiler *compiler, Chunk *chunk, uint8_t byte, size_t l
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code =
             GROW_ARRAY(vm, compiler, uint8_t, chunk->code, oldCapacity, chunk->capacity);
-        chunk->lines =
-            GROW_ARRAY(vm, compiler, size_t, chunk->lines, oldCapacity, chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
+
+    // Only a change of line starts a new run
+    if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) {
+        return;
+    }
+
+    if (chunk->lineCapacity < chunk->lineCount + 1) {
+        size_t oldCapacity = chunk->lineCapacity;
+        chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->lines = GROW_ARRAY(vm, compiler, LineStart, chunk->lines, oldCapacity,
+                                  chunk->lineCapacity);
+    }
+
+    LineStart *lineStart = &chunk->lines[chunk->lineCount++];
+    lineStart->offset = chunk->count - 1;
+    lineStart->line = line;
+}
+
+size_t instructionLength(Chunk *chunk, size_t offset) {
+    switch ((OpCode)chunk->code[offset]) {
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INHERIT:
+        case OP_GET_INDEX:
+        case OP_SET_INDEX:
+        case OP_GET_LOCAL_0:
+        case OP_GET_LOCAL_1:
+        case OP_GET_LOCAL_2:
+        case OP_GET_LOCAL_3:
+            return 1;
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_SUPER:
+        case OP_CALL:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_LIST:
+            return 2;
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_SUPER_INVOKE:
+        case OP_GET_LOCAL_LONG:
+        case OP_SET_LOCAL_LONG:
+        case OP_ADD_LOCAL_CONST:
+        case OP_INCREMENT_LOCAL:
+        case OP_GET_UPVALUE_LONG:
+        case OP_SET_UPVALUE_LONG:
+            return 3;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_CONSTANT_LONG:
+        case OP_GET_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG:
+        case OP_JUMP_LONG:
+        case OP_JUMP_IF_FALSE_LONG:
+        case OP_JUMP_IF_TRUE_LONG:
+        case OP_LOOP_LONG:
+        case OP_GET_SUPER_LONG:
+        case OP_CLASS_LONG:
+        case OP_METHOD_LONG:
+            return 4;
+        case OP_INVOKE:
+        case OP_LESS_LOCAL_LOCAL_JUMP:
+        case OP_SUPER_INVOKE_LONG:
+            return 5;
+        case OP_GET_PROPERTY_LONG:
+        case OP_SET_PROPERTY_LONG:
+            return 6;
+        case OP_INVOKE_LONG:
+            return 7;
+        case OP_CLOSURE: {
+            // Each upvalue is captured by a local flag and a 16 bit index
+            ObjFunction *func = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + 3 * func->upvalueCount;
+        }
+        case OP_CLOSURE_LONG: {
+            size_t constant = (size_t)((chunk->code[offset + 1] << 16) |
+                                       (chunk->code[offset + 2] << 8) |
+                                       chunk->code[offset + 3]);
+            ObjFunction *func = AS_FUNCTION(chunk->constants.values[constant]);
+            return 4 + 3 * func->upvalueCount;
+        }
+    }
+
+    return 1; // Unreachable
+}
+
+/**
+ * @brief Net number of values the instruction at `offset` pushes, negative
+ * when it pops more than it pushes.
+ */
+static int stackEffect(Chunk *chunk, size_t offset) {
+    uint8_t *code = &chunk->code[offset];
+
+    switch ((OpCode)code[0]) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_CLASS:
+        case OP_CONSTANT_LONG:
+        case OP_GET_LOCAL_LONG:
+        case OP_GET_GLOBAL_LONG:
+        case OP_GET_LOCAL_0:
+        case OP_GET_LOCAL_1:
+        case OP_GET_LOCAL_2:
+        case OP_GET_LOCAL_3:
+        case OP_ADD_LOCAL_CONST:
+        case OP_GET_UPVALUE_LONG:
+        case OP_CLOSURE_LONG:
+        case OP_CLASS_LONG:
+            return 1;
+        case OP_SET_LOCAL:
+        case OP_SET_GLOBAL:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_SET_LOCAL_LONG:
+        case OP_SET_GLOBAL_LONG:
+        case OP_JUMP_LONG:
+        case OP_JUMP_IF_FALSE_LONG:
+        case OP_JUMP_IF_TRUE_LONG:
+        case OP_LOOP_LONG:
+        case OP_INCREMENT_LOCAL:
+        case OP_LESS_LOCAL_LOCAL_JUMP:
+        case OP_SET_UPVALUE_LONG:
+        case OP_GET_PROPERTY_LONG:
+            return 0;
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INHERIT:
+        case OP_METHOD:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_GET_INDEX:
+        case OP_SET_PROPERTY_LONG:
+        case OP_GET_SUPER_LONG:
+        case OP_METHOD_LONG:
+            return -1;
+        case OP_SET_INDEX:
+            return -2;
+        case OP_LIST:
+            return 1 - code[1];
+        case OP_CALL:
+            return -code[1];
+        case OP_INVOKE:
+            return -code[2];
+        case OP_INVOKE_LONG:
+            return -code[4];
+        case OP_SUPER_INVOKE:
+            return -code[2] - 1; // The superclass is popped as well
+        case OP_SUPER_INVOKE_LONG:
+            return -code[4] - 1;
+    }
+
+    return 0; // Unreachable
+}
+
+uint8_t genericOpcode(uint8_t op) {
+    switch (op) {
+        case OP_GREATER_NUM:
+            return OP_GREATER;
+        case OP_LESS_NUM:
+            return OP_LESS;
+        case OP_ADD_NUM:
+            return OP_ADD;
+        case OP_SUBTRACT_NUM:
+            return OP_SUBTRACT;
+        case OP_MULTIPLY_NUM:
+            return OP_MULTIPLY;
+        case OP_DIVIDE_NUM:
+            return OP_DIVIDE;
+        default:
+            return op;
+    }
+}
+
+/**
+ * @brief Offset a jump instruction at `offset` may continue at other than the
+ * next instruction, `chunk->count` for backward jumps and other instructions.
+ */
+static size_t forwardTarget(Chunk *chunk, size_t offset, size_t length) {
+    uint8_t *code = &chunk->code[offset];
+
+    switch ((OpCode)code[0]) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LESS_LOCAL_LOCAL_JUMP: {
+            size_t jump = (size_t)((code[length - 2] << 8) | code[length - 1]);
+            return offset + length + jump < chunk->count ? offset + length + jump
+                                                         : chunk->count;
+        }
+        case OP_JUMP_LONG:
+        case OP_JUMP_IF_FALSE_LONG:
+        case OP_JUMP_IF_TRUE_LONG: {
+            size_t jump = (size_t)((code[1] << 16) | (code[2] << 8) | code[3]);
+            return offset + length + jump < chunk->count ? offset + length + jump
+                                                         : chunk->count;
+        }
+        default:
+            return chunk->count;
+    }
+}
+
+size_t stackDepth(VM *vm, Compiler *compiler, Chunk *chunk, uint8_t arity) {
+    // Depth when reaching each offset through a forward jump, 0 if none does.
+    // Loops jump back to a depth already seen and statements never leave
+    // values behind, so one pass in code order sees every depth.
+    size_t *targets = ALLOCATE(vm, compiler, size_t, chunk->count);
+    memset(targets, 0, chunk->count * sizeof(size_t));
+
+    size_t depth = (size_t)arity + 1;
+    size_t maxDepth = depth;
+    size_t offset = 0;
+
+    while (offset < chunk->count) {
+        if (targets[offset] > depth) {
+            depth = targets[offset];
+        }
+
+        size_t length = instructionLength(chunk, offset);
+        int effect = stackEffect(chunk, offset);
+
+        // Only a corrupt cache file pops into the slot of the callee
+        if (effect < 0 && depth <= (size_t)-effect) {
+            maxDepth = 0;
+            break;
+        }
+
+        depth += (size_t)effect;
+
+        if (depth > maxDepth) {
+            maxDepth = depth;
+        }
+
+        size_t target = forwardTarget(chunk, offset, length);
+
+        if (target < chunk->count && targets[target] < depth) {
+            targets[target] = depth;
+        }
+
+        offset += length;
+    }
+
+    FREE_ARRAY(vm, compiler, size_t, targets, chunk->count);
+    return maxDepth;
+}
+
+size_t getLine(Chunk *chunk, size_t offset) {
+    return findLine(chunk->lines, chunk->lineCount, offset);
+}
+
+size_t findLine(const LineStart *lines, size_t lineCount, size_t offset) {
+    size_t start = 0;
+    size_t end = lineCount;
+
+    // Binary search for the last run starting at or before offset
+    while (end - start > 1) {
+        size_t mid = start + (end - start) / 2;
+
+        if (lines[mid].offset > offset) {
+            end = mid;
+        } else {
+            start = mid;
+        }
+    }
+
+    return lineCount == 0 ? 0 : lines[start].line;
 }
 
-uint8_t addConstant(VM *vm, Compiler *compiler, Chunk *chunk, Value value) {
+size_t addConstant(VM *vm, Compiler *compiler, Chunk *chunk, Value value) {
     // Push-pop of value is done so that value is reachable
     // by VM and thus isn't swept if the GC is triggered by
     // `writeValueArray'.
     push(vm, value);
     writeValueArray(vm, compiler, &chunk->constants, value);
+    writeBarrier(vm, value);
     pop(vm);
     return chunk->constants.count - 1;
 }
 
+size_t addInlineCache(VM *vm, Compiler *compiler, Chunk *chunk) {
+    if (chunk->cacheCapacity < chunk->cacheCount + 1) {
+        size_t oldCapacity = chunk->cacheCapacity;
+        chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->caches = GROW_ARRAY(vm, compiler, InlineCache, chunk->caches, oldCapacity,
+                                   chunk->cacheCapacity);
+    }
+
+    chunk->caches[chunk->cacheCount].count = 0;
+
+    return chunk->cacheCount++;
+}
+
 void freeChunk(VM *vm, Compiler *compiler, Chunk *chunk) {
-    FREE_ARRAY(vm, compiler, uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(vm, compiler, size_t, chunk->lines, chunk->capacity);
+    if (chunk->capacity > 0) {
+        FREE_ARRAY(vm, compiler, uint8_t, chunk->code, chunk->capacity);
+    }
+
+    if (chunk->lineCapacity > 0) {
+        FREE_ARRAY(vm, compiler, LineStart, chunk->lines, chunk->lineCapacity);
+    }
+
     freeValueArray(vm, compiler, &chunk->constants);
+    FREE_ARRAY(vm, compiler, InlineCache, chunk->caches, chunk->cacheCapacity);
     initChunk(chunk);
 }
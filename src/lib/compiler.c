@@ -8,8 +8,11 @@
 #include "chunk.h"
 #include "common.h"
 #include "compiler.h"
+#include "hash.h"
 #include "memory.h"
 #include "object.h"
+#include "optimizer.h"
+#include "regvm.h"
 #include "scanner.h"
 #include "value.h"
 #include "vm.h"
@@ -18,8 +21,6 @@
 #include "debug.h"
 #endif // DEBUG_PRINT_CODE
 
-Chunk *compilingChunk;
-
 static Chunk *currentChunk(Compiler *compiler) { return &compiler->func->chunk; }
 
 static void errorAt(Parser *parser, Token *token, const char *message) {
@@ -28,17 +29,17 @@ static void errorAt(Parser *parser, Token *token, const char *message) {
     }
 
     parser->panicMode = true;
-    fprintf(stderr, "[line %zu] Error", token->line);
+    fprintf(parser->err, "[line %zu] Error", token->line);
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(parser->err, " at end");
     } else if (token->type == TOKEN_ERROR) {
         // Nothing
     } else {
-        fprintf(stderr, " at '%.*s'", (int)token->length, token->start);
+        fprintf(parser->err, " at '%.*s'", (int)token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", message);
+    fprintf(parser->err, ": %s\n", message);
     parser->hadError = true;
 }
 
@@ -95,30 +96,57 @@ static void emitBytes(Parser *parser, uint8_t byte1, uint8_t byte2, Compiler *co
     emitByte(parser, byte2, compiler, vm);
 }
 
+/**
+ * @brief Emits the long form of a jump with a placeholder offset.
+ *
+ * @details The distance of a forward jump isn't known until it is patched, so
+ * jumps are always emitted long and narrowed by `optimizeChunk()` once the
+ * layout of the function is final.
+ */
 static size_t emitJump(Parser *parser, uint8_t instruction, Compiler *compiler, VM *vm) {
     emitByte(parser, instruction, compiler, vm);
     emitByte(parser, 0xff, compiler, vm);
     emitByte(parser, 0xff, compiler, vm);
+    emitByte(parser, 0xff, compiler, vm);
+
+    return currentChunk(compiler)->count - 3;
+}
+
+static void emitShort(Parser *parser, uint16_t value, Compiler *compiler, VM *vm) {
+    emitByte(parser, (uint8_t)((value >> 8) & 0xff), compiler, vm);
+    emitByte(parser, (uint8_t)(value & 0xff), compiler, vm);
+}
 
-    return currentChunk(compiler)->count - 2;
+static void emitLong(Parser *parser, uint32_t value, Compiler *compiler, VM *vm) {
+    emitByte(parser, (uint8_t)((value >> 16) & 0xff), compiler, vm);
+    emitShort(parser, (uint16_t)(value & 0xffff), compiler, vm);
+}
+
+static void emitCache(Parser *parser, Compiler *compiler, VM *vm) {
+    size_t cache = addInlineCache(vm, compiler, currentChunk(compiler));
+
+    if (cache > UINT16_MAX) {
+        error(parser, "Too many property accesses in one chunk.");
+    }
+
+    emitShort(parser, (uint16_t)cache, compiler, vm);
 }
 
 static void emitLoop(Parser *parser, size_t loopStart, Compiler *compiler, VM *vm) {
-    emitByte(parser, OP_LOOP, compiler, vm);
+    emitByte(parser, OP_LOOP_LONG, compiler, vm);
 
-    size_t offset = currentChunk(compiler)->count - loopStart + 2;
+    size_t offset = currentChunk(compiler)->count - loopStart + 3;
 
-    if (offset > UINT16_MAX) {
+    if (offset > UINT24_MAX) {
         error(parser, "Loop body too large.");
     }
 
-    emitByte(parser, (offset >> 8) & 0xff, compiler, vm);
-    emitByte(parser, offset & 0xff, compiler, vm);
+    emitLong(parser, (uint32_t)offset, compiler, vm);
 }
 
 static void emitReturn(Parser *parser, Compiler *compiler, VM *vm) {
     if (compiler->ftype == TYPE_INITIALIZER) {
-        emitBytes(parser, OP_GET_LOCAL, 0, compiler, vm);
+        emitByte(parser, OP_GET_LOCAL_0, compiler, vm);
     } else {
         emitByte(parser, OP_NIL, compiler, vm);
     }
@@ -126,10 +154,10 @@ static void emitReturn(Parser *parser, Compiler *compiler, VM *vm) {
     emitByte(parser, OP_RETURN, compiler, vm);
 }
 
-static uint8_t makeConstant(Parser *parser, Value value, Compiler *compiler, VM *vm) {
-    uint8_t constant = addConstant(vm, compiler, currentChunk(compiler), value);
+static size_t makeConstant(Parser *parser, Value value, Compiler *compiler, VM *vm) {
+    size_t constant = addConstant(vm, compiler, currentChunk(compiler), value);
 
-    if (constant > UINT8_MAX) {
+    if (constant > UINT24_MAX) {
         error(parser, "Too many constants in one chunk.");
         return 0;
     }
@@ -137,31 +165,66 @@ static uint8_t makeConstant(Parser *parser, Value value, Compiler *compiler, VM
     return constant;
 }
 
+/**
+ * @brief Emits `op` with a single byte `constant` operand, or `longOp` with a
+ * 24 bit one past the first 256 constants of the chunk.
+ */
+static void emitConstantOp(Parser *parser, uint8_t op, uint8_t longOp, size_t constant,
+                           Compiler *compiler, VM *vm) {
+    if (constant <= UINT8_MAX) {
+        emitBytes(parser, op, (uint8_t)constant, compiler, vm);
+    } else {
+        emitByte(parser, longOp, compiler, vm);
+        emitLong(parser, (uint32_t)constant, compiler, vm);
+    }
+}
+
 static void emitConstant(Parser *parser, Value value, Compiler *compiler, VM *vm) {
-    emitBytes(parser, OP_CONSTANT, makeConstant(parser, value, compiler, vm), compiler,
-              vm);
+    emitConstantOp(parser, OP_CONSTANT, OP_CONSTANT_LONG,
+                   makeConstant(parser, value, compiler, vm), compiler, vm);
 }
 
 static void patchJump(Parser *parser, size_t offset, Compiler *compiler) {
-    size_t jump = currentChunk(compiler)->count - offset - 2;
+    size_t jump = currentChunk(compiler)->count - offset - 3;
 
-    if (jump > UINT16_MAX) {
+    if (jump > UINT24_MAX) {
         error(parser, "Too much code to jump over.");
     }
 
-    currentChunk(compiler)->code[offset] = (jump >> 8) & 0xff;
-    currentChunk(compiler)->code[offset + 1] = jump & 0xff;
+    currentChunk(compiler)->code[offset] = (jump >> 16) & 0xff;
+    currentChunk(compiler)->code[offset + 1] = (jump >> 8) & 0xff;
+    currentChunk(compiler)->code[offset + 2] = jump & 0xff;
 }
 
 static ObjFunction *endCompiler(Parser *parser, Compiler *compiler, VM *vm) {
     emitReturn(parser, compiler, vm);
 
+    FREE_ARRAY(vm, compiler, Local, compiler->locals, (size_t)compiler->localCapacity);
+    compiler->locals = NULL;
+    compiler->localCapacity = 0;
+
     ObjFunction *func = compiler->func;
 
+    if (!parser->hadError) {
+        optimizeChunk(vm, compiler, currentChunk(compiler));
+        func->stackSize = stackDepth(vm, compiler, currentChunk(compiler), func->arity);
+    }
+
+#ifdef CLOX_REGISTER_VM
+    if (vm->registerVM && !parser->hadError) {
+        translateChunk(vm, compiler, currentChunk(compiler), func->arity, &func->reg);
+    }
+#endif // CLOX_REGISTER_VM
+
 #ifdef DEBUG_PRINT_CODE
     if (!parser->hadError) {
         disassembleChunk(currentChunk(compiler),
                          func->name != NULL ? func->name->chars : "<script>");
+
+        if (func->reg.count > 0) {
+            disassembleRegChunk(&func->reg, currentChunk(compiler),
+                                func->name != NULL ? func->name->chars : "<script>");
+        }
     }
 #endif // DEBUG_PRINT_CODE
 
@@ -197,15 +260,54 @@ static ParseRule *getRule(TokenType type);
 static void parsePrecedence(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
                             ClassCompiler *currentClass, Precedence precedence);
 
-static uint8_t identifierConstant(Parser *parser, Token *name, Compiler *compiler,
-                                  VM *vm) {
-    return makeConstant(parser,
-                        OBJ_VAL(copyString(vm, compiler, name->length, name->start)),
-                        compiler, vm);
+static size_t identifierConstant(Parser *parser, Token *name, Compiler *compiler,
+                                 VM *vm) {
+    ObjString *string =
+        copyHashedString(vm, compiler, name->length, name->start, name->hash);
+    ValueArray *constants = &currentChunk(compiler)->constants;
+    size_t count = constants->count < UINT8_COUNT ? constants->count : UINT8_COUNT;
+
+    // Names are interned, sharing their constants leaves more room for literals
+    // before the short forms with single byte operands run out
+    for (size_t idx = 0; idx < count; idx++) {
+        if (IS_STRING(constants->values[idx]) && AS_STRING(constants->values[idx]) == string) {
+            return idx;
+        }
+    }
+
+    return makeConstant(parser, OBJ_VAL(string), compiler, vm);
+}
+
+static uint32_t globalIndex(Parser *parser, Token *name, Compiler *compiler, VM *vm) {
+    push(vm, OBJ_VAL(copyHashedString(vm, compiler, name->length, name->start, name->hash)));
+    size_t slot = globalSlot(vm, compiler, AS_STRING(vm->stackTop[-1]));
+    pop(vm);
+
+    if (slot > UINT24_MAX) {
+        error(parser, "Too many global variables.");
+        return 0;
+    }
+
+    return (uint32_t)slot;
+}
+
+/**
+ * @brief Emits global variable instruction `op` for `slot`, or `longOp` when
+ * the slot doesn't fit in 16 bits.
+ */
+static void emitGlobal(Parser *parser, uint8_t op, uint8_t longOp, uint32_t slot,
+                       Compiler *compiler, VM *vm) {
+    if (slot <= UINT16_MAX) {
+        emitByte(parser, op, compiler, vm);
+        emitShort(parser, (uint16_t)slot, compiler, vm);
+    } else {
+        emitByte(parser, longOp, compiler, vm);
+        emitLong(parser, slot, compiler, vm);
+    }
 }
 
 static bool identifiersEqual(Token *a, Token *b) {
-    if (a->length != b->length) {
+    if (a->hash != b->hash || a->length != b->length) {
         return false;
     }
 
@@ -228,8 +330,8 @@ static intmax_t resolveLocal(Parser *parser, Compiler *compiler, Token *name) {
     return -1;
 }
 
-static intmax_t addUpvalue(Compiler *compiler, Parser *parser, uint8_t index,
-                           bool isLocal) {
+static intmax_t addUpvalue(Compiler *compiler, Parser *parser, uint16_t index,
+                           bool isLocal, VM *vm) {
     intmax_t upvalueCount = (intmax_t)compiler->func->upvalueCount;
 
     for (intmax_t idx = 0; idx < upvalueCount; idx++) {
@@ -239,50 +341,69 @@ static intmax_t addUpvalue(Compiler *compiler, Parser *parser, uint8_t index,
         }
     }
 
-    if (upvalueCount == UINT8_COUNT) {
+    if (upvalueCount == UINT16_COUNT) {
         error(parser, "Too many closure variables in function.");
         return 0;
     }
 
+    if ((size_t)upvalueCount == compiler->upvalueCapacity) {
+        size_t oldCapacity = compiler->upvalueCapacity;
+        compiler->upvalueCapacity = GROW_CAPACITY(oldCapacity);
+        compiler->upvalues = GROW_ARRAY(vm, compiler, Upvalue, compiler->upvalues,
+                                        oldCapacity, compiler->upvalueCapacity);
+    }
+
     compiler->upvalues[upvalueCount].isLocal = isLocal;
-    compiler->upvalues[upvalueCount].index = index = isLocal;
+    compiler->upvalues[upvalueCount].index = index;
     return (intmax_t)compiler->func->upvalueCount++;
 }
 
-static intmax_t resolveUpvalue(Compiler *compiler, Parser *parser, Token *name) {
+static intmax_t resolveUpvalue(Compiler *compiler, Parser *parser, Token *name,
+                               VM *vm) {
     if (compiler->enclosing == NULL) {
         return -1;
     }
 
-    intmax_t local = resolveLocal(parser, compiler, name);
+    intmax_t local = resolveLocal(parser, compiler->enclosing, name);
 
     if (local != -1) {
         ((Compiler *)compiler->enclosing)->locals[local].isCaptured = true;
-        return addUpvalue(compiler, parser, (uint8_t)local, true);
+        return addUpvalue(compiler, parser, (uint16_t)local, true, vm);
     }
 
-    intmax_t upvalue = resolveUpvalue((Compiler *)compiler->enclosing, parser, name);
+    intmax_t upvalue = resolveUpvalue((Compiler *)compiler->enclosing, parser, name, vm);
 
     if (upvalue != -1) {
-        return addUpvalue(compiler, parser, (uint8_t)upvalue, false);
+        return addUpvalue(compiler, parser, (uint16_t)upvalue, false, vm);
     }
 
     return -1;
 }
 
-static void addLocal(Parser *parser, Compiler *compiler, Token name) {
-    if (compiler->localCount == UINT8_COUNT) {
+static void growLocals(Compiler *compiler, VM *vm) {
+    size_t oldCapacity = (size_t)compiler->localCapacity;
+    compiler->localCapacity = (intmax_t)GROW_CAPACITY(oldCapacity);
+    compiler->locals = GROW_ARRAY(vm, compiler, Local, compiler->locals, oldCapacity,
+                                  (size_t)compiler->localCapacity);
+}
+
+static void addLocal(Parser *parser, Compiler *compiler, Token name, VM *vm) {
+    if (compiler->localCount == UINT16_COUNT) {
         error(parser, "Too many local variables in function.");
         return;
     }
 
+    if (compiler->localCount == compiler->localCapacity) {
+        growLocals(compiler, vm);
+    }
+
     Local *local = &compiler->locals[compiler->localCount++];
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
 }
 
-static void declareVariable(Parser *parser, Compiler *compiler) {
+static void declareVariable(Parser *parser, Compiler *compiler, VM *vm) {
     if (compiler->scopeDepth == 0) {
         return;
     }
@@ -301,7 +422,7 @@ static void declareVariable(Parser *parser, Compiler *compiler) {
         }
     }
 
-    addLocal(parser, compiler, *name);
+    addLocal(parser, compiler, *name, vm);
 }
 
 static void binary(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
@@ -376,20 +497,56 @@ static void call(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
 static void dot(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
                 ClassCompiler *currentClass, bool canAssign) {
     consume(parser, scanner, TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = identifierConstant(parser, &parser->previous, compiler, vm);
+    size_t name = identifierConstant(parser, &parser->previous, compiler, vm);
 
     if (canAssign && match(parser, scanner, TOKEN_EQUAL)) {
         expression(parser, scanner, vm, compiler, currentClass);
-        emitBytes(parser, OP_SET_PROPERTY, name, compiler, vm);
+        emitConstantOp(parser, OP_SET_PROPERTY, OP_SET_PROPERTY_LONG, name, compiler, vm);
+        emitCache(parser, compiler, vm);
     } else if (match(parser, scanner, TOKEN_LEFT_PAREN)) {
         uint8_t argCount = argumentList(parser, scanner, vm, compiler, currentClass);
-        emitBytes(parser, OP_INVOKE, name, compiler, vm);
+        emitConstantOp(parser, OP_INVOKE, OP_INVOKE_LONG, name, compiler, vm);
         emitByte(parser, argCount, compiler, vm);
+        emitCache(parser, compiler, vm);
+    } else {
+        emitConstantOp(parser, OP_GET_PROPERTY, OP_GET_PROPERTY_LONG, name, compiler, vm);
+        emitCache(parser, compiler, vm);
+    }
+}
+
+static void index_(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
+                   ClassCompiler *currentClass, bool canAssign) {
+    expression(parser, scanner, vm, compiler, currentClass);
+    consume(parser, scanner, TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if (canAssign && match(parser, scanner, TOKEN_EQUAL)) {
+        expression(parser, scanner, vm, compiler, currentClass);
+        emitByte(parser, OP_SET_INDEX, compiler, vm);
     } else {
-        emitBytes(parser, OP_GET_PROPERTY, name, compiler, vm);
+        emitByte(parser, OP_GET_INDEX, compiler, vm);
     }
 }
 
+static void list(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
+                 ClassCompiler *currentClass, bool canAssign) {
+    uint8_t itemCount = 0;
+
+    if (!check(parser, TOKEN_RIGHT_BRACKET)) {
+        do {
+            expression(parser, scanner, vm, compiler, currentClass);
+
+            if (itemCount == UINT8_MAX) {
+                error(parser, "Can't have more than 255 items in a list literal.");
+            }
+
+            itemCount += 1;
+        } while (match(parser, scanner, TOKEN_COMMA));
+    }
+
+    consume(parser, scanner, TOKEN_RIGHT_BRACKET, "Expect ']' after list items.");
+    emitBytes(parser, OP_LIST, itemCount, compiler, vm);
+}
+
 static void literal(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
                     ClassCompiler *currentClass, bool canAssign) {
     switch (parser->previous.type) {
@@ -409,7 +566,7 @@ static void literal(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler
 
 static void and_(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
                  ClassCompiler *currentClass, bool canAssign) {
-    size_t endJmp = emitJump(parser, OP_JUMP_IF_FALSE, compiler, vm);
+    size_t endJmp = emitJump(parser, OP_JUMP_IF_FALSE_LONG, compiler, vm);
 
     emitByte(parser, OP_POP, compiler, vm);
     parsePrecedence(parser, scanner, vm, compiler, currentClass, PREC_AND);
@@ -419,8 +576,8 @@ static void and_(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
 
 static void or_(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
                 ClassCompiler *currentClass, bool canAssign) {
-    size_t elseJmp = emitJump(parser, OP_JUMP_IF_FALSE, compiler, vm);
-    size_t endJmp = emitJump(parser, OP_JUMP, compiler, vm);
+    size_t elseJmp = emitJump(parser, OP_JUMP_IF_FALSE_LONG, compiler, vm);
+    size_t endJmp = emitJump(parser, OP_JUMP_LONG, compiler, vm);
 
     patchJump(parser, elseJmp, compiler);
     emitByte(parser, OP_POP, compiler, vm);
@@ -453,23 +610,47 @@ static void namedVariable(Parser *parser, Scanner *scanner, VM *vm, Compiler *co
                           ClassCompiler *currentClass, bool canAssign, Token name) {
     uint8_t getOp;
     uint8_t setOp;
+    uint8_t getLongOp;
+    uint8_t setLongOp;
     intmax_t arg = resolveLocal(parser, compiler, &name);
 
     if (arg != -1) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
-    } else if ((arg = resolveUpvalue(compiler, parser, &name)) != -1) {
+        getLongOp = OP_GET_LOCAL_LONG;
+        setLongOp = OP_SET_LOCAL_LONG;
+    } else if ((arg = resolveUpvalue(compiler, parser, &name, vm)) != -1) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
+        getLongOp = OP_GET_UPVALUE_LONG;
+        setLongOp = OP_SET_UPVALUE_LONG;
     } else {
-        arg = identifierConstant(parser, &name, compiler, vm);
-        getOp = OP_GET_GLOBAL;
-        setOp = OP_SET_GLOBAL;
+        uint32_t global = globalIndex(parser, &name, compiler, vm);
+
+        if (canAssign && match(parser, scanner, TOKEN_EQUAL)) {
+            expression(parser, scanner, vm, compiler, currentClass);
+            emitGlobal(parser, OP_SET_GLOBAL, OP_SET_GLOBAL_LONG, global, compiler, vm);
+        } else {
+            emitGlobal(parser, OP_GET_GLOBAL, OP_GET_GLOBAL_LONG, global, compiler, vm);
+        }
+
+        return;
     }
 
-    if (canAssign && match(parser, scanner, TOKEN_EQUAL)) {
+    if (arg > UINT8_MAX) {
+        bool isSet = canAssign && match(parser, scanner, TOKEN_EQUAL);
+
+        if (isSet) {
+            expression(parser, scanner, vm, compiler, currentClass);
+        }
+
+        emitByte(parser, isSet ? setLongOp : getLongOp, compiler, vm);
+        emitShort(parser, (uint16_t)arg, compiler, vm);
+    } else if (canAssign && match(parser, scanner, TOKEN_EQUAL)) {
         expression(parser, scanner, vm, compiler, currentClass);
         emitBytes(parser, setOp, (uint8_t)arg, compiler, vm);
+    } else if (getOp == OP_GET_LOCAL && arg <= 3) {
+        emitByte(parser, (uint8_t)(OP_GET_LOCAL_0 + arg), compiler, vm);
     } else {
         emitBytes(parser, getOp, (uint8_t)arg, compiler, vm);
     }
@@ -485,6 +666,7 @@ static Token syntheticToken(const char *text) {
     Token token;
     token.start = text;
     token.length = (size_t)strlen(text);
+    token.hash = hashChars(text, token.length);
     return token;
 }
 
@@ -498,7 +680,7 @@ static void super_(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
 
     consume(parser, scanner, TOKEN_DOT, "Expect '.' after 'super'.");
     consume(parser, scanner, TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = identifierConstant(parser, &parser->previous, compiler, vm);
+    size_t name = identifierConstant(parser, &parser->previous, compiler, vm);
 
     namedVariable(parser, scanner, vm, compiler, currentClass, false,
                   syntheticToken("this"));
@@ -507,12 +689,12 @@ static void super_(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
         uint8_t argCount = argumentList(parser, scanner, vm, compiler, currentClass);
         namedVariable(parser, scanner, vm, compiler, currentClass, false,
                       syntheticToken("super"));
-        emitBytes(parser, OP_SUPER_INVOKE, name, compiler, vm);
+        emitConstantOp(parser, OP_SUPER_INVOKE, OP_SUPER_INVOKE_LONG, name, compiler, vm);
         emitByte(parser, argCount, compiler, vm);
     } else {
         namedVariable(parser, scanner, vm, compiler, currentClass, false,
                       syntheticToken("super"));
-        emitBytes(parser, OP_GET_SUPER, name, compiler, vm);
+        emitConstantOp(parser, OP_GET_SUPER, OP_GET_SUPER_LONG, name, compiler, vm);
     }
 }
 
@@ -553,6 +735,8 @@ ParseRule rules[] = {
     [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
     [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE}, 
     [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LEFT_BRACKET]  = {list,     index_, PREC_CALL},
+    [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
     [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_DOT]           = {NULL,     dot,    PREC_CALL},
     [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
@@ -582,7 +766,7 @@ ParseRule rules[] = {
     [TOKEN_OR]            = {NULL,     or_,    PREC_OR},
     [TOKEN_PRINT]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_RETURN]        = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_SUPER]         = {NULL,     super_, PREC_NONE},
+    [TOKEN_SUPER]         = {super_,   NULL,   PREC_NONE},
     [TOKEN_THIS]          = {this_,    NULL,   PREC_NONE},
     [TOKEN_TRUE]          = {literal,  NULL,   PREC_NONE},
     [TOKEN_VAR]           = {NULL,     NULL,   PREC_NONE},
@@ -635,17 +819,17 @@ static void block(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
     consume(parser, scanner, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static uint8_t parseVariable(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
-                             const char *errorMsg) {
+static uint32_t parseVariable(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
+                              const char *errorMsg) {
     consume(parser, scanner, TOKEN_IDENTIFIER, errorMsg);
 
-    declareVariable(parser, compiler);
+    declareVariable(parser, compiler, vm);
 
     if (compiler->scopeDepth > 0) {
         return 0;
     }
 
-    return identifierConstant(parser, &parser->previous, compiler, vm);
+    return globalIndex(parser, &parser->previous, compiler, vm);
 }
 
 static void markInitialized(Compiler *compiler) {
@@ -656,13 +840,13 @@ static void markInitialized(Compiler *compiler) {
     compiler->locals[compiler->localCount - 1].depth = compiler->scopeDepth;
 }
 
-static void defineVariable(Parser *parser, Compiler *compiler, VM *vm, uint8_t global) {
+static void defineVariable(Parser *parser, Compiler *compiler, VM *vm, uint32_t global) {
     if (compiler->scopeDepth > 0) {
         markInitialized(compiler);
         return;
     }
 
-    emitBytes(parser, OP_DEFINE_GLOBAL, global, compiler, vm);
+    emitGlobal(parser, OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global, compiler, vm);
 }
 
 static void function(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
@@ -681,8 +865,8 @@ static void function(Parser *parser, Scanner *scanner, VM *vm, Compiler *compile
                 errorAtCurrent(parser, "Can't have more than 254 parameters.");
             }
 
-            uint8_t constant = parseVariable(parser, scanner, vm, &localCompiler,
-                                             "Expect parameter name.");
+            uint32_t constant = parseVariable(parser, scanner, vm, &localCompiler,
+                                              "Expect parameter name.");
             defineVariable(parser, &localCompiler, vm, constant);
         } while (match(parser, scanner, TOKEN_COMMA));
     }
@@ -693,19 +877,22 @@ static void function(Parser *parser, Scanner *scanner, VM *vm, Compiler *compile
     block(parser, scanner, vm, &localCompiler, currentClass);
 
     ObjFunction *func = endCompiler(parser, &localCompiler, vm);
-    emitBytes(parser, OP_CLOSURE, makeConstant(parser, OBJ_VAL(func), compiler, vm),
-              compiler, vm);
+    emitConstantOp(parser, OP_CLOSURE, OP_CLOSURE_LONG,
+                   makeConstant(parser, OBJ_VAL(func), compiler, vm), compiler, vm);
 
     for (size_t idx = 0; idx < func->upvalueCount; idx++) {
-        emitByte(parser, compiler->upvalues[idx].isLocal ? 1 : 0, compiler, vm);
-        emitByte(parser, compiler->upvalues[idx].index, compiler, vm);
+        emitByte(parser, localCompiler.upvalues[idx].isLocal ? 1 : 0, compiler, vm);
+        emitShort(parser, localCompiler.upvalues[idx].index, compiler, vm);
     }
+
+    FREE_ARRAY(vm, compiler, Upvalue, localCompiler.upvalues,
+               localCompiler.upvalueCapacity);
 }
 
 static void method(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
                    ClassCompiler *currentClass) {
     consume(parser, scanner, TOKEN_IDENTIFIER, "Expect method name.");
-    uint8_t constant = identifierConstant(parser, &parser->previous, compiler, vm);
+    size_t constant = identifierConstant(parser, &parser->previous, compiler, vm);
 
     FunctionType ftype = TYPE_METHOD;
 
@@ -714,18 +901,25 @@ static void method(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
     }
 
     function(parser, scanner, vm, compiler, currentClass, ftype);
-    emitBytes(parser, OP_METHOD, constant, compiler, vm);
+    emitConstantOp(parser, OP_METHOD, OP_METHOD_LONG, constant, compiler, vm);
 }
 
 static void classDeclaration(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
                              ClassCompiler *currentClass) {
     consume(parser, scanner, TOKEN_IDENTIFIER, "Expect class name.");
     Token className = parser->previous;
-    uint8_t nameConstant = identifierConstant(parser, &parser->previous, compiler, vm);
+    size_t nameConstant = identifierConstant(parser, &parser->previous, compiler, vm);
+
+    declareVariable(parser, compiler, vm);
+    emitConstantOp(parser, OP_CLASS, OP_CLASS_LONG, nameConstant, compiler, vm);
 
-    declareVariable(parser, compiler);
-    emitBytes(parser, OP_CLASS, nameConstant, compiler, vm);
-    defineVariable(parser, compiler, vm, nameConstant);
+    uint32_t global = 0;
+
+    if (compiler->scopeDepth == 0) {
+        global = globalIndex(parser, &className, compiler, vm);
+    }
+
+    defineVariable(parser, compiler, vm, global);
 
     ClassCompiler classCompiler;
     classCompiler.enclosing = currentClass;
@@ -741,7 +935,7 @@ static void classDeclaration(Parser *parser, Scanner *scanner, VM *vm, Compiler
         }
 
         beginScope(compiler);
-        addLocal(parser, compiler, syntheticToken("super"));
+        addLocal(parser, compiler, syntheticToken("super"), vm);
         defineVariable(parser, compiler, vm, 0);
 
         namedVariable(parser, scanner, vm, compiler, currentClass, false, className);
@@ -757,7 +951,7 @@ static void classDeclaration(Parser *parser, Scanner *scanner, VM *vm, Compiler
     }
 
     consume(parser, scanner, TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
-    pop(vm);
+    emitByte(parser, OP_POP, compiler, vm);
 
     if (classCompiler.hasSuperclass) {
         endScope(parser, compiler, vm);
@@ -768,7 +962,7 @@ static void classDeclaration(Parser *parser, Scanner *scanner, VM *vm, Compiler
 
 static void funDeclaration(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
                            ClassCompiler *currentClass) {
-    uint8_t global =
+    uint32_t global =
         parseVariable(parser, scanner, vm, compiler, "Expect function name.");
     markInitialized(compiler);
     function(parser, scanner, vm, compiler, currentClass, TYPE_FUNCTION);
@@ -777,7 +971,7 @@ static void funDeclaration(Parser *parser, Scanner *scanner, VM *vm, Compiler *c
 
 static void varDeclaration(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
                            ClassCompiler *currentClass) {
-    uint8_t global =
+    uint32_t global =
         parseVariable(parser, scanner, vm, compiler, "Expect variable name.");
 
     if (match(parser, scanner, TOKEN_EQUAL)) {
@@ -830,11 +1024,11 @@ static void ifStatement(Parser *parser, Scanner *scanner, VM *vm, Compiler *comp
     expression(parser, scanner, vm, compiler, currentClass);
     consume(parser, scanner, TOKEN_RIGHT_PAREN, "Expect ')' after 'if'.");
 
-    size_t thenJmp = emitJump(parser, OP_JUMP_IF_FALSE, compiler, vm);
+    size_t thenJmp = emitJump(parser, OP_JUMP_IF_FALSE_LONG, compiler, vm);
     emitByte(parser, OP_POP, compiler, vm);
     statement(parser, scanner, vm, compiler, currentClass);
 
-    size_t elseJmp = emitJump(parser, OP_JUMP, compiler, vm);
+    size_t elseJmp = emitJump(parser, OP_JUMP_LONG, compiler, vm);
 
     patchJump(parser, thenJmp, compiler);
     emitByte(parser, OP_POP, compiler, vm);
@@ -867,12 +1061,12 @@ static void forStatement(Parser *parser, Scanner *scanner, VM *vm, Compiler *com
         expression(parser, scanner, vm, compiler, currentClass);
         consume(parser, scanner, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
-        exitJmp = (intmax_t)emitJump(parser, OP_JUMP_IF_FALSE, compiler, vm);
+        exitJmp = (intmax_t)emitJump(parser, OP_JUMP_IF_FALSE_LONG, compiler, vm);
         emitByte(parser, OP_POP, compiler, vm);
     }
 
     if (!match(parser, scanner, TOKEN_RIGHT_PAREN)) {
-        size_t bodyJmp = emitJump(parser, OP_JUMP, compiler, vm);
+        size_t bodyJmp = emitJump(parser, OP_JUMP_LONG, compiler, vm);
         size_t incStart = currentChunk(compiler)->count;
         expression(parser, scanner, vm, compiler, currentClass);
         emitByte(parser, OP_POP, compiler, vm);
@@ -888,6 +1082,7 @@ static void forStatement(Parser *parser, Scanner *scanner, VM *vm, Compiler *com
 
     if (exitJmp != -1) {
         patchJump(parser, (size_t)exitJmp, compiler);
+        emitByte(parser, OP_POP, compiler, vm);
     }
 
     endScope(parser, compiler, vm);
@@ -900,7 +1095,7 @@ static void whileStatement(Parser *parser, Scanner *scanner, VM *vm, Compiler *c
     expression(parser, scanner, vm, compiler, currentClass);
     consume(parser, scanner, TOKEN_RIGHT_PAREN, "Expect ')' after 'while' condition.");
 
-    size_t exitJmp = emitJump(parser, OP_JUMP_IF_FALSE, compiler, vm);
+    size_t exitJmp = emitJump(parser, OP_JUMP_IF_FALSE_LONG, compiler, vm);
     emitByte(parser, OP_POP, compiler, vm);
     statement(parser, scanner, vm, compiler, currentClass);
     emitLoop(parser, loopStart, compiler, vm);
@@ -929,9 +1124,9 @@ static void synchronize(Parser *parser, Scanner *scanner) {
                 return;
             default:; // Do nothing
         }
-    }
 
-    advance(parser, scanner);
+        advance(parser, scanner);
+    }
 }
 
 static void declaration(Parser *parser, Scanner *scanner, VM *vm, Compiler *compiler,
@@ -979,14 +1174,22 @@ void initCompiler(Compiler *compiler, Compiler *enclosing, FunctionType ftype,
     compiler->func = NULL;
     compiler->ftype = ftype;
     compiler->func = newFunction(vm, compiler);
+    compiler->locals = NULL;
     compiler->localCount = 0;
+    compiler->localCapacity = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalueCapacity = 0;
     compiler->scopeDepth = 0;
 
     if (ftype != TYPE_SCRIPT) {
-        compiler->func->name =
-            copyString(vm, compiler, parser->previous.length, parser->previous.start);
+        compiler->func->name = copyHashedString(vm, compiler, parser->previous.length,
+                                                parser->previous.start,
+                                                parser->previous.hash);
+        writeBarrierObject(vm, (Obj *)compiler->func->name);
     }
 
+    growLocals(compiler, vm);
+
     Local *local = &compiler->locals[compiler->localCount++];
     local->depth = 0;
     local->isCaptured = false;
@@ -998,6 +1201,8 @@ void initCompiler(Compiler *compiler, Compiler *enclosing, FunctionType ftype,
         local->name.start = "";
         local->name.length = 0;
     }
+
+    local->name.hash = hashChars(local->name.start, local->name.length);
 }
 
 ObjFunction *compile(Scanner *scanner, const char *source, VM *vm) {
@@ -1006,6 +1211,7 @@ ObjFunction *compile(Scanner *scanner, const char *source, VM *vm) {
     Parser parser;
     parser.hadError = false;
     parser.panicMode = false;
+    parser.err = vm->err;
 
     Compiler compiler;
     initCompiler(&compiler, NULL, TYPE_SCRIPT, &parser, vm);
@@ -7,6 +7,93 @@
 #include "value.h"
 #include "vm.h"
 
+// clang-format off
+static const char *opcodeNames[] = {
+    [OP_CONSTANT]              = "OP_CONSTANT",
+    [OP_NIL]                   = "OP_NIL",
+    [OP_TRUE]                  = "OP_TRUE",
+    [OP_FALSE]                 = "OP_FALSE",
+    [OP_POP]                   = "OP_POP",
+    [OP_GET_LOCAL]             = "OP_GET_LOCAL",
+    [OP_GET_GLOBAL]            = "OP_GET_GLOBAL",
+    [OP_DEFINE_GLOBAL]         = "OP_DEFINE_GLOBAL",
+    [OP_SET_LOCAL]             = "OP_SET_LOCAL",
+    [OP_SET_GLOBAL]            = "OP_SET_GLOBAL",
+    [OP_GET_UPVALUE]           = "OP_GET_UPVALUE",
+    [OP_SET_UPVALUE]           = "OP_SET_UPVALUE",
+    [OP_GET_PROPERTY]          = "OP_GET_PROPERTY",
+    [OP_SET_PROPERTY]          = "OP_SET_PROPERTY",
+    [OP_GET_SUPER]             = "OP_GET_SUPER",
+    [OP_EQUAL]                 = "OP_EQUAL",
+    [OP_GREATER]               = "OP_GREATER",
+    [OP_LESS]                  = "OP_LESS",
+    [OP_ADD]                   = "OP_ADD",
+    [OP_SUBTRACT]              = "OP_SUBTRACT",
+    [OP_MULTIPLY]              = "OP_MULTIPLY",
+    [OP_DIVIDE]                = "OP_DIVIDE",
+    [OP_NOT]                   = "OP_NOT",
+    [OP_NEGATE]                = "OP_NEGATE",
+    [OP_PRINT]                 = "OP_PRINT",
+    [OP_JUMP]                  = "OP_JUMP",
+    [OP_JUMP_IF_FALSE]         = "OP_JUMP_IF_FALSE",
+    [OP_JUMP_IF_TRUE]          = "OP_JUMP_IF_TRUE",
+    [OP_LOOP]                  = "OP_LOOP",
+    [OP_CALL]                  = "OP_CALL",
+    [OP_INVOKE]                = "OP_INVOKE",
+    [OP_SUPER_INVOKE]          = "OP_SUPER_INVOKE",
+    [OP_CLOSURE]               = "OP_CLOSURE",
+    [OP_CLOSE_UPVALUE]         = "OP_CLOSE_UPVALUE",
+    [OP_RETURN]                = "OP_RETURN",
+    [OP_CLASS]                 = "OP_CLASS",
+    [OP_INHERIT]               = "OP_INHERIT",
+    [OP_METHOD]                = "OP_METHOD",
+    [OP_LIST]                  = "OP_LIST",
+    [OP_GET_INDEX]             = "OP_GET_INDEX",
+    [OP_SET_INDEX]             = "OP_SET_INDEX",
+    [OP_CONSTANT_LONG]         = "OP_CONSTANT_LONG",
+    [OP_GET_LOCAL_LONG]        = "OP_GET_LOCAL_LONG",
+    [OP_SET_LOCAL_LONG]        = "OP_SET_LOCAL_LONG",
+    [OP_GET_GLOBAL_LONG]       = "OP_GET_GLOBAL_LONG",
+    [OP_DEFINE_GLOBAL_LONG]    = "OP_DEFINE_GLOBAL_LONG",
+    [OP_SET_GLOBAL_LONG]       = "OP_SET_GLOBAL_LONG",
+    [OP_JUMP_LONG]             = "OP_JUMP_LONG",
+    [OP_JUMP_IF_FALSE_LONG]    = "OP_JUMP_IF_FALSE_LONG",
+    [OP_JUMP_IF_TRUE_LONG]     = "OP_JUMP_IF_TRUE_LONG",
+    [OP_LOOP_LONG]             = "OP_LOOP_LONG",
+    [OP_GET_UPVALUE_LONG]      = "OP_GET_UPVALUE_LONG",
+    [OP_SET_UPVALUE_LONG]      = "OP_SET_UPVALUE_LONG",
+    [OP_GET_PROPERTY_LONG]     = "OP_GET_PROPERTY_LONG",
+    [OP_SET_PROPERTY_LONG]     = "OP_SET_PROPERTY_LONG",
+    [OP_GET_SUPER_LONG]        = "OP_GET_SUPER_LONG",
+    [OP_INVOKE_LONG]           = "OP_INVOKE_LONG",
+    [OP_SUPER_INVOKE_LONG]     = "OP_SUPER_INVOKE_LONG",
+    [OP_CLOSURE_LONG]          = "OP_CLOSURE_LONG",
+    [OP_CLASS_LONG]            = "OP_CLASS_LONG",
+    [OP_METHOD_LONG]           = "OP_METHOD_LONG",
+    [OP_GET_LOCAL_0]           = "OP_GET_LOCAL_0",
+    [OP_GET_LOCAL_1]           = "OP_GET_LOCAL_1",
+    [OP_GET_LOCAL_2]           = "OP_GET_LOCAL_2",
+    [OP_GET_LOCAL_3]           = "OP_GET_LOCAL_3",
+    [OP_ADD_LOCAL_CONST]       = "OP_ADD_LOCAL_CONST",
+    [OP_INCREMENT_LOCAL]       = "OP_INCREMENT_LOCAL",
+    [OP_LESS_LOCAL_LOCAL_JUMP] = "OP_LESS_LOCAL_LOCAL_JUMP",
+    [OP_GREATER_NUM]           = "OP_GREATER_NUM",
+    [OP_LESS_NUM]              = "OP_LESS_NUM",
+    [OP_ADD_NUM]               = "OP_ADD_NUM",
+    [OP_SUBTRACT_NUM]          = "OP_SUBTRACT_NUM",
+    [OP_MULTIPLY_NUM]          = "OP_MULTIPLY_NUM",
+    [OP_DIVIDE_NUM]            = "OP_DIVIDE_NUM",
+};
+// clang-format on
+
+const char *opcodeName(uint8_t opcode) {
+    if (opcode >= sizeof(opcodeNames) / sizeof(opcodeNames[0])) {
+        return "OP_UNKNOWN";
+    }
+
+    return opcodeNames[opcode];
+}
+
 void disassembleChunk(Chunk *chunk, const char *name) {
     printf("== %s ==\n", name);
 
@@ -23,14 +110,83 @@ static size_t constantInstruction(const char *name, Chunk *chunk, size_t offset)
     return offset + 2;
 }
 
-static size_t invokeInstruction(const char *name, Chunk *chunk, size_t offset) {
-    uint8_t constant = chunk->code[offset + 1];
-    uint8_t argCount = chunk->code[offset + 1];
+static uint32_t readLong(Chunk *chunk, size_t offset) {
+    return (uint32_t)((chunk->code[offset] << 16) | (chunk->code[offset + 1] << 8) |
+                      chunk->code[offset + 2]);
+}
+
+static size_t constantLongInstruction(const char *name, Chunk *chunk, size_t offset) {
+    uint32_t constant = readLong(chunk, offset + 1);
+    printf("%-16s %4u '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 4;
+}
+
+/**
+ * @brief Reads the constant operand at `offset`, `width` bytes wide for the
+ * short (1) or long (3) form of an instruction.
+ */
+static uint32_t readConstant(Chunk *chunk, size_t offset, size_t width) {
+    return width == 1 ? chunk->code[offset] : readLong(chunk, offset);
+}
+
+static size_t invokeInstruction(const char *name, size_t width, Chunk *chunk,
+                                size_t offset) {
+    uint32_t constant = readConstant(chunk, offset + 1, width);
+    uint8_t argCount = chunk->code[offset + 1 + width];
 
     printf("%-16s (%u args) %4u '", name, argCount, constant);
     printValue(chunk->constants.values[constant]);
     printf("'\n");
-    return offset + 3;
+    return offset + 2 + width;
+}
+
+static uint16_t readCache(Chunk *chunk, size_t offset) {
+    return (uint16_t)((chunk->code[offset] << 8) | chunk->code[offset + 1]);
+}
+
+static size_t propertyInstruction(const char *name, size_t width, Chunk *chunk,
+                                  size_t offset) {
+    uint32_t constant = readConstant(chunk, offset + 1, width);
+
+    printf("%-16s %4u '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' cache %u\n", readCache(chunk, offset + 1 + width));
+    return offset + 3 + width;
+}
+
+static size_t cachedInvokeInstruction(const char *name, size_t width, Chunk *chunk,
+                                      size_t offset) {
+    uint32_t constant = readConstant(chunk, offset + 1, width);
+    uint8_t argCount = chunk->code[offset + 1 + width];
+
+    printf("%-16s (%u args) %4u '", name, argCount, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' cache %u\n", readCache(chunk, offset + 2 + width));
+    return offset + 4 + width;
+}
+
+static size_t closureInstruction(const char *name, size_t width, Chunk *chunk,
+                                 size_t offset) {
+    uint32_t constant = readConstant(chunk, offset + 1, width);
+    printf("%-16s %4u ", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("\n");
+
+    ObjFunction *func = AS_FUNCTION(chunk->constants.values[constant]);
+    offset += 1 + width;
+
+    for (size_t idx = 0; idx < func->upvalueCount; idx++) {
+        uint8_t isLocal = chunk->code[offset];
+        size_t index = (size_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+
+        printf("%04zu      |                     %s %zu\n", offset,
+               isLocal ? "local" : "upvalue", index);
+        offset += 3;
+    }
+
+    return offset;
 }
 
 /**
@@ -47,6 +203,23 @@ static size_t byteInstruction(const char *name, Chunk *chunk, size_t offset) {
     return offset + 2;
 }
 
+static size_t globalInstruction(const char *name, Chunk *chunk, size_t offset) {
+    uint16_t slot = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-16s %4u\n", name, slot);
+    return offset + 3;
+}
+
+static size_t shortInstruction(const char *name, Chunk *chunk, size_t offset) {
+    uint16_t slot = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-16s %4u\n", name, slot);
+    return offset + 3;
+}
+
+static size_t globalLongInstruction(const char *name, Chunk *chunk, size_t offset) {
+    printf("%-16s %4u\n", name, readLong(chunk, offset + 1));
+    return offset + 4;
+}
+
 static size_t jumpInstruction(const char *name, int8_t sign, Chunk *chunk,
                               size_t offset) {
     uint16_t jmp = (uint16_t)(chunk->code[offset + 1] << 8);
@@ -56,13 +229,42 @@ static size_t jumpInstruction(const char *name, int8_t sign, Chunk *chunk,
     return offset + 3;
 }
 
+static size_t jumpLongInstruction(const char *name, int8_t sign, Chunk *chunk,
+                                  size_t offset) {
+    uint32_t jmp = readLong(chunk, offset + 1);
+    printf("%-16s %4zu -> %ld\n", name, offset,
+           ((intmax_t)offset) + 4 + (sign * (intmax_t)jmp));
+    return offset + 4;
+}
+
+static size_t localConstantInstruction(const char *name, Chunk *chunk, size_t offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+
+    printf("%-16s %4u %4u '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+static size_t localsJumpInstruction(const char *name, Chunk *chunk, size_t offset) {
+    uint8_t left = chunk->code[offset + 1];
+    uint8_t right = chunk->code[offset + 2];
+    uint16_t jmp = (uint16_t)((chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+
+    printf("%-16s %4u %4u %4zu -> %zu\n", name, left, right, offset, offset + 5 + jmp);
+    return offset + 5;
+}
+
 size_t disassembleInstruction(Chunk *chunk, size_t offset) {
     printf("%04zu ", offset);
 
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    size_t line = getLine(chunk, offset);
+
+    if (offset > 0 && line == getLine(chunk, offset - 1)) {
         printf("   | ");
     } else {
-        printf("%4zu ", chunk->lines[offset]);
+        printf("%4zu ", line);
     }
 
     uint8_t instruction = chunk->code[offset];
@@ -81,21 +283,21 @@ size_t disassembleInstruction(Chunk *chunk, size_t offset) {
         case OP_GET_LOCAL:
             return byteInstruction("OP_GET_LOCAL", chunk, offset);
         case OP_GET_GLOBAL:
-            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_GET_GLOBAL", chunk, offset);
         case OP_DEFINE_GLOBAL:
-            return byteInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
         case OP_SET_LOCAL:
             return byteInstruction("OP_SET_LOCAL", chunk, offset);
         case OP_SET_GLOBAL:
-            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_GET_UPVALUE:
             return byteInstruction("OP_GET_UPVALUE", chunk, offset);
         case OP_SET_UPVALUE:
             return byteInstruction("OP_SET_UPVALUE", chunk, offset);
         case OP_GET_PROPERTY:
-            return byteInstruction("OP_GET_PROPERTY", chunk, offset);
+            return propertyInstruction("OP_GET_PROPERTY", 1, chunk, offset);
         case OP_SET_PROPERTY:
-            return byteInstruction("OP_SET_PROPERTY", chunk, offset);
+            return propertyInstruction("OP_SET_PROPERTY", 1, chunk, offset);
         case OP_GET_SUPER:
             return constantInstruction("OP_GET_SUPER", chunk, offset);
         case OP_EQUAL:
@@ -122,33 +324,18 @@ size_t disassembleInstruction(Chunk *chunk, size_t offset) {
             return jumpInstruction("OP_JUMP", 1, chunk, offset);
         case OP_JUMP_IF_FALSE:
             return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_JUMP_IF_TRUE:
+            return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
         case OP_LOOP:
             return jumpInstruction("OP_LOOP", -1, chunk, offset);
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
         case OP_INVOKE:
-            return invokeInstruction("OP_INVOKE", chunk, offset);
+            return cachedInvokeInstruction("OP_INVOKE", 1, chunk, offset);
         case OP_SUPER_INVOKE:
-            return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
-        case OP_CLOSURE: {
-            offset += 1;
-            uint8_t constant = chunk->code[offset++];
-            printf("%-16s %4d ", "OP_CLOSURE", constant);
-            printValue(chunk->constants.values[constant]);
-            printf("\n");
-
-            ObjFunction *func = AS_FUNCTION(chunk->constants.values[constant]);
-
-            for (size_t idx = 0; idx < func->upvalueCount; idx++) {
-                uint8_t isLocal = chunk->code[offset++];
-                size_t index = chunk->code[offset++];
-
-                printf("%04zu      |                     %s %zu\n", offset - 2,
-                       isLocal ? "local" : "upvalue", index);
-            }
-
-            return offset;
-        }
+            return invokeInstruction("OP_SUPER_INVOKE", 1, chunk, offset);
+        case OP_CLOSURE:
+            return closureInstruction("OP_CLOSURE", 1, chunk, offset);
         case OP_CLOSE_UPVALUE:
             return simpleInstruction("OP_CLOSE_UPVALUE", offset);
         case OP_RETURN:
@@ -159,8 +346,217 @@ size_t disassembleInstruction(Chunk *chunk, size_t offset) {
             return simpleInstruction("OP_INHERIT", offset);
         case OP_METHOD:
             return constantInstruction("OP_METHOD", chunk, offset);
+        case OP_LIST:
+            return byteInstruction("OP_LIST", chunk, offset);
+        case OP_GET_INDEX:
+            return simpleInstruction("OP_GET_INDEX", offset);
+        case OP_SET_INDEX:
+            return simpleInstruction("OP_SET_INDEX", offset);
+        case OP_CONSTANT_LONG:
+            return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
+        case OP_GET_LOCAL_LONG:
+            return shortInstruction("OP_GET_LOCAL_LONG", chunk, offset);
+        case OP_SET_LOCAL_LONG:
+            return shortInstruction("OP_SET_LOCAL_LONG", chunk, offset);
+        case OP_GET_GLOBAL_LONG:
+            return globalLongInstruction("OP_GET_GLOBAL_LONG", chunk, offset);
+        case OP_DEFINE_GLOBAL_LONG:
+            return globalLongInstruction("OP_DEFINE_GLOBAL_LONG", chunk, offset);
+        case OP_SET_GLOBAL_LONG:
+            return globalLongInstruction("OP_SET_GLOBAL_LONG", chunk, offset);
+        case OP_JUMP_LONG:
+            return jumpLongInstruction("OP_JUMP_LONG", 1, chunk, offset);
+        case OP_JUMP_IF_FALSE_LONG:
+            return jumpLongInstruction("OP_JUMP_IF_FALSE_LONG", 1, chunk, offset);
+        case OP_JUMP_IF_TRUE_LONG:
+            return jumpLongInstruction("OP_JUMP_IF_TRUE_LONG", 1, chunk, offset);
+        case OP_LOOP_LONG:
+            return jumpLongInstruction("OP_LOOP_LONG", -1, chunk, offset);
+        case OP_GET_UPVALUE_LONG:
+            return shortInstruction("OP_GET_UPVALUE_LONG", chunk, offset);
+        case OP_SET_UPVALUE_LONG:
+            return shortInstruction("OP_SET_UPVALUE_LONG", chunk, offset);
+        case OP_GET_PROPERTY_LONG:
+            return propertyInstruction("OP_GET_PROPERTY_LONG", 3, chunk, offset);
+        case OP_SET_PROPERTY_LONG:
+            return propertyInstruction("OP_SET_PROPERTY_LONG", 3, chunk, offset);
+        case OP_GET_SUPER_LONG:
+            return constantLongInstruction("OP_GET_SUPER_LONG", chunk, offset);
+        case OP_INVOKE_LONG:
+            return cachedInvokeInstruction("OP_INVOKE_LONG", 3, chunk, offset);
+        case OP_SUPER_INVOKE_LONG:
+            return invokeInstruction("OP_SUPER_INVOKE_LONG", 3, chunk, offset);
+        case OP_CLOSURE_LONG:
+            return closureInstruction("OP_CLOSURE_LONG", 3, chunk, offset);
+        case OP_CLASS_LONG:
+            return constantLongInstruction("OP_CLASS_LONG", chunk, offset);
+        case OP_METHOD_LONG:
+            return constantLongInstruction("OP_METHOD_LONG", chunk, offset);
+        case OP_GET_LOCAL_0:
+            return simpleInstruction("OP_GET_LOCAL_0", offset);
+        case OP_GET_LOCAL_1:
+            return simpleInstruction("OP_GET_LOCAL_1", offset);
+        case OP_GET_LOCAL_2:
+            return simpleInstruction("OP_GET_LOCAL_2", offset);
+        case OP_GET_LOCAL_3:
+            return simpleInstruction("OP_GET_LOCAL_3", offset);
+        case OP_ADD_LOCAL_CONST:
+            return localConstantInstruction("OP_ADD_LOCAL_CONST", chunk, offset);
+        case OP_INCREMENT_LOCAL:
+            return localConstantInstruction("OP_INCREMENT_LOCAL", chunk, offset);
+        case OP_LESS_LOCAL_LOCAL_JUMP:
+            return localsJumpInstruction("OP_LESS_LOCAL_LOCAL_JUMP", chunk, offset);
+        case OP_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+            return simpleInstruction(opcodeName(instruction), offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
 }
+
+void disassembleRegChunk(RegChunk *reg, Chunk *chunk, const char *name) {
+    printf("== %s (registers: %zu) ==\n", name, reg->frameSize);
+
+    for (size_t index = 0; index < reg->count;) {
+        index = disassembleRegInstruction(reg, chunk, index);
+    }
+}
+
+/**
+ * @brief Prints an `RK()` operand, registers as `rN` and constants by value.
+ */
+static void printOperand(Chunk *chunk, uint16_t operand) {
+    if (operand < RK_CONSTANT) {
+        printf(" r%u", operand);
+        return;
+    }
+
+    printf(" '");
+    printValue(chunk->constants.values[operand - RK_CONSTANT]);
+    printf("'");
+}
+
+size_t disassembleRegInstruction(RegChunk *reg, Chunk *chunk, size_t index) {
+    // clang-format off
+    static const char *names[] = {
+        [REG_MOVE]                = "REG_MOVE",
+        [REG_NIL]                 = "REG_NIL",
+        [REG_TRUE]                = "REG_TRUE",
+        [REG_FALSE]               = "REG_FALSE",
+        [REG_GET_GLOBAL]          = "REG_GET_GLOBAL",
+        [REG_DEFINE_GLOBAL]       = "REG_DEFINE_GLOBAL",
+        [REG_SET_GLOBAL]          = "REG_SET_GLOBAL",
+        [REG_GET_UPVALUE]         = "REG_GET_UPVALUE",
+        [REG_SET_UPVALUE]         = "REG_SET_UPVALUE",
+        [REG_EQUAL]               = "REG_EQUAL",
+        [REG_GREATER]             = "REG_GREATER",
+        [REG_LESS]                = "REG_LESS",
+        [REG_ADD]                 = "REG_ADD",
+        [REG_SUBTRACT]            = "REG_SUBTRACT",
+        [REG_MULTIPLY]            = "REG_MULTIPLY",
+        [REG_DIVIDE]              = "REG_DIVIDE",
+        [REG_NOT]                 = "REG_NOT",
+        [REG_NEGATE]              = "REG_NEGATE",
+        [REG_PRINT]               = "REG_PRINT",
+        [REG_JUMP]                = "REG_JUMP",
+        [REG_JUMP_IF_FALSE]       = "REG_JUMP_IF_FALSE",
+        [REG_JUMP_IF_TRUE]        = "REG_JUMP_IF_TRUE",
+        [REG_JUMP_IF_EQUAL]       = "REG_JUMP_IF_EQUAL",
+        [REG_JUMP_IF_NOT_EQUAL]   = "REG_JUMP_IF_NOT_EQUAL",
+        [REG_JUMP_IF_GREATER]     = "REG_JUMP_IF_GREATER",
+        [REG_JUMP_IF_NOT_GREATER] = "REG_JUMP_IF_NOT_GREATER",
+        [REG_JUMP_IF_LESS]        = "REG_JUMP_IF_LESS",
+        [REG_JUMP_IF_NOT_LESS]    = "REG_JUMP_IF_NOT_LESS",
+        [REG_CALL]                = "REG_CALL",
+        [REG_RETURN]              = "REG_RETURN",
+    };
+    // clang-format on
+
+    printf("%04zu ", index);
+
+    size_t line = getRegLine(reg, index);
+
+    if (index > 0 && line == getRegLine(reg, index - 1)) {
+        printf("   | ");
+    } else {
+        printf("%4zu ", line);
+    }
+
+    RegInstr *instr = &reg->code[index];
+
+    if (instr->op > REG_RETURN) {
+        printf("Unknown opcode %d\n", instr->op);
+        return index + 1;
+    }
+
+    printf("%-23s", names[instr->op]);
+
+    switch (instr->op) {
+        case REG_NIL:
+        case REG_TRUE:
+        case REG_FALSE:
+            printf(" r%u", instr->a);
+            break;
+        case REG_MOVE:
+        case REG_NOT:
+        case REG_NEGATE:
+            printf(" r%u", instr->a);
+            printOperand(chunk, instr->b);
+            break;
+        case REG_GET_GLOBAL:
+            printf(" r%u g%u", instr->a, instr->b);
+            break;
+        case REG_DEFINE_GLOBAL:
+        case REG_SET_GLOBAL:
+            printf(" g%u", instr->b);
+            printOperand(chunk, instr->c);
+            break;
+        case REG_GET_UPVALUE:
+            printf(" r%u u%u", instr->a, instr->b);
+            break;
+        case REG_SET_UPVALUE:
+            printf(" u%u", instr->b);
+            printOperand(chunk, instr->c);
+            break;
+        case REG_EQUAL:
+        case REG_GREATER:
+        case REG_LESS:
+        case REG_ADD:
+        case REG_SUBTRACT:
+        case REG_MULTIPLY:
+        case REG_DIVIDE:
+            printf(" r%u", instr->a);
+            printOperand(chunk, instr->b);
+            printOperand(chunk, instr->c);
+            break;
+        case REG_PRINT:
+        case REG_RETURN:
+            printOperand(chunk, instr->b);
+            break;
+        case REG_JUMP:
+            printf(" -> %ld", (intmax_t)index + 1 + instr->d);
+            break;
+        case REG_JUMP_IF_FALSE:
+        case REG_JUMP_IF_TRUE:
+            printOperand(chunk, instr->b);
+            printf(" -> %ld", (intmax_t)index + 1 + instr->d);
+            break;
+        case REG_CALL:
+            printf(" r%u (%u args)", instr->a, instr->b);
+            break;
+        default:
+            // Compare and branch
+            printOperand(chunk, instr->b);
+            printOperand(chunk, instr->c);
+            printf(" -> %ld", (intmax_t)index + 1 + instr->d);
+            break;
+    }
+
+    printf("\n");
+    return index + 1;
+}
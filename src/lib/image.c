@@ -0,0 +1,63 @@
+#include <stdlib.h>
+
+#include "compiler.h"
+#include "image.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+/**
+ * @brief Freezes every object of the image's VM.
+ *
+ * @details A full collection first completes any cycle the compiler left
+ * in progress, so all objects are white and on `vm->objects`.
+ */
+static void freeze(Image *image) {
+    VM *vm = &image->vm;
+
+    push(vm, OBJ_VAL(image->script));
+    collectGarbage(vm, NULL);
+    pop(vm);
+
+    image->cacheCount = 0;
+
+    for (Obj *object = vm->objects; object != NULL; object = object->next) {
+        object->isMarked = true;
+
+        if (object->type == OBJ_FUNCTION) {
+            ObjFunction *func = (ObjFunction *)object;
+            func->frozen = true;
+            func->cacheBase = image->cacheCount;
+            func->jit.failed = true;
+            image->cacheCount += func->chunk.cacheCount;
+        }
+    }
+}
+
+Image *newImage(Scanner *scanner, const char *source, bool optimize, bool registerVM) {
+    Image *image = (Image *)malloc(sizeof(Image));
+
+    if (image == NULL) {
+        return NULL;
+    }
+
+    initVM(&image->vm);
+    image->vm.optimize = optimize;
+    image->vm.registerVM = registerVM;
+    image->script = compile(scanner, source, &image->vm);
+
+    if (image->script == NULL) {
+        freeImage(image);
+        return NULL;
+    }
+
+    freeze(image);
+    return image;
+}
+
+void freeImage(Image *image) {
+    freeVM(&image->vm, NULL);
+    free(image);
+}
+
+InterpreterResult interpretImage(VM *vm) { return interpretFunction(vm, vm->image->script); }
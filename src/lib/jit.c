@@ -0,0 +1,908 @@
+// MAP_ANONYMOUS isn't part of strict C99 POSIX headers
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "jit.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+#ifdef CLOX_JIT
+#include <sys/mman.h>
+#endif // CLOX_JIT
+
+void initJitCode(JitCode *jit) {
+    jit->code = NULL;
+    jit->size = 0;
+    jit->entries = NULL;
+    jit->entryCount = 0;
+    jit->hotness = 0;
+    jit->failed = false;
+}
+
+void freeJitCode(VM *vm, Compiler *compiler, JitCode *jit) {
+#ifdef CLOX_JIT
+    if (jit->code != NULL) {
+        munmap(jit->code, jit->size);
+    }
+#endif // CLOX_JIT
+
+    FREE_ARRAY(vm, compiler, uint32_t, jit->entries, jit->entryCount);
+    initJitCode(jit);
+}
+
+#if defined(CLOX_JIT) && defined(NAN_BOXING) && defined(__x86_64__)
+
+/**
+ * @brief x86-64 general purpose registers, numbered as encoded.
+ */
+typedef enum {
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+} Register;
+
+// Registers pinned for the whole function. All are callee saved, so they
+// survive calls into the VM without being spilled.
+#define VM_REG    RBX // VM *
+#define QNAN_REG  RBP // QNAN, for type guards and building booleans
+#define FRAME_REG R12 // CallFrame * of the running function
+#define TOP_REG   R13 // Value *, cached `vm->stackTop'
+#define SLOTS_REG R14 // Value *, the frame's slots
+
+#define XMM0 0
+#define XMM1 1
+
+/**
+ * @brief Condition codes of `jcc` and `setcc`.
+ */
+typedef enum {
+    COND_B = 0x2,
+    COND_E = 0x4,
+    COND_NE = 0x5,
+    COND_BE = 0x6,
+    COND_A = 0x7,
+    COND_NP = 0xb,
+} Condition;
+
+// Address of a function called from generated code
+#define ADDRESS(func) ((uint64_t)(uintptr_t)(func))
+
+// Opcodes above 0xff live behind the 0x0f escape byte
+#define ESC(opcode) (0x0f00 | (opcode))
+
+// Opcodes of `op r/m64, r64` arithmetic
+#define ALU_ADD 0x01
+#define ALU_OR  0x09
+#define ALU_AND 0x21
+#define ALU_SUB 0x29
+#define ALU_XOR 0x31
+#define ALU_CMP 0x39
+
+// Opcode extensions of `op r/m64, imm` arithmetic
+#define IMM_ADD 0
+#define IMM_OR  1
+#define IMM_SUB 5
+#define IMM_CMP 7
+
+/**
+ * @brief Jump whose 32 bit displacement is patched once its target is known.
+ *
+ * @details `target` is a bytecode offset. Side exits jump to a stub resuming
+ * the stack interpreter at `target` instead of to its template.
+ */
+typedef struct {
+    size_t at;
+    size_t target;
+    bool exit;
+} CodeFixup;
+
+/**
+ * @brief State of a function's compilation.
+ *
+ * @details `entries` maps bytecode offsets to template offsets in `code`.
+ * `epilogue` is the offset of the code returning to `jitEnter()`, which every
+ * exit from generated code jumps to with its status in `eax`.
+ */
+typedef struct {
+    VM *vm;
+    Compiler *compiler;
+    Chunk *chunk;
+    uint8_t *code;
+    size_t count;
+    size_t capacity;
+    uint32_t *entries;
+    size_t epilogue;
+    CodeFixup *fixups;
+    size_t fixupCount;
+    size_t fixupCapacity;
+} Assembler;
+
+/**
+ * @brief Signature of generated code, starting at `target` within it.
+ */
+typedef JitStatus (*JitFn)(VM *vm, CallFrame *frame, uint8_t *target);
+
+static void emitByte(Assembler *as, uint8_t byte) {
+    if (as->capacity < as->count + 1) {
+        size_t oldCapacity = as->capacity;
+        as->capacity = GROW_CAPACITY(oldCapacity);
+        as->code = GROW_ARRAY(as->vm, as->compiler, uint8_t, as->code, oldCapacity,
+                              as->capacity);
+    }
+
+    as->code[as->count++] = byte;
+}
+
+static void emitU32(Assembler *as, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        emitByte(as, (uint8_t)(value >> shift));
+    }
+}
+
+static void emitU64(Assembler *as, uint64_t value) {
+    for (int shift = 0; shift < 64; shift += 8) {
+        emitByte(as, (uint8_t)(value >> shift));
+    }
+}
+
+static void patchU32(Assembler *as, size_t at, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        as->code[at++] = (uint8_t)(value >> shift);
+    }
+}
+
+static void emitOpcode(Assembler *as, uint8_t prefix, bool wide, uint16_t opcode,
+                       int reg, int rm) {
+    uint8_t rex = (uint8_t)(0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3));
+
+    if (prefix != 0) {
+        emitByte(as, prefix);
+    }
+
+    if (rex != 0x40) {
+        emitByte(as, rex);
+    }
+
+    if (opcode > 0xff) {
+        emitByte(as, 0x0f);
+    }
+
+    emitByte(as, (uint8_t)opcode);
+}
+
+/**
+ * @brief Emits an instruction with register operands `reg` and `rm`.
+ */
+static void emitRegReg(Assembler *as, uint8_t prefix, bool wide, uint16_t opcode, int reg,
+                       int rm) {
+    emitOpcode(as, prefix, wide, opcode, reg, rm);
+    emitByte(as, (uint8_t)(0xc0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+/**
+ * @brief Emits an instruction with register operand `reg` and memory operand
+ * `[base + disp]`.
+ */
+static void emitRegMem(Assembler *as, uint8_t prefix, bool wide, uint16_t opcode, int reg,
+                       int base, int32_t disp) {
+    emitOpcode(as, prefix, wide, opcode, reg, base);
+    uint8_t modrm = (uint8_t)(((reg & 7) << 3) | (base & 7));
+
+    // RBP and R13 bases have no displacement-free encoding
+    if (disp == 0 && (base & 7) != RBP) {
+        emitByte(as, modrm);
+    } else if (disp >= INT8_MIN && disp <= INT8_MAX) {
+        emitByte(as, 0x40 | modrm);
+    } else {
+        emitByte(as, 0x80 | modrm);
+    }
+
+    // RSP and R12 bases need a SIB byte
+    if ((base & 7) == RSP) {
+        emitByte(as, 0x24);
+    }
+
+    if (disp != 0 || (base & 7) == RBP) {
+        if (disp >= INT8_MIN && disp <= INT8_MAX) {
+            emitByte(as, (uint8_t)(int8_t)disp);
+        } else {
+            emitU32(as, (uint32_t)disp);
+        }
+    }
+}
+
+static void emitLoad(Assembler *as, Register dst, Register base, int32_t disp) {
+    emitRegMem(as, 0, true, 0x8b, dst, base, disp);
+}
+
+static void emitStore(Assembler *as, Register base, int32_t disp, Register src) {
+    emitRegMem(as, 0, true, 0x89, src, base, disp);
+}
+
+static void emitMove(Assembler *as, Register dst, Register src) {
+    emitRegReg(as, 0, true, 0x89, src, dst);
+}
+
+static void emitAlu(Assembler *as, uint8_t opcode, Register dst, Register src) {
+    emitRegReg(as, 0, true, opcode, src, dst);
+}
+
+static void emitAluImm(Assembler *as, int extension, Register dst, int32_t imm) {
+    if (imm >= INT8_MIN && imm <= INT8_MAX) {
+        emitRegReg(as, 0, true, 0x83, extension, dst);
+        emitByte(as, (uint8_t)(int8_t)imm);
+    } else {
+        emitRegReg(as, 0, true, 0x81, extension, dst);
+        emitU32(as, (uint32_t)imm);
+    }
+}
+
+static void emitLoadImm(Assembler *as, Register dst, uint64_t imm) {
+    // 32 bit moves zero extend into the full register
+    emitOpcode(as, 0, imm > UINT32_MAX, (uint16_t)(0xb8 | (dst & 7)), 0, dst);
+
+    if (imm > UINT32_MAX) {
+        emitU64(as, imm);
+    } else {
+        emitU32(as, (uint32_t)imm);
+    }
+}
+
+static void emitPush(Assembler *as, Register reg) {
+    emitOpcode(as, 0, false, (uint16_t)(0x50 | (reg & 7)), 0, reg);
+}
+
+static void emitPop(Assembler *as, Register reg) {
+    emitOpcode(as, 0, false, (uint16_t)(0x58 | (reg & 7)), 0, reg);
+}
+
+static void emitToXmm(Assembler *as, int xmm, Register src) {
+    emitRegReg(as, 0x66, true, ESC(0x6e), xmm, src);
+}
+
+static void emitFromXmm(Assembler *as, Register dst, int xmm) {
+    emitRegReg(as, 0x66, true, ESC(0x7e), xmm, dst);
+}
+
+static void emitCompareXmm(Assembler *as, int a, int b) {
+    emitRegReg(as, 0x66, false, ESC(0x2e), a, b);
+}
+
+static void emitSetCondition(Assembler *as, Condition cond, Register dst) {
+    emitRegReg(as, 0, false, (uint16_t)ESC(0x90 | cond), 0, dst);
+}
+
+static void emitCall(Assembler *as, uint64_t func) {
+    emitLoadImm(as, RAX, func);
+    emitRegReg(as, 0, false, 0xff, 2, RAX);
+}
+
+/**
+ * @brief Emits a conditional jump with a displacement to be patched.
+ *
+ * @returns offset of the displacement
+ */
+static size_t emitJumpIf(Assembler *as, Condition cond) {
+    emitByte(as, 0x0f);
+    emitByte(as, (uint8_t)(0x80 | cond));
+    emitU32(as, 0);
+    return as->count - 4;
+}
+
+static size_t emitJump(Assembler *as) {
+    emitByte(as, 0xe9);
+    emitU32(as, 0);
+    return as->count - 4;
+}
+
+static void patchJump(Assembler *as, size_t at, size_t target) {
+    patchU32(as, at, (uint32_t)((int64_t)target - (int64_t)(at + 4)));
+}
+
+static void patchHere(Assembler *as, size_t at) { patchJump(as, at, as->count); }
+
+static void addFixup(Assembler *as, size_t at, size_t target, bool exit) {
+    if (as->fixupCapacity < as->fixupCount + 1) {
+        size_t oldCapacity = as->fixupCapacity;
+        as->fixupCapacity = GROW_CAPACITY(oldCapacity);
+        as->fixups = GROW_ARRAY(as->vm, as->compiler, CodeFixup, as->fixups, oldCapacity,
+                                as->fixupCapacity);
+    }
+
+    as->fixups[as->fixupCount++] = (CodeFixup){at, target, exit};
+}
+
+/**
+ * @brief Jumps to the template of the instruction at bytecode `target`.
+ */
+static void emitBranch(Assembler *as, size_t at, size_t target) {
+    if (as->entries[target] != JIT_NO_ENTRY) {
+        patchJump(as, at, as->entries[target]);
+    } else {
+        addFixup(as, at, target, false);
+    }
+}
+
+/**
+ * @brief Leaves for the stack interpreter at the instruction at `offset` when
+ * `cond` holds, before the instruction had any effect.
+ */
+static void emitExitIf(Assembler *as, Condition cond, size_t offset) {
+    addFixup(as, emitJumpIf(as, cond), offset, true);
+}
+
+/**
+ * @brief Leaves for the stack interpreter at the instruction at `offset` when
+ * `reg` doesn't hold a number.
+ */
+static void emitGuardNumber(Assembler *as, Register reg, size_t offset) {
+    emitMove(as, RDX, reg);
+    emitAlu(as, ALU_AND, RDX, QNAN_REG);
+    emitAlu(as, ALU_CMP, RDX, QNAN_REG);
+    emitExitIf(as, COND_E, offset);
+}
+
+/**
+ * @brief Sets the flags so `COND_BE` holds when `reg` is falsey.
+ *
+ * @details nil and false are the two values right above QNAN, which leaves
+ * `reg - QNAN - 1` at most 1 exactly for them.
+ */
+static void emitTestFalsey(Assembler *as, Register reg) {
+    emitMove(as, RDX, reg);
+    emitAlu(as, ALU_SUB, RDX, QNAN_REG);
+    emitAluImm(as, IMM_SUB, RDX, 1);
+    emitAluImm(as, IMM_CMP, RDX, 1);
+}
+
+/**
+ * @brief Turns the truth value in `al` into a boolean in `rax`.
+ */
+static void emitBoolean(Assembler *as) {
+    emitRegReg(as, 0, false, ESC(0xb6), RAX, RAX);
+    emitAluImm(as, IMM_OR, RAX, TAG_FALSE);
+    emitAlu(as, ALU_OR, RAX, QNAN_REG);
+}
+
+static void emitPushValue(Assembler *as, Register reg) {
+    emitStore(as, TOP_REG, 0, reg);
+    emitAluImm(as, IMM_ADD, TOP_REG, (int32_t)sizeof(Value));
+}
+
+/**
+ * @brief Loads the two topmost values into `rax` and `rcx`, leaving for the
+ * stack interpreter unless both are numbers, then into `xmm0` and `xmm1`.
+ */
+static void emitNumberOperands(Assembler *as, size_t offset) {
+    emitLoad(as, RAX, TOP_REG, -2 * (int32_t)sizeof(Value));
+    emitLoad(as, RCX, TOP_REG, -(int32_t)sizeof(Value));
+    emitGuardNumber(as, RAX, offset);
+    emitGuardNumber(as, RCX, offset);
+    emitToXmm(as, XMM0, RAX);
+    emitToXmm(as, XMM1, RCX);
+}
+
+/**
+ * @brief Replaces the two topmost values by `rax`.
+ */
+static void emitBinaryResult(Assembler *as) {
+    emitAluImm(as, IMM_SUB, TOP_REG, (int32_t)sizeof(Value));
+    emitStore(as, TOP_REG, -(int32_t)sizeof(Value), RAX);
+}
+
+/**
+ * @brief Makes the frame's `ip` point at bytecode `offset`.
+ */
+static void emitSyncIp(Assembler *as, size_t offset) {
+    emitLoadImm(as, RAX, (uint64_t)(uintptr_t)(as->chunk->code + offset));
+    emitStore(as, FRAME_REG, (int32_t)offsetof(CallFrame, ip), RAX);
+}
+
+/**
+ * @brief Writes back the cached stack top and `ip`, the latter pointing past
+ * the instruction for runtime errors, ahead of a call into the VM.
+ */
+static void emitBeforeHelper(Assembler *as, size_t next) {
+    emitSyncIp(as, next);
+    emitStore(as, VM_REG, (int32_t)offsetof(VM, stackTop), TOP_REG);
+    emitMove(as, RDI, VM_REG);
+}
+
+/**
+ * @brief Calls a helper returning a `JitStatus`, leaving generated code unless
+ * it returns `JIT_CONTINUE`.
+ */
+static void emitHelper(Assembler *as, uint64_t helper) {
+    emitCall(as, helper);
+    emitLoad(as, TOP_REG, VM_REG, (int32_t)offsetof(VM, stackTop));
+    emitRegReg(as, 0, false, 0x85, RAX, RAX);
+    patchJump(as, emitJumpIf(as, COND_NE), as->epilogue);
+}
+
+static void emitPrologue(Assembler *as) {
+    emitPush(as, RBX);
+    emitPush(as, RBP);
+    emitPush(as, R12);
+    emitPush(as, R13);
+    emitPush(as, R14);
+
+    emitMove(as, VM_REG, RDI);
+    emitMove(as, FRAME_REG, RSI);
+    emitLoad(as, SLOTS_REG, FRAME_REG, (int32_t)offsetof(CallFrame, slots));
+    emitLoad(as, TOP_REG, VM_REG, (int32_t)offsetof(VM, stackTop));
+    emitLoadImm(as, QNAN_REG, QNAN);
+
+    // Continue at the template `jitEnter()' resumes the frame at
+    emitRegReg(as, 0, false, 0xff, 4, RDX);
+
+    as->epilogue = as->count;
+    emitStore(as, VM_REG, (int32_t)offsetof(VM, stackTop), TOP_REG);
+    emitPop(as, R14);
+    emitPop(as, R13);
+    emitPop(as, R12);
+    emitPop(as, RBP);
+    emitPop(as, RBX);
+    emitByte(as, 0xc3);
+}
+
+static uint16_t readShort(const uint8_t *operand) {
+    return (uint16_t)((operand[0] << 8) | operand[1]);
+}
+
+static uint32_t readLong(const uint8_t *operand) {
+    return (uint32_t)((operand[0] << 16) | (operand[1] << 8) | operand[2]);
+}
+
+static int32_t slotOffset(size_t slot) { return (int32_t)(slot * sizeof(Value)); }
+
+/**
+ * @brief Emits the template of the instruction at `offset`.
+ */
+static void emitTemplate(Assembler *as, size_t offset) {
+    Chunk *chunk = as->chunk;
+    const uint8_t *ip = chunk->code + offset;
+    size_t next = offset + instructionLength(chunk, offset);
+    // Templates guard operand types themselves, quickened sites compile alike
+    uint8_t op = genericOpcode(*ip);
+
+    switch ((OpCode)op) {
+        case OP_CONSTANT:
+            emitLoadImm(as, RAX, chunk->constants.values[ip[1]]);
+            emitPushValue(as, RAX);
+            break;
+        case OP_CONSTANT_LONG:
+            emitLoadImm(as, RAX, chunk->constants.values[readLong(ip + 1)]);
+            emitPushValue(as, RAX);
+            break;
+        case OP_NIL:
+            emitLoadImm(as, RAX, NIL_VAL);
+            emitPushValue(as, RAX);
+            break;
+        case OP_TRUE:
+            emitLoadImm(as, RAX, TRUE_VAL);
+            emitPushValue(as, RAX);
+            break;
+        case OP_FALSE:
+            emitLoadImm(as, RAX, FALSE_VAL);
+            emitPushValue(as, RAX);
+            break;
+        case OP_POP:
+            emitAluImm(as, IMM_SUB, TOP_REG, (int32_t)sizeof(Value));
+            break;
+        case OP_GET_LOCAL:
+        case OP_GET_LOCAL_0:
+        case OP_GET_LOCAL_1:
+        case OP_GET_LOCAL_2:
+        case OP_GET_LOCAL_3: {
+            uint8_t slot = *ip == OP_GET_LOCAL ? ip[1] : (uint8_t)(*ip - OP_GET_LOCAL_0);
+            emitLoad(as, RAX, SLOTS_REG, slotOffset(slot));
+            emitPushValue(as, RAX);
+            break;
+        }
+        case OP_GET_LOCAL_LONG:
+            emitLoad(as, RAX, SLOTS_REG, slotOffset(readShort(ip + 1)));
+            emitPushValue(as, RAX);
+            break;
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_LONG: {
+            size_t slot = *ip == OP_SET_LOCAL ? ip[1] : readShort(ip + 1);
+            emitLoad(as, RAX, TOP_REG, -(int32_t)sizeof(Value));
+            emitStore(as, SLOTS_REG, slotOffset(slot), RAX);
+            break;
+        }
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG: {
+            bool isLong = *ip == OP_GET_GLOBAL_LONG || *ip == OP_SET_GLOBAL_LONG;
+            int32_t slot = slotOffset(isLong ? readLong(ip + 1) : readShort(ip + 1));
+            emitLoad(as, RCX, VM_REG, (int32_t)offsetof(VM, globalValues));
+            emitLoad(as, RAX, RCX, slot);
+            emitLoadImm(as, RDX, UNDEFINED_VAL);
+            emitAlu(as, ALU_CMP, RAX, RDX);
+            emitExitIf(as, COND_E, offset);
+
+            if (*ip == OP_GET_GLOBAL || *ip == OP_GET_GLOBAL_LONG) {
+                emitPushValue(as, RAX);
+            } else {
+                emitLoad(as, RAX, TOP_REG, -(int32_t)sizeof(Value));
+                emitStore(as, RCX, slot, RAX);
+            }
+            break;
+        }
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_LONG: {
+            size_t slot = *ip == OP_DEFINE_GLOBAL ? readShort(ip + 1) : readLong(ip + 1);
+            emitLoad(as, RCX, VM_REG, (int32_t)offsetof(VM, globalValues));
+            emitAluImm(as, IMM_SUB, TOP_REG, (int32_t)sizeof(Value));
+            emitLoad(as, RAX, TOP_REG, 0);
+            emitStore(as, RCX, slotOffset(slot), RAX);
+            break;
+        }
+        case OP_GET_UPVALUE:
+        case OP_GET_UPVALUE_LONG: {
+            size_t slot = *ip == OP_GET_UPVALUE ? ip[1] : readShort(ip + 1);
+            emitLoad(as, RAX, FRAME_REG, (int32_t)offsetof(CallFrame, closure));
+            emitLoad(as, RAX, RAX, (int32_t)offsetof(ObjClosure, upvalues));
+            emitLoad(as, RAX, RAX, (int32_t)(slot * sizeof(ObjUpvalue *)));
+            emitLoad(as, RAX, RAX, (int32_t)offsetof(ObjUpvalue, location));
+            emitLoad(as, RAX, RAX, 0);
+            emitPushValue(as, RAX);
+            break;
+        }
+        case OP_SET_UPVALUE:
+        case OP_SET_UPVALUE_LONG:
+            emitBeforeHelper(as, next);
+            emitLoadImm(as, RSI, *ip == OP_SET_UPVALUE ? ip[1] : readShort(ip + 1));
+            emitHelper(as, ADDRESS(jitSetUpvalue));
+            break;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_PROPERTY_LONG:
+        case OP_SET_PROPERTY_LONG: {
+            // The long forms widen the name to 24 bits, moving the cache index along
+            bool isLong = *ip == OP_GET_PROPERTY_LONG || *ip == OP_SET_PROPERTY_LONG;
+            size_t name = isLong ? readLong(ip + 1) : ip[1];
+            const uint8_t *cache = ip + (isLong ? 4 : 2);
+
+            emitBeforeHelper(as, next);
+            emitLoadImm(as, RSI,
+                        (uint64_t)(uintptr_t)AS_STRING(chunk->constants.values[name]));
+            emitLoadImm(as, RDX, (uint64_t)(uintptr_t)&chunk->caches[readShort(cache)]);
+            emitHelper(as, *ip == OP_GET_PROPERTY || *ip == OP_GET_PROPERTY_LONG
+                               ? ADDRESS(jitGetProperty)
+                               : ADDRESS(jitSetProperty));
+            break;
+        }
+        case OP_LIST:
+            emitBeforeHelper(as, next);
+            emitLoadImm(as, RSI, ip[1]);
+            emitHelper(as, ADDRESS(jitList));
+            break;
+        case OP_GET_INDEX:
+        case OP_SET_INDEX:
+            emitBeforeHelper(as, next);
+            emitHelper(as, op == OP_GET_INDEX ? ADDRESS(jitGetIndex) : ADDRESS(jitSetIndex));
+            break;
+        case OP_EQUAL: {
+            emitLoad(as, RAX, TOP_REG, -2 * (int32_t)sizeof(Value));
+            emitLoad(as, RCX, TOP_REG, -(int32_t)sizeof(Value));
+
+            // Numbers compare as doubles, everything else by identity
+            size_t notNumber[2];
+            for (int idx = 0; idx < 2; idx++) {
+                emitMove(as, RDX, idx == 0 ? RAX : RCX);
+                emitAlu(as, ALU_AND, RDX, QNAN_REG);
+                emitAlu(as, ALU_CMP, RDX, QNAN_REG);
+                notNumber[idx] = emitJumpIf(as, COND_E);
+            }
+
+            emitToXmm(as, XMM0, RAX);
+            emitToXmm(as, XMM1, RCX);
+            emitCompareXmm(as, XMM0, XMM1);
+            emitSetCondition(as, COND_E, RAX);
+            emitSetCondition(as, COND_NP, RCX);
+            emitRegReg(as, 0, false, 0x20, RCX, RAX);
+            size_t done = emitJump(as);
+
+            patchHere(as, notNumber[0]);
+            patchHere(as, notNumber[1]);
+            emitAlu(as, ALU_CMP, RAX, RCX);
+            size_t same = emitJumpIf(as, COND_E);
+
+            // Distinct ropes may hold equal text, the stack interpreter
+            // flattens them
+            emitLoadImm(as, RSI, SIGN_BIT | QNAN);
+            for (int idx = 0; idx < 2; idx++) {
+                emitMove(as, RDX, idx == 0 ? RAX : RCX);
+                emitAlu(as, ALU_AND, RDX, RSI);
+                emitAlu(as, ALU_CMP, RDX, RSI);
+                size_t notObject = emitJumpIf(as, COND_NE);
+
+                // cmp byte [obj + type], OBJ_ROPE
+                emitMove(as, RDX, idx == 0 ? RAX : RCX);
+                emitAlu(as, ALU_XOR, RDX, RSI);
+                emitRegMem(as, 0, false, 0x80, 7, RDX, (int32_t)offsetof(Obj, type));
+                emitByte(as, OBJ_ROPE);
+                emitExitIf(as, COND_E, offset);
+                patchHere(as, notObject);
+            }
+
+            emitAlu(as, ALU_CMP, RAX, RCX);
+            patchHere(as, same);
+            emitSetCondition(as, COND_E, RAX);
+
+            patchHere(as, done);
+            emitBoolean(as);
+            emitBinaryResult(as);
+            break;
+        }
+        case OP_GREATER:
+        case OP_LESS:
+            // Unordered compares clear `above', so NaN operands yield false
+            emitNumberOperands(as, offset);
+            if (op == OP_GREATER) {
+                emitCompareXmm(as, XMM0, XMM1);
+            } else {
+                emitCompareXmm(as, XMM1, XMM0);
+            }
+            emitSetCondition(as, COND_A, RAX);
+            emitBoolean(as);
+            emitBinaryResult(as);
+            break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE: {
+            // Strings and type errors are left to the stack interpreter
+            static const uint8_t arithmetic[] = {
+                [OP_ADD] = 0x58,
+                [OP_SUBTRACT] = 0x5c,
+                [OP_MULTIPLY] = 0x59,
+                [OP_DIVIDE] = 0x5e,
+            };
+
+            emitNumberOperands(as, offset);
+            emitRegReg(as, 0xf2, false, ESC(arithmetic[op]), XMM0, XMM1);
+            emitFromXmm(as, RAX, XMM0);
+            emitBinaryResult(as);
+            break;
+        }
+        case OP_NOT:
+            emitLoad(as, RAX, TOP_REG, -(int32_t)sizeof(Value));
+            emitTestFalsey(as, RAX);
+            emitSetCondition(as, COND_BE, RAX);
+            emitBoolean(as);
+            emitStore(as, TOP_REG, -(int32_t)sizeof(Value), RAX);
+            break;
+        case OP_NEGATE:
+            emitLoad(as, RAX, TOP_REG, -(int32_t)sizeof(Value));
+            emitGuardNumber(as, RAX, offset);
+            // btc rax, 63
+            emitRegReg(as, 0, true, ESC(0xba), 7, RAX);
+            emitByte(as, 63);
+            emitStore(as, TOP_REG, -(int32_t)sizeof(Value), RAX);
+            break;
+        case OP_PRINT:
+            // Printing a rope flattens it, which allocates
+            emitBeforeHelper(as, next);
+            emitHelper(as, ADDRESS(jitPrint));
+            break;
+        case OP_JUMP:
+            emitBranch(as, emitJump(as), next + readShort(ip + 1));
+            break;
+        case OP_JUMP_LONG:
+            emitBranch(as, emitJump(as), next + readLong(ip + 1));
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP_IF_FALSE_LONG:
+        case OP_JUMP_IF_TRUE_LONG: {
+            bool ifFalse = *ip == OP_JUMP_IF_FALSE || *ip == OP_JUMP_IF_FALSE_LONG;
+            bool isLong = *ip == OP_JUMP_IF_FALSE_LONG || *ip == OP_JUMP_IF_TRUE_LONG;
+            emitLoad(as, RAX, TOP_REG, -(int32_t)sizeof(Value));
+            emitTestFalsey(as, RAX);
+            emitBranch(as, emitJumpIf(as, ifFalse ? COND_BE : COND_A),
+                       next + (isLong ? readLong(ip + 1) : readShort(ip + 1)));
+            break;
+        }
+        case OP_LOOP:
+        case OP_LOOP_LONG:
+            // cmp byte [vm + heapExhausted], 0, the stack interpreter raises it
+            emitRegMem(as, 0, false, 0x80, 7, VM_REG,
+                       (int32_t)offsetof(VM, heapExhausted));
+            emitByte(as, 0);
+            emitExitIf(as, COND_NE, offset);
+            emitBranch(as, emitJump(as),
+                       next - (*ip == OP_LOOP ? readShort(ip + 1) : readLong(ip + 1)));
+            break;
+        case OP_CALL:
+            emitBeforeHelper(as, next);
+            emitLoadImm(as, RSI, ip[1]);
+            emitHelper(as, ADDRESS(jitCall));
+            break;
+        case OP_INVOKE:
+        case OP_INVOKE_LONG: {
+            size_t name = *ip == OP_INVOKE ? ip[1] : readLong(ip + 1);
+            const uint8_t *operands = ip + (*ip == OP_INVOKE ? 2 : 4);
+
+            emitBeforeHelper(as, next);
+            emitLoadImm(as, RSI,
+                        (uint64_t)(uintptr_t)AS_STRING(chunk->constants.values[name]));
+            emitLoadImm(as, RDX, operands[0]);
+            emitLoadImm(as, RCX,
+                        (uint64_t)(uintptr_t)&chunk->caches[readShort(operands + 1)]);
+            emitHelper(as, ADDRESS(jitInvoke));
+            break;
+        }
+        case OP_CLOSE_UPVALUE:
+            emitBeforeHelper(as, next);
+            emitHelper(as, ADDRESS(jitCloseUpvalue));
+            break;
+        case OP_RETURN:
+            // Always leaves, the caller resumes in whichever tier runs it
+            emitBeforeHelper(as, next);
+            emitHelper(as, ADDRESS(jitReturn));
+            break;
+        case OP_ADD_LOCAL_CONST:
+        case OP_INCREMENT_LOCAL:
+            emitLoad(as, RAX, SLOTS_REG, slotOffset(ip[1]));
+            emitGuardNumber(as, RAX, offset);
+            emitLoadImm(as, RCX, chunk->constants.values[ip[2]]);
+            emitToXmm(as, XMM0, RAX);
+            emitToXmm(as, XMM1, RCX);
+            emitRegReg(as, 0xf2, false, ESC(0x58), XMM0, XMM1);
+            emitFromXmm(as, RAX, XMM0);
+
+            if (*ip == OP_ADD_LOCAL_CONST) {
+                emitPushValue(as, RAX);
+            } else {
+                emitStore(as, SLOTS_REG, slotOffset(ip[1]), RAX);
+            }
+            break;
+        case OP_LESS_LOCAL_LOCAL_JUMP:
+            emitLoad(as, RAX, SLOTS_REG, slotOffset(ip[1]));
+            emitLoad(as, RCX, SLOTS_REG, slotOffset(ip[2]));
+            emitGuardNumber(as, RAX, offset);
+            emitGuardNumber(as, RCX, offset);
+            emitToXmm(as, XMM0, RAX);
+            emitToXmm(as, XMM1, RCX);
+            // Jumps unless b > a, unordered operands included
+            emitCompareXmm(as, XMM1, XMM0);
+            emitBranch(as, emitJumpIf(as, COND_BE), next + readShort(ip + 3));
+            break;
+        default:
+            // Closures, classes and super calls always run on the interpreter
+            addFixup(as, emitJump(as), offset, true);
+            break;
+    }
+}
+
+/**
+ * @brief Emits the side exit stubs and resolves the remaining jumps.
+ */
+static void finishCode(Assembler *as) {
+    size_t stub = 0;
+    size_t stubTarget = SIZE_MAX;
+
+    for (size_t idx = 0; idx < as->fixupCount; idx++) {
+        CodeFixup *fixup = &as->fixups[idx];
+
+        if (!fixup->exit) {
+            patchJump(as, fixup->at, as->entries[fixup->target]);
+            continue;
+        }
+
+        // Exits are recorded in bytecode order, consecutive ones share a stub
+        if (fixup->target != stubTarget) {
+            stub = as->count;
+            stubTarget = fixup->target;
+            emitSyncIp(as, fixup->target);
+            emitLoadImm(as, RAX, JIT_DEOPT);
+            patchJump(as, emitJump(as), as->epilogue);
+        }
+
+        patchJump(as, fixup->at, stub);
+    }
+}
+
+bool jitCompile(VM *vm, Compiler *compiler, Chunk *chunk, JitCode *jit) {
+    Assembler as;
+    as.vm = vm;
+    as.compiler = compiler;
+    as.chunk = chunk;
+    as.code = NULL;
+    as.count = 0;
+    as.capacity = 0;
+    as.fixups = NULL;
+    as.fixupCount = 0;
+    as.fixupCapacity = 0;
+    as.entries = ALLOCATE(vm, compiler, uint32_t, chunk->count);
+
+    for (size_t offset = 0; offset < chunk->count; offset++) {
+        as.entries[offset] = JIT_NO_ENTRY;
+    }
+
+    emitPrologue(&as);
+
+    for (size_t offset = 0; offset < chunk->count;
+         offset += instructionLength(chunk, offset)) {
+        as.entries[offset] = (uint32_t)as.count;
+        emitTemplate(&as, offset);
+    }
+
+    finishCode(&as);
+
+    // Mapped writable first and only made executable once complete
+    void *code = mmap(NULL, as.count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    bool mapped = code != MAP_FAILED;
+
+    if (mapped) {
+        memcpy(code, as.code, as.count);
+        mapped = mprotect(code, as.count, PROT_READ | PROT_EXEC) == 0;
+
+        if (!mapped) {
+            munmap(code, as.count);
+        }
+    }
+
+    if (mapped) {
+        jit->code = code;
+        jit->size = as.count;
+        jit->entries = as.entries;
+        jit->entryCount = chunk->count;
+    } else {
+        FREE_ARRAY(vm, compiler, uint32_t, as.entries, chunk->count);
+        jit->failed = true;
+    }
+
+    FREE_ARRAY(vm, compiler, uint8_t, as.code, as.capacity);
+    FREE_ARRAY(vm, compiler, CodeFixup, as.fixups, as.fixupCapacity);
+
+    return mapped;
+}
+
+JitStatus jitEnter(VM *vm) {
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    ObjFunction *func = frame->closure->func;
+    uint32_t entry = func->jit.entries[frame->ip - func->chunk.code];
+
+    if (entry == JIT_NO_ENTRY) {
+        return JIT_DEOPT;
+    }
+
+    // ISO C has no conversion from object to function pointers
+    JitFn code;
+    memcpy(&code, &func->jit.code, sizeof(code));
+
+    return code(vm, frame, func->jit.code + entry);
+}
+
+#else
+bool jitCompile(VM *vm, Compiler *compiler, Chunk *chunk, JitCode *jit) {
+    jit->failed = true;
+    return false;
+}
+
+JitStatus jitEnter(VM *vm) { return JIT_DEOPT; }
+#endif // CLOX_JIT && NAN_BOXING && __x86_64__
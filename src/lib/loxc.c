@@ -0,0 +1,747 @@
+// POSIX file and mapping functions aren't part of strict C99 headers
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "hash.h"
+#include "loxc.h"
+#include "memory.h"
+#include "object.h"
+#include "regvm.h"
+#include "value.h"
+#include "vm.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define LOXC_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief "LOXC" as a little endian word, files of the other byte order don't
+ * match.
+ */
+#define LOXC_MAGIC 0x43584f4c
+
+/**
+ * @brief Header flag set when the bytecode went through the optimizer.
+ */
+#define LOXC_OPTIMIZED 1
+
+/**
+ * @brief String length marking a missing name.
+ */
+#define LOXC_NO_STRING UINT32_MAX
+
+/**
+ * @brief Start of a cache file.
+ *
+ * @details The names of the global slots referenced by the bytecode follow,
+ * in slot order, and then the script function. `wordSize` guards the line
+ * tables, which are stored as laid out in memory. `payloadHash` is the
+ * `hashChars()` of everything after the header, the operand checks keep a
+ * damaged file from reaching outside the script but not from running it
+ * differently.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t wordSize;
+    uint32_t flags;
+    uint64_t sourceHash;
+    uint64_t sourceLength;
+    uint64_t globalCount;
+    uint64_t payloadHash;
+} LoxcHeader;
+
+/**
+ * @brief Start of a serialized function.
+ *
+ * @details Followed by its name, its code, its line table aligned to 8 bytes
+ * and its constants. Nested functions are serialized in place of the constant
+ * referring to them.
+ */
+typedef struct {
+    uint32_t arity;
+    uint32_t upvalueCount;
+    uint32_t constantCount;
+    uint32_t cacheCount;
+    uint64_t codeCount;
+    uint64_t lineCount;
+} LoxcFunction;
+
+/**
+ * @brief Type of a serialized constant.
+ */
+typedef enum {
+    LOXC_NUMBER,
+    LOXC_STRING,
+    LOXC_FUNCTION,
+} LoxcConstant;
+
+/**
+ * @brief Cache file contents being built.
+ *
+ * @details `ok` is cleared when a function holds something that can't be
+ * serialized.
+ */
+typedef struct {
+    VM *vm;
+    uint8_t *bytes;
+    size_t count;
+    size_t capacity;
+    bool ok;
+} Writer;
+
+/**
+ * @brief Position in a cache file being loaded.
+ *
+ * @details `ok` is cleared once anything doesn't check out, any read after
+ * that yields nothing.
+ */
+typedef struct {
+    VM *vm;
+    uint8_t *data;
+    size_t size;
+    size_t offset;
+    bool ok;
+} Reader;
+
+static uint32_t currentFlags(VM *vm) { return vm->optimize ? LOXC_OPTIMIZED : 0; }
+
+char *loxcPath(const char *path, const char *cacheDir, const char *source) {
+    char *result;
+
+    if (cacheDir == NULL) {
+        size_t length = strlen(path);
+        bool isLox = length >= 4 && strcmp(path + length - 4, ".lox") == 0;
+        result = (char *)malloc(length + (isLox ? 2 : 6));
+
+        if (result != NULL) {
+            sprintf(result, isLox ? "%sc" : "%s.loxc", path);
+        }
+    } else {
+        uint64_t hash = hashChars(source, strlen(source));
+        result = (char *)malloc(strlen(cacheDir) + 23);
+
+        if (result != NULL) {
+            sprintf(result, "%s/%016llx.loxc", cacheDir, (unsigned long long)hash);
+        }
+    }
+
+    return result;
+}
+
+static void writeBytes(Writer *writer, const void *bytes, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    if (writer->capacity < writer->count + size) {
+        size_t oldCapacity = writer->capacity;
+
+        while (writer->capacity < writer->count + size) {
+            writer->capacity = GROW_CAPACITY(writer->capacity);
+        }
+
+        writer->bytes = GROW_ARRAY(writer->vm, NULL, uint8_t, writer->bytes, oldCapacity,
+                                   writer->capacity);
+    }
+
+    memcpy(writer->bytes + writer->count, bytes, size);
+    writer->count += size;
+}
+
+static void writeU32(Writer *writer, uint32_t value) {
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeAlign(Writer *writer) {
+    static const uint8_t padding[8] = {0};
+    writeBytes(writer, padding, (8 - writer->count % 8) % 8);
+}
+
+static void writeString(Writer *writer, ObjString *string) {
+    if (string == NULL) {
+        writeU32(writer, LOXC_NO_STRING);
+        return;
+    }
+
+    writeU32(writer, (uint32_t)string->length);
+    writeBytes(writer, string->chars, string->length);
+}
+
+static void writeFunction(Writer *writer, ObjFunction *func) {
+    Chunk *chunk = &func->chunk;
+    LoxcFunction header = {
+        .arity = func->arity,
+        .upvalueCount = (uint32_t)func->upvalueCount,
+        .constantCount = (uint32_t)chunk->constants.count,
+        .cacheCount = (uint32_t)chunk->cacheCount,
+        .codeCount = chunk->count,
+        .lineCount = chunk->lineCount,
+    };
+
+    writeBytes(writer, &header, sizeof(header));
+    writeString(writer, func->name);
+    writeBytes(writer, chunk->code, chunk->count);
+    writeAlign(writer);
+    writeBytes(writer, chunk->lines, chunk->lineCount * sizeof(LineStart));
+
+    for (size_t idx = 0; idx < chunk->constants.count; idx++) {
+        Value constant = chunk->constants.values[idx];
+
+        if (IS_NUMBER(constant)) {
+            double number = AS_NUMBER(constant);
+            writeU32(writer, LOXC_NUMBER);
+            writeBytes(writer, &number, sizeof(number));
+        } else if (IS_STRING(constant)) {
+            writeU32(writer, LOXC_STRING);
+            writeString(writer, AS_STRING(constant));
+        } else if (IS_FUNCTION(constant)) {
+            writeU32(writer, LOXC_FUNCTION);
+            writeFunction(writer, AS_FUNCTION(constant));
+        } else {
+            writer->ok = false;
+        }
+    }
+}
+
+/**
+ * @brief Creates a temporary file next to `cachePath` for writing, storing
+ * its path in `tempPath`.
+ *
+ * @details The name is unique where `mkstemp()` is available, so VMs writing
+ * the same cache concurrently don't write into each other's file.
+ */
+static FILE *openTemp(char *tempPath, const char *cachePath) {
+#ifdef LOXC_MMAP
+    sprintf(tempPath, "%s.XXXXXX", cachePath);
+    int fd = mkstemp(tempPath);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    fchmod(fd, 0644);
+    FILE *file = fdopen(fd, "wb");
+
+    if (file == NULL) {
+        close(fd);
+        remove(tempPath);
+    }
+
+    return file;
+#else
+    sprintf(tempPath, "%s.tmp", cachePath);
+    return fopen(tempPath, "wb");
+#endif // LOXC_MMAP
+}
+
+/**
+ * @brief Writes the cache file of a freshly compiled script, going through a
+ * temporary file so readers never see a partial cache.
+ */
+static void writeCache(VM *vm, const char *cachePath, const char *source,
+                       ObjFunction *script) {
+    Writer writer = {vm, NULL, 0, 0, true};
+    size_t length = strlen(source);
+    LoxcHeader header = {
+        .magic = LOXC_MAGIC,
+        .version = LOXC_VERSION,
+        .wordSize = sizeof(size_t),
+        .flags = currentFlags(vm),
+        .sourceHash = hashChars(source, length),
+        .sourceLength = length,
+        .globalCount = vm->globalCount,
+    };
+
+    // The script isn't reachable from anywhere else until it runs
+    push(vm, OBJ_VAL(script));
+
+    writeBytes(&writer, &header, sizeof(header));
+
+    for (size_t idx = 0; idx < vm->globalCount; idx++) {
+        writeString(&writer, vm->globalNames[idx]);
+    }
+
+    writeFunction(&writer, script);
+    pop(vm);
+
+    if (writer.ok) {
+        header.payloadHash = hashChars((const char *)writer.bytes + sizeof(header),
+                                       writer.count - sizeof(header));
+        memcpy(writer.bytes, &header, sizeof(header));
+    }
+
+    char *tempPath = (char *)malloc(strlen(cachePath) + 8);
+
+    if (writer.ok && tempPath != NULL) {
+        FILE *file = openTemp(tempPath, cachePath);
+
+        if (file != NULL) {
+            bool written = fwrite(writer.bytes, 1, writer.count, file) == writer.count;
+            written = fclose(file) == 0 && written;
+
+            if (!written || rename(tempPath, cachePath) != 0) {
+                remove(tempPath);
+            }
+        }
+    }
+
+    free(tempPath);
+    FREE_ARRAY(vm, NULL, uint8_t, writer.bytes, writer.capacity);
+}
+
+static void *readBytes(Reader *reader, size_t size) {
+    if (!reader->ok || reader->size - reader->offset < size) {
+        reader->ok = false;
+        return NULL;
+    }
+
+    void *bytes = reader->data + reader->offset;
+    reader->offset += size;
+    return bytes;
+}
+
+static uint32_t readU32(Reader *reader) {
+    uint32_t value = 0;
+    const void *bytes = readBytes(reader, sizeof(value));
+
+    if (bytes != NULL) {
+        memcpy(&value, bytes, sizeof(value));
+    }
+
+    return value;
+}
+
+static void readAlign(Reader *reader) { readBytes(reader, (8 - reader->offset % 8) % 8); }
+
+/**
+ * @brief Interns a string of the file.
+ *
+ * @returns the string, NULL for a missing name or if the file is broken
+ */
+static ObjString *readString(Reader *reader) {
+    uint32_t length = readU32(reader);
+
+    if (length == LOXC_NO_STRING) {
+        return NULL;
+    }
+
+    const char *chars = (const char *)readBytes(reader, length);
+    return chars == NULL ? NULL : copyString(reader->vm, NULL, length, chars);
+}
+
+static size_t operandShort(const uint8_t *code) {
+    return (size_t)((code[0] << 8) | code[1]);
+}
+
+static size_t operandLong(const uint8_t *code) {
+    return (size_t)((code[0] << 16) | (code[1] << 8) | code[2]);
+}
+
+static bool nameConstant(Chunk *chunk, size_t index) {
+    return index < chunk->constants.count && IS_STRING(chunk->constants.values[index]);
+}
+
+static bool numberConstant(Chunk *chunk, size_t index) {
+    return index < chunk->constants.count && IS_NUMBER(chunk->constants.values[index]);
+}
+
+static bool jumpTarget(Chunk *chunk, const bool *starts, size_t target) {
+    return target < chunk->count && starts[target];
+}
+
+/**
+ * @brief Checks the operands of the instruction at `offset` refer to what
+ * exists: constants of the kind used, global slots, slots of the frame,
+ * upvalues, inline caches and the starts of instructions to jump to.
+ */
+static bool validOperands(VM *vm, ObjFunction *func, const bool *starts, size_t offset) {
+    Chunk *chunk = &func->chunk;
+    const uint8_t *code = &chunk->code[offset];
+    size_t next = offset + instructionLength(chunk, offset);
+
+    switch ((OpCode)code[0]) {
+        case OP_CONSTANT:
+            return code[1] < chunk->constants.count;
+        case OP_CONSTANT_LONG:
+            return operandLong(code + 1) < chunk->constants.count;
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+            return code[1] < func->stackSize;
+        case OP_GET_LOCAL_LONG:
+        case OP_SET_LOCAL_LONG:
+            return operandShort(code + 1) < func->stackSize;
+        case OP_GET_LOCAL_0:
+        case OP_GET_LOCAL_1:
+        case OP_GET_LOCAL_2:
+        case OP_GET_LOCAL_3:
+            return (size_t)(code[0] - OP_GET_LOCAL_0) < func->stackSize;
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+            return operandShort(code + 1) < vm->globalCount;
+        case OP_GET_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG:
+            return operandLong(code + 1) < vm->globalCount;
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+            return code[1] < func->upvalueCount;
+        case OP_GET_UPVALUE_LONG:
+        case OP_SET_UPVALUE_LONG:
+            return operandShort(code + 1) < func->upvalueCount;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            return nameConstant(chunk, code[1]) &&
+                   operandShort(code + 2) < chunk->cacheCount;
+        case OP_GET_PROPERTY_LONG:
+        case OP_SET_PROPERTY_LONG:
+            return nameConstant(chunk, operandLong(code + 1)) &&
+                   operandShort(code + 4) < chunk->cacheCount;
+        case OP_INVOKE:
+            return nameConstant(chunk, code[1]) &&
+                   operandShort(code + 3) < chunk->cacheCount;
+        case OP_INVOKE_LONG:
+            return nameConstant(chunk, operandLong(code + 1)) &&
+                   operandShort(code + 5) < chunk->cacheCount;
+        case OP_GET_SUPER:
+        case OP_SUPER_INVOKE:
+        case OP_CLASS:
+        case OP_METHOD:
+            return nameConstant(chunk, code[1]);
+        case OP_GET_SUPER_LONG:
+        case OP_SUPER_INVOKE_LONG:
+        case OP_CLASS_LONG:
+        case OP_METHOD_LONG:
+            return nameConstant(chunk, operandLong(code + 1));
+        case OP_ADD_LOCAL_CONST:
+        case OP_INCREMENT_LOCAL:
+            return code[1] < func->stackSize && numberConstant(chunk, code[2]);
+        case OP_LESS_LOCAL_LOCAL_JUMP:
+            return code[1] < func->stackSize && code[2] < func->stackSize &&
+                   jumpTarget(chunk, starts, next + operandShort(code + 3));
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            return jumpTarget(chunk, starts, next + operandShort(code + 1));
+        case OP_JUMP_LONG:
+        case OP_JUMP_IF_FALSE_LONG:
+        case OP_JUMP_IF_TRUE_LONG:
+            return jumpTarget(chunk, starts, next + operandLong(code + 1));
+        case OP_LOOP:
+            return operandShort(code + 1) <= next &&
+                   jumpTarget(chunk, starts, next - operandShort(code + 1));
+        case OP_LOOP_LONG:
+            return operandLong(code + 1) <= next &&
+                   jumpTarget(chunk, starts, next - operandLong(code + 1));
+        case OP_CLOSURE:
+        case OP_CLOSURE_LONG:
+            // Captures a slot of this frame or one of its own upvalues
+            for (const uint8_t *capture = code + (code[0] == OP_CLOSURE ? 2 : 4);
+                 capture < chunk->code + next; capture += 3) {
+                size_t limit = capture[0] ? func->stackSize : func->upvalueCount;
+
+                if (capture[0] > 1 || operandShort(capture + 1) >= limit) {
+                    return false;
+                }
+            }
+
+            return true;
+        default:
+            return true;
+    }
+}
+
+/**
+ * @brief Checks the loaded code decodes into whole, known instructions whose
+ * operands are in range, setting the stack size of `func` on the way.
+ */
+static bool validCode(VM *vm, ObjFunction *func) {
+    Chunk *chunk = &func->chunk;
+
+    if (chunk->count == 0) {
+        return false;
+    }
+
+    bool *starts = ALLOCATE(vm, NULL, bool, chunk->count);
+    memset(starts, 0, chunk->count * sizeof(bool));
+    size_t offset = 0;
+    bool valid = true;
+
+    while (offset < chunk->count && valid) {
+        uint8_t op = chunk->code[offset];
+
+        // The length of a closure depends on the function it refers to
+        valid = op <= OP_LESS_LOCAL_LOCAL_JUMP;
+
+        if (valid && (op == OP_CLOSURE || op == OP_CLOSURE_LONG)) {
+            bool isLong = op == OP_CLOSURE_LONG;
+            size_t constant = SIZE_MAX;
+
+            if (offset + (isLong ? 3 : 1) < chunk->count) {
+                constant = isLong ? operandLong(&chunk->code[offset + 1])
+                                  : chunk->code[offset + 1];
+            }
+
+            valid = constant < chunk->constants.count &&
+                    IS_FUNCTION(chunk->constants.values[constant]);
+        }
+
+        if (valid) {
+            starts[offset] = true;
+            offset += instructionLength(chunk, offset);
+        }
+    }
+
+    valid = valid && offset == chunk->count;
+
+    // Frame slots are bounded by the stack the code needs, which takes whole
+    // instructions to work out
+    if (valid) {
+        func->stackSize = stackDepth(vm, NULL, chunk, func->arity);
+        valid = func->stackSize > 0;
+    }
+
+    for (offset = 0; offset < chunk->count && valid;
+         offset += instructionLength(chunk, offset)) {
+        valid = validOperands(vm, func, starts, offset);
+    }
+
+    FREE_ARRAY(vm, NULL, bool, starts, chunk->count);
+    return valid;
+}
+
+static ObjFunction *readFunction(Reader *reader) {
+    VM *vm = reader->vm;
+    LoxcFunction header;
+    const void *bytes = readBytes(reader, sizeof(header));
+
+    if (bytes == NULL) {
+        return NULL;
+    }
+
+    memcpy(&header, bytes, sizeof(header));
+
+    ObjFunction *func = newFunction(vm, NULL);
+    push(vm, OBJ_VAL(func));
+
+    func->arity = (uint8_t)header.arity;
+    func->upvalueCount = header.upvalueCount;
+    func->name = readString(reader);
+    writeBarrierObject(vm, (Obj *)func->name);
+
+    // Code and lines stay in the file, the chunk only borrows them
+    Chunk *chunk = &func->chunk;
+    chunk->code = (uint8_t *)readBytes(reader, header.codeCount);
+    chunk->count = reader->ok ? header.codeCount : 0;
+    readAlign(reader);
+    chunk->lines = (LineStart *)readBytes(reader, header.lineCount * sizeof(LineStart));
+    chunk->lineCount = reader->ok ? header.lineCount : 0;
+
+    for (uint32_t idx = 0; idx < header.constantCount && reader->ok; idx++) {
+        Value constant = NIL_VAL;
+
+        switch (readU32(reader)) {
+            case LOXC_NUMBER: {
+                double number = 0;
+                bytes = readBytes(reader, sizeof(number));
+
+                if (bytes != NULL) {
+                    memcpy(&number, bytes, sizeof(number));
+                }
+
+                constant = NUMBER_VAL(number);
+                break;
+            }
+            case LOXC_STRING: {
+                ObjString *string = readString(reader);
+                reader->ok = reader->ok && string != NULL;
+                constant = string == NULL ? NIL_VAL : OBJ_VAL(string);
+                break;
+            }
+            case LOXC_FUNCTION: {
+                ObjFunction *nested = readFunction(reader);
+                constant = nested == NULL ? NIL_VAL : OBJ_VAL(nested);
+                break;
+            }
+            default:
+                reader->ok = false;
+                break;
+        }
+
+        addConstant(vm, NULL, chunk, constant);
+    }
+
+    // Every cache belongs to an instruction longer than a byte
+    reader->ok = reader->ok && header.cacheCount <= header.codeCount;
+
+    for (uint32_t idx = 0; idx < header.cacheCount && reader->ok; idx++) {
+        addInlineCache(vm, NULL, chunk);
+    }
+
+    reader->ok = reader->ok && validCode(vm, func);
+
+#ifdef CLOX_REGISTER_VM
+    if (reader->ok && vm->registerVM) {
+        translateChunk(vm, NULL, chunk, func->arity, &func->reg);
+    }
+#endif // CLOX_REGISTER_VM
+
+    pop(vm);
+    return reader->ok ? func : NULL;
+}
+
+static bool loadFile(const char *path, MappedFile *file) {
+#ifdef LOXC_MMAP
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(LoxcHeader)) {
+        file->size = (size_t)st.st_size;
+        data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    // The mapping outlives the descriptor
+    close(fd);
+
+    file->data = data;
+    file->mapped = true;
+    return data != MAP_FAILED;
+#else
+    FILE *handle = fopen(path, "rb");
+
+    if (handle == NULL) {
+        return false;
+    }
+
+    fseek(handle, 0, SEEK_END);
+    file->size = (size_t)ftell(handle);
+    rewind(handle);
+    file->data = malloc(file->size);
+    file->mapped = false;
+
+    bool read = file->data != NULL && file->size >= sizeof(LoxcHeader) &&
+                fread(file->data, 1, file->size, handle) == file->size;
+    fclose(handle);
+
+    if (!read) {
+        free(file->data);
+    }
+
+    return read;
+#endif // LOXC_MMAP
+}
+
+static void unloadFile(MappedFile *file) {
+#ifdef LOXC_MMAP
+    if (file->mapped) {
+        munmap(file->data, file->size);
+        return;
+    }
+#endif // LOXC_MMAP
+
+    free(file->data);
+}
+
+/**
+ * @brief Loads the script from its cache file.
+ *
+ * @returns the script function or NULL if there is no usable cache
+ */
+static ObjFunction *loadCache(VM *vm, const char *cachePath, const char *source) {
+    MappedFile file;
+
+    if (!loadFile(cachePath, &file)) {
+        return NULL;
+    }
+
+    Reader reader = {vm, (uint8_t *)file.data, file.size, 0, true};
+    size_t length = strlen(source);
+    LoxcHeader header;
+    memcpy(&header, readBytes(&reader, sizeof(header)), sizeof(header));
+
+    reader.ok = header.magic == LOXC_MAGIC && header.version == LOXC_VERSION &&
+                header.wordSize == sizeof(size_t) && header.flags == currentFlags(vm) &&
+                header.sourceLength == length &&
+                header.sourceHash == hashChars(source, length) &&
+                header.payloadHash == hashChars((const char *)file.data + sizeof(header),
+                                                file.size - sizeof(header));
+
+    // Global slots are baked into the code, they must come out the same
+    for (uint64_t idx = 0; idx < header.globalCount && reader.ok; idx++) {
+        ObjString *name = readString(&reader);
+
+        if (name != NULL) {
+            push(vm, OBJ_VAL(name));
+            reader.ok = globalSlot(vm, NULL, name) == idx;
+            pop(vm);
+        } else {
+            reader.ok = false;
+        }
+    }
+
+    ObjFunction *script = reader.ok ? readFunction(&reader) : NULL;
+
+    // Upvalues of the functions within are bounded by the closures creating
+    // them, the script has nothing to capture
+    if (script == NULL || script->upvalueCount != 0) {
+        unloadFile(&file);
+        return NULL;
+    }
+
+    if (vm->mappedCapacity < vm->mappedCount + 1) {
+        push(vm, OBJ_VAL(script));
+        size_t oldCapacity = vm->mappedCapacity;
+        vm->mappedCapacity = GROW_CAPACITY(oldCapacity);
+        vm->mappedFiles = GROW_ARRAY(vm, NULL, MappedFile, vm->mappedFiles, oldCapacity,
+                                     vm->mappedCapacity);
+        pop(vm);
+    }
+
+    vm->mappedFiles[vm->mappedCount++] = file;
+    return script;
+}
+
+InterpreterResult interpretCached(VM *vm, Scanner *scanner, const char *source,
+                                  const char *cachePath) {
+    ObjFunction *script = loadCache(vm, cachePath, source);
+
+    if (script == NULL) {
+        script = compile(scanner, source, vm);
+
+        if (script == NULL) {
+            return INTERPRETER_COMPILE_ERR;
+        }
+
+        writeCache(vm, cachePath, source, script);
+    }
+
+    return interpretFunction(vm, script);
+}
+
+void freeMappedFiles(VM *vm, Compiler *compiler) {
+    for (size_t idx = 0; idx < vm->mappedCount; idx++) {
+        unloadFile(&vm->mappedFiles[idx]);
+    }
+
+    FREE_ARRAY(vm, compiler, MappedFile, vm->mappedFiles, vm->mappedCapacity);
+    vm->mappedFiles = NULL;
+    vm->mappedCount = 0;
+    vm->mappedCapacity = 0;
+}
@@ -1,31 +1,82 @@
+// POSIX clocks aren't part of strict C99 headers
+#define _DEFAULT_SOURCE
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "chunk.h"
 #include "compiler.h"
+#include "image.h"
+#include "jit.h"
 #include "memory.h"
 #include "object.h"
+#include "pool.h"
+#include "regvm.h"
 #include "table.h"
 #include "value.h"
 
 #ifdef DEBUG_LOG_GC
 #include "debug.h"
-#include <stdio.h>
 #endif // DEBUG_LOG_GC
 
-#define GC_HEAP_GROW_FACTOR 2
+#ifdef PARALLEL_MARK
+#include <pthread.h>
+#endif // PARALLEL_MARK
 
-void *reallocate(VM *vm, Compiler *compiler, void *pointer, size_t oldSize,
-                 size_t newSize) {
-    vm->bytesAllocated += newSize - oldSize;
+// Bounds of the growth factor adapted to `gcTargetRatio`
+#define GC_GROW_MIN 1.25
+#define GC_GROW_MAX 16.0
 
-    if (newSize > oldSize) {
+// Grey objects of one thread taking part in a parallel mark, see
+// `traceParallel()'. Tracing on the VM's own grey stack passes NULL.
+typedef struct Marker Marker;
+
+static void collectIfNeeded(VM *vm, Compiler *compiler) {
 #ifdef DEBUG_STRESS_GC
+    if (vm->gcIncremental) {
+        stepGarbage(vm, compiler);
+    } else {
         collectGarbage(vm, compiler);
+    }
 #else
-        if (vm->bytesAllocated > vm->nextGC) {
-            collectGarbage(vm, compiler);
+    if (vm->gcIncremental) {
+        if (vm->gcPhase != GC_IDLE || vm->bytesAllocated > vm->nextGC) {
+            stepGarbage(vm, compiler);
         }
+    } else if (vm->bytesAllocated > vm->nextGC) {
+        collectGarbage(vm, compiler);
+    }
 #endif // DEBUG_STRESS_GC
+
+    // Only give up on the limit once a full collection couldn't get back under
+    // it, the script is failed at its next safepoint.
+    if (vm->heapLimit > 0 && vm->bytesAllocated > vm->heapLimit && !vm->heapExhausted) {
+        collectGarbage(vm, compiler);
+        vm->heapExhausted = vm->bytesAllocated > vm->heapLimit;
+    }
+}
+
+void outOfMemory(VM *vm) {
+    vm->heapExhausted = true;
+
+    if (vm->outOfMemory != NULL) {
+        longjmp(*vm->outOfMemory, 1);
+    }
+
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+}
+
+void *reallocate(VM *vm, Compiler *compiler, void *pointer, size_t oldSize,
+                 size_t newSize) {
+    vm->bytesAllocated += newSize - oldSize;
+
+    if (newSize > oldSize) {
+        collectIfNeeded(vm, compiler);
     }
 
     if (newSize == 0) {
@@ -33,15 +84,67 @@ void *reallocate(VM *vm, Compiler *compiler, void *pointer, size_t oldSize,
         return NULL;
     }
 
+    // Past the limit already, a growth bigger than the whole limit fails now
+    // rather than at the next safepoint
+    if (vm->heapExhausted && newSize - oldSize > vm->heapLimit) {
+        vm->bytesAllocated -= newSize - oldSize;
+        outOfMemory(vm);
+    }
+
     void *result = realloc(pointer, newSize);
 
     if (result == NULL) {
-        exit(1);
+        // Give the system back whatever is garbage and try once more
+        collectGarbage(vm, compiler);
+        result = realloc(pointer, newSize);
+    }
+
+    if (result == NULL) {
+        vm->bytesAllocated -= newSize - oldSize;
+        outOfMemory(vm);
     }
 
     return result;
 }
 
+void *allocateObjectMemory(VM *vm, Compiler *compiler, size_t size) {
+#ifdef CLOX_POOL_ALLOCATOR
+    vm->bytesAllocated += size;
+    collectIfNeeded(vm, compiler);
+
+    if (vm->heapExhausted && size > vm->heapLimit) {
+        vm->bytesAllocated -= size;
+        outOfMemory(vm);
+    }
+
+    void *result = poolAlloc(&vm->pool, size);
+
+    if (result == NULL) {
+        collectGarbage(vm, compiler);
+        result = poolAlloc(&vm->pool, size);
+    }
+
+    if (result == NULL) {
+        vm->bytesAllocated -= size;
+        outOfMemory(vm);
+    }
+
+    return result;
+#else
+    return reallocate(vm, compiler, NULL, 0, size);
+#endif // CLOX_POOL_ALLOCATOR
+}
+
+void freeObjectMemory(VM *vm, Compiler *compiler, void *pointer, size_t size) {
+#ifdef CLOX_POOL_ALLOCATOR
+    (void)compiler;
+    vm->bytesAllocated -= size;
+    poolFree(&vm->pool, pointer, size);
+#else
+    reallocate(vm, compiler, pointer, size, 0);
+#endif // CLOX_POOL_ALLOCATOR
+}
+
 void markObject(VM *vm, Obj *object) {
     if (object == NULL) {
         return;
@@ -60,12 +163,17 @@ void markObject(VM *vm, Obj *object) {
     object->isMarked = true;
 
     if (vm->greyCapacity < vm->greyCount + 1) {
-        vm->greyCapacity = GROW_CAPACITY(vm->greyCapacity);
-        vm->greyStack = (Obj **)realloc(vm->greyStack, sizeof(Obj *) * vm->greyCapacity);
+        size_t capacity = GROW_CAPACITY(vm->greyCapacity);
+        Obj **stack = (Obj **)realloc(vm->greyStack, sizeof(Obj *) * capacity);
 
-        if (vm->greyStack == NULL) {
-            exit(1);
+        if (stack == NULL) {
+            // Left to the rescan in `finishMark()`
+            vm->greyOverflow = true;
+            return;
         }
+
+        vm->greyStack = stack;
+        vm->greyCapacity = capacity;
     }
 
     vm->greyStack[vm->greyCount++] = object;
@@ -77,13 +185,60 @@ void markValue(VM *vm, Value value) {
     }
 }
 
-static void markArray(VM *vm, ValueArray *array) {
+#ifdef PARALLEL_MARK
+static void greyParallel(Marker *marker, Obj *object);
+#endif // PARALLEL_MARK
+
+static void greyObject(VM *vm, Marker *marker, Obj *object) {
+#ifdef PARALLEL_MARK
+    if (marker != NULL) {
+        greyParallel(marker, object);
+        return;
+    }
+#else
+    (void)marker;
+#endif // PARALLEL_MARK
+
+    markObject(vm, object);
+}
+
+static void greyValue(VM *vm, Marker *marker, Value value) {
+    if (IS_OBJ(value)) {
+        greyObject(vm, marker, AS_OBJ(value));
+    }
+}
+
+static void greyArray(VM *vm, Marker *marker, ValueArray *array) {
     for (size_t idx = 0; idx < array->count; idx++) {
-        markValue(vm, array->values[idx]);
+        greyValue(vm, marker, array->values[idx]);
+    }
+}
+
+static void greyTable(VM *vm, Marker *marker, Table *table) {
+    for (size_t idx = 0; idx < table->capacity; idx++) {
+        Entry *entry = &table->entries[idx];
+        greyObject(vm, marker, (Obj *)entry->key);
+        greyValue(vm, marker, entry->value);
     }
 }
 
-static void blackenObject(VM *vm, Obj *object) {
+static void greyCaches(VM *vm, Marker *marker, InlineCache *caches, size_t count) {
+    for (size_t idx = 0; idx < count; idx++) {
+        InlineCache *cache = &caches[idx];
+
+        for (uint8_t way = 0; way < cache->count; way++) {
+            greyObject(vm, marker, (Obj *)cache->entries[way].shape);
+            greyObject(vm, marker, (Obj *)cache->entries[way].transition);
+            greyObject(vm, marker, (Obj *)cache->entries[way].method);
+        }
+    }
+}
+
+/**
+ * @brief Greys the objects referenced by `object`, pushing them onto the grey
+ * stack of `marker` or of the VM without one.
+ */
+static void blackenObject(VM *vm, Marker *marker, Obj *object) {
 #ifdef DEBUG_LOG_GC
     printf("%p blacken ", (void *)object);
     printValue(OBJ_VAL(object));
@@ -93,40 +248,70 @@ static void blackenObject(VM *vm, Obj *object) {
     switch (object->type) {
         case OBJ_BOUND_METHOD: {
             ObjBoundMethod *bound = (ObjBoundMethod *)object;
-            markValue(vm, bound->receiver);
-            markObject(vm, (Obj *)bound->method);
+            greyValue(vm, marker, bound->receiver);
+            greyObject(vm, marker, (Obj *)bound->method);
             break;
         }
         case OBJ_CLASS: {
             ObjClass *klass = (ObjClass *)object;
-            markObject(vm, (Obj *)klass->name);
-            markTable(vm, &klass->methods);
+            greyObject(vm, marker, (Obj *)klass->name);
+            greyTable(vm, marker, &klass->methods);
+            greyObject(vm, marker, (Obj *)klass->rootShape);
             break;
         }
         case OBJ_CLOSURE: {
             ObjClosure *closure = (ObjClosure *)object;
-            markObject(vm, (Obj *)closure->func);
+            greyObject(vm, marker, (Obj *)closure->func);
 
             for (size_t idx = 0; idx < closure->upvalueCount; idx++) {
-                markObject(vm, (Obj *)closure->upvalues[idx]);
+                greyObject(vm, marker, (Obj *)closure->upvalues[idx]);
             }
 
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction *func = (ObjFunction *)object;
-            markObject(vm, (Obj *)func->name);
-            markArray(vm, &func->chunk.constants);
+            greyObject(vm, marker, (Obj *)func->name);
+            greyArray(vm, marker, &func->chunk.constants);
+            greyCaches(vm, marker, func->chunk.caches, func->chunk.cacheCount);
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance *instance = (ObjInstance *)object;
-            markObject(vm, (Obj *)instance->klass);
-            markTable(vm, &instance->fields);
+            greyObject(vm, marker, (Obj *)instance->klass);
+            greyObject(vm, marker, (Obj *)instance->shape);
+
+            for (uint32_t slot = 0; slot < instance->shape->slotCount; slot++) {
+                greyValue(vm, marker, instance->fields[slot]);
+            }
+
+            break;
+        }
+        case OBJ_LIST: {
+            ObjList *list = (ObjList *)object;
+
+            for (size_t idx = 0; idx < list->count; idx++) {
+                greyValue(vm, marker, list->items[idx]);
+            }
+
+            break;
+        }
+        case OBJ_ROPE: {
+            ObjRope *rope = (ObjRope *)object;
+            greyObject(vm, marker, rope->left);
+            greyObject(vm, marker, rope->right);
+            greyObject(vm, marker, (Obj *)rope->flat);
+            break;
+        }
+        case OBJ_SHAPE: {
+            ObjShape *shape = (ObjShape *)object;
+            greyObject(vm, marker, (Obj *)shape->parent);
+            greyObject(vm, marker, (Obj *)shape->key);
+            greyTable(vm, marker, &shape->transitions);
             break;
         }
         case OBJ_UPVALUE:
-            markValue(vm, ((ObjUpvalue *)object)->closed);
+            greyValue(vm, marker, ((ObjUpvalue *)object)->closed);
             break;
         case OBJ_NATIVE:
         case OBJ_STRING:
@@ -134,6 +319,48 @@ static void blackenObject(VM *vm, Obj *object) {
     }
 }
 
+/**
+ * @brief Bytes taken by an object and the arrays it owns.
+ */
+static size_t objectSize(Obj *object) {
+    switch (object->type) {
+        case OBJ_BOUND_METHOD:
+            return sizeof(ObjBoundMethod);
+        case OBJ_CLASS:
+            return sizeof(ObjClass) + ((ObjClass *)object)->methods.capacity * sizeof(Entry);
+        case OBJ_CLOSURE:
+            return sizeof(ObjClosure) +
+                   ((ObjClosure *)object)->upvalueCount * sizeof(ObjUpvalue *);
+        case OBJ_FUNCTION: {
+            ObjFunction *func = (ObjFunction *)object;
+            return sizeof(ObjFunction) + func->chunk.capacity +
+                   func->chunk.lineCapacity * sizeof(LineStart) +
+                   func->chunk.constants.capacity * sizeof(Value) +
+                   func->chunk.cacheCapacity * sizeof(InlineCache) +
+                   func->reg.capacity * sizeof(RegInstr) +
+                   func->reg.lineCapacity * sizeof(LineStart) + func->jit.size +
+                   func->jit.entryCount * sizeof(uint32_t);
+        }
+        case OBJ_INSTANCE:
+            return sizeof(ObjInstance) + ((ObjInstance *)object)->capacity * sizeof(Value);
+        case OBJ_LIST:
+            return sizeof(ObjList) + ((ObjList *)object)->capacity * sizeof(Value);
+        case OBJ_NATIVE:
+            return sizeof(ObjNative);
+        case OBJ_ROPE:
+            return sizeof(ObjRope);
+        case OBJ_SHAPE:
+            return sizeof(ObjShape) +
+                   ((ObjShape *)object)->transitions.capacity * sizeof(Entry);
+        case OBJ_STRING:
+            return STRING_SIZE(((ObjString *)object)->length);
+        case OBJ_UPVALUE:
+            return sizeof(ObjUpvalue);
+    }
+
+    return 0;
+}
+
 static void freeObject(VM *vm, Compiler *compiler, Obj *object) {
 
 #ifdef DEBUG_LOG_GC
@@ -160,23 +387,40 @@ static void freeObject(VM *vm, Compiler *compiler, Obj *object) {
         case OBJ_FUNCTION: {
             ObjFunction *func = (ObjFunction *)object;
             freeChunk(vm, compiler, &func->chunk);
+            freeRegChunk(vm, compiler, &func->reg);
+            freeJitCode(vm, compiler, &func->jit);
             FREE(vm, compiler, ObjFunction, object);
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance *instance = (ObjInstance *)object;
-            freeTable(vm, compiler, &instance->fields);
+            FREE_ARRAY(vm, compiler, Value, instance->fields, instance->capacity);
             FREE(vm, compiler, ObjInstance, object);
             break;
         }
+        case OBJ_LIST: {
+            ObjList *list = (ObjList *)object;
+            FREE_ARRAY(vm, compiler, Value, list->items, list->capacity);
+            FREE(vm, compiler, ObjList, object);
+            break;
+        }
         case OBJ_NATIVE: {
             FREE(vm, compiler, ObjNative, object);
             break;
         }
+        case OBJ_ROPE: {
+            FREE(vm, compiler, ObjRope, object);
+            break;
+        }
+        case OBJ_SHAPE: {
+            ObjShape *shape = (ObjShape *)object;
+            freeTable(vm, compiler, &shape->transitions);
+            FREE(vm, compiler, ObjShape, object);
+            break;
+        }
         case OBJ_STRING: {
             ObjString *string = (ObjString *)object;
-            FREE_ARRAY(vm, compiler, char, string->chars, string->length + 1);
-            FREE(vm, compiler, ObjString, object);
+            freeObjectMemory(vm, compiler, object, STRING_SIZE(string->length));
             break;
         }
         case OBJ_UPVALUE: {
@@ -201,53 +445,490 @@ static void markRoots(VM *vm, Compiler *compiler) {
     }
 
     markTable(vm, &vm->globals);
+
+    for (size_t idx = 0; idx < vm->globalCount; idx++) {
+        markValue(vm, vm->globalValues[idx]);
+        markObject(vm, (Obj *)vm->globalNames[idx]);
+    }
     markCompilerRoots(vm, compiler);
     markObject(vm, (Obj *)vm->initString);
+
+    if (vm->imageCaches != NULL) {
+        greyCaches(vm, NULL, vm->imageCaches, vm->image->cacheCount);
+    }
+}
+
+#ifdef PARALLEL_MARK
+// Grey objects handed between markers at a time
+#define MARK_BATCH 64
+
+/**
+ * @brief Grey objects shared by the markers of a parallel mark.
+ *
+ * @details Markers trace from their own stack and donate a batch from it here
+ * whenever another marker is idle, which takes it back out. Marking is done
+ * once every marker is idle with the pool empty.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    Obj **stack;
+    size_t count;
+    size_t capacity;
+    size_t markerCount;
+    size_t idle; // Written under `lock', read without it to decide on donating
+    bool done;
+} MarkPool;
+
+struct Marker {
+    VM *vm;
+    MarkPool *pool;
+    Obj **stack;
+    size_t count;
+    size_t capacity;
+};
+
+/**
+ * @brief Pushes a grey object, dropping it for the rescan in `finishMark()`
+ * when the stack can't grow.
+ */
+static void pushGrey(VM *vm, Obj ***stack, size_t *count, size_t *capacity,
+                     Obj *object) {
+    if (*capacity < *count + 1) {
+        size_t grown = *capacity < MARK_BATCH ? MARK_BATCH : GROW_CAPACITY(*capacity);
+        Obj **items = (Obj **)realloc(*stack, sizeof(Obj *) * grown);
+
+        if (items == NULL) {
+            __atomic_store_n(&vm->greyOverflow, true, __ATOMIC_RELAXED);
+            return;
+        }
+
+        *stack = items;
+        *capacity = grown;
+    }
+
+    (*stack)[(*count)++] = object;
+}
+
+/**
+ * @brief Greys an object for the marker that claims it first.
+ *
+ * @details Claiming sets the mark bit atomically so another marker reaching
+ * the same object leaves it alone. The plain load first avoids writing the
+ * cache lines of objects that are already marked, such as those of a frozen
+ * image shared with other threads.
+ */
+static void greyParallel(Marker *marker, Obj *object) {
+    if (object == NULL || __atomic_load_n(&object->isMarked, __ATOMIC_RELAXED) ||
+        __atomic_exchange_n(&object->isMarked, true, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    pushGrey(marker->vm, &marker->stack, &marker->count, &marker->capacity, object);
+}
+
+static void donateBatch(Marker *marker) {
+    MarkPool *pool = marker->pool;
+    pthread_mutex_lock(&pool->lock);
+
+    for (size_t idx = 0; idx < MARK_BATCH; idx++) {
+        pushGrey(marker->vm, &pool->stack, &pool->count, &pool->capacity,
+                 marker->stack[--marker->count]);
+    }
+
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Refills the empty stack of `marker` from the pool, waiting for
+ * another marker to donate when there is nothing to take.
+ *
+ * @returns false once marking is done
+ */
+static bool takeBatch(Marker *marker) {
+    MarkPool *pool = marker->pool;
+    pthread_mutex_lock(&pool->lock);
+    __atomic_store_n(&pool->idle, pool->idle + 1, __ATOMIC_RELAXED);
+
+    while (pool->count == 0 && !pool->done) {
+        if (pool->idle == pool->markerCount) {
+            pool->done = true;
+            pthread_cond_broadcast(&pool->changed);
+            break;
+        }
+
+        pthread_cond_wait(&pool->changed, &pool->lock);
+    }
+
+    bool found = pool->count > 0;
+
+    if (found) {
+        __atomic_store_n(&pool->idle, pool->idle - 1, __ATOMIC_RELAXED);
+
+        for (size_t idx = 0; idx < MARK_BATCH && pool->count > 0; idx++) {
+            pushGrey(marker->vm, &marker->stack, &marker->count, &marker->capacity,
+                     pool->stack[--pool->count]);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return found;
 }
 
-static void traceReferences(VM *vm) {
-    while (vm->greyCount > 0) {
+static void *runMarker(void *arg) {
+    Marker *marker = (Marker *)arg;
+    MarkPool *pool = marker->pool;
+
+    while (takeBatch(marker)) {
+        while (marker->count > 0) {
+            blackenObject(marker->vm, marker, marker->stack[--marker->count]);
+
+            if (marker->count >= 2 * MARK_BATCH &&
+                __atomic_load_n(&pool->idle, __ATOMIC_RELAXED) > 0) {
+                donateBatch(marker);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Traces all grey objects on `vm->gcThreads` threads, the calling one
+ * included.
+ *
+ * @details The VM's grey stack seeds the pool and gets its storage back
+ * afterwards. Markers only read the objects they blacken and only write mark
+ * bits, so the heap is safe to share while the mutator is stopped.
+ *
+ * @returns false, without having traced anything, if no marker could be set up
+ */
+static bool traceParallel(VM *vm) {
+    size_t threadCount = vm->gcThreads;
+    Marker *markers = (Marker *)malloc(threadCount * sizeof(Marker));
+    pthread_t *threads = (pthread_t *)malloc(threadCount * sizeof(pthread_t));
+
+    if (markers == NULL || threads == NULL) {
+        free(markers);
+        free(threads);
+        return false;
+    }
+
+    MarkPool pool;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.changed, NULL);
+    pool.stack = vm->greyStack;
+    pool.count = vm->greyCount;
+    pool.capacity = vm->greyCapacity;
+    pool.markerCount = threadCount;
+    pool.idle = 0;
+    pool.done = false;
+
+    for (size_t idx = 0; idx < threadCount; idx++) {
+        markers[idx] = (Marker){.vm = vm, .pool = &pool, .stack = NULL};
+    }
+
+    size_t started = 1;
+
+    while (started < threadCount &&
+           pthread_create(&threads[started], NULL, runMarker, &markers[started]) == 0) {
+        started++;
+    }
+
+    if (started < threadCount) {
+        // Markers already running may be waiting for the missing ones
+        pthread_mutex_lock(&pool.lock);
+        pool.markerCount = started;
+        pthread_cond_broadcast(&pool.changed);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    runMarker(&markers[0]);
+
+    for (size_t idx = 1; idx < started; idx++) {
+        pthread_join(threads[idx], NULL);
+    }
+
+    for (size_t idx = 0; idx < threadCount; idx++) {
+        free((void *)markers[idx].stack);
+    }
+
+    vm->greyStack = pool.stack;
+    vm->greyCount = 0;
+    vm->greyCapacity = pool.capacity;
+
+    pthread_cond_destroy(&pool.changed);
+    pthread_mutex_destroy(&pool.lock);
+    free(markers);
+    free(threads);
+    return true;
+}
+#endif // PARALLEL_MARK
+
+static void traceReferences(VM *vm, size_t budget) {
+    while (vm->greyCount > 0 && budget > 0) {
         Obj *object = vm->greyStack[--vm->greyCount];
-        blackenObject(vm, object);
+        blackenObject(vm, NULL, object);
+        budget--;
     }
 }
 
-static void sweep(VM *vm, Compiler *compiler) {
-    Obj *prev = NULL;
-    Obj *object = vm->objects;
+/**
+ * @brief Traces every grey object, in parallel when the VM has more than one
+ * GC thread and the heap is large enough to be worth starting them.
+ */
+static void traceAll(VM *vm) {
+#ifdef PARALLEL_MARK
+    if (vm->gcThreads > 1 && vm->greyCount > 0 &&
+        vm->bytesAllocated >= GC_PARALLEL_THRESHOLD && traceParallel(vm)) {
+        return;
+    }
+#endif // PARALLEL_MARK
+
+    traceReferences(vm, SIZE_MAX);
+}
+
+static void beginMark(VM *vm, Compiler *compiler) {
+#ifdef DEBUG_LOG_GC
+    printf("-- gc mark begin\n");
+#endif // DEBUG_LOG_GC
+
+    vm->gcPhase = GC_MARK;
+    markRoots(vm, compiler);
+}
+
+/**
+ * @brief Atomically completes marking.
+ *
+ * @details Roots aren't covered by the write barrier so they are rescanned
+ * before the remaining grey objects are traced. Objects dropped by a grey
+ * stack that couldn't grow are marked but untraced, blackening every marked
+ * object again greys whatever they missed. Unmarked strings can then be
+ * dropped from the intern table, as nothing can reach them any more, and the
+ * object list is set aside to be swept. Objects allocated from here on go on a
+ * fresh list and survive the cycle.
+ */
+static void finishMark(VM *vm, Compiler *compiler) {
+    markRoots(vm, compiler);
+    traceAll(vm);
+
+    while (vm->greyOverflow) {
+        vm->greyOverflow = false;
+
+        for (Obj *object = vm->objects; object != NULL; object = object->next) {
+            if (object->isMarked) {
+                blackenObject(vm, NULL, object);
+            }
+        }
+
+        traceAll(vm);
+    }
+
+    tableRemoveWhite(&vm->strings);
+
+    vm->sweepList = vm->objects;
+    vm->objects = NULL;
+    vm->survivors = NULL;
+    vm->survivorsTail = &vm->survivors;
+    vm->gcPhase = GC_SWEEP;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc mark end\n");
+#endif // DEBUG_LOG_GC
+}
+
+/**
+ * @brief Frees unmarked objects of the sweep list, collecting the survivors as
+ * white objects in their original order.
+ *
+ * @returns true once the sweep list is exhausted
+ */
+static bool sweep(VM *vm, Compiler *compiler, size_t budget) {
+    GCStats *stats = &vm->gcStats;
+    size_t before = vm->bytesAllocated;
+
+    while (vm->sweepList != NULL && budget > 0) {
+        Obj *object = vm->sweepList;
+        vm->sweepList = object->next;
+        budget--;
 
-    while (object != NULL) {
         if (object->isMarked) {
             object->isMarked = false;
-            prev = object;
-            object = object->next;
+            *vm->survivorsTail = object;
+            vm->survivorsTail = &object->next;
+
+            stats->sweepBytes[object->type] += objectSize(object);
+            stats->sweepObjects[object->type]++;
         } else {
-            Obj *unreached = object;
-            object = object->next;
+            freeObject(vm, compiler, object);
+        }
+    }
+
+    // Freeing never allocates, so the drop is all freed memory
+    stats->sweepFreed += before - vm->bytesAllocated;
+
+    return vm->sweepList == NULL;
+}
+
+static uint64_t pauseClock(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+        return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    }
+#endif // CLOCK_MONOTONIC
 
-            if (prev != NULL) {
-                prev->next = object;
-            } else {
-                vm->objects = object;
+    return (uint64_t)((double)clock() * 1e9 / CLOCKS_PER_SEC);
+}
+
+/**
+ * @brief Scales `gcGrowFactor` towards spending `gcTargetRatio` of the time
+ * since the previous cycle ended collecting.
+ *
+ * @details `start` is when the current pause began, as it isn't part of
+ * `gcStats.pauseTotal` yet.
+ */
+static void adaptGrowth(VM *vm, uint64_t start) {
+    uint64_t now = pauseClock();
+    uint64_t pauses = vm->gcStats.pauseTotal + (now - start);
+
+    if (vm->gcEpoch != 0 && now > vm->gcEpoch) {
+        double ratio = (double)(pauses - vm->gcEpochPauses) / (double)(now - vm->gcEpoch);
+
+        // Grow fast when collecting too much so a burst of garbage settles
+        // quickly, shrink slowly to give memory back
+        if (ratio > vm->gcTargetRatio) {
+            vm->gcGrowFactor *= 1.5;
+
+            if (vm->gcGrowFactor > GC_GROW_MAX) {
+                vm->gcGrowFactor = GC_GROW_MAX;
             }
+        } else if (ratio < vm->gcTargetRatio / 2) {
+            vm->gcGrowFactor /= 1.2;
 
-            freeObject(vm, compiler, unreached);
+            if (vm->gcGrowFactor < GC_GROW_MIN) {
+                vm->gcGrowFactor = GC_GROW_MIN;
+            }
         }
     }
+
+    vm->gcEpoch = now;
+    vm->gcEpochPauses = pauses;
+}
+
+static void finishSweep(VM *vm, uint64_t start) {
+    // Survivors go ahead of objects allocated during the sweep
+    *vm->survivorsTail = vm->objects;
+    vm->objects = vm->survivors;
+    vm->survivors = NULL;
+    vm->survivorsTail = &vm->survivors;
+
+    if (vm->gcTargetRatio > 0) {
+        adaptGrowth(vm, start);
+    }
+
+    vm->gcPhase = GC_IDLE;
+    vm->nextGC = (size_t)((double)vm->bytesAllocated * vm->gcGrowFactor);
+
+    // A small live heap would otherwise start the next cycle after a few
+    // allocations
+    if (vm->nextGC < vm->gcMinHeap) {
+        vm->nextGC = vm->gcMinHeap;
+    }
+
+    if (vm->heapLimit > 0 && vm->nextGC > vm->heapLimit) {
+        vm->nextGC = vm->heapLimit;
+    }
+
+    GCStats *stats = &vm->gcStats;
+    GCCycle *cycle = &stats->history[stats->cycles % GC_HISTORY];
+    cycle->freed = stats->sweepFreed;
+    cycle->live = vm->bytesAllocated;
+    cycle->nextGC = vm->nextGC;
+    stats->cycles++;
+    stats->bytesFreed += stats->sweepFreed;
+    memcpy(stats->liveBytes, stats->sweepBytes, sizeof(stats->liveBytes));
+    memcpy(stats->liveObjects, stats->sweepObjects, sizeof(stats->liveObjects));
+
+    stats->sweepFreed = 0;
+    memset(stats->sweepBytes, 0, sizeof(stats->sweepBytes));
+    memset(stats->sweepObjects, 0, sizeof(stats->sweepObjects));
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc sweep end, next GC at %zu\n", vm->nextGC);
+#endif // DEBUG_LOG_GC
+}
+
+static void recordPause(VM *vm, uint64_t start) {
+    GCStats *stats = &vm->gcStats;
+    uint64_t pause = pauseClock() - start;
+    size_t bucket = 0;
+
+    for (uint64_t micros = pause / 1000; micros > 0 && bucket < GC_PAUSE_BUCKETS - 1;
+         micros >>= 1) {
+        bucket++;
+    }
+
+    stats->pauses++;
+    stats->pauseTotal += pause;
+    stats->pauseHistogram[bucket]++;
+
+    if (pause > stats->pauseMax) {
+        stats->pauseMax = pause;
+    }
+}
+
+void stepGarbage(VM *vm, Compiler *compiler) {
+    uint64_t start = pauseClock();
+
+    switch (vm->gcPhase) {
+        case GC_IDLE:
+            beginMark(vm, compiler);
+            break;
+        case GC_MARK:
+            traceReferences(vm, vm->gcStepSize);
+
+            if (vm->greyCount == 0) {
+                finishMark(vm, compiler);
+            }
+
+            break;
+        case GC_SWEEP:
+            if (sweep(vm, compiler, vm->gcStepSize)) {
+                finishSweep(vm, start);
+            }
+
+            break;
+    }
+
+    recordPause(vm, start);
 }
 
 void collectGarbage(VM *vm, Compiler *compiler) {
+    uint64_t start = pauseClock();
+
 #ifdef DEBUG_LOG_GC
     printf("-- gc begin\n");
     size_t before = vm->bytesAllocated;
 #endif // DEBUG_LOG_GC
 
-    markRoots(vm, compiler);
-    traceReferences(vm);
-    tableRemoveWhite(&vm->strings);
-    sweep(vm, compiler);
+    // Complete an interrupted cycle, sweeping it is required before the
+    // objects set aside can be marked again.
+    if (vm->gcPhase == GC_SWEEP) {
+        sweep(vm, compiler, SIZE_MAX);
+        finishSweep(vm, start);
+    }
+
+    if (vm->gcPhase == GC_IDLE) {
+        beginMark(vm, compiler);
+    }
 
-    vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
+    finishMark(vm, compiler);
+    sweep(vm, compiler, SIZE_MAX);
+    finishSweep(vm, start);
+    recordPause(vm, start);
 
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
@@ -256,14 +937,78 @@ void collectGarbage(VM *vm, Compiler *compiler) {
 #endif // DEBUG_LOG_GC
 }
 
-void freeObjects(VM *vm, Compiler *compiler) {
-    Obj *object = vm->objects;
-
+static void freeList(VM *vm, Compiler *compiler, Obj *object) {
     while (object != NULL) {
         Obj *next = object->next;
         freeObject(vm, compiler, object);
         object = next;
     }
+}
+
+void freeObjects(VM *vm, Compiler *compiler) {
+    *vm->survivorsTail = NULL;
+
+    freeList(vm, compiler, vm->objects);
+    freeList(vm, compiler, vm->sweepList);
+    freeList(vm, compiler, vm->survivors);
+    vm->objects = NULL;
+    vm->sweepList = NULL;
+    vm->survivors = NULL;
+    vm->survivorsTail = &vm->survivors;
 
     free((void *)vm->greyStack);
 }
+
+void getGCStats(VM *vm, GCStats *stats) {
+    *stats = vm->gcStats;
+    stats->bytesAllocated = vm->bytesAllocated;
+    stats->nextGC = vm->nextGC;
+    stats->stringCount = 0;
+    stats->stringEntries = vm->strings.count;
+    stats->stringCapacity = vm->strings.capacity;
+
+    for (size_t idx = 0; idx < vm->strings.capacity; idx++) {
+        if (vm->strings.entries[idx].key != NULL) {
+            stats->stringCount++;
+        }
+    }
+}
+
+void writeGCStats(const GCStats *stats, FILE *out) {
+    fprintf(out,
+            "{\"cycles\": %" PRIu64 ", \"pauses\": %" PRIu64 ", \"pauseTotalNs\": %" PRIu64
+            ", \"pauseMaxNs\": %" PRIu64 ", \"pauseHistogram\": [",
+            stats->cycles, stats->pauses, stats->pauseTotal, stats->pauseMax);
+
+    for (size_t bucket = 0; bucket < GC_PAUSE_BUCKETS; bucket++) {
+        fprintf(out, "%s%" PRIu64, bucket > 0 ? ", " : "", stats->pauseHistogram[bucket]);
+    }
+
+    fprintf(out,
+            "], \"bytesFreed\": %" PRIu64 ", \"bytesAllocated\": %zu, \"nextGC\": %zu, "
+            "\"strings\": {\"count\": %zu, \"entries\": %zu, \"capacity\": %zu, "
+            "\"load\": %.3f}, \"live\": {",
+            stats->bytesFreed, stats->bytesAllocated, stats->nextGC, stats->stringCount,
+            stats->stringEntries, stats->stringCapacity,
+            stats->stringCapacity == 0
+                ? 0.0
+                : (double)stats->stringEntries / (double)stats->stringCapacity);
+
+    for (size_t type = 0; type < OBJ_TYPE_COUNT; type++) {
+        fprintf(out, "%s\"%s\": {\"objects\": %zu, \"bytes\": %zu}", type > 0 ? ", " : "",
+                objTypeName((ObjType)type), stats->liveObjects[type], stats->liveBytes[type]);
+    }
+
+    fprintf(out, "}, \"history\": [");
+
+    // Oldest cycle first
+    uint64_t first = stats->cycles > GC_HISTORY ? stats->cycles - GC_HISTORY : 0;
+
+    for (uint64_t idx = first; idx < stats->cycles; idx++) {
+        const GCCycle *cycle = &stats->history[idx % GC_HISTORY];
+        fprintf(out, "%s{\"freed\": %zu, \"live\": %zu, \"nextGC\": %zu}",
+                idx > first ? ", " : "", cycle->freed, cycle->live, cycle->nextGC);
+    }
+
+    fprintf(out, "]}");
+}
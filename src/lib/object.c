@@ -1,10 +1,15 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "chunk.h"
+#include "hash.h"
+#include "image.h"
+#include "jit.h"
 #include "memory.h"
 #include "object.h"
+#include "regvm.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
@@ -12,8 +17,10 @@
 #define ALLOCATE_OBJ(vm, compiler, type, objectType)                                     \
     (type *)allocateObject(vm, compiler, sizeof(type), objectType)
 
-static void *allocateObject(VM *vm, Compiler *compiler, size_t size, ObjType type) {
-    Obj *object = (Obj *)reallocate(vm, compiler, NULL, 0, size);
+// Instances usually hold few fields so start smaller than other arrays
+#define GROW_FIELD_CAPACITY(capacity) ((capacity) < 4 ? 4 : (capacity) * 2)
+
+static void linkObject(VM *vm, Obj *object, size_t size, ObjType type) {
     object->type = type;
     object->isMarked = false;
 
@@ -22,17 +29,25 @@ static void *allocateObject(VM *vm, Compiler *compiler, size_t size, ObjType typ
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void *)object, size, type);
+#else
+    (void)size;
 #endif // DEBUG_LOG_GC
+}
 
+static void *allocateObject(VM *vm, Compiler *compiler, size_t size, ObjType type) {
+    Obj *object = (Obj *)allocateObjectMemory(vm, compiler, size);
+    linkObject(vm, object, size, type);
     return object;
 }
 
-static ObjString *allocateString(VM *vm, Compiler *compiler, size_t length, char *chars,
-                                 uint32_t hash) {
-    ObjString *string = ALLOCATE_OBJ(vm, compiler, ObjString, OBJ_STRING);
-    string->length = length;
-    string->chars = chars;
+/**
+ * @brief Turns a string from `reserveString()` into a live, interned object.
+ */
+static ObjString *adoptString(VM *vm, Compiler *compiler, ObjString *string,
+                              uint64_t poly, uint32_t hash) {
+    string->poly = poly;
     string->hash = hash;
+    linkObject(vm, (Obj *)string, STRING_SIZE(string->length), OBJ_STRING);
 
     // Push-pop of value is done so that value is reachable
     // by VM and thus isn't swept if the GC is triggered by
@@ -44,17 +59,6 @@ static ObjString *allocateString(VM *vm, Compiler *compiler, size_t length, char
     return string;
 }
 
-static uint32_t hashString(const char *key, size_t length) {
-    uint32_t hash = 2166136261U;
-
-    for (size_t i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[0];
-        hash *= 16777619;
-    }
-
-    return hash;
-}
-
 ObjBoundMethod *newBoundMethod(VM *vm, Compiler *compiler, Value receiver,
                                ObjClosure *method) {
     ObjBoundMethod *bound = ALLOCATE_OBJ(vm, compiler, ObjBoundMethod, OBJ_BOUND_METHOD);
@@ -68,16 +72,38 @@ ObjFunction *newFunction(VM *vm, Compiler *compiler) {
 
     func->arity = 0;
     func->upvalueCount = 0;
+    func->stackSize = 0;
     func->name = NULL;
+    func->frozen = false;
+    func->cacheBase = 0;
     initChunk(&func->chunk);
+    initRegChunk(&func->reg);
+    initJitCode(&func->jit);
 
     return func;
 }
 
+static ObjShape *newShape(VM *vm, Compiler *compiler, ObjShape *parent, ObjString *key) {
+    ObjShape *shape = ALLOCATE_OBJ(vm, compiler, ObjShape, OBJ_SHAPE);
+    shape->parent = parent;
+    shape->key = key;
+    shape->slotCount = parent == NULL ? 0 : parent->slotCount + 1;
+    initTable(&shape->transitions);
+    return shape;
+}
+
 ObjInstance *newInstance(VM *vm, Compiler *compiler, ObjClass *klass) {
+    Value *fields = NULL;
+
+    if (klass->fieldCapacity > 0) {
+        fields = ALLOCATE(vm, compiler, Value, klass->fieldCapacity);
+    }
+
     ObjInstance *instance = ALLOCATE_OBJ(vm, compiler, ObjInstance, OBJ_INSTANCE);
     instance->klass = klass;
-    initTable(&instance->fields);
+    instance->shape = klass->rootShape;
+    instance->capacity = klass->fieldCapacity;
+    instance->fields = fields;
     return instance;
 }
 
@@ -85,9 +111,229 @@ ObjClass *newClass(VM *vm, Compiler *compiler, ObjString *name) {
     ObjClass *klass = ALLOCATE_OBJ(vm, compiler, ObjClass, OBJ_CLASS);
     klass->name = name;
     initTable(&klass->methods);
+    klass->version = 0;
+    klass->rootShape = NULL;
+    klass->fieldCapacity = 0;
+
+    // Class must be reachable while its root shape is allocated
+    push(vm, OBJ_VAL(klass));
+    klass->rootShape = newShape(vm, compiler, NULL, NULL);
+    writeBarrierObject(vm, (Obj *)klass->rootShape);
+    pop(vm);
+
     return klass;
 }
 
+int64_t shapeFind(ObjShape *shape, ObjString *key) {
+    for (; shape->parent != NULL; shape = shape->parent) {
+        if (shape->key == key) {
+            return (int64_t)shape->slotCount - 1;
+        }
+    }
+
+    return -1;
+}
+
+ObjShape *shapeTransition(VM *vm, Compiler *compiler, ObjShape *shape, ObjString *key) {
+    Value next;
+
+    if (tableGet(&shape->transitions, key, &next)) {
+        return AS_SHAPE(next);
+    }
+
+    ObjShape *child = newShape(vm, compiler, shape, key);
+
+    push(vm, OBJ_VAL(child));
+    tableSet(vm, compiler, &shape->transitions, key, OBJ_VAL(child));
+    writeBarrierObject(vm, (Obj *)child);
+    pop(vm);
+
+    return child;
+}
+
+void instanceAddField(VM *vm, Compiler *compiler, ObjInstance *instance,
+                      ObjShape *shape, Value value) {
+    uint32_t slot = shape->slotCount - 1;
+
+    if (slot >= instance->capacity) {
+        uint32_t oldCapacity = instance->capacity;
+        uint32_t capacity = GROW_FIELD_CAPACITY(oldCapacity);
+
+        // Value being stored may only be reachable from the caller
+        push(vm, value);
+        instance->fields =
+            GROW_ARRAY(vm, compiler, Value, instance->fields, oldCapacity, capacity);
+        pop(vm);
+
+        instance->capacity = capacity;
+
+        if (capacity > instance->klass->fieldCapacity) {
+            instance->klass->fieldCapacity = capacity;
+        }
+    }
+
+    instance->fields[slot] = value;
+    instance->shape = shape;
+    writeBarrier(vm, value);
+    writeBarrierObject(vm, (Obj *)shape);
+}
+
+void instanceSetField(VM *vm, Compiler *compiler, ObjInstance *instance,
+                      ObjString *key, Value value) {
+    int64_t slot = shapeFind(instance->shape, key);
+
+    if (slot >= 0) {
+        instance->fields[slot] = value;
+        writeBarrier(vm, value);
+        return;
+    }
+
+    push(vm, value);
+    ObjShape *shape = shapeTransition(vm, compiler, instance->shape, key);
+    pop(vm);
+
+    instanceAddField(vm, compiler, instance, shape, value);
+}
+
+ObjList *newList(VM *vm, Compiler *compiler, size_t capacity) {
+    Value *items = NULL;
+
+    if (capacity > 0) {
+        items = ALLOCATE(vm, compiler, Value, capacity);
+    }
+
+    ObjList *list = ALLOCATE_OBJ(vm, compiler, ObjList, OBJ_LIST);
+    list->count = 0;
+    list->capacity = capacity;
+    list->items = items;
+    return list;
+}
+
+void listAppend(VM *vm, Compiler *compiler, ObjList *list, Value value) {
+    if (list->count + 1 > list->capacity) {
+        size_t capacity = GROW_CAPACITY(list->capacity);
+
+        // Value being stored may only be reachable from the caller
+        push(vm, value);
+        list->items = GROW_ARRAY(vm, compiler, Value, list->items, list->capacity, capacity);
+        list->capacity = capacity;
+        pop(vm);
+    }
+
+    list->items[list->count++] = value;
+    writeBarrier(vm, value);
+}
+
+static size_t pieceLength(Obj *piece) {
+    return piece->type == OBJ_STRING ? ((ObjString *)piece)->length
+                                     : ((ObjRope *)piece)->length;
+}
+
+static uint64_t piecePoly(Obj *piece) {
+    return piece->type == OBJ_STRING ? ((ObjString *)piece)->poly
+                                     : ((ObjRope *)piece)->poly;
+}
+
+/**
+ * @brief Obtains the string holding the characters of a rope piece, NULL for
+ * a rope not flattened yet.
+ */
+static ObjString *pieceString(Obj *piece) {
+    return piece->type == OBJ_STRING ? (ObjString *)piece : ((ObjRope *)piece)->flat;
+}
+
+ObjRope *newRope(VM *vm, Compiler *compiler, Obj *left, Obj *right) {
+    // Flattened ropes are replaced by their string, letting them be collected
+    ObjString *leftString = pieceString(left);
+    ObjString *rightString = pieceString(right);
+    left = leftString != NULL ? (Obj *)leftString : left;
+    right = rightString != NULL ? (Obj *)rightString : right;
+
+    ObjRope *rope = ALLOCATE_OBJ(vm, compiler, ObjRope, OBJ_ROPE);
+    size_t rightLength = pieceLength(right);
+    rope->length = pieceLength(left) + rightLength;
+    rope->poly = hashConcat(piecePoly(left), piecePoly(right), rightLength);
+    rope->left = left;
+    rope->right = right;
+    rope->flat = NULL;
+    return rope;
+}
+
+/**
+ * @brief Rope piece whose characters go to `dest`, see `copyRopeChars()`.
+ */
+typedef struct {
+    ObjRope *rope;
+    char *dest;
+} RopeTask;
+
+/**
+ * @brief Copies the characters of `rope`, which must stay reachable, into
+ * `dest`, which must have room for `rope->length` of them.
+ */
+static void copyRopeChars(VM *vm, Compiler *compiler, ObjRope *rope, char *dest) {
+    // Ropes built in loops are lopsided, so string pieces are copied straight
+    // away and only a right piece is deferred while descending a left one
+    RopeTask *pending = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    while (true) {
+        ObjString *left = pieceString(rope->left);
+        ObjString *right = pieceString(rope->right);
+        size_t leftLength = pieceLength(rope->left);
+
+        if (left != NULL) {
+            memcpy(dest, left->chars, leftLength);
+        }
+
+        if (right != NULL) {
+            memcpy(dest + leftLength, right->chars, right->length);
+        }
+
+        if (left == NULL) {
+            if (right == NULL) {
+                if (count + 1 > capacity) {
+                    size_t oldCapacity = capacity;
+                    capacity = GROW_CAPACITY(oldCapacity);
+                    pending = GROW_ARRAY(vm, compiler, RopeTask, pending, oldCapacity,
+                                         capacity);
+                }
+
+                pending[count++] = (RopeTask){(ObjRope *)rope->right, dest + leftLength};
+            }
+
+            rope = (ObjRope *)rope->left;
+        } else if (right == NULL) {
+            rope = (ObjRope *)rope->right;
+            dest += leftLength;
+        } else if (count > 0) {
+            count--;
+            rope = pending[count].rope;
+            dest = pending[count].dest;
+        } else {
+            break;
+        }
+    }
+
+    FREE_ARRAY(vm, compiler, RopeTask, pending, capacity);
+}
+
+ObjString *flattenRope(VM *vm, Compiler *compiler, ObjRope *rope) {
+    if (rope->flat == NULL) {
+        ObjString *string = reserveString(vm, compiler, rope->length);
+        copyRopeChars(vm, compiler, rope, string->chars);
+        rope->flat = internString(vm, compiler, string, rope->poly);
+        writeBarrierObject(vm, (Obj *)rope->flat);
+
+        // The pieces are no longer needed and may be collected
+        rope->left = NULL;
+        rope->right = NULL;
+    }
+
+    return rope->flat;
+}
+
 ObjClosure *newClosure(VM *vm, Compiler *compiler, ObjFunction *func) {
     ObjUpvalue **upvalues = ALLOCATE(vm, compiler, ObjUpvalue *, func->upvalueCount);
 
@@ -110,32 +356,65 @@ ObjNative *newNative(VM *vm, Compiler *compiler, NativeFn func, uint8_t arity) {
     return native;
 }
 
-ObjString *takeString(VM *vm, Compiler *compiler, size_t length, char *chars) {
-    uint32_t hash = hashString(chars, length);
+ObjString *reserveString(VM *vm, Compiler *compiler, size_t length) {
+    ObjString *string = (ObjString *)allocateObjectMemory(vm, compiler, STRING_SIZE(length));
+    string->length = length;
+    string->chars[length] = '\0';
+    return string;
+}
 
-    ObjString *interned = tableFindString(&vm->strings, chars, length, hash);
+/**
+ * @brief Finds an interned string equal to `chars`, be it the VM's own or one
+ * of its image.
+ */
+static ObjString *findString(VM *vm, const char *chars, size_t length, uint32_t hash) {
+    if (vm->image != NULL) {
+        ObjString *frozen = tableFindString(&vm->image->vm.strings, chars, length, hash);
+
+        if (frozen != NULL) {
+            return frozen;
+        }
+    }
+
+    return tableFindString(&vm->strings, chars, length, hash);
+}
+
+ObjString *internString(VM *vm, Compiler *compiler, ObjString *string, uint64_t poly) {
+    uint32_t hash = hashFinalize(poly);
+
+    ObjString *interned = findString(vm, string->chars, string->length, hash);
 
     if (interned != NULL) {
-        FREE_ARRAY(vm, compiler, char, chars, length + 1);
+        freeObjectMemory(vm, compiler, string, STRING_SIZE(string->length));
         return interned;
     }
 
-    return allocateString(vm, compiler, length, chars, hash);
+    return adoptString(vm, compiler, string, poly, hash);
+}
+
+ObjString *takeString(VM *vm, Compiler *compiler, size_t length, char *chars) {
+    ObjString *string = copyString(vm, compiler, length, chars);
+    FREE_ARRAY(vm, compiler, char, chars, length + 1);
+    return string;
 }
 
 ObjString *copyString(VM *vm, Compiler *compiler, size_t length, const char *chars) {
-    uint32_t hash = hashString(chars, length);
+    return copyHashedString(vm, compiler, length, chars, hashChars(chars, length));
+}
+
+ObjString *copyHashedString(VM *vm, Compiler *compiler, size_t length, const char *chars,
+                            uint64_t poly) {
+    uint32_t hash = hashFinalize(poly);
 
-    ObjString *interned = tableFindString(&vm->strings, chars, length, hash);
+    ObjString *interned = findString(vm, chars, length, hash);
 
     if (interned != NULL) {
         return interned;
     }
 
-    char *heapChars = ALLOCATE(vm, compiler, char, length + 1);
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0';
-    return allocateString(vm, compiler, length, heapChars, hash);
+    ObjString *string = reserveString(vm, compiler, length);
+    memcpy(string->chars, chars, length);
+    return adoptString(vm, compiler, string, poly, hash);
 }
 
 ObjUpvalue *newUpvalue(VM *vm, Compiler *compiler, Value *slot) {
@@ -146,40 +425,100 @@ ObjUpvalue *newUpvalue(VM *vm, Compiler *compiler, Value *slot) {
     return upvalue;
 }
 
-static void printFunction(ObjFunction *func) {
+// clang-format off
+static const char *typeNames[OBJ_TYPE_COUNT] = {
+    [OBJ_BOUND_METHOD] = "boundMethod",
+    [OBJ_CLASS]        = "class",
+    [OBJ_CLOSURE]      = "closure",
+    [OBJ_FUNCTION]     = "function",
+    [OBJ_INSTANCE]     = "instance",
+    [OBJ_LIST]         = "list",
+    [OBJ_NATIVE]       = "native",
+    [OBJ_ROPE]         = "rope",
+    [OBJ_SHAPE]        = "shape",
+    [OBJ_STRING]       = "string",
+    [OBJ_UPVALUE]      = "upvalue",
+};
+// clang-format on
+
+const char *objTypeName(ObjType type) { return typeNames[type]; }
+
+static void printFunction(FILE *out, ObjFunction *func) {
     if (func->name == NULL) {
-        printf("<script>");
+        fprintf(out, "<script>");
         return;
     }
 
-    printf("<fn %s>", func->name->chars);
+    fprintf(out, "<fn %s>", func->name->chars);
 }
 
-void printObject(Value value) {
+static void printList(FILE *out, ObjList *list, size_t depth) {
+    if (depth == LIST_PRINT_DEPTH) {
+        fprintf(out, "[...]");
+        return;
+    }
+
+    fputc('[', out);
+
+    for (size_t idx = 0; idx < list->count; idx++) {
+        if (idx > 0) {
+            fprintf(out, ", ");
+        }
+
+        if (IS_LIST(list->items[idx])) {
+            printList(out, AS_LIST(list->items[idx]), depth + 1);
+        } else {
+            fprintValue(out, list->items[idx]);
+        }
+    }
+
+    fputc(']', out);
+}
+
+static void printRope(FILE *out, ObjRope *rope) {
+    // Gathering the characters allocates, so only ropes the VM flattened for
+    // `print` show them, see `printable()`
+    if (rope->flat != NULL) {
+        fprintf(out, "%s", rope->flat->chars);
+    } else {
+        fprintf(out, "<rope of %zu chars>", rope->length);
+    }
+}
+
+void printObject(FILE *out, Value value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_BOUND_METHOD:
-            printFunction(AS_BOUND_METHOD(value)->method->func);
+            printFunction(out, AS_BOUND_METHOD(value)->method->func);
             break;
         case OBJ_CLASS:
-            printf("%s", AS_CLASS(value)->name->chars);
+            fprintf(out, "%s", AS_CLASS(value)->name->chars);
             break;
         case OBJ_CLOSURE:
-            printFunction(AS_CLOSURE(value)->func);
+            printFunction(out, AS_CLOSURE(value)->func);
             break;
         case OBJ_FUNCTION:
-            printFunction(AS_FUNCTION(value));
+            printFunction(out, AS_FUNCTION(value));
             break;
         case OBJ_INSTANCE:
-            printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
+            fprintf(out, "%s instance", AS_INSTANCE(value)->klass->name->chars);
+            break;
+        case OBJ_LIST:
+            printList(out, AS_LIST(value), 0);
             break;
         case OBJ_NATIVE:
-            printf("<native fn>");
+            fprintf(out, "<native fn>");
+            break;
+        case OBJ_ROPE:
+            printRope(out, AS_ROPE(value));
+            break;
+        case OBJ_SHAPE:
+            fprintf(out, "shape");
             break;
         case OBJ_STRING:
-            printf("%s", AS_CSTRING(value));
+            fprintf(out, "%s", AS_CSTRING(value));
             break;
         case OBJ_UPVALUE:
-            printf("upvalue");
+            fprintf(out, "upvalue");
             break;
     }
 }
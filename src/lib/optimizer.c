@@ -0,0 +1,708 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+#include "value.h"
+#include "vm.h"
+
+/**
+ * @brief Longest instruction kept in decoded form, longer ones (closures and the long
+ * property accesses and invokes) are copied verbatim from the original code.
+ */
+#define INSTR_MAX_BYTES 5
+
+/**
+ * @brief Marks a decoded instruction as not being a jump.
+ */
+#define NO_TARGET SIZE_MAX
+
+/**
+ * @brief Instruction decoded from a chunk.
+ *
+ * @details Jumps refer to the index of the instruction they land on in the
+ * original instruction list, `target`, and get their offsets recomputed once
+ * the optimized layout is known. They are decoded in their short form, where
+ * the offset is the last two operand bytes, and only encoded long when the
+ * offset doesn't fit.
+ */
+typedef struct {
+    uint8_t bytes[INSTR_MAX_BYTES];
+    size_t offset;
+    size_t length;
+    size_t line;
+    size_t target;
+    bool isTarget;
+} Instr;
+
+/**
+ * @brief State of the peephole pass.
+ *
+ * @details Instructions are appended to `out` one at a time, and each append
+ * may rewrite the tail of `out` instead. `newIndex` maps original instruction
+ * indices to their position in `out`, which is where jumps to them land.
+ * Superinstructions are always selected, the remaining rewrites only when
+ * `optimize` is set.
+ */
+typedef struct {
+    Chunk *chunk;
+    Instr *in;
+    size_t inCount;
+    Instr *out;
+    size_t outCount;
+    size_t *newIndex;
+    bool pendingTarget;
+    bool skipNext;
+    bool optimize;
+} Optimizer;
+
+static bool isJump(uint8_t op) {
+    return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE ||
+           op == OP_LOOP || op == OP_LESS_LOCAL_LOCAL_JUMP;
+}
+
+/**
+ * @brief Long form of a jump, `op` itself if there is none.
+ */
+static uint8_t widenJump(uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+            return OP_JUMP_LONG;
+        case OP_JUMP_IF_FALSE:
+            return OP_JUMP_IF_FALSE_LONG;
+        case OP_JUMP_IF_TRUE:
+            return OP_JUMP_IF_TRUE_LONG;
+        case OP_LOOP:
+            return OP_LOOP_LONG;
+        default:
+            return op;
+    }
+}
+
+/**
+ * @brief Short form of a jump, `op` itself if there is none.
+ */
+static uint8_t narrowJump(uint8_t op) {
+    switch (op) {
+        case OP_JUMP_LONG:
+            return OP_JUMP;
+        case OP_JUMP_IF_FALSE_LONG:
+            return OP_JUMP_IF_FALSE;
+        case OP_JUMP_IF_TRUE_LONG:
+            return OP_JUMP_IF_TRUE;
+        case OP_LOOP_LONG:
+            return OP_LOOP;
+        default:
+            return op;
+    }
+}
+
+static bool isLiteral(Instr *instr) {
+    uint8_t op = instr->bytes[0];
+    return op == OP_CONSTANT || op == OP_NIL || op == OP_TRUE || op == OP_FALSE;
+}
+
+static bool isPurePush(Instr *instr) {
+    uint8_t op = instr->bytes[0];
+    return isLiteral(instr) || op == OP_GET_LOCAL || op == OP_GET_UPVALUE;
+}
+
+static Value literalValue(Chunk *chunk, Instr *instr) {
+    switch (instr->bytes[0]) {
+        case OP_NIL:
+            return NIL_VAL;
+        case OP_TRUE:
+            return BOOL_VAL(true);
+        case OP_FALSE:
+            return BOOL_VAL(false);
+        default:
+            return chunk->constants.values[instr->bytes[1]];
+    }
+}
+
+static bool isNumberLiteral(Chunk *chunk, Instr *instr) {
+    return instr->bytes[0] == OP_CONSTANT && IS_NUMBER(literalValue(chunk, instr));
+}
+
+/**
+ * @brief Checks whether a constant can be reused for `value`.
+ *
+ * @details Numbers are compared bitwise so that `-0` and `0` stay distinct.
+ */
+static bool sameConstant(Value constant, Value value) {
+    if (IS_NUMBER(constant) && IS_NUMBER(value)) {
+        double x = AS_NUMBER(constant);
+        double y = AS_NUMBER(value);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+
+    return valuesEqual(constant, value);
+}
+
+/**
+ * @brief Rewrites `instr` in place to push `value`.
+ *
+ * @returns false if the constant pool is full
+ */
+static bool makeLiteral(VM *vm, Compiler *compiler, Chunk *chunk, Instr *instr,
+                        Value value) {
+    if (IS_NIL(value)) {
+        instr->bytes[0] = OP_NIL;
+        instr->length = 1;
+        return true;
+    }
+
+    if (IS_BOOL(value)) {
+        instr->bytes[0] = AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+        instr->length = 1;
+        return true;
+    }
+
+    // Only the constants a single byte operand reaches are candidates
+    size_t count = chunk->constants.count < UINT8_COUNT ? chunk->constants.count
+                                                        : UINT8_COUNT;
+    size_t constant = 0;
+
+    while (constant < count && !sameConstant(chunk->constants.values[constant], value)) {
+        constant++;
+    }
+
+    if (constant == count) {
+        if (chunk->constants.count >= UINT8_MAX) {
+            return false;
+        }
+
+        constant = addConstant(vm, compiler, chunk, value);
+    }
+
+    instr->bytes[0] = OP_CONSTANT;
+    instr->bytes[1] = (uint8_t)constant;
+    instr->length = 2;
+    return true;
+}
+
+static bool foldBinary(VM *vm, Compiler *compiler, Optimizer *opt, Instr *instr) {
+    if (opt->outCount < 2) {
+        return false;
+    }
+
+    Instr *a = &opt->out[opt->outCount - 2];
+    Instr *b = &opt->out[opt->outCount - 1];
+
+    if (!isLiteral(a) || !isLiteral(b) || b->isTarget) {
+        return false;
+    }
+
+    Value left = literalValue(opt->chunk, a);
+    Value right = literalValue(opt->chunk, b);
+    Value result;
+
+    if (instr->bytes[0] == OP_EQUAL) {
+        result = BOOL_VAL(valuesEqual(left, right));
+    } else if (!isNumberLiteral(opt->chunk, a) || !isNumberLiteral(opt->chunk, b)) {
+        return false;
+    } else {
+        double x = AS_NUMBER(left);
+        double y = AS_NUMBER(right);
+
+        switch (instr->bytes[0]) {
+            case OP_GREATER:
+                result = BOOL_VAL(x > y);
+                break;
+            case OP_LESS:
+                result = BOOL_VAL(x < y);
+                break;
+            case OP_ADD:
+                result = NUMBER_VAL(x + y);
+                break;
+            case OP_SUBTRACT:
+                result = NUMBER_VAL(x - y);
+                break;
+            case OP_MULTIPLY:
+                result = NUMBER_VAL(x * y);
+                break;
+            case OP_DIVIDE:
+                result = NUMBER_VAL(x / y);
+                break;
+            default:
+                return false;
+        }
+    }
+
+    Instr folded = *a;
+
+    if (!makeLiteral(vm, compiler, opt->chunk, &folded, result)) {
+        return false;
+    }
+
+    folded.line = instr->line;
+    opt->out[opt->outCount - 2] = folded;
+    opt->outCount--;
+    return true;
+}
+
+static bool foldUnary(VM *vm, Compiler *compiler, Optimizer *opt, Instr *instr) {
+    if (opt->outCount < 1) {
+        return false;
+    }
+
+    Instr *operand = &opt->out[opt->outCount - 1];
+
+    if (!isLiteral(operand)) {
+        return false;
+    }
+
+    Value value = literalValue(opt->chunk, operand);
+    Value result;
+
+    if (instr->bytes[0] == OP_NOT) {
+        result = BOOL_VAL(IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)));
+    } else if (IS_NUMBER(value)) {
+        result = NUMBER_VAL(-AS_NUMBER(value));
+    } else {
+        return false;
+    }
+
+    Instr folded = *operand;
+
+    if (!makeLiteral(vm, compiler, opt->chunk, &folded, result)) {
+        return false;
+    }
+
+    folded.line = instr->line;
+    *operand = folded;
+    return true;
+}
+
+static bool removeDeadPush(Optimizer *opt) {
+    if (opt->outCount < 1 || !isPurePush(&opt->out[opt->outCount - 1])) {
+        return false;
+    }
+
+    // Jumps to the removed push now land on whatever comes next
+    if (opt->out[opt->outCount - 1].isTarget) {
+        opt->pendingTarget = true;
+    }
+
+    opt->outCount--;
+    return true;
+}
+
+/**
+ * @brief Fuses `OP_NOT; OP_JUMP_IF_FALSE` into `OP_JUMP_IF_TRUE`.
+ *
+ * @details The fused jump leaves the un-negated condition on the stack, so this
+ * is only done when both paths immediately pop it, as for `if` and `while`.
+ */
+static bool fuseNotJump(Optimizer *opt, Instr *instr, size_t index) {
+    if (opt->outCount < 1 || opt->out[opt->outCount - 1].bytes[0] != OP_NOT) {
+        return false;
+    }
+
+    if (index + 1 >= opt->inCount || opt->in[index + 1].bytes[0] != OP_POP ||
+        instr->target >= opt->inCount || opt->in[instr->target].bytes[0] != OP_POP) {
+        return false;
+    }
+
+    Instr *negation = &opt->out[opt->outCount - 1];
+    bool isTarget = negation->isTarget;
+    *negation = *instr;
+    negation->bytes[0] = OP_JUMP_IF_TRUE;
+    negation->isTarget = isTarget;
+    return true;
+}
+
+/**
+ * @brief Turns `OP_SET_X n; OP_POP; OP_GET_X n` into `OP_SET_X n`, as the
+ * stored value is still on the stack after the set.
+ */
+static bool removeReload(Optimizer *opt, Instr *instr, uint8_t setOp) {
+    if (opt->outCount < 2) {
+        return false;
+    }
+
+    Instr *set = &opt->out[opt->outCount - 2];
+    Instr *pop = &opt->out[opt->outCount - 1];
+
+    if (set->bytes[0] != setOp || pop->bytes[0] != OP_POP || pop->isTarget ||
+        set->length != instr->length ||
+        memcmp(set->bytes + 1, instr->bytes + 1, instr->length - 1) != 0) {
+        return false;
+    }
+
+    opt->outCount--;
+    return true;
+}
+
+/**
+ * @brief Drops `OP_SET_LOCAL n` directly after `OP_GET_LOCAL n`.
+ */
+static bool removeSelfStore(Optimizer *opt, Instr *instr) {
+    if (opt->outCount < 1) {
+        return false;
+    }
+
+    Instr *get = &opt->out[opt->outCount - 1];
+    return get->bytes[0] == OP_GET_LOCAL && get->bytes[1] == instr->bytes[1];
+}
+
+/**
+ * @brief Turns `OP_GET_LOCAL n; OP_CONSTANT c; OP_ADD` into
+ * `OP_ADD_LOCAL_CONST n c` for numeric constants.
+ */
+static bool fuseAddLocalConst(Optimizer *opt, Instr *instr) {
+    if (opt->outCount < 2) {
+        return false;
+    }
+
+    Instr *get = &opt->out[opt->outCount - 2];
+    Instr *constant = &opt->out[opt->outCount - 1];
+
+    if (get->bytes[0] != OP_GET_LOCAL || !isNumberLiteral(opt->chunk, constant) ||
+        constant->isTarget) {
+        return false;
+    }
+
+    get->bytes[0] = OP_ADD_LOCAL_CONST;
+    get->bytes[2] = constant->bytes[1];
+    get->length = 3;
+    get->line = instr->line;
+    opt->outCount--;
+    return true;
+}
+
+/**
+ * @brief Turns `OP_ADD_LOCAL_CONST n c; OP_SET_LOCAL n; OP_POP` into
+ * `OP_INCREMENT_LOCAL n c`, which updates the slot without touching the stack.
+ */
+static bool fuseIncrementLocal(Optimizer *opt) {
+    if (opt->outCount < 2) {
+        return false;
+    }
+
+    Instr *add = &opt->out[opt->outCount - 2];
+    Instr *set = &opt->out[opt->outCount - 1];
+
+    if (add->bytes[0] != OP_ADD_LOCAL_CONST || set->bytes[0] != OP_SET_LOCAL ||
+        set->bytes[1] != add->bytes[1] || set->isTarget) {
+        return false;
+    }
+
+    add->bytes[0] = OP_INCREMENT_LOCAL;
+    opt->outCount--;
+    return true;
+}
+
+/**
+ * @brief Turns `OP_GET_LOCAL a; OP_GET_LOCAL b; OP_LESS; OP_JUMP_IF_FALSE` into
+ * `OP_LESS_LOCAL_LOCAL_JUMP a b`.
+ *
+ * @details The fused jump never pushes the condition, so this needs both paths
+ * to pop it right away. The pop on the fall through path is dropped and the
+ * jump lands just past the pop at its target, which is kept for other paths.
+ */
+static bool fuseLessJump(Optimizer *opt, Instr *instr, size_t index) {
+    if (opt->outCount < 3) {
+        return false;
+    }
+
+    Instr *left = &opt->out[opt->outCount - 3];
+    Instr *right = &opt->out[opt->outCount - 2];
+    Instr *less = &opt->out[opt->outCount - 1];
+
+    if (left->bytes[0] != OP_GET_LOCAL || right->bytes[0] != OP_GET_LOCAL ||
+        less->bytes[0] != OP_LESS || right->isTarget || less->isTarget) {
+        return false;
+    }
+
+    if (index + 1 >= opt->inCount || opt->in[index + 1].bytes[0] != OP_POP ||
+        opt->in[index + 1].isTarget || instr->target >= opt->inCount ||
+        opt->in[instr->target].bytes[0] != OP_POP) {
+        return false;
+    }
+
+    // The fused jump has no long form. Code only shrinks, so it is enough for
+    // the jump to fit before optimizing.
+    if (opt->in[instr->target].offset - opt->in[index].offset > UINT16_MAX) {
+        return false;
+    }
+
+    left->bytes[0] = OP_LESS_LOCAL_LOCAL_JUMP;
+    left->bytes[2] = right->bytes[1];
+    left->length = 5;
+    left->line = less->line;
+    left->target = instr->target + 1;
+
+    if (left->target < opt->inCount) {
+        opt->in[left->target].isTarget = true;
+    }
+
+    opt->outCount -= 2;
+    opt->skipNext = true;
+    return true;
+}
+
+static bool fuse(Optimizer *opt, Instr *instr, size_t index) {
+    switch (instr->bytes[0]) {
+        case OP_ADD:
+            return fuseAddLocalConst(opt, instr);
+        case OP_POP:
+            return fuseIncrementLocal(opt);
+        case OP_JUMP_IF_FALSE:
+            return fuseLessJump(opt, instr, index);
+        default:
+            return false;
+    }
+}
+
+static bool simplify(VM *vm, Compiler *compiler, Optimizer *opt, Instr *instr,
+                     size_t index) {
+    switch (instr->bytes[0]) {
+        case OP_POP:
+            return removeDeadPush(opt);
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            return foldBinary(vm, compiler, opt, instr);
+        case OP_NOT:
+        case OP_NEGATE:
+            return foldUnary(vm, compiler, opt, instr);
+        case OP_JUMP_IF_FALSE:
+            return fuseNotJump(opt, instr, index);
+        case OP_GET_LOCAL:
+            return removeReload(opt, instr, OP_SET_LOCAL);
+        case OP_GET_UPVALUE:
+            return removeReload(opt, instr, OP_SET_UPVALUE);
+        case OP_GET_GLOBAL:
+            return removeReload(opt, instr, OP_SET_GLOBAL);
+        case OP_SET_LOCAL:
+            return removeSelfStore(opt, instr);
+        default:
+            return false;
+    }
+}
+
+static bool peephole(VM *vm, Compiler *compiler, Optimizer *opt, Instr *instr,
+                     size_t index) {
+    if (instr->isTarget) {
+        return false;
+    }
+
+    if (opt->optimize && simplify(vm, compiler, opt, instr, index)) {
+        return true;
+    }
+
+    return fuse(opt, instr, index);
+}
+
+static size_t decode(VM *vm, Compiler *compiler, Chunk *chunk, Instr **instrs) {
+    size_t count = 0;
+
+    for (size_t offset = 0; offset < chunk->count; count++) {
+        offset += instructionLength(chunk, offset);
+    }
+
+    size_t *indexAt = ALLOCATE(vm, compiler, size_t, chunk->count + 1);
+    Instr *in = ALLOCATE(vm, compiler, Instr, count);
+
+    size_t offset = 0;
+
+    for (size_t idx = 0; idx < count; idx++) {
+        Instr *instr = &in[idx];
+        size_t length = instructionLength(chunk, offset);
+        instr->offset = offset;
+        instr->length = length;
+        instr->line = getLine(chunk, offset);
+        instr->target = NO_TARGET;
+        instr->isTarget = false;
+
+        size_t copied = length < INSTR_MAX_BYTES ? length : INSTR_MAX_BYTES;
+        memcpy(instr->bytes, chunk->code + offset, copied);
+
+        // Rewrites only match the generic local load, it is specialized again on encoding
+        uint8_t op = instr->bytes[0];
+
+        if (op >= OP_GET_LOCAL_0 && op <= OP_GET_LOCAL_3) {
+            instr->bytes[0] = OP_GET_LOCAL;
+            instr->bytes[1] = (uint8_t)(op - OP_GET_LOCAL_0);
+            instr->length = 2;
+        }
+
+        // The compiler emits long jumps only, they are widened again on encoding
+        size_t jump = NO_TARGET;
+
+        if (narrowJump(op) != op) {
+            jump = (size_t)((instr->bytes[1] << 16) | (instr->bytes[2] << 8) |
+                            instr->bytes[3]);
+            instr->bytes[0] = narrowJump(op);
+            instr->length = 3;
+        } else if (isJump(op)) {
+            jump = (size_t)((instr->bytes[length - 2] << 8) | instr->bytes[length - 1]);
+        }
+
+        // Holds the target offset until all instructions are indexed
+        if (jump != NO_TARGET) {
+            instr->target = instr->bytes[0] == OP_LOOP ? offset + length - jump
+                                                       : offset + length + jump;
+        }
+
+        indexAt[offset] = idx;
+        offset += length;
+    }
+
+    indexAt[chunk->count] = count;
+
+    for (size_t idx = 0; idx < count; idx++) {
+        Instr *instr = &in[idx];
+
+        if (instr->target == NO_TARGET) {
+            continue;
+        }
+
+        instr->target = indexAt[instr->target];
+
+        if (instr->target < count) {
+            in[instr->target].isTarget = true;
+        }
+    }
+
+    FREE_ARRAY(vm, compiler, size_t, indexAt, chunk->count + 1);
+
+    *instrs = in;
+    return count;
+}
+
+static void encode(VM *vm, Compiler *compiler, Optimizer *opt) {
+    Chunk *chunk = opt->chunk;
+    size_t *positions = ALLOCATE(vm, compiler, size_t, opt->outCount + 1);
+
+    for (size_t idx = 0; idx < opt->outCount; idx++) {
+        Instr *instr = &opt->out[idx];
+
+        if (instr->bytes[0] == OP_GET_LOCAL && instr->bytes[1] <= 3) {
+            instr->bytes[0] = (uint8_t)(OP_GET_LOCAL_0 + instr->bytes[1]);
+            instr->length = 1;
+        }
+    }
+
+    // Jumps start out short and are widened while their offset doesn't fit.
+    // Widening only ever moves code apart, so this settles.
+    for (bool widened = true; widened;) {
+        size_t position = 0;
+        widened = false;
+
+        for (size_t idx = 0; idx < opt->outCount; idx++) {
+            positions[idx] = position;
+            position += opt->out[idx].length;
+        }
+
+        positions[opt->outCount] = position;
+
+        for (size_t idx = 0; idx < opt->outCount; idx++) {
+            Instr *instr = &opt->out[idx];
+            uint8_t op = instr->bytes[0];
+
+            if (instr->target == NO_TARGET || widenJump(op) == op) {
+                continue;
+            }
+
+            size_t target = positions[opt->newIndex[instr->target]];
+            size_t next = positions[idx] + instr->length;
+
+            if ((op == OP_LOOP ? next - target : target - next) > UINT16_MAX) {
+                instr->bytes[0] = widenJump(op);
+                instr->length = 4;
+                widened = true;
+            }
+        }
+    }
+
+    Chunk rebuilt;
+    initChunk(&rebuilt);
+
+    for (size_t idx = 0; idx < opt->outCount; idx++) {
+        Instr *instr = &opt->out[idx];
+
+        if (instr->target != NO_TARGET) {
+            size_t target = positions[opt->newIndex[instr->target]];
+            size_t next = positions[idx] + instr->length;
+            uint8_t op = narrowJump(instr->bytes[0]);
+            size_t jump = op == OP_LOOP ? next - target : target - next;
+
+            if (op != instr->bytes[0]) {
+                instr->bytes[1] = (uint8_t)((jump >> 16) & 0xff);
+                instr->bytes[2] = (uint8_t)((jump >> 8) & 0xff);
+                instr->bytes[3] = (uint8_t)(jump & 0xff);
+            } else {
+                size_t jumpAt = instr->length - 2;
+                instr->bytes[jumpAt] = (uint8_t)((jump >> 8) & 0xff);
+                instr->bytes[jumpAt + 1] = (uint8_t)(jump & 0xff);
+            }
+        }
+
+        const uint8_t *bytes =
+            instr->length <= INSTR_MAX_BYTES ? instr->bytes : chunk->code + instr->offset;
+
+        for (size_t byte = 0; byte < instr->length; byte++) {
+            writeChunk(vm, compiler, &rebuilt, bytes[byte], instr->line);
+        }
+    }
+
+    FREE_ARRAY(vm, compiler, size_t, positions, opt->outCount + 1);
+    FREE_ARRAY(vm, compiler, uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(vm, compiler, LineStart, chunk->lines, chunk->lineCapacity);
+
+    chunk->count = rebuilt.count;
+    chunk->capacity = rebuilt.capacity;
+    chunk->code = rebuilt.code;
+    chunk->lineCount = rebuilt.lineCount;
+    chunk->lineCapacity = rebuilt.lineCapacity;
+    chunk->lines = rebuilt.lines;
+}
+
+void optimizeChunk(VM *vm, Compiler *compiler, Chunk *chunk) {
+    if (chunk->count == 0) {
+        return;
+    }
+
+    Optimizer opt;
+    opt.chunk = chunk;
+    opt.inCount = decode(vm, compiler, chunk, &opt.in);
+    opt.out = ALLOCATE(vm, compiler, Instr, opt.inCount);
+    opt.outCount = 0;
+    opt.newIndex = ALLOCATE(vm, compiler, size_t, opt.inCount + 1);
+    opt.pendingTarget = false;
+    opt.skipNext = false;
+    opt.optimize = vm->optimize;
+
+    for (size_t idx = 0; idx < opt.inCount; idx++) {
+        if (opt.skipNext) {
+            opt.skipNext = false;
+            opt.newIndex[idx] = opt.outCount;
+            continue;
+        }
+
+        Instr instr = opt.in[idx];
+        instr.isTarget = instr.isTarget || opt.pendingTarget;
+        opt.pendingTarget = false;
+        opt.newIndex[idx] = opt.outCount;
+
+        if (!peephole(vm, compiler, &opt, &instr, idx)) {
+            opt.out[opt.outCount++] = instr;
+        }
+    }
+
+    opt.newIndex[opt.inCount] = opt.outCount;
+
+    encode(vm, compiler, &opt);
+
+    FREE_ARRAY(vm, compiler, Instr, opt.in, opt.inCount);
+    FREE_ARRAY(vm, compiler, Instr, opt.out, opt.inCount);
+    FREE_ARRAY(vm, compiler, size_t, opt.newIndex, opt.inCount + 1);
+}
@@ -0,0 +1,104 @@
+#include <stdlib.h>
+
+#include "common.h"
+#include "pool.h"
+
+// GCC and newer clang define __SANITIZE_ADDRESS__, older clang only answers
+// __has_feature(), which GCC may not have at all so it gets its own #if
+#ifdef __SANITIZE_ADDRESS__
+#define POOL_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define POOL_ASAN
+#endif
+#endif
+
+#ifdef POOL_ASAN
+#include <sanitizer/asan_interface.h>
+#else
+#define ASAN_POISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+#define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+#endif // POOL_ASAN
+
+static size_t sizeClass(size_t size) { return (size + POOL_GRANULE - 1) / POOL_GRANULE - 1; }
+
+void initPool(Pool *pool) {
+    for (size_t idx = 0; idx < POOL_CLASSES; idx++) {
+        pool->classes[idx].freeList = NULL;
+        pool->classes[idx].bump = NULL;
+        pool->classes[idx].end = NULL;
+    }
+
+    pool->slabs = NULL;
+}
+
+static bool addSlab(Pool *pool, PoolClass *bin) {
+    PoolSlab *slab = (PoolSlab *)malloc(POOL_SLAB_SIZE);
+
+    if (slab == NULL) {
+        return false;
+    }
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    // Header takes a whole granule so blocks stay suitably aligned
+    bin->bump = (char *)slab + POOL_GRANULE;
+    bin->end = (char *)slab + POOL_SLAB_SIZE;
+    ASAN_POISON_MEMORY_REGION(bin->bump, (size_t)(bin->end - bin->bump));
+    return true;
+}
+
+void *poolAlloc(Pool *pool, size_t size) {
+    if (size > POOL_MAX_SIZE) {
+        return malloc(size);
+    }
+
+    size_t index = sizeClass(size);
+    size_t blockSize = (index + 1) * POOL_GRANULE;
+    PoolClass *bin = &pool->classes[index];
+    void *block;
+
+    if (bin->freeList != NULL) {
+        block = bin->freeList;
+        ASAN_UNPOISON_MEMORY_REGION(block, blockSize);
+        bin->freeList = bin->freeList->next;
+        return block;
+    }
+
+    if ((size_t)(bin->end - bin->bump) < blockSize && !addSlab(pool, bin)) {
+        return NULL;
+    }
+
+    block = bin->bump;
+    bin->bump += blockSize;
+    ASAN_UNPOISON_MEMORY_REGION(block, blockSize);
+    return block;
+}
+
+void poolFree(Pool *pool, void *pointer, size_t size) {
+    if (size > POOL_MAX_SIZE) {
+        free(pointer);
+        return;
+    }
+
+    size_t index = sizeClass(size);
+    PoolClass *bin = &pool->classes[index];
+    PoolBlock *block = (PoolBlock *)pointer;
+
+    block->next = bin->freeList;
+    bin->freeList = block;
+    ASAN_POISON_MEMORY_REGION(block, (index + 1) * POOL_GRANULE);
+}
+
+void freePool(Pool *pool) {
+    PoolSlab *slab = pool->slabs;
+
+    while (slab != NULL) {
+        PoolSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+
+    initPool(pool);
+}
@@ -0,0 +1,364 @@
+// POSIX timers and clocks aren't part of strict C99 headers
+#define _DEFAULT_SOURCE
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "debug.h"
+#include "hash.h"
+#include "memory.h"
+#include "object.h"
+#include "profile.h"
+#include "vm.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PROFILE_TIMER
+#include <sys/time.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PROFILE_TSC
+#include <x86intrin.h>
+#endif
+
+// Set by the sampling timer, cleared by the VM taking the sample
+static volatile sig_atomic_t sampleDue = 0;
+
+void initProfiler(Profiler *profiler) {
+    memset(profiler->counts, 0, sizeof(profiler->counts));
+    memset(profiler->cycles, 0, sizeof(profiler->cycles));
+    profiler->countdown = PROFILE_TIMING_PERIOD;
+    profiler->random = 1;
+    profiler->previous = -1;
+    profiler->start = 0;
+
+    profiler->samples = NULL;
+    profiler->sampleCount = 0;
+    profiler->sampleCapacity = 0;
+    profiler->sampleTotal = 0;
+}
+
+void freeProfiler(Profiler *profiler) {
+    for (size_t idx = 0; idx < profiler->sampleCapacity; idx++) {
+        free(profiler->samples[idx].frames);
+    }
+
+    free(profiler->samples);
+    initProfiler(profiler);
+}
+
+#ifdef PROFILE_TIMER
+static void requestSample(int signal) {
+    (void)signal;
+    sampleDue = 1;
+}
+#endif // PROFILE_TIMER
+
+bool startSampling(uint32_t interval) {
+#ifdef PROFILE_TIMER
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestSample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGPROF, &action, NULL) != 0) {
+        return false;
+    }
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = (time_t)(interval / 1000000);
+    timer.it_interval.tv_usec = (suseconds_t)(interval % 1000000);
+    timer.it_value = timer.it_interval;
+
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+#else
+    (void)interval;
+    return false;
+#endif // PROFILE_TIMER
+}
+
+void stopSampling(void) {
+#ifdef PROFILE_TIMER
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+#endif // PROFILE_TIMER
+
+    sampleDue = 0;
+}
+
+static uint64_t readCycles(void) {
+#if defined(PROFILE_TSC)
+    return __rdtsc();
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#elif defined(PROFILE_TIMER)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#else
+    return (uint64_t)clock();
+#endif
+}
+
+static size_t cycleBucket(uint64_t cycles) {
+#if defined(__GNUC__) || defined(__clang__)
+    size_t bucket = cycles == 0 ? 0 : (size_t)(63 - __builtin_clzll(cycles));
+#else
+    size_t bucket = 0;
+
+    while (cycles > 1 && bucket < PROFILE_BUCKETS - 1) {
+        cycles >>= 1;
+        bucket++;
+    }
+#endif
+
+    return bucket < PROFILE_BUCKETS ? bucket : PROFILE_BUCKETS - 1;
+}
+
+/**
+ * @brief Appends `count` characters to the growable string `*buffer`.
+ */
+static bool appendChars(char **buffer, size_t *length, size_t *capacity,
+                        const char *chars, size_t count) {
+    if (*length + count + 1 > *capacity) {
+        size_t newCapacity = *capacity;
+
+        while (*length + count + 1 > newCapacity) {
+            newCapacity = GROW_CAPACITY(newCapacity);
+        }
+
+        char *grown = (char *)realloc(*buffer, newCapacity);
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        *buffer = grown;
+        *capacity = newCapacity;
+    }
+
+    memcpy(*buffer + *length, chars, count);
+    *length += count;
+    (*buffer)[*length] = '\0';
+    return true;
+}
+
+/**
+ * @brief Folds the call stack of `vm` into `script;outer:12;inner:3`, naming
+ * each frame after its function and the line it is at.
+ *
+ * @returns the folded frames allocated with `malloc()`, NULL if out of memory
+ */
+static char *foldStack(VM *vm, size_t *length) {
+    char *buffer = NULL;
+    size_t capacity = 0;
+    *length = 0;
+
+    for (size_t idx = 0; idx < vm->frameCount; idx++) {
+        CallFrame *frame = &vm->frames[idx];
+        ObjFunction *func = frame->closure->func;
+        size_t line = getLine(&func->chunk, (size_t)(frame->ip - func->chunk.code - 1));
+
+        const char *name = func->name == NULL ? "script" : func->name->chars;
+        char suffix[32];
+        int suffixLength = snprintf(suffix, sizeof(suffix), ":%zu", line);
+
+        if ((idx > 0 && !appendChars(&buffer, length, &capacity, ";", 1)) ||
+            !appendChars(&buffer, length, &capacity, name, strlen(name)) ||
+            !appendChars(&buffer, length, &capacity, suffix, (size_t)suffixLength)) {
+            free(buffer);
+            return NULL;
+        }
+    }
+
+    return buffer;
+}
+
+static ProfileSample *findSample(ProfileSample *samples, size_t capacity,
+                                 const char *frames, size_t length, uint64_t hash) {
+    size_t index = (size_t)hash & (capacity - 1);
+
+    for (;;) {
+        ProfileSample *sample = &samples[index];
+
+        if (sample->frames == NULL ||
+            (sample->hash == hash && strncmp(sample->frames, frames, length + 1) == 0)) {
+            return sample;
+        }
+
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static bool growSamples(Profiler *profiler) {
+    size_t capacity = GROW_CAPACITY(profiler->sampleCapacity);
+    ProfileSample *samples = (ProfileSample *)calloc(capacity, sizeof(ProfileSample));
+
+    if (samples == NULL) {
+        return false;
+    }
+
+    for (size_t idx = 0; idx < profiler->sampleCapacity; idx++) {
+        ProfileSample *old = &profiler->samples[idx];
+
+        if (old->frames != NULL) {
+            *findSample(samples, capacity, old->frames, strlen(old->frames), old->hash) =
+                *old;
+        }
+    }
+
+    free(profiler->samples);
+    profiler->samples = samples;
+    profiler->sampleCapacity = capacity;
+    return true;
+}
+
+static void sampleStack(VM *vm, Profiler *profiler) {
+    if ((profiler->sampleCount + 1) * 4 > profiler->sampleCapacity * 3 &&
+        !growSamples(profiler)) {
+        return;
+    }
+
+    size_t length;
+    char *frames = foldStack(vm, &length);
+
+    if (frames == NULL) {
+        return;
+    }
+
+    uint64_t hash = hashChars(frames, length);
+    ProfileSample *sample =
+        findSample(profiler->samples, profiler->sampleCapacity, frames, length, hash);
+
+    if (sample->frames == NULL) {
+        sample->frames = frames;
+        sample->hash = hash;
+        sample->count = 0;
+        profiler->sampleCount++;
+    } else {
+        free(frames);
+    }
+
+    sample->count++;
+    profiler->sampleTotal++;
+}
+
+/**
+ * @brief Finishes timing the previous instruction and, once the countdown to
+ * the next timed instruction runs out, starts timing `opcode` and takes a
+ * stack sample if one is due.
+ */
+static void profileTick(VM *vm, Profiler *profiler, uint8_t opcode) {
+    uint64_t now = readCycles();
+
+    if (profiler->previous >= 0) {
+        profiler->cycles[profiler->previous][cycleBucket(now - profiler->start)]++;
+        profiler->previous = -1;
+    }
+
+    if (profiler->countdown > 0) {
+        return;
+    }
+
+    // Gaps uniform in [1, 2 * PROFILE_TIMING_PERIOD - 1], from a 64 bit LCG
+    profiler->random = profiler->random * 6364136223846793005u + 1442695040888963407u;
+    profiler->countdown =
+        1 + (uint32_t)((profiler->random >> 33) % (2 * PROFILE_TIMING_PERIOD - 1));
+
+    if (sampleDue) {
+        sampleDue = 0;
+        sampleStack(vm, profiler);
+        // Don't charge taking the sample to the instruction
+        now = readCycles();
+    }
+
+    profiler->previous = opcode;
+    profiler->start = now;
+}
+
+void profileInstruction(VM *vm, Profiler *profiler, uint8_t opcode) {
+    profiler->counts[opcode]++;
+
+    if (--profiler->countdown == 0 || profiler->previous >= 0) {
+        profileTick(vm, profiler, opcode);
+    }
+}
+
+void writeFoldedStacks(Profiler *profiler, FILE *out) {
+    for (size_t idx = 0; idx < profiler->sampleCapacity; idx++) {
+        ProfileSample *sample = &profiler->samples[idx];
+
+        if (sample->frames != NULL) {
+            fprintf(out, "%s %" PRIu64 "\n", sample->frames, sample->count);
+        }
+    }
+}
+
+typedef struct {
+    uint8_t opcode;
+    uint64_t count;
+} OpcodeCount;
+
+static int compareCounts(const void *a, const void *b) {
+    const OpcodeCount *left = (const OpcodeCount *)a;
+    const OpcodeCount *right = (const OpcodeCount *)b;
+
+    if (left->count != right->count) {
+        return left->count < right->count ? 1 : -1;
+    }
+
+    return left->opcode < right->opcode ? -1 : 1;
+}
+
+void writeOpcodeProfile(Profiler *profiler, FILE *out) {
+    OpcodeCount executed[PROFILE_OPCODES];
+    size_t count = 0;
+    uint64_t total = 0;
+
+    for (size_t opcode = 0; opcode < PROFILE_OPCODES; opcode++) {
+        if (profiler->counts[opcode] > 0) {
+            executed[count].opcode = (uint8_t)opcode;
+            executed[count].count = profiler->counts[opcode];
+            total += profiler->counts[opcode];
+            count++;
+        }
+    }
+
+    qsort(executed, count, sizeof(OpcodeCount), compareCounts);
+
+#ifdef PROFILE_TSC
+    const char *unit = "cycles";
+#else
+    const char *unit = "ticks";
+#endif // PROFILE_TSC
+
+    fprintf(out, "%" PRIu64 " instructions, %" PRIu64 " stack samples\n", total,
+            profiler->sampleTotal);
+    fprintf(out, "%-26s %14s %7s  %s per instruction, 1 in %d timed, by power of two\n",
+            "opcode", "count", "share", unit, PROFILE_TIMING_PERIOD);
+
+    for (size_t idx = 0; idx < count; idx++) {
+        uint8_t opcode = executed[idx].opcode;
+        fprintf(out, "%-26s %14" PRIu64 " %6.2f%% ", opcodeName(opcode),
+                executed[idx].count, 100.0 * (double)executed[idx].count / (double)total);
+
+        for (size_t bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+            if (profiler->cycles[opcode][bucket] > 0) {
+                fprintf(out, " 2^%zu:%" PRIu64, bucket, profiler->cycles[opcode][bucket]);
+            }
+        }
+
+        fprintf(out, "\n");
+    }
+}
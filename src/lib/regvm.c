@@ -0,0 +1,678 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "memory.h"
+#include "regvm.h"
+#include "value.h"
+
+/**
+ * @brief Marks stack offsets whose depth isn't known yet.
+ */
+#define NO_DEPTH SIZE_MAX
+
+/**
+ * @brief Marks the absence of a register instruction.
+ */
+#define NO_INSTR SIZE_MAX
+
+/**
+ * @brief Forward jump waiting for its target to be translated.
+ */
+typedef struct {
+    size_t instr;
+    size_t target;
+} JumpFixup;
+
+/**
+ * @brief State of a stack to register code translation.
+ *
+ * @details The stack is simulated while translating: `operands[p]` is the RK
+ * operand currently holding the value of stack slot `p`. A slot holding
+ * anything but its own register is a load of a local or constant that hasn't
+ * been copied into the slot yet, consumers read the operand directly instead.
+ * `labels` maps stack code offsets to register instruction indices and
+ * `depths` the expected stack depth at each jump target. `lastResult` is the
+ * last emitted instruction while its only effect is writing a temporary,
+ * which lets assignments and branches take it over.
+ */
+typedef struct {
+    Chunk *chunk;
+    RegChunk *reg;
+    uint16_t operands[UINT8_COUNT];
+    size_t depth;
+    size_t maxDepth;
+    size_t line;
+    size_t lastResult;
+    bool *isTarget;
+    size_t *depths;
+    size_t *labels;
+    JumpFixup *fixups;
+    size_t fixupCount;
+    size_t fixupCapacity;
+} Translator;
+
+void initRegChunk(RegChunk *reg) {
+    reg->count = 0;
+    reg->capacity = 0;
+    reg->code = NULL;
+    reg->lineCount = 0;
+    reg->lineCapacity = 0;
+    reg->lines = NULL;
+    reg->frameSize = 0;
+}
+
+void freeRegChunk(VM *vm, Compiler *compiler, RegChunk *reg) {
+    FREE_ARRAY(vm, compiler, RegInstr, reg->code, reg->capacity);
+    FREE_ARRAY(vm, compiler, LineStart, reg->lines, reg->lineCapacity);
+    initRegChunk(reg);
+}
+
+size_t getRegLine(RegChunk *reg, size_t index) {
+    return findLine(reg->lines, reg->lineCount, index);
+}
+
+static size_t emitInstr(VM *vm, Compiler *compiler, Translator *tr, RegInstr instr) {
+    RegChunk *reg = tr->reg;
+
+    if (reg->capacity < reg->count + 1) {
+        size_t oldCapacity = reg->capacity;
+        reg->capacity = GROW_CAPACITY(oldCapacity);
+        reg->code =
+            GROW_ARRAY(vm, compiler, RegInstr, reg->code, oldCapacity, reg->capacity);
+    }
+
+    reg->code[reg->count] = instr;
+    tr->lastResult = NO_INSTR;
+
+    // Only a change of line starts a new run
+    if (reg->lineCount == 0 || reg->lines[reg->lineCount - 1].line != tr->line) {
+        if (reg->lineCapacity < reg->lineCount + 1) {
+            size_t oldCapacity = reg->lineCapacity;
+            reg->lineCapacity = GROW_CAPACITY(oldCapacity);
+            reg->lines = GROW_ARRAY(vm, compiler, LineStart, reg->lines, oldCapacity,
+                                    reg->lineCapacity);
+        }
+
+        LineStart *lineStart = &reg->lines[reg->lineCount++];
+        lineStart->offset = reg->count;
+        lineStart->line = tr->line;
+    }
+
+    return reg->count++;
+}
+
+static size_t emit(VM *vm, Compiler *compiler, Translator *tr, uint8_t op, size_t a,
+                   uint16_t b, uint16_t c) {
+    RegInstr instr = {op, (uint8_t)a, b, c, 0};
+    return emitInstr(vm, compiler, tr, instr);
+}
+
+/**
+ * @brief Emits an instruction whose only effect is writing register `a`.
+ */
+static void emitResult(VM *vm, Compiler *compiler, Translator *tr, uint8_t op, size_t a,
+                       uint16_t b, uint16_t c) {
+    tr->lastResult = emit(vm, compiler, tr, op, a, b, c);
+}
+
+/**
+ * @brief Takes back `lastResult` if it wrote the temporary in stack slot `slot`.
+ */
+static bool takeResult(Translator *tr, size_t slot, RegInstr *instr) {
+    if (tr->lastResult == NO_INSTR || tr->reg->code[tr->lastResult].a != slot) {
+        return false;
+    }
+
+    *instr = tr->reg->code[--tr->reg->count];
+    tr->lastResult = NO_INSTR;
+    return true;
+}
+
+static bool pushOperand(Translator *tr, uint16_t operand) {
+    if (tr->depth == UINT8_COUNT) {
+        return false;
+    }
+
+    tr->operands[tr->depth++] = operand;
+
+    if (tr->depth > tr->maxDepth) {
+        tr->maxDepth = tr->depth;
+    }
+
+    return true;
+}
+
+static void materialize(VM *vm, Compiler *compiler, Translator *tr, size_t slot) {
+    if (tr->operands[slot] != slot) {
+        emit(vm, compiler, tr, REG_MOVE, slot, tr->operands[slot], 0);
+        tr->operands[slot] = (uint16_t)slot;
+    }
+}
+
+/**
+ * @brief Copies every pending load into its slot, as control flow merges
+ * expect all values in place.
+ */
+static void materializeAll(VM *vm, Compiler *compiler, Translator *tr) {
+    for (size_t slot = 0; slot < tr->depth; slot++) {
+        materialize(vm, compiler, tr, slot);
+    }
+}
+
+/**
+ * @brief Copies pending loads of register `reg` into their slots before it is
+ * overwritten.
+ */
+static void beforeWrite(VM *vm, Compiler *compiler, Translator *tr, size_t reg) {
+    for (size_t slot = 0; slot < tr->depth; slot++) {
+        if (slot != reg && tr->operands[slot] == reg) {
+            materialize(vm, compiler, tr, slot);
+        }
+    }
+}
+
+static bool setTargetDepth(Translator *tr, size_t target, size_t depth) {
+    if (tr->depths[target] == NO_DEPTH) {
+        tr->depths[target] = depth;
+    }
+
+    return tr->depths[target] == depth;
+}
+
+static void addFixup(VM *vm, Compiler *compiler, Translator *tr, size_t instr,
+                     size_t target) {
+    if (tr->fixupCapacity < tr->fixupCount + 1) {
+        size_t oldCapacity = tr->fixupCapacity;
+        tr->fixupCapacity = GROW_CAPACITY(oldCapacity);
+        tr->fixups = GROW_ARRAY(vm, compiler, JumpFixup, tr->fixups, oldCapacity,
+                                tr->fixupCapacity);
+    }
+
+    tr->fixups[tr->fixupCount].instr = instr;
+    tr->fixups[tr->fixupCount].target = target;
+    tr->fixupCount++;
+}
+
+static bool setJump(Translator *tr, size_t instr, size_t label) {
+    intmax_t jump = (intmax_t)label - (intmax_t)instr - 1;
+
+    if (jump < INT16_MIN || jump > INT16_MAX) {
+        return false;
+    }
+
+    tr->reg->code[instr].d = (int16_t)jump;
+    return true;
+}
+
+static size_t jumpTarget(Chunk *chunk, size_t offset) {
+    size_t length = instructionLength(chunk, offset);
+    size_t jump = (size_t)((chunk->code[offset + length - 2] << 8) |
+                           chunk->code[offset + length - 1]);
+    size_t next = offset + length;
+    return chunk->code[offset] == OP_LOOP ? next - jump : next + jump;
+}
+
+static bool isSupported(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_GET_LOCAL:
+        case OP_GET_LOCAL_0:
+        case OP_GET_LOCAL_1:
+        case OP_GET_LOCAL_2:
+        case OP_GET_LOCAL_3:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_UPVALUE_LONG:
+        case OP_SET_UPVALUE_LONG:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_PRINT:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_CALL:
+        case OP_RETURN:
+        case OP_ADD_LOCAL_CONST:
+        case OP_INCREMENT_LOCAL:
+        case OP_LESS_LOCAL_LOCAL_JUMP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool isJump(uint8_t op) {
+    return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE ||
+           op == OP_LOOP || op == OP_LESS_LOCAL_LOCAL_JUMP;
+}
+
+/**
+ * @brief Checks whether both successors of the conditional jump at `offset`
+ * pop the condition right away.
+ */
+static bool popsCondition(Translator *tr, size_t offset) {
+    Chunk *chunk = tr->chunk;
+    size_t next = offset + 3;
+    size_t target = jumpTarget(chunk, offset);
+
+    return next < chunk->count && chunk->code[next] == OP_POP && !tr->isTarget[next] &&
+           target < chunk->count && chunk->code[target] == OP_POP;
+}
+
+/**
+ * @brief Checks whether `lastResult` is a comparison writing stack slot `slot`.
+ */
+static bool isCompare(Translator *tr, size_t slot) {
+    if (tr->lastResult == NO_INSTR) {
+        return false;
+    }
+
+    RegInstr *instr = &tr->reg->code[tr->lastResult];
+    return instr->a == slot &&
+           (instr->op == REG_EQUAL || instr->op == REG_GREATER || instr->op == REG_LESS);
+}
+
+static uint8_t branchFor(uint8_t compare, bool jumpIfTrue) {
+    switch (compare) {
+        case REG_EQUAL:
+            return jumpIfTrue ? REG_JUMP_IF_EQUAL : REG_JUMP_IF_NOT_EQUAL;
+        case REG_GREATER:
+            return jumpIfTrue ? REG_JUMP_IF_GREATER : REG_JUMP_IF_NOT_GREATER;
+        case REG_LESS:
+            return jumpIfTrue ? REG_JUMP_IF_LESS : REG_JUMP_IF_NOT_LESS;
+        default:
+            return jumpIfTrue ? REG_JUMP_IF_TRUE : REG_JUMP_IF_FALSE;
+    }
+}
+
+/**
+ * @brief Translates a conditional jump.
+ *
+ * @details When both successors pop the condition it is consumed by the jump
+ * itself, the pop on the fall through path is skipped and the jump lands
+ * past the pop at its target. A comparison computing the condition is then
+ * merged into the jump.
+ *
+ * @returns the number of stack code bytes consumed or 0 on failure
+ */
+static size_t translateBranch(VM *vm, Compiler *compiler, Translator *tr, size_t offset) {
+    Chunk *chunk = tr->chunk;
+    size_t target = jumpTarget(chunk, offset);
+    bool jumpIfTrue = chunk->code[offset] == OP_JUMP_IF_TRUE;
+
+    if (!popsCondition(tr, offset)) {
+        materializeAll(vm, compiler, tr);
+        size_t jump = emit(vm, compiler, tr, branchFor(REG_JUMP, jumpIfTrue), 0,
+                           (uint16_t)(tr->depth - 1), 0);
+        addFixup(vm, compiler, tr, jump, target);
+        return setTargetDepth(tr, target, tr->depth) ? 3 : 0;
+    }
+
+    size_t condition = tr->depth - 1;
+    uint8_t op = branchFor(REG_JUMP, jumpIfTrue);
+    uint16_t b = tr->operands[condition];
+    uint16_t c = 0;
+    RegInstr compare;
+
+    if (isCompare(tr, condition) && takeResult(tr, condition, &compare)) {
+        op = branchFor(compare.op, jumpIfTrue);
+        b = compare.b;
+        c = compare.c;
+    }
+
+    tr->depth = condition;
+    materializeAll(vm, compiler, tr);
+
+    size_t jump = emit(vm, compiler, tr, op, 0, b, c);
+    addFixup(vm, compiler, tr, jump, target + 1);
+
+    if (!setTargetDepth(tr, target, tr->depth + 1) ||
+        !setTargetDepth(tr, target + 1, tr->depth)) {
+        return 0;
+    }
+
+    return 4;
+}
+
+/**
+ * @brief Translates an assignment of the stack top to local `slot`.
+ *
+ * @details When the value was just computed into its temporary the
+ * instruction computing it writes the local instead.
+ */
+static void translateSetLocal(VM *vm, Compiler *compiler, Translator *tr, size_t slot) {
+    size_t top = tr->depth - 1;
+    RegInstr instr;
+
+    if (takeResult(tr, top, &instr)) {
+        beforeWrite(vm, compiler, tr, slot);
+        instr.a = (uint8_t)slot;
+        emitInstr(vm, compiler, tr, instr);
+        tr->operands[slot] = (uint16_t)slot;
+        tr->operands[top] = (uint16_t)slot;
+        return;
+    }
+
+    beforeWrite(vm, compiler, tr, slot);
+    emit(vm, compiler, tr, REG_MOVE, slot, tr->operands[top], 0);
+    tr->operands[slot] = (uint16_t)slot;
+}
+
+static uint16_t readShort(Chunk *chunk, size_t offset) {
+    return (uint16_t)((chunk->code[offset] << 8) | chunk->code[offset + 1]);
+}
+
+/**
+ * @brief Translates the stack instruction at `offset`.
+ *
+ * @returns the number of stack code bytes consumed or 0 on failure
+ */
+static size_t translateInstruction(VM *vm, Compiler *compiler, Translator *tr,
+                                   size_t offset) {
+    Chunk *chunk = tr->chunk;
+    uint8_t *code = chunk->code + offset;
+    size_t length = instructionLength(chunk, offset);
+    size_t depth = tr->depth;
+
+    switch (code[0]) {
+        case OP_CONSTANT:
+            return pushOperand(tr, (uint16_t)(RK_CONSTANT + code[1])) ? length : 0;
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE: {
+            uint8_t op = code[0] == OP_NIL    ? REG_NIL
+                         : code[0] == OP_TRUE ? REG_TRUE
+                                              : REG_FALSE;
+
+            if (!pushOperand(tr, (uint16_t)depth)) {
+                return 0;
+            }
+
+            emitResult(vm, compiler, tr, op, depth, 0, 0);
+            return length;
+        }
+        case OP_POP:
+            tr->depth -= 1;
+            return length;
+        case OP_GET_LOCAL:
+            return pushOperand(tr, tr->operands[code[1]]) ? length : 0;
+        case OP_GET_LOCAL_0:
+        case OP_GET_LOCAL_1:
+        case OP_GET_LOCAL_2:
+        case OP_GET_LOCAL_3:
+            return pushOperand(tr, tr->operands[code[0] - OP_GET_LOCAL_0]) ? length : 0;
+        case OP_SET_LOCAL:
+            translateSetLocal(vm, compiler, tr, code[1]);
+            return length;
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_GET_UPVALUE_LONG: {
+            uint8_t op = code[0] == OP_GET_GLOBAL ? REG_GET_GLOBAL : REG_GET_UPVALUE;
+            uint16_t index =
+                code[0] == OP_GET_UPVALUE ? code[1] : readShort(chunk, offset + 1);
+
+            if (!pushOperand(tr, (uint16_t)depth)) {
+                return 0;
+            }
+
+            emitResult(vm, compiler, tr, op, depth, index, 0);
+            return length;
+        }
+        case OP_DEFINE_GLOBAL:
+            emit(vm, compiler, tr, REG_DEFINE_GLOBAL, 0, readShort(chunk, offset + 1),
+                 tr->operands[depth - 1]);
+            tr->depth -= 1;
+            return length;
+        case OP_SET_GLOBAL:
+            emit(vm, compiler, tr, REG_SET_GLOBAL, 0, readShort(chunk, offset + 1),
+                 tr->operands[depth - 1]);
+            return length;
+        case OP_SET_UPVALUE:
+        case OP_SET_UPVALUE_LONG: {
+            uint16_t index =
+                code[0] == OP_SET_UPVALUE ? code[1] : readShort(chunk, offset + 1);
+            emit(vm, compiler, tr, REG_SET_UPVALUE, 0, index, tr->operands[depth - 1]);
+            return length;
+        }
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE: {
+            // clang-format off
+            static const uint8_t binaryOps[] = {
+                [OP_EQUAL]    = REG_EQUAL,
+                [OP_GREATER]  = REG_GREATER,
+                [OP_LESS]     = REG_LESS,
+                [OP_ADD]      = REG_ADD,
+                [OP_SUBTRACT] = REG_SUBTRACT,
+                [OP_MULTIPLY] = REG_MULTIPLY,
+                [OP_DIVIDE]   = REG_DIVIDE,
+            };
+            // clang-format on
+
+            size_t dest = depth - 2;
+            emitResult(vm, compiler, tr, binaryOps[code[0]], dest, tr->operands[dest],
+                       tr->operands[depth - 1]);
+            tr->operands[dest] = (uint16_t)dest;
+            tr->depth -= 1;
+            return length;
+        }
+        case OP_NOT:
+        case OP_NEGATE: {
+            size_t dest = depth - 1;
+            emitResult(vm, compiler, tr, code[0] == OP_NOT ? REG_NOT : REG_NEGATE, dest,
+                       tr->operands[dest], 0);
+            tr->operands[dest] = (uint16_t)dest;
+            return length;
+        }
+        case OP_PRINT:
+            emit(vm, compiler, tr, REG_PRINT, 0, tr->operands[depth - 1], 0);
+            tr->depth -= 1;
+            return length;
+        case OP_JUMP: {
+            size_t target = jumpTarget(chunk, offset);
+            materializeAll(vm, compiler, tr);
+            addFixup(vm, compiler, tr, emit(vm, compiler, tr, REG_JUMP, 0, 0, 0), target);
+            return setTargetDepth(tr, target, tr->depth) ? length : 0;
+        }
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            return translateBranch(vm, compiler, tr, offset);
+        case OP_LOOP: {
+            size_t target = jumpTarget(chunk, offset);
+            materializeAll(vm, compiler, tr);
+            size_t jump = emit(vm, compiler, tr, REG_JUMP, 0, 0, 0);
+
+            if (tr->depths[target] != tr->depth || !setJump(tr, jump, tr->labels[target])) {
+                return 0;
+            }
+
+            return length;
+        }
+        case OP_CALL: {
+            size_t argCount = code[1];
+            size_t callee = depth - argCount - 1;
+
+            for (size_t slot = callee; slot < depth; slot++) {
+                materialize(vm, compiler, tr, slot);
+            }
+
+            emit(vm, compiler, tr, REG_CALL, callee, (uint16_t)argCount, 0);
+            tr->depth = callee + 1;
+            return length;
+        }
+        case OP_RETURN:
+            emit(vm, compiler, tr, REG_RETURN, 0, tr->operands[depth - 1], 0);
+            tr->depth -= 1;
+            return length;
+        case OP_ADD_LOCAL_CONST:
+            if (!pushOperand(tr, (uint16_t)depth)) {
+                return 0;
+            }
+
+            emitResult(vm, compiler, tr, REG_ADD, depth, tr->operands[code[1]],
+                       (uint16_t)(RK_CONSTANT + code[2]));
+            return length;
+        case OP_INCREMENT_LOCAL:
+            beforeWrite(vm, compiler, tr, code[1]);
+            emit(vm, compiler, tr, REG_ADD, code[1], tr->operands[code[1]],
+                 (uint16_t)(RK_CONSTANT + code[2]));
+            tr->operands[code[1]] = code[1];
+            return length;
+        case OP_LESS_LOCAL_LOCAL_JUMP: {
+            size_t target = jumpTarget(chunk, offset);
+            materializeAll(vm, compiler, tr);
+            size_t jump = emit(vm, compiler, tr, REG_JUMP_IF_NOT_LESS, 0, code[1], code[2]);
+            addFixup(vm, compiler, tr, jump, target);
+            return setTargetDepth(tr, target, tr->depth) ? length : 0;
+        }
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Finds jump targets, including the spots past a popped condition
+ * branches may be redirected to.
+ */
+static bool markTargets(Translator *tr) {
+    Chunk *chunk = tr->chunk;
+
+    for (size_t offset = 0; offset < chunk->count;
+         offset += instructionLength(chunk, offset)) {
+        uint8_t op = chunk->code[offset];
+
+        if (!isSupported(op)) {
+            return false;
+        }
+
+        if (!isJump(op)) {
+            continue;
+        }
+
+        size_t target = jumpTarget(chunk, offset);
+        tr->isTarget[target] = true;
+
+        if (target < chunk->count && chunk->code[target] == OP_POP) {
+            tr->isTarget[target + 1] = true;
+        }
+    }
+
+    return true;
+}
+
+static bool translate(VM *vm, Compiler *compiler, Translator *tr, size_t arity) {
+    Chunk *chunk = tr->chunk;
+
+    if (!markTargets(tr)) {
+        return false;
+    }
+
+    // The callee and its arguments are in place on entry
+    for (size_t slot = 0; slot <= arity; slot++) {
+        tr->operands[slot] = (uint16_t)slot;
+    }
+
+    tr->depth = arity + 1;
+    tr->maxDepth = tr->depth;
+    bool reachable = true;
+
+    for (size_t offset = 0; offset < chunk->count;) {
+        if (tr->isTarget[offset]) {
+            if (tr->depths[offset] == NO_DEPTH) {
+                tr->depths[offset] = tr->depth;
+            } else if (!reachable) {
+                tr->depth = tr->depths[offset];
+
+                // Every jump here has its values in place already
+                for (size_t slot = 0; slot < tr->depth; slot++) {
+                    tr->operands[slot] = (uint16_t)slot;
+                }
+            } else if (tr->depths[offset] != tr->depth) {
+                return false;
+            }
+
+            materializeAll(vm, compiler, tr);
+            tr->labels[offset] = tr->reg->count;
+            tr->lastResult = NO_INSTR;
+        }
+
+        uint8_t op = chunk->code[offset];
+        tr->line = getLine(chunk, offset);
+
+        size_t consumed = translateInstruction(vm, compiler, tr, offset);
+
+        if (consumed == 0) {
+            return false;
+        }
+
+        reachable = op != OP_JUMP && op != OP_LOOP && op != OP_RETURN;
+        offset += consumed;
+    }
+
+    for (size_t idx = 0; idx < tr->fixupCount; idx++) {
+        JumpFixup *fixup = &tr->fixups[idx];
+
+        if (tr->labels[fixup->target] == NO_INSTR ||
+            !setJump(tr, fixup->instr, tr->labels[fixup->target])) {
+            return false;
+        }
+    }
+
+    tr->reg->frameSize = tr->maxDepth;
+    return true;
+}
+
+bool translateChunk(VM *vm, Compiler *compiler, Chunk *chunk, size_t arity,
+                    RegChunk *reg) {
+    Translator tr;
+    tr.chunk = chunk;
+    tr.reg = reg;
+    tr.lastResult = NO_INSTR;
+    tr.fixups = NULL;
+    tr.fixupCount = 0;
+    tr.fixupCapacity = 0;
+    tr.isTarget = ALLOCATE(vm, compiler, bool, chunk->count + 1);
+    tr.depths = ALLOCATE(vm, compiler, size_t, chunk->count + 1);
+    tr.labels = ALLOCATE(vm, compiler, size_t, chunk->count + 1);
+
+    for (size_t offset = 0; offset <= chunk->count; offset++) {
+        tr.isTarget[offset] = false;
+        tr.depths[offset] = NO_DEPTH;
+        tr.labels[offset] = NO_INSTR;
+    }
+
+    initRegChunk(reg);
+    bool translated = translate(vm, compiler, &tr, arity);
+
+    if (!translated) {
+        freeRegChunk(vm, compiler, reg);
+    }
+
+    FREE_ARRAY(vm, compiler, bool, tr.isTarget, chunk->count + 1);
+    FREE_ARRAY(vm, compiler, size_t, tr.depths, chunk->count + 1);
+    FREE_ARRAY(vm, compiler, size_t, tr.labels, chunk->count + 1);
+    FREE_ARRAY(vm, compiler, JumpFixup, tr.fixups, tr.fixupCapacity);
+
+    return translated;
+}
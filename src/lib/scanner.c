@@ -2,6 +2,218 @@
 
 #include <string.h>
 
+#include "hash.h"
+
+// Runs of whitespace, comment text, string contents, identifiers and digits
+// are found a 16 byte block at a time where the target has vector compares.
+// Blocks are loaded aligned, so a load never crosses into the page after the
+// '\0' terminating the source.
+#if defined(__GNUC__) || defined(__clang__)
+#if defined(__SSE2__)
+#define SCANNER_SIMD
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define SCANNER_SIMD
+#include <arm_neon.h>
+#endif
+#endif
+
+/**
+ * @brief Characters ending a run skipped by `skipRun()`.
+ */
+typedef enum {
+    STOP_LINE_END,   // '\n', ending a comment
+    STOP_NOT_SPACE,  // Anything but ' ', '\r', '\t' and '\n'
+    STOP_QUOTE,      // '"', ending a string literal
+    STOP_NOT_ALNUM,  // Anything but letters, digits and '_'
+    STOP_NOT_DIGIT,  // Anything but digits
+} StopKind;
+
+static bool isDigit(char chr) { return chr >= '0' && chr <= '9'; }
+
+static bool isAlpha(char chr) {
+    return (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || chr == '_';
+}
+
+static bool endsRun(char chr, StopKind kind) {
+    switch (kind) {
+        case STOP_LINE_END:
+            return chr == '\n' || chr == '\0';
+        case STOP_NOT_SPACE:
+            return chr != ' ' && chr != '\r' && chr != '\t' && chr != '\n';
+        case STOP_QUOTE:
+            return chr == '"' || chr == '\0';
+        case STOP_NOT_ALNUM:
+            return !isAlpha(chr) && !isDigit(chr);
+        case STOP_NOT_DIGIT:
+            return !isDigit(chr);
+    }
+
+    return true; // Unreachable
+}
+
+#ifdef SCANNER_SIMD
+#define BLOCK_SIZE 16
+
+// Characters checked one at a time before switching to blocks, most runs are
+// shorter than the overhead of a block compare
+#define SCALAR_PREFIX 8
+
+#if defined(__SSE2__)
+typedef __m128i Block;
+
+// Bits per byte in a mask
+#define MASK_STRIDE 1
+#define MASK_ALL 0xffffu
+
+static Block loadBlock(const char *block) {
+    return _mm_load_si128((const __m128i *)(const void *)block);
+}
+
+static uint64_t toMask(__m128i cmp) { return (uint64_t)(unsigned)_mm_movemask_epi8(cmp); }
+
+static uint64_t equalMask(Block block, char chr) {
+    return toMask(_mm_cmpeq_epi8(block, _mm_set1_epi8(chr)));
+}
+
+static uint64_t rangeMask(Block block, char low, char high) {
+    // Unsigned `chr - low <= high - low', as `min(x, limit) == x'
+    __m128i offset = _mm_sub_epi8(block, _mm_set1_epi8(low));
+    __m128i limit = _mm_set1_epi8((char)(high - low));
+    return toMask(_mm_cmpeq_epi8(_mm_min_epu8(offset, limit), offset));
+}
+#else
+typedef uint8x16_t Block;
+
+// Narrowing the compare result leaves 4 bits per byte
+#define MASK_STRIDE 4
+#define MASK_ALL UINT64_MAX
+
+static Block loadBlock(const char *block) { return vld1q_u8((const uint8_t *)block); }
+
+static uint64_t toMask(uint8x16_t cmp) {
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+static uint64_t equalMask(Block block, char chr) {
+    return toMask(vceqq_u8(block, vdupq_n_u8((uint8_t)chr)));
+}
+
+static uint64_t rangeMask(Block block, char low, char high) {
+    uint8x16_t offset = vsubq_u8(block, vdupq_n_u8((uint8_t)low));
+    return toMask(vcleq_u8(offset, vdupq_n_u8((uint8_t)(high - low))));
+}
+#endif
+
+/**
+ * @brief Obtains the mask of bytes in `block` that end a run of `kind`.
+ *
+ * @details Every kind stops at the terminating '\0'.
+ */
+static uint64_t stopMask(Block block, StopKind kind) {
+    switch (kind) {
+        case STOP_LINE_END:
+            return equalMask(block, '\n') | equalMask(block, '\0');
+        case STOP_NOT_SPACE:
+            return ~(equalMask(block, ' ') | equalMask(block, '\r') |
+                     equalMask(block, '\t') | equalMask(block, '\n')) &
+                   MASK_ALL;
+        case STOP_QUOTE:
+            return equalMask(block, '"') | equalMask(block, '\0');
+        case STOP_NOT_ALNUM:
+            return ~(rangeMask(block, 'a', 'z') | rangeMask(block, 'A', 'Z') |
+                     rangeMask(block, '0', '9') | equalMask(block, '_')) &
+                   MASK_ALL;
+        case STOP_NOT_DIGIT:
+            return ~rangeMask(block, '0', '9') & MASK_ALL;
+    }
+
+    return MASK_ALL; // Unreachable
+}
+
+/**
+ * @brief Counts the bytes set in a mask.
+ */
+static size_t countBytes(uint64_t mask) {
+    size_t count = 0;
+
+    for (; mask != 0; mask &= mask - 1) {
+        count++;
+    }
+
+    return count / MASK_STRIDE;
+}
+
+/**
+ * @brief Block-wise part of `skipRun()`.
+ *
+ * @details The aligned blocks the run spans are read whole, including bytes
+ * before `current` and after the terminator, which the address sanitizer
+ * would report.
+ */
+__attribute__((no_sanitize_address)) static const char *
+skipBlocks(const char *current, StopKind kind, size_t *line) {
+    const char *block = (const char *)((uintptr_t)current & ~(uintptr_t)(BLOCK_SIZE - 1));
+    unsigned int skip = (unsigned int)(current - block) * MASK_STRIDE;
+
+    for (;; block += BLOCK_SIZE, skip = 0) {
+        Block bytes = loadBlock(block);
+        uint64_t stops = stopMask(bytes, kind) >> skip << skip;
+        uint64_t newlines = line != NULL ? equalMask(bytes, '\n') >> skip << skip : 0;
+
+        if (stops != 0) {
+            // Only count newlines before the stop
+            newlines &= (stops & (~stops + 1)) - 1;
+
+            if (line != NULL) {
+                *line += countBytes(newlines);
+            }
+
+            return block + __builtin_ctzll(stops) / MASK_STRIDE;
+        }
+
+        if (line != NULL) {
+            *line += countBytes(newlines);
+        }
+    }
+}
+
+/**
+ * @brief Finds the first character from `current` on ending a run of `kind`,
+ * adding the newlines skipped to `line` unless it is NULL.
+ */
+static const char *skipRun(const char *current, StopKind kind, size_t *line) {
+    for (int idx = 0; idx < SCALAR_PREFIX; idx++, current++) {
+        if (endsRun(*current, kind)) {
+            return current;
+        }
+
+        if (line != NULL && *current == '\n') {
+            (*line)++;
+        }
+    }
+
+    return skipBlocks(current, kind, line);
+}
+#else
+/**
+ * @brief Finds the first character from `current` on ending a run of `kind`,
+ * adding the newlines skipped to `line` unless it is NULL.
+ */
+static const char *skipRun(const char *current, StopKind kind, size_t *line) {
+    while (!endsRun(*current, kind)) {
+        if (line != NULL && *current == '\n') {
+            (*line)++;
+        }
+
+        current++;
+    }
+
+    return current;
+}
+#endif // SCANNER_SIMD
+
 void initScanner(Scanner *scanner, const char *source) {
     scanner->start = source;
     scanner->current = source;
@@ -46,17 +258,12 @@ static void skipWhitespace(Scanner *scanner) {
             case ' ':
             case '\r':
             case '\t':
-                advance(scanner);
-                break;
             case '\n':
-                scanner->line++;
-                advance(scanner);
+                scanner->current = skipRun(scanner->current, STOP_NOT_SPACE, &scanner->line);
                 break;
             case '/':
                 if (peekNext(scanner) == '/') {
-                    while (peek(scanner) != '\n' && !isAtEnd(scanner)) {
-                        advance(scanner);
-                    }
+                    scanner->current = skipRun(scanner->current, STOP_LINE_END, NULL);
                 } else {
                     return;
                 }
@@ -74,6 +281,7 @@ static Token makeToken(Scanner *scanner, TokenType type) {
     token.start = scanner->start;
     token.length = (size_t)(scanner->current - scanner->start);
     token.line = scanner->line;
+    token.hash = 0;
 
     return token;
 }
@@ -85,18 +293,13 @@ static Token errorToken(Scanner *scanner, const char *message) {
     token.start = message;
     token.length = (size_t)strlen(message);
     token.line = scanner->line;
+    token.hash = 0;
 
     return token;
 }
 
 static Token string(Scanner *scanner) {
-    while (peek(scanner) != '"' && !isAtEnd(scanner)) {
-        if (peek(scanner) == '\n') {
-            scanner->line++;
-        }
-
-        advance(scanner);
-    }
+    scanner->current = skipRun(scanner->current, STOP_QUOTE, &scanner->line);
 
     if (isAtEnd(scanner)) {
         return errorToken(scanner, "Unterminated string literal.");
@@ -107,98 +310,81 @@ static Token string(Scanner *scanner) {
     return makeToken(scanner, TOKEN_STRING);
 }
 
-static bool isDigit(char chr) { return chr >= '0' && chr <= '9'; }
-
 static Token number(Scanner *scanner) {
-    while (isDigit(peek(scanner))) {
-        advance(scanner);
-    }
+    scanner->current = skipRun(scanner->current, STOP_NOT_DIGIT, NULL);
 
     // Look for fractional part
     if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
         // Consume decimal point '.'
         advance(scanner);
-
-        while (isDigit(peek(scanner))) {
-            advance(scanner);
-        }
+        scanner->current = skipRun(scanner->current, STOP_NOT_DIGIT, NULL);
     }
 
     return makeToken(scanner, TOKEN_NUMBER);
 }
 
-static bool isAlpha(char chr) {
-    return (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || chr == '_';
-}
-
-static TokenType checkKeyword(Scanner *scanner, ptrdiff_t start, ptrdiff_t length,
-                              const char *rest, TokenType type) {
-    if (scanner->current - scanner->start == start + length &&
-        memcmp((const void *)(scanner->start + start), (const void *)rest,
-               (size_t)length) == 0) {
-        return type;
-    }
-
-    return TOKEN_IDENTIFIER;
-}
-
-static TokenType identifierType(Scanner *scanner) {
-    switch (scanner->start[0]) {
-        case 'a':
-            return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
-        case 'c':
-            return checkKeyword(scanner, 1, 4, "lass", TOKEN_CLASS);
-        case 'e':
-            return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
-        case 'f':
-            if (scanner->current - scanner->start > 1) {
-                switch (scanner->start[1]) {
-                    case 'a':
-                        return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
-                    case 'o':
-                        return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
-                    case 'u':
-                        return checkKeyword(scanner, 2, 1, "n", TOKEN_FUN);
-                }
-            }
-            break;
-        case 'i':
-            return checkKeyword(scanner, 1, 1, "f", TOKEN_IF);
-        case 'n':
-            return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
-        case 'o':
-            return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
-        case 'p':
-            return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
-        case 'r':
-            return checkKeyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
-        case 's':
-            return checkKeyword(scanner, 1, 4, "uper", TOKEN_SUPER);
-        case 't':
-            if (scanner->current - scanner->start > 1) {
-                switch (scanner->start[1]) {
-                    case 'h':
-                        return checkKeyword(scanner, 2, 2, "is", TOKEN_THIS);
-                    case 'r':
-                        return checkKeyword(scanner, 2, 2, "ue", TOKEN_TRUE);
-                }
-            }
-            break;
-        case 'v':
-            return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
-        case 'w':
-            return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
+/**
+ * @brief Keyword recognized by `identifierType()`.
+ */
+typedef struct {
+    const char *chars;
+    size_t length;
+    uint64_t hash; // hashChars(chars, length)
+    TokenType type;
+} Keyword;
+
+/**
+ * @brief Multiplier giving every keyword hash its own slot in `keywords`,
+ * indexed by the top 4 bits of the product.
+ *
+ * @details Found by trying random odd multipliers until the keywords' slots
+ * were all distinct, so the table has to be regenerated along with it
+ * whenever a keyword is added.
+ */
+#define KEYWORD_MULTIPLIER UINT64_C(0x3cd99a031f7ebe9d)
+#define KEYWORD_SLOT(hash) ((size_t)(((hash) * KEYWORD_MULTIPLIER) >> 60))
+
+// clang-format off
+static const Keyword keywords[16] = {
+    {"false",  5, UINT64_C(0x0787a154368939ab), TOKEN_FALSE},
+    {"nil",    3, UINT64_C(0x01763d00013e4e75), TOKEN_NIL},
+    {"or",     2, UINT64_C(0x00006f000000bd0f), TOKEN_OR},
+    {"fun",    3, UINT64_C(0x015b190001274993), TOKEN_FUN},
+    {"super",  5, UINT64_C(0xd48d83c0f96f274b), TOKEN_SUPER},
+    {"while",  5, UINT64_C(0xe3c531e2126a0099), TOKEN_WHILE},
+    {"and",    3, UINT64_C(0x014a14000118cdd7), TOKEN_AND},
+    {"var",    3, UINT64_C(0x0191650001555a2b), TOKEN_VAR},
+    {"true",   4, UINT64_C(0xee4f9d023a6954f2), TOKEN_TRUE},
+    {"return", 6, UINT64_C(0xb220d4380b02bea8), TOKEN_RETURN},
+    {"class",  5, UINT64_C(0x86ba843b69c0329c), TOKEN_CLASS},
+    {"print",  5, UINT64_C(0xda894da7e801cec5), TOKEN_PRINT},
+    {"for",    3, UINT64_C(0x015b130001273f65), TOKEN_FOR},
+    {"this",   4, UINT64_C(0xee2d95023a4c6102), TOKEN_THIS},
+    {"else",   4, UINT64_C(0x6c4d0201f0c01291), TOKEN_ELSE},
+    {"if",     2, UINT64_C(0x000069000000b2d1), TOKEN_IF},
+};
+// clang-format on
+
+static TokenType identifierType(const char *start, size_t length, uint64_t hash) {
+    const Keyword *keyword = &keywords[KEYWORD_SLOT(hash)];
+
+    if (keyword->hash == hash && keyword->length == length &&
+        memcmp(start, keyword->chars, length) == 0) {
+        return keyword->type;
     }
 
     return TOKEN_IDENTIFIER;
 }
 
 static Token identifier(Scanner *scanner) {
-    while (isAlpha(peek(scanner)) || isDigit(peek(scanner))) {
-        advance(scanner);
-    }
+    scanner->current = skipRun(scanner->current, STOP_NOT_ALNUM, NULL);
 
-    return makeToken(scanner, identifierType(scanner));
+    size_t length = (size_t)(scanner->current - scanner->start);
+    uint64_t hash = hashChars(scanner->start, length);
+
+    Token token = makeToken(scanner, identifierType(scanner->start, length, hash));
+    token.hash = hash;
+    return token;
 }
 
 Token scanToken(Scanner *scanner) {
@@ -228,6 +414,10 @@ Token scanToken(Scanner *scanner) {
             return makeToken(scanner, TOKEN_LEFT_BRACE);
         case '}':
             return makeToken(scanner, TOKEN_RIGHT_BRACE);
+        case '[':
+            return makeToken(scanner, TOKEN_LEFT_BRACKET);
+        case ']':
+            return makeToken(scanner, TOKEN_RIGHT_BRACKET);
         case ';':
             return makeToken(scanner, TOKEN_SEMICOLON);
         case ',':
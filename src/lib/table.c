@@ -96,6 +96,8 @@ void tableAddAll(VM *vm, Compiler *compiler, Table *from, Table *to) {
 
         if (entry->key != NULL) {
             tableSet(vm, compiler, to, entry->key, entry->value);
+            writeBarrierObject(vm, (Obj *)entry->key);
+            writeBarrier(vm, entry->value);
         }
     }
 }
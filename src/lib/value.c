@@ -14,7 +14,7 @@ void initValueArray(ValueArray *array) {
 
 void writeValueArray(VM *vm, Compiler *compiler, ValueArray *array, Value value) {
     if (array->capacity < array->count + 1) {
-        uint8_t oldCapacity = array->capacity;
+        size_t oldCapacity = array->capacity;
         array->capacity = GROW_CAPACITY(oldCapacity);
         array->values =
             GROW_ARRAY(vm, compiler, Value, array->values, oldCapacity, array->capacity);
@@ -45,6 +45,7 @@ bool valuesEqual(Value a, Value b) {
         case VAL_BOOL:
             return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL:
+        case VAL_UNDEFINED:
             return true;
         case VAL_NUMBER:
             return AS_NUMBER(a) == AS_NUMBER(b);
@@ -56,32 +57,39 @@ bool valuesEqual(Value a, Value b) {
 #endif // NAN_BOXING
 }
 
-void printValue(Value value) {
+void printValue(Value value) { fprintValue(stdout, value); }
+
+void fprintValue(FILE *out, Value value) {
 #ifdef NAN_BOXING
 
     if (IS_BOOL(value)) {
-        printf(AS_BOOL(value) ? "true" : "false");
+        fprintf(out, AS_BOOL(value) ? "true" : "false");
     } else if (IS_NIL(value)) {
-        printf("nil");
+        fprintf(out, "nil");
     } else if (IS_NUMBER(value)) {
-        printf("%g", AS_NUMBER(value));
+        fprintf(out, "%g", AS_NUMBER(value));
     } else if (IS_OBJ(value)) {
-        printObject(value);
+        printObject(out, value);
+    } else if (IS_UNDEFINED(value)) {
+        fprintf(out, "undefined");
     }
 
 #else
     switch (value.type) {
         case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
+            fprintf(out, AS_BOOL(value) ? "true" : "false");
             break;
         case VAL_NIL:
-            printf("nil");
+            fprintf(out, "nil");
             break;
         case VAL_NUMBER:
-            printf("%g", AS_NUMBER(value));
+            fprintf(out, "%g", AS_NUMBER(value));
             break;
         case VAL_OBJ:
-            printObject(value);
+            printObject(out, value);
+            break;
+        case VAL_UNDEFINED:
+            fprintf(out, "undefined");
             break;
     }
 #endif // NAN_BOXING
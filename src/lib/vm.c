@@ -1,6 +1,10 @@
+// POSIX clocks aren't part of strict C99 headers
+#define _DEFAULT_SOURCE
+
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <wchar.h>
@@ -9,8 +13,13 @@
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "hash.h"
+#include "image.h"
+#include "jit.h"
+#include "loxc.h"
 #include "memory.h"
 #include "object.h"
+#include "profile.h"
 #include "table.h"
 #include "value.h"
 #include "vm.h"
@@ -19,27 +28,33 @@ static void resetStack(VM *vm) {
     vm->stackTop = vm->stack;
     vm->frameCount = 0;
     vm->openUpvalues = NULL;
+    vm->heapExhausted = false;
 }
 
 static void runtimeError(VM *vm, const char *format, ...) {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->err, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->err);
 
     for (intmax_t i = (intmax_t)(vm->frameCount - 1); i >= 0; i--) {
         CallFrame *frame = &vm->frames[i];
         ObjFunction *func = frame->closure->func;
-        size_t instruction = (size_t)(frame->ip - func->chunk.code - 1);
-        size_t line = func->chunk.lines[instruction];
+        size_t line;
+
+        if (func->reg.count > 0) {
+            line = getRegLine(&func->reg, (size_t)(frame->pc - func->reg.code - 1));
+        } else {
+            line = getLine(&func->chunk, (size_t)(frame->ip - func->chunk.code - 1));
+        }
 
-        fprintf(stderr, "[line %zu] in ", line);
+        fprintf(vm->err, "[line %zu] in ", line);
 
         if (func->name == NULL) {
-            fprintf(stderr, "script\n");
+            fprintf(vm->err, "script\n");
         } else {
-            fprintf(stderr, "%s()\n", func->name->chars);
+            fprintf(vm->err, "%s()\n", func->name->chars);
         }
     }
 
@@ -50,19 +65,96 @@ static void defineNative(VM *vm, Compiler *compiler, const char *name, NativeFn
                          uint8_t arity) {
 
     if (arity == UINT8_MAX) {
-        fprintf(stderr, "Can't have more than 255 parameters in native function %s.\n",
+        fprintf(vm->err, "Can't have more than 255 parameters in native function %s.\n",
                 name);
     }
 
     push(vm, OBJ_VAL(copyString(vm, compiler, strlen(name), name)));
     push(vm, OBJ_VAL(newNative(vm, compiler, func, arity)));
-    tableSet(vm, compiler, &vm->globals, AS_STRING(vm->stack[0]), vm->stack[1]);
+    size_t slot = globalSlot(vm, compiler, AS_STRING(vm->stack[0]));
+    vm->globalValues[slot] = vm->stack[1];
     pop(vm);
     pop(vm);
 }
 
+size_t globalSlot(VM *vm, Compiler *compiler, ObjString *name) {
+    Value slot;
+
+    if (tableGet(&vm->globals, name, &slot)) {
+        return (size_t)AS_NUMBER(slot);
+    }
+
+    if (vm->globalCapacity < vm->globalCount + 1) {
+        size_t capacity = GROW_CAPACITY(vm->globalCapacity);
+        vm->globalValues = GROW_ARRAY(vm, compiler, Value, vm->globalValues,
+                                      vm->globalCapacity, capacity);
+        vm->globalNames = GROW_ARRAY(vm, compiler, ObjString *, vm->globalNames,
+                                     vm->globalCapacity, capacity);
+        vm->globalCapacity = capacity;
+    }
+
+    size_t index = vm->globalCount++;
+    vm->globalValues[index] = UNDEFINED_VAL;
+    vm->globalNames[index] = name;
+
+    tableSet(vm, compiler, &vm->globals, name, NUMBER_VAL((double)index));
+    return index;
+}
+
 static Value peek(VM *vm, int distance) { return vm->stackTop[-1 - distance]; }
 
+/**
+ * @brief Grows the stack to at least `count` slots.
+ *
+ * @details The stack moves to a new allocation, the stack top, the slots of
+ * every frame and the open upvalues are rebased onto it.
+ */
+static void ensureStack(VM *vm, size_t count) {
+    if (count <= vm->stackCapacity) {
+        return;
+    }
+
+    size_t capacity = vm->stackCapacity;
+
+    while (capacity < count) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+
+    Value *stack = (Value *)malloc(sizeof(Value) * capacity);
+
+    if (stack == NULL) {
+        outOfMemory(vm);
+    }
+
+    memcpy(stack, vm->stack, sizeof(Value) * (size_t)(vm->stackTop - vm->stack));
+
+    for (size_t idx = 0; idx < vm->frameCount; idx++) {
+        vm->frames[idx].slots = stack + (vm->frames[idx].slots - vm->stack);
+    }
+
+    for (ObjUpvalue *upvalue = vm->openUpvalues; upvalue != NULL;
+         upvalue = (ObjUpvalue *)upvalue->next) {
+        upvalue->location = stack + (upvalue->location - vm->stack);
+    }
+
+    vm->stackTop = stack + (vm->stackTop - vm->stack);
+    free(vm->stack);
+    vm->stack = stack;
+    vm->stackCapacity = capacity;
+}
+
+static void growFrames(VM *vm) {
+    size_t capacity = GROW_CAPACITY(vm->frameCapacity);
+    CallFrame *frames = (CallFrame *)realloc(vm->frames, sizeof(CallFrame) * capacity);
+
+    if (frames == NULL) {
+        outOfMemory(vm);
+    }
+
+    vm->frames = frames;
+    vm->frameCapacity = capacity;
+}
+
 static bool call(VM *vm, ObjClosure *closure, uint8_t argCount) {
     if (argCount != closure->func->arity) {
         runtimeError(vm, "Expected %d arguments but got %d.", closure->func->arity,
@@ -70,14 +162,60 @@ static bool call(VM *vm, ObjClosure *closure, uint8_t argCount) {
         return false;
     }
 
-    if (vm->frameCount == FRAMES_MAX) {
+    if (vm->frameCount >= vm->maxFrames) {
         runtimeError(vm, "Stack overflow");
+        return false;
+    }
+
+    // Calls and loop iterations are where running past the heap limit fails
+    if (vm->heapExhausted) {
+        runtimeError(vm, "Out of memory.");
+        return false;
+    }
+
+    size_t stackSize = closure->func->stackSize;
+
+#ifdef CLOX_REGISTER_VM
+    RegChunk *reg = &closure->func->reg;
+
+    if (reg->frameSize > stackSize) {
+        stackSize = reg->frameSize;
+    }
+#endif // CLOX_REGISTER_VM
+
+    // Pointers into the stack are only good again once it has room for the call
+    size_t base = (size_t)(vm->stackTop - vm->stack) - argCount - 1;
+    ensureStack(vm, base + stackSize + STACK_SLACK);
+
+    if (vm->frameCount == vm->frameCapacity) {
+        growFrames(vm);
+    }
+
+    Value *slots = vm->stack + base;
+
+#ifdef CLOX_JIT
+    // Frozen functions are shared with other threads and never compiled
+    if (!closure->func->jit.failed) {
+        closure->func->jit.hotness++;
+    }
+#endif // CLOX_JIT
+
+#ifdef CLOX_REGISTER_VM
+    if (reg->count > 0) {
+        // Registers are always reachable, clear the ones past the arguments
+        while (vm->stackTop < slots + reg->frameSize) {
+            *vm->stackTop++ = NIL_VAL;
+        }
     }
+#endif // CLOX_REGISTER_VM
 
     CallFrame *frame = &vm->frames[vm->frameCount++];
     frame->closure = closure;
     frame->ip = closure->func->chunk.code;
-    frame->slots = vm->stackTop - argCount - 1;
+    frame->pc = closure->func->reg.code;
+    frame->slots = slots;
+    frame->caches = closure->func->frozen ? vm->imageCaches + closure->func->cacheBase
+                                          : closure->func->chunk.caches;
 
     return true;
 }
@@ -115,7 +253,13 @@ static bool callValue(VM *vm, Compiler *compiler, Value callee, uint8_t argCount
                     return false;
                 }
 
-                Value result = native->func(argCount, vm->stackTop - argCount);
+                Value result = native->func(vm, argCount, vm->stackTop - argCount);
+
+                // The native reported an error and the stack is already reset
+                if (IS_UNDEFINED(result)) {
+                    return false;
+                }
+
                 vm->stackTop -= argCount + 1;
                 push(vm, result);
                 return true;
@@ -129,6 +273,107 @@ static bool callValue(VM *vm, Compiler *compiler, Value callee, uint8_t argCount
     return false;
 }
 
+/**
+ * @brief Resolves property `name` of an instance, consulting and refreshing the
+ * access site's inline cache.
+ *
+ * @details When the cache is full the lookup result is written to `scratch`
+ * instead, leaving the access site megamorphic.
+ *
+ * @returns the entry describing the property or NULL if there is no such
+ * field or method
+ */
+static InlineCacheEntry *lookupProperty(VM *vm, ObjInstance *instance, ObjString *name,
+                                        InlineCache *cache, InlineCacheEntry *scratch) {
+    ObjShape *shape = instance->shape;
+    ObjClass *klass = instance->klass;
+    InlineCacheEntry *entry = NULL;
+
+    for (uint8_t way = 0; way < cache->count; way++) {
+        if (cache->entries[way].shape == shape) {
+            entry = &cache->entries[way];
+
+            // Field slots are fixed by the shape so only methods can go stale
+            if (entry->method == NULL || entry->version == klass->version) {
+                return entry;
+            }
+
+            break;
+        }
+    }
+
+    int64_t slot = shapeFind(shape, name);
+    Value method = NIL_VAL;
+
+    if (slot < 0 && !tableGet(&klass->methods, name, &method)) {
+        return NULL;
+    }
+
+    if (entry == NULL) {
+        entry = cache->count < INLINE_CACHE_WAYS ? &cache->entries[cache->count++]
+                                                 : scratch;
+    }
+
+    entry->shape = shape;
+    entry->transition = NULL;
+    entry->method = slot < 0 ? AS_CLOSURE(method) : NULL;
+    entry->version = klass->version;
+    entry->slot = slot < 0 ? 0 : (uint32_t)slot;
+
+    writeBarrierObject(vm, (Obj *)entry->shape);
+    writeBarrierObject(vm, (Obj *)entry->method);
+
+    return entry;
+}
+
+/**
+ * @brief Stores `value` into field `name` of an instance, consulting and
+ * refreshing the access site's inline cache.
+ */
+static void setProperty(VM *vm, Compiler *compiler, ObjInstance *instance,
+                        ObjString *name, Value value, InlineCache *cache) {
+    ObjShape *shape = instance->shape;
+
+    for (uint8_t way = 0; way < cache->count; way++) {
+        InlineCacheEntry *entry = &cache->entries[way];
+
+        if (entry->shape == shape) {
+            if (entry->transition == NULL) {
+                instance->fields[entry->slot] = value;
+                writeBarrier(vm, value);
+            } else {
+                instanceAddField(vm, compiler, instance, entry->transition, value);
+            }
+
+            return;
+        }
+    }
+
+    int64_t slot = shapeFind(shape, name);
+    ObjShape *transition = NULL;
+
+    if (slot < 0) {
+        transition = shapeTransition(vm, compiler, shape, name);
+        instanceAddField(vm, compiler, instance, transition, value);
+        slot = (int64_t)transition->slotCount - 1;
+    } else {
+        instance->fields[slot] = value;
+        writeBarrier(vm, value);
+    }
+
+    if (cache->count < INLINE_CACHE_WAYS) {
+        InlineCacheEntry *entry = &cache->entries[cache->count++];
+        entry->shape = shape;
+        entry->transition = transition;
+        entry->method = NULL;
+        entry->version = 0;
+        entry->slot = (uint32_t)slot;
+
+        writeBarrierObject(vm, (Obj *)entry->shape);
+        writeBarrierObject(vm, (Obj *)entry->transition);
+    }
+}
+
 static bool invokeFromClass(VM *vm, ObjClass *klass, ObjString *name, uint8_t argCount) {
     Value method;
 
@@ -140,7 +385,8 @@ static bool invokeFromClass(VM *vm, ObjClass *klass, ObjString *name, uint8_t ar
     return call(vm, AS_CLOSURE(method), argCount);
 }
 
-static bool invoke(VM *vm, Compiler *compiler, ObjString *name, uint8_t argCount) {
+static bool invoke(VM *vm, Compiler *compiler, ObjString *name, uint8_t argCount,
+                   InlineCache *cache) {
     Value receiver = peek(vm, argCount);
 
     if (!IS_INSTANCE(receiver)) {
@@ -149,14 +395,21 @@ static bool invoke(VM *vm, Compiler *compiler, ObjString *name, uint8_t argCount
     }
 
     ObjInstance *instance = AS_INSTANCE(receiver);
-    Value value;
+    InlineCacheEntry scratch;
+    InlineCacheEntry *entry = lookupProperty(vm, instance, name, cache, &scratch);
 
-    if (tableGet(&instance->fields, name, &value)) {
+    if (entry == NULL) {
+        runtimeError(vm, "Undefined property '%s'.", name->chars);
+        return false;
+    }
+
+    if (entry->method == NULL) {
+        Value value = instance->fields[entry->slot];
         vm->stackTop[-argCount - 1] = value;
         return callValue(vm, compiler, value, argCount);
     }
 
-    return invokeFromClass(vm, instance->klass, name, argCount);
+    return call(vm, entry->method, argCount);
 }
 
 static bool bindMethod(VM *vm, Compiler *compiler, ObjClass *klass, ObjString *name) {
@@ -204,356 +457,1212 @@ static void closeUpvalues(VM *vm, Value *last) {
         ObjUpvalue *upvalue = vm->openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
+        writeBarrier(vm, upvalue->closed);
         vm->openUpvalues = (ObjUpvalue *)upvalue->next;
     }
 }
 
 static void defineMethod(VM *vm, Compiler *compiler, ObjString *name) {
     Value method = peek(vm, 0);
-    ObjClass *klass = AS_CLASS(method);
+    ObjClass *klass = AS_CLASS(peek(vm, 1));
     tableSet(vm, compiler, &klass->methods, name, method);
+    writeBarrier(vm, method);
+    klass->version += 1;
     pop(vm);
 }
 
+/**
+ * @brief Replaces the `count` values on top of the stack with a list of them.
+ */
+static void buildList(VM *vm, Compiler *compiler, uint8_t count) {
+    // Items stay on the stack, reachable, while the list is allocated
+    ObjList *list = newList(vm, compiler, count);
+    Value *items = vm->stackTop - count;
+
+    for (uint8_t idx = 0; idx < count; idx++) {
+        list->items[idx] = items[idx];
+        writeBarrier(vm, items[idx]);
+    }
+
+    list->count = count;
+    vm->stackTop = items;
+    push(vm, OBJ_VAL(list));
+}
+
+/**
+ * @brief Converts `index` to the slot of an element of list.
+ *
+ * @returns false, having reported the error, if `index` isn't the integer
+ * index of an existing element
+ */
+static bool listSlot(VM *vm, ObjList *list, Value index, size_t *slot) {
+    if (!IS_NUMBER(index)) {
+        runtimeError(vm, "List index must be a number.");
+        return false;
+    }
+
+    double number = AS_NUMBER(index);
+
+    // Written so NaN fails the range check
+    if (!(number >= 0 && number < (double)list->count) ||
+        (double)(size_t)number != number) {
+        runtimeError(vm, "List index out of range.");
+        return false;
+    }
+
+    *slot = (size_t)number;
+    return true;
+}
+
+/**
+ * @brief Replaces the list and index on top of the stack with the element.
+ */
+static bool getIndex(VM *vm) {
+    if (!IS_LIST(peek(vm, 1))) {
+        runtimeError(vm, "Only lists can be indexed.");
+        return false;
+    }
+
+    ObjList *list = AS_LIST(peek(vm, 1));
+    size_t slot;
+
+    if (!listSlot(vm, list, peek(vm, 0), &slot)) {
+        return false;
+    }
+
+    vm->stackTop -= 1;
+    vm->stackTop[-1] = list->items[slot];
+    return true;
+}
+
+/**
+ * @brief Stores the top of the stack into the element of the list and index
+ * below it, leaving the value.
+ */
+static bool setIndex(VM *vm) {
+    if (!IS_LIST(peek(vm, 2))) {
+        runtimeError(vm, "Only lists can be indexed.");
+        return false;
+    }
+
+    ObjList *list = AS_LIST(peek(vm, 2));
+    Value value = peek(vm, 0);
+    size_t slot;
+
+    if (!listSlot(vm, list, peek(vm, 1), &slot)) {
+        return false;
+    }
+
+    list->items[slot] = value;
+    writeBarrier(vm, value);
+
+    vm->stackTop -= 2;
+    vm->stackTop[-1] = value;
+    return true;
+}
+
 static bool isFalsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+/**
+ * @brief Creates the concatenation of two strings, both must stay reachable
+ * by the VM until it returns.
+ */
+static ObjString *concatStrings(VM *vm, Compiler *compiler, ObjString *a, ObjString *b) {
+    ObjString *string = reserveString(vm, compiler, a->length + b->length);
+    memcpy(string->chars, a->chars, a->length);
+    memcpy(string->chars + a->length, b->chars, b->length);
+
+    return internString(vm, compiler, string, hashConcat(a->poly, b->poly, b->length));
+}
+
+/**
+ * @brief Checks if value is a string or a rope.
+ */
+static bool isText(Value value) { return IS_STRING(value) || IS_ROPE(value); }
+
+static size_t textLength(Obj *text) {
+    return text->type == OBJ_STRING ? ((ObjString *)text)->length
+                                    : ((ObjRope *)text)->length;
+}
+
+/**
+ * @brief Obtains the interned string of a string or rope.
+ */
+static ObjString *flattenText(VM *vm, Compiler *compiler, Obj *text) {
+    return text->type == OBJ_STRING ? (ObjString *)text
+                                    : flattenRope(vm, compiler, (ObjRope *)text);
+}
+
+/**
+ * @brief Concatenates two strings or ropes, both must stay reachable by the VM
+ * until it returns.
+ *
+ * @details Short results are copied and interned right away. Longer ones are
+ * made into ropes so building a string piece by piece doesn't copy and intern
+ * every intermediate, the characters are only gathered once the result is
+ * compared or printed.
+ */
+static Obj *concatText(VM *vm, Compiler *compiler, Obj *a, Obj *b) {
+    size_t length = textLength(a) + textLength(b);
+
+    // A rope past the heap limit could never be flattened, copying it right
+    // away raises the error while the script can still report it
+    if (length >= ROPE_MIN_LENGTH && (vm->heapLimit == 0 || length <= vm->heapLimit)) {
+        return (Obj *)newRope(vm, compiler, a, b);
+    }
+
+    ObjString *left = flattenText(vm, compiler, a);
+    ObjString *right = flattenText(vm, compiler, b);
+    return (Obj *)concatStrings(vm, compiler, left, right);
+}
+
 static void concatenate(VM *vm, Compiler *compiler) {
     // String operands a peeked instead of popped so the values
     // remain on the stack and is reachable by VM and thus
     // isn't swept if the GC is triggered by allocating memory
     // for the destination string.
-    ObjString *b = AS_STRING(peek(vm, 0));
-    ObjString *a = AS_STRING(peek(vm, 0));
-
-    size_t length = a->length + b->length;
-    char *chars = ALLOCATE(vm, compiler, char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    Obj *b = AS_OBJ(peek(vm, 0));
+    Obj *a = AS_OBJ(peek(vm, 1));
 
-    ObjString *string = takeString(vm, compiler, length, chars);
+    Obj *result = concatText(vm, compiler, a, b);
     // Popped here once allocation is successful.
     pop(vm);
     pop(vm);
-    push(vm, OBJ_VAL(string));
+    push(vm, OBJ_VAL(result));
+}
+
+/**
+ * @brief Compares two values, flattening ropes first so equal text compares as
+ * the same interned string. Both must stay reachable by the VM until it
+ * returns.
+ */
+static bool equalValues(VM *vm, Compiler *compiler, Value a, Value b) {
+    if (IS_ROPE(a)) {
+        a = OBJ_VAL(flattenRope(vm, compiler, AS_ROPE(a)));
+    }
+
+    if (IS_ROPE(b)) {
+        b = OBJ_VAL(flattenRope(vm, compiler, AS_ROPE(b)));
+    }
+
+    return valuesEqual(a, b);
+}
+
+/**
+ * @brief Flattens `value` if it's a rope, and the ropes in it if it's a list
+ * down to the depth lists are printed to, so printing it shows every
+ * character. `value` must stay reachable by the VM until it returns.
+ */
+static Value printable(VM *vm, Compiler *compiler, Value value, size_t depth) {
+    if (IS_ROPE(value)) {
+        return OBJ_VAL(flattenRope(vm, compiler, AS_ROPE(value)));
+    }
+
+    if (IS_LIST(value) && depth < LIST_PRINT_DEPTH) {
+        ObjList *list = AS_LIST(value);
+
+        // Stored flattened, as `sort()` does
+        for (size_t idx = 0; idx < list->count; idx++) {
+            list->items[idx] = printable(vm, compiler, list->items[idx], depth + 1);
+        }
+    }
+
+    return value;
 }
 
-static Value clockNative(size_t argCount, Value *args) {
+static Value clockNative(VM *vm, size_t argCount, Value *args) {
+    (void)vm;
+    (void)argCount;
+    (void)args;
+
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    // `clock()' counts every thread of the process, which would run faster
+    // than the script's own time while other VMs run alongside it
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0) {
+        return NUMBER_VAL((double)now.tv_sec + (double)now.tv_nsec / 1e9);
+    }
+#endif // CLOCK_THREAD_CPUTIME_ID
+
     return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
-void initVM(VM *vm) {
-    resetStack(vm);
-    vm->objects = NULL;
-    vm->bytesAllocated = 0;
-    vm->nextGC = 1024 * 1024;
+/**
+ * @brief Checks a native was passed `arity` arguments, reporting a runtime
+ * error otherwise.
+ *
+ * @details `callValue()` checks the declared arity of natives already, natives
+ * reading `args` check again so they stay safe however they are called.
+ */
+static bool nativeArity(VM *vm, size_t argCount, size_t arity) {
+    if (argCount != arity) {
+        runtimeError(vm, "Expected %zu arguments but got %zu.", arity, argCount);
+        return false;
+    }
 
-    vm->greyCount = 0;
-    vm->greyCapacity = 0;
-    vm->greyStack = NULL;
+    return true;
+}
 
-    initTable(&vm->globals);
-    initTable(&vm->strings);
+static Value lenNative(VM *vm, size_t argCount, Value *args) {
+    if (!nativeArity(vm, argCount, 1)) {
+        return UNDEFINED_VAL;
+    }
 
-    vm->initString = NULL;
-    vm->initString = copyString(vm, NULL, 4, "init");
+    if (IS_LIST(args[0])) {
+        return NUMBER_VAL((double)AS_LIST(args[0])->count);
+    }
 
-    defineNative(vm, NULL, "clock", clockNative, 0);
+    if (IS_STRING(args[0])) {
+        return NUMBER_VAL((double)AS_STRING(args[0])->length);
+    }
+
+    if (IS_ROPE(args[0])) {
+        return NUMBER_VAL((double)AS_ROPE(args[0])->length);
+    }
+
+    runtimeError(vm, "Can only take the length of lists and strings.");
+    return UNDEFINED_VAL;
 }
 
-void freeVM(VM *vm, Compiler *compiler) {
-    freeTable(vm, compiler, &vm->globals);
-    freeTable(vm, compiler, &vm->strings);
+static Value appendNative(VM *vm, size_t argCount, Value *args) {
+    if (!nativeArity(vm, argCount, 2)) {
+        return UNDEFINED_VAL;
+    }
 
-    vm->initString = NULL;
+    if (!IS_LIST(args[0])) {
+        runtimeError(vm, "Can only append to lists.");
+        return UNDEFINED_VAL;
+    }
 
-    freeObjects(vm, compiler);
+    listAppend(vm, NULL, AS_LIST(args[0]), args[1]);
+    return NIL_VAL;
 }
 
-static InterpreterResult run(VM *vm, Compiler *compiler) {
-    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+/**
+ * @brief Reads the bound of a slice, which may be `count` itself.
+ */
+static bool sliceBound(Value value, size_t count, size_t *bound) {
+    if (!IS_NUMBER(value)) {
+        return false;
+    }
 
-#define READ_BYTE() (*frame->ip++)
+    double number = AS_NUMBER(value);
 
-#define READ_CONSTANT() ((frame)->closure->func->chunk.constants.values[READ_BYTE()])
+    if (!(number >= 0 && number <= (double)count) || (double)(size_t)number != number) {
+        return false;
+    }
 
-#define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+    *bound = (size_t)number;
+    return true;
+}
 
-#define READ_STRING() AS_STRING(READ_CONSTANT())
+/**
+ * @brief Returns a new list of the elements of a list from index `start` up to,
+ * but excluding, index `end`.
+ */
+static Value sliceNative(VM *vm, size_t argCount, Value *args) {
+    if (!nativeArity(vm, argCount, 3)) {
+        return UNDEFINED_VAL;
+    }
 
-#define BINARY_OP(valueType, op)                                                         \
-    do {                                                                                 \
-        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) {                        \
-            runtimeError(vm, "Operands must be numbers.");                               \
-            return INTERPRETER_RUNTIME_ERR;                                              \
-        }                                                                                \
-        double b = AS_NUMBER(pop(vm));                                                   \
-        double a = AS_NUMBER(pop(vm));                                                   \
-        push(vm, valueType(a op b));                                                     \
-    } while (false)
+    if (!IS_LIST(args[0])) {
+        runtimeError(vm, "Can only slice lists.");
+        return UNDEFINED_VAL;
+    }
 
-    for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-        printf("          ");
-        for (Value *slot = vm->stack; slot < vm->stackTop; slot++) {
-            printf("[ ");
-            printValue(*slot);
-            printf(" ]");
-        }
-        printf("\n");
+    ObjList *list = AS_LIST(args[0]);
+    size_t start;
+    size_t end;
 
-        disassembleInstruction(&frame->closure->func->chunk,
-                               (size_t)(frame->ip - frame->closure->func->chunk.code));
-#endif
+    if (!sliceBound(args[1], list->count, &start) ||
+        !sliceBound(args[2], list->count, &end) || start > end) {
+        runtimeError(vm, "Slice bounds out of range.");
+        return UNDEFINED_VAL;
+    }
 
-        uint8_t instruction;
+    // The source stays reachable through the arguments while allocating
+    ObjList *slice = newList(vm, NULL, end - start);
 
-        switch (instruction = READ_BYTE()) {
-            case OP_CONSTANT: {
-                Value constant = READ_CONSTANT();
-                push(vm, constant);
-                break;
-            }
-            case OP_NIL:
-                push(vm, NIL_VAL);
-                break;
-            case OP_TRUE:
-                push(vm, BOOL_VAL(true));
-                break;
-            case OP_FALSE:
-                push(vm, BOOL_VAL(false));
-                break;
-            case OP_POP:
-                pop(vm);
-                break;
-            case OP_GET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                push(vm, frame->slots[slot]);
-                break;
-            }
-            case OP_GET_GLOBAL: {
-                ObjString *name = READ_STRING();
-                Value value;
+    if (end > start) {
+        memcpy(slice->items, list->items + start, (end - start) * sizeof(Value));
+    }
 
-                if (!tableGet(&vm->globals, name, &value)) {
-                    runtimeError(vm, "Undefined variable '%s'.", name->chars);
-                    return INTERPRETER_RUNTIME_ERR;
-                }
+    slice->count = end - start;
+    return OBJ_VAL(slice);
+}
 
-                push(vm, value);
-                break;
-            }
-            case OP_DEFINE_GLOBAL: {
-                ObjString *name = READ_STRING();
-                tableSet(vm, compiler, &vm->globals, name, peek(vm, 0));
-                pop(vm);
-                break;
-            }
-            case OP_SET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(vm, 0);
-                break;
-            }
-            case OP_SET_GLOBAL: {
-                ObjString *name = READ_STRING();
+static int compareNumbers(const void *a, const void *b) {
+    double left = AS_NUMBER(*(const Value *)a);
+    double right = AS_NUMBER(*(const Value *)b);
+    return (left > right) - (left < right);
+}
 
-                if (tableSet(vm, compiler, &vm->globals, name, peek(vm, 0))) {
-                    tableDelete(&vm->globals, name);
-                    runtimeError(vm, "Undefined variable '%s'.", name->chars);
-                    return INTERPRETER_RUNTIME_ERR;
-                }
+static int compareStrings(const void *a, const void *b) {
+    ObjString *left = AS_STRING(*(const Value *)a);
+    ObjString *right = AS_STRING(*(const Value *)b);
+    size_t length = left->length < right->length ? left->length : right->length;
+    int order = memcmp(left->chars, right->chars, length);
 
-                break;
-            }
-            case OP_GET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                push(vm, *frame->closure->upvalues[slot]->location);
-                break;
-            }
-            case OP_SET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(vm, 0);
-                break;
-            }
-            case OP_GET_PROPERTY: {
-                if (!IS_INSTANCE(peek(vm, 0))) {
-                    runtimeError(vm, "Only instances have properties.");
-                    return INTERPRETER_RUNTIME_ERR;
-                }
+    if (order != 0) {
+        return order;
+    }
 
-                ObjInstance *instance = AS_INSTANCE(peek(vm, 0));
-                ObjString *name = READ_STRING();
+    return (left->length > right->length) - (left->length < right->length);
+}
 
-                Value value;
+/**
+ * @brief Sorts a list of numbers or of strings in place, ascending.
+ */
+static Value sortNative(VM *vm, size_t argCount, Value *args) {
+    if (!nativeArity(vm, argCount, 1)) {
+        return UNDEFINED_VAL;
+    }
 
-                if (tableGet(&instance->fields, name, &value)) {
-                    pop(vm);
-                    push(vm, value);
-                    break;
-                }
+    if (!IS_LIST(args[0])) {
+        runtimeError(vm, "Can only sort lists.");
+        return UNDEFINED_VAL;
+    }
 
-                if (!bindMethod(vm, compiler, instance->klass, name)) {
-                    return INTERPRETER_RUNTIME_ERR;
-                }
+    ObjList *list = AS_LIST(args[0]);
+    bool numbers = true;
+    bool strings = true;
 
-                break;
-            }
-            case OP_SET_PROPERTY: {
+    for (size_t idx = 0; idx < list->count; idx++) {
+        Value item = list->items[idx];
 
-                if (!IS_INSTANCE(peek(vm, 1))) {
-                    runtimeError(vm, "Only instances have fields.");
-                    return INTERPRETER_RUNTIME_ERR;
-                }
+        // Ropes are compared by their characters so store them flattened
+        if (strings && IS_ROPE(item)) {
+            item = OBJ_VAL(flattenRope(vm, NULL, AS_ROPE(item)));
+            list->items[idx] = item;
+        }
 
-                ObjInstance *instance = AS_INSTANCE(peek(vm, 1));
-                tableSet(vm, compiler, &instance->fields, READ_STRING(), peek(vm, 0));
+        numbers = numbers && IS_NUMBER(item);
+        strings = strings && IS_STRING(item);
+    }
 
-                Value value = pop(vm);
-                pop(vm);
-                push(vm, value);
+    if (!numbers && !strings) {
+        runtimeError(vm, "Can only sort lists of numbers or of strings.");
+        return UNDEFINED_VAL;
+    }
 
-                break;
-            }
-            case OP_GET_SUPER: {
-                ObjString *name = READ_STRING();
-                ObjClass *superclass = AS_CLASS(pop(vm));
+    qsort(list->items, list->count, sizeof(Value),
+          numbers ? compareNumbers : compareStrings);
+    return NIL_VAL;
+}
 
-                if (!bindMethod(vm, compiler, superclass, name)) {
-                    return INTERPRETER_RUNTIME_ERR;
-                }
+static void setStat(VM *vm, ObjInstance *instance, const char *name, double value) {
+    ObjString *key = copyString(vm, NULL, strlen(name), name);
+    push(vm, OBJ_VAL(key));
+    instanceSetField(vm, NULL, instance, key, NUMBER_VAL(value));
+    pop(vm);
+}
 
-                break;
-            }
-            case OP_EQUAL: {
-                Value b = pop(vm);
-                Value a = pop(vm);
-                push(vm, BOOL_VAL(valuesEqual(a, b)));
-                break;
+/**
+ * @brief Returns a `GCStats` instance holding the collector statistics, times
+ * in seconds and sizes in bytes.
+ */
+static Value gcStatsNative(VM *vm, size_t argCount, Value *args) {
+    (void)argCount;
+    (void)args;
+
+    // Taken before allocating the instance, which can trigger a collection
+    GCStats stats;
+    getGCStats(vm, &stats);
+
+    ObjString *name = copyString(vm, NULL, 7, "GCStats");
+    push(vm, OBJ_VAL(name));
+    ObjClass *klass = newClass(vm, NULL, name);
+    push(vm, OBJ_VAL(klass));
+    ObjInstance *instance = newInstance(vm, NULL, klass);
+    push(vm, OBJ_VAL(instance));
+
+    setStat(vm, instance, "cycles", (double)stats.cycles);
+    setStat(vm, instance, "pauses", (double)stats.pauses);
+    setStat(vm, instance, "pauseTotal", (double)stats.pauseTotal / 1e9);
+    setStat(vm, instance, "pauseMax", (double)stats.pauseMax / 1e9);
+    setStat(vm, instance, "bytesFreed", (double)stats.bytesFreed);
+    setStat(vm, instance, "bytesAllocated", (double)stats.bytesAllocated);
+    setStat(vm, instance, "nextGC", (double)stats.nextGC);
+    setStat(vm, instance, "strings", (double)stats.stringCount);
+    setStat(vm, instance, "stringCapacity", (double)stats.stringCapacity);
+
+    if (stats.cycles > 0) {
+        GCCycle *last = &stats.history[(stats.cycles - 1) % GC_HISTORY];
+        setStat(vm, instance, "lastFreed", (double)last->freed);
+    }
+
+    for (size_t type = 0; type < OBJ_TYPE_COUNT; type++) {
+        char field[32];
+        snprintf(field, sizeof(field), "%sBytes", objTypeName((ObjType)type));
+        setStat(vm, instance, field, (double)stats.liveBytes[type]);
+    }
+
+    pop(vm);
+    pop(vm);
+    pop(vm);
+    return OBJ_VAL(instance);
+}
+
+void initVM(VM *vm) { initVMWithImage(vm, NULL); }
+
+void initVMWithImage(VM *vm, Image *image) {
+    vm->frames = (CallFrame *)malloc(sizeof(CallFrame) * FRAMES_INITIAL);
+    vm->frameCapacity = FRAMES_INITIAL;
+    vm->maxFrames = FRAMES_MAX;
+    vm->stack = (Value *)malloc(sizeof(Value) * STACK_INITIAL);
+    vm->stackCapacity = STACK_INITIAL;
+
+    if (vm->frames == NULL || vm->stack == NULL) {
+        exit(1);
+    }
+
+    resetStack(vm);
+    vm->optimize = false;
+    vm->registerVM = false;
+    vm->jit = false;
+    vm->jitThreshold = JIT_HOT_THRESHOLD;
+    vm->profiler = NULL;
+    vm->objects = NULL;
+    initPool(&vm->pool);
+    vm->bytesAllocated = 0;
+    vm->nextGC = GC_INITIAL_HEAP;
+    vm->gcMinHeap = GC_INITIAL_HEAP;
+
+    vm->gcPhase = GC_IDLE;
+    vm->gcIncremental = true;
+    vm->gcStepSize = GC_STEP_SIZE;
+    vm->gcThreads = 1;
+    vm->gcGrowFactor = GC_HEAP_GROW_FACTOR;
+    vm->gcTargetRatio = 0;
+    vm->heapLimit = 0;
+    vm->heapExhausted = false;
+    vm->gcEpoch = 0;
+    vm->gcEpochPauses = 0;
+    vm->sweepList = NULL;
+    memset(&vm->gcStats, 0, sizeof(vm->gcStats));
+    vm->survivors = NULL;
+    vm->survivorsTail = &vm->survivors;
+
+    vm->greyCount = 0;
+    vm->greyCapacity = 0;
+    vm->greyOverflow = false;
+    vm->greyStack = NULL;
+
+    initTable(&vm->globals);
+    vm->globalValues = NULL;
+    vm->globalNames = NULL;
+    vm->globalCount = 0;
+    vm->globalCapacity = 0;
+
+    initTable(&vm->strings);
+
+    vm->image = image;
+    vm->imageCaches = NULL;
+
+    if (image != NULL) {
+        InlineCache *caches = ALLOCATE(vm, NULL, InlineCache, image->cacheCount);
+
+        for (size_t idx = 0; idx < image->cacheCount; idx++) {
+            caches[idx].count = 0;
+        }
+
+        vm->imageCaches = caches;
+
+        // Same slots as the image's code was compiled with
+        for (size_t idx = 0; idx < image->vm.globalCount; idx++) {
+            globalSlot(vm, NULL, image->vm.globalNames[idx]);
+        }
+    }
+
+    vm->mappedFiles = NULL;
+    vm->mappedCount = 0;
+    vm->mappedCapacity = 0;
+
+    vm->out = stdout;
+    vm->err = stderr;
+
+    vm->initString = NULL;
+    vm->initString = copyString(vm, NULL, 4, "init");
+
+    defineNative(vm, NULL, "clock", clockNative, 0);
+    defineNative(vm, NULL, "gcStats", gcStatsNative, 0);
+    defineNative(vm, NULL, "len", lenNative, 1);
+    defineNative(vm, NULL, "append", appendNative, 2);
+    defineNative(vm, NULL, "slice", sliceNative, 3);
+    defineNative(vm, NULL, "sort", sortNative, 1);
+}
+
+void freeVM(VM *vm, Compiler *compiler) {
+    freeTable(vm, compiler, &vm->globals);
+    FREE_ARRAY(vm, compiler, Value, vm->globalValues, vm->globalCapacity);
+    FREE_ARRAY(vm, compiler, ObjString *, vm->globalNames, vm->globalCapacity);
+    vm->globalCount = 0;
+    vm->globalCapacity = 0;
+
+    freeTable(vm, compiler, &vm->strings);
+
+    if (vm->imageCaches != NULL) {
+        FREE_ARRAY(vm, compiler, InlineCache, vm->imageCaches, vm->image->cacheCount);
+        vm->imageCaches = NULL;
+    }
+
+    vm->initString = NULL;
+
+    freeObjects(vm, compiler);
+    freeMappedFiles(vm, compiler);
+    freePool(&vm->pool);
+
+    free(vm->frames);
+    free(vm->stack);
+    vm->frames = NULL;
+    vm->stack = NULL;
+    vm->frameCapacity = 0;
+    vm->stackCapacity = 0;
+}
+
+VM *newVM(Image *image) {
+    VM *vm = (VM *)malloc(sizeof(VM));
+
+    if (vm != NULL) {
+        initVMWithImage(vm, image);
+    }
+
+    return vm;
+}
+
+void destroyVM(VM *vm) {
+    freeVM(vm, NULL);
+    free(vm);
+}
+
+// Returned by the interpreter loops when the current frame has to continue in
+// another tier, never escapes `run()'.
+#define INTERPRETER_SWITCH ((InterpreterResult)(INTERPRETER_RUNTIME_ERR + 1))
+
+#ifdef CLOX_REGISTER_VM
+#define IS_REGISTER_FRAME(frame) ((frame)->closure->func->reg.count > 0)
+
+/**
+ * @brief Makes all registers of a frame reachable again once it is resumed
+ * after a call, clearing whatever the callee left past the result.
+ */
+static void resumeRegisters(VM *vm, CallFrame *frame) {
+    Value *end = frame->slots + frame->closure->func->reg.frameSize;
+
+    while (vm->stackTop < end) {
+        *vm->stackTop++ = NIL_VAL;
+    }
+
+    vm->stackTop = end;
+}
+#endif // CLOX_REGISTER_VM
+
+#ifdef CLOX_JIT
+/**
+ * @brief Checks if a function runs as machine code, compiling it first when
+ * it just got hot.
+ */
+static bool jitReady(VM *vm, Compiler *compiler, ObjFunction *func) {
+    if (func->jit.code != NULL) {
+        return true;
+    }
+
+    if (!vm->jit || func->jit.failed || func->jit.hotness < vm->jitThreshold) {
+        return false;
+    }
+
+    return jitCompile(vm, compiler, &func->chunk, &func->jit);
+}
+#endif // CLOX_JIT
+
+/**
+ * @brief Checks if the current frame continues in another tier than the stack
+ * interpreter, preparing its registers if it has any.
+ */
+static bool leavesStack(VM *vm, Compiler *compiler, CallFrame *frame) {
+#ifdef CLOX_REGISTER_VM
+    if (IS_REGISTER_FRAME(frame)) {
+        resumeRegisters(vm, frame);
+        return true;
+    }
+#endif // CLOX_REGISTER_VM
+
+#ifdef CLOX_JIT
+    if (jitReady(vm, compiler, frame->closure->func)) {
+        return true;
+    }
+#endif // CLOX_JIT
+
+    return false;
+}
+
+/**
+ * @brief Checks if the frame's code may be rewritten in place by quickening.
+ *
+ * @details Frozen functions are shared with VMs on other threads and borrowed
+ * code is mapped read-only from a cache file, both keep their generic opcodes.
+ */
+static bool canQuicken(CallFrame *frame) {
+    ObjFunction *func = frame->closure->func;
+    return !func->frozen && func->chunk.capacity > 0;
+}
+
+#ifdef THREADED_DISPATCH
+// Labels-as-values are a GNU extension; silence pedantic warnings for the
+// interpreter loops.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif // THREADED_DISPATCH
+
+/**
+ * @brief Executes stack bytecode until the script returns, fails or control
+ * reaches a frame running in another tier.
+ */
+static InterpreterResult runStack(VM *vm, Compiler *compiler) {
+    // The hot parts of the current frame are cached in locals so the
+    // dispatch loop doesn't chase `frame->' on every operand read. Anything
+    // that can observe a frame (calls, runtime errors) must see the cached
+    // `ip' written back first using `STORE_FRAME()'.
+    CallFrame *frame;
+    uint8_t *ip;
+    Value *slots;
+    Value *constants;
+    InlineCache *caches;
+
+#define LOAD_FRAME()                                                                     \
+    do {                                                                                 \
+        frame = &vm->frames[vm->frameCount - 1];                                         \
+        ip = frame->ip;                                                                  \
+        slots = frame->slots;                                                            \
+        constants = frame->closure->func->chunk.constants.values;                        \
+        caches = frame->caches;                                                          \
+    } while (false)
+
+#define STORE_FRAME() (frame->ip = ip)
+
+#define LEAVE_STACK()                                                                    \
+    do {                                                                                 \
+        if (leavesStack(vm, compiler, frame)) {                                          \
+            STORE_FRAME();                                                               \
+            return INTERPRETER_SWITCH;                                                   \
+        }                                                                                \
+    } while (false)
+
+#define READ_BYTE() (*ip++)
+
+#define READ_CONSTANT() (constants[READ_BYTE()])
+
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+
+#define READ_LONG() (ip += 3, (uint32_t)((ip[-3] << 16) | (ip[-2] << 8) | ip[-1]))
+
+#define READ_STRING() AS_STRING(READ_CONSTANT())
+
+#define READ_STRING_LONG() AS_STRING(constants[READ_LONG()])
+
+#define READ_CACHE() (&caches[READ_SHORT()])
+
+#define RUNTIME_ERROR(...)                                                               \
+    do {                                                                                 \
+        STORE_FRAME();                                                                   \
+        runtimeError(vm, __VA_ARGS__);                                                   \
+        return INTERPRETER_RUNTIME_ERR;                                                  \
+    } while (false)
+
+// Rewrites the instruction just read to its `quickened` form
+#define QUICKEN(quickened)                                                               \
+    do {                                                                                 \
+        if (canQuicken(frame)) {                                                         \
+            ip[-1] = (quickened);                                                        \
+        }                                                                                \
+    } while (false)
+
+#define BINARY_OP(valueType, op, quickened)                                              \
+    do {                                                                                 \
+        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) {                        \
+            RUNTIME_ERROR("Operands must be numbers.");                                  \
+        }                                                                                \
+        double b = AS_NUMBER(pop(vm));                                                   \
+        double a = AS_NUMBER(pop(vm));                                                   \
+        push(vm, valueType(a op b));                                                     \
+        QUICKEN(quickened);                                                              \
+    } while (false)
+
+// Quickened arithmetic works on the stack in place. Operands of another type
+// put the generic opcode back and dispatch it again instead.
+#define NUMBER_OP(valueType, op, generic)                                                \
+    do {                                                                                 \
+        Value b = vm->stackTop[-1];                                                      \
+        Value a = vm->stackTop[-2];                                                      \
+        if (IS_NUMBERS(a, b)) {                                                          \
+            vm->stackTop[-2] = valueType(AS_NUMBER(a) op AS_NUMBER(b));                  \
+            vm->stackTop--;                                                              \
+        } else {                                                                         \
+            ip[-1] = (generic);                                                          \
+            ip--;                                                                        \
+        }                                                                                \
+    } while (false)
+
+// The long forms of the instructions below only differ in the width of their
+// constant operand, which `readName` or `readFunc` reads
+
+#define GET_PROPERTY(readName)                                                           \
+    do {                                                                                 \
+        if (!IS_INSTANCE(peek(vm, 0))) {                                                 \
+            RUNTIME_ERROR("Only instances have properties.");                            \
+        }                                                                                \
+        ObjInstance *instance = AS_INSTANCE(peek(vm, 0));                                \
+        ObjString *name = (readName);                                                    \
+        InlineCache *cache = READ_CACHE();                                               \
+        InlineCacheEntry scratch;                                                        \
+        InlineCacheEntry *entry = lookupProperty(vm, instance, name, cache, &scratch);   \
+        if (entry == NULL) {                                                             \
+            RUNTIME_ERROR("Undefined property '%s'.", name->chars);                      \
+        }                                                                                \
+        if (entry->method == NULL) {                                                     \
+            vm->stackTop[-1] = instance->fields[entry->slot];                            \
+        } else {                                                                         \
+            STORE_FRAME();                                                               \
+            ObjBoundMethod *bound =                                                      \
+                newBoundMethod(vm, compiler, peek(vm, 0), entry->method);                \
+            vm->stackTop[-1] = OBJ_VAL(bound);                                           \
+        }                                                                                \
+    } while (false)
+
+#define SET_PROPERTY(readName)                                                           \
+    do {                                                                                 \
+        if (!IS_INSTANCE(peek(vm, 1))) {                                                 \
+            RUNTIME_ERROR("Only instances have fields.");                                \
+        }                                                                                \
+        ObjInstance *instance = AS_INSTANCE(peek(vm, 1));                                \
+        ObjString *name = (readName);                                                    \
+        InlineCache *cache = READ_CACHE();                                               \
+        STORE_FRAME();                                                                   \
+        setProperty(vm, compiler, instance, name, peek(vm, 0), cache);                   \
+        Value value = pop(vm);                                                           \
+        pop(vm);                                                                         \
+        push(vm, value);                                                                 \
+    } while (false)
+
+#define GET_SUPER(readName)                                                              \
+    do {                                                                                 \
+        ObjString *name = (readName);                                                    \
+        ObjClass *superclass = AS_CLASS(pop(vm));                                        \
+        STORE_FRAME();                                                                   \
+        if (!bindMethod(vm, compiler, superclass, name)) {                               \
+            return INTERPRETER_RUNTIME_ERR;                                              \
+        }                                                                                \
+    } while (false)
+
+#define INVOKE(readName)                                                                 \
+    do {                                                                                 \
+        ObjString *method = (readName);                                                  \
+        uint8_t argCount = READ_BYTE();                                                  \
+        InlineCache *cache = READ_CACHE();                                               \
+        STORE_FRAME();                                                                   \
+        if (!invoke(vm, compiler, method, argCount, cache)) {                            \
+            return INTERPRETER_RUNTIME_ERR;                                              \
+        }                                                                                \
+        LOAD_FRAME();                                                                    \
+        LEAVE_STACK();                                                                   \
+    } while (false)
+
+#define SUPER_INVOKE(readName)                                                           \
+    do {                                                                                 \
+        ObjString *method = (readName);                                                  \
+        uint8_t argCount = READ_BYTE();                                                  \
+        ObjClass *superclass = AS_CLASS(pop(vm));                                        \
+        STORE_FRAME();                                                                   \
+        if (!invokeFromClass(vm, superclass, method, argCount)) {                        \
+            return INTERPRETER_RUNTIME_ERR;                                              \
+        }                                                                                \
+        LOAD_FRAME();                                                                    \
+        LEAVE_STACK();                                                                   \
+    } while (false)
+
+// Each upvalue is captured by a local flag and a 16 bit index
+#define CLOSURE(readFunc)                                                                \
+    do {                                                                                 \
+        ObjFunction *func = (readFunc);                                                  \
+        ObjClosure *closure = newClosure(vm, compiler, func);                            \
+        push(vm, OBJ_VAL(closure));                                                      \
+        for (size_t idx = 0; idx < closure->upvalueCount; idx++) {                       \
+            uint8_t isLocal = READ_BYTE();                                               \
+            uint16_t index = READ_SHORT();                                               \
+            if (isLocal) {                                                               \
+                closure->upvalues[idx] = captureUpvalue(vm, compiler, slots + index);    \
+            } else {                                                                     \
+                closure->upvalues[idx] = frame->closure->upvalues[index];                \
+            }                                                                            \
+            writeBarrierObject(vm, (Obj *)closure->upvalues[idx]);                       \
+        }                                                                                \
+    } while (false)
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_INSTRUCTION()                                                              \
+    do {                                                                                 \
+        printf("          ");                                                            \
+        for (Value *slot = vm->stack; slot < vm->stackTop; slot++) {                     \
+            printf("[ ");                                                                \
+            printValue(*slot);                                                           \
+            printf(" ]");                                                                \
+        }                                                                                \
+        printf("\n");                                                                    \
+        disassembleInstruction(&frame->closure->func->chunk,                             \
+                               (size_t)(ip - frame->closure->func->chunk.code));         \
+    } while (false)
+#else
+#define TRACE_INSTRUCTION() ((void)0)
+#endif // DEBUG_TRACE_EXECUTION
+
+#ifdef THREADED_DISPATCH
+    // clang-format off
+    static void *dispatchTable[] = {
+        [OP_CONSTANT]              = &&label_OP_CONSTANT,
+        [OP_NIL]                   = &&label_OP_NIL,
+        [OP_TRUE]                  = &&label_OP_TRUE,
+        [OP_FALSE]                 = &&label_OP_FALSE,
+        [OP_POP]                   = &&label_OP_POP,
+        [OP_GET_LOCAL]             = &&label_OP_GET_LOCAL,
+        [OP_GET_GLOBAL]            = &&label_OP_GET_GLOBAL,
+        [OP_DEFINE_GLOBAL]         = &&label_OP_DEFINE_GLOBAL,
+        [OP_SET_LOCAL]             = &&label_OP_SET_LOCAL,
+        [OP_SET_GLOBAL]            = &&label_OP_SET_GLOBAL,
+        [OP_GET_UPVALUE]           = &&label_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE]           = &&label_OP_SET_UPVALUE,
+        [OP_GET_PROPERTY]          = &&label_OP_GET_PROPERTY,
+        [OP_SET_PROPERTY]          = &&label_OP_SET_PROPERTY,
+        [OP_GET_SUPER]             = &&label_OP_GET_SUPER,
+        [OP_EQUAL]                 = &&label_OP_EQUAL,
+        [OP_GREATER]               = &&label_OP_GREATER,
+        [OP_LESS]                  = &&label_OP_LESS,
+        [OP_ADD]                   = &&label_OP_ADD,
+        [OP_SUBTRACT]              = &&label_OP_SUBTRACT,
+        [OP_MULTIPLY]              = &&label_OP_MULTIPLY,
+        [OP_DIVIDE]                = &&label_OP_DIVIDE,
+        [OP_NOT]                   = &&label_OP_NOT,
+        [OP_NEGATE]                = &&label_OP_NEGATE,
+        [OP_PRINT]                 = &&label_OP_PRINT,
+        [OP_JUMP]                  = &&label_OP_JUMP,
+        [OP_JUMP_IF_FALSE]         = &&label_OP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_TRUE]          = &&label_OP_JUMP_IF_TRUE,
+        [OP_LOOP]                  = &&label_OP_LOOP,
+        [OP_CALL]                  = &&label_OP_CALL,
+        [OP_INVOKE]                = &&label_OP_INVOKE,
+        [OP_SUPER_INVOKE]          = &&label_OP_SUPER_INVOKE,
+        [OP_CLOSURE]               = &&label_OP_CLOSURE,
+        [OP_CLOSE_UPVALUE]         = &&label_OP_CLOSE_UPVALUE,
+        [OP_RETURN]                = &&label_OP_RETURN,
+        [OP_CLASS]                 = &&label_OP_CLASS,
+        [OP_INHERIT]               = &&label_OP_INHERIT,
+        [OP_METHOD]                = &&label_OP_METHOD,
+        [OP_LIST]                  = &&label_OP_LIST,
+        [OP_GET_INDEX]             = &&label_OP_GET_INDEX,
+        [OP_SET_INDEX]             = &&label_OP_SET_INDEX,
+        [OP_CONSTANT_LONG]         = &&label_OP_CONSTANT_LONG,
+        [OP_GET_LOCAL_LONG]        = &&label_OP_GET_LOCAL_LONG,
+        [OP_SET_LOCAL_LONG]        = &&label_OP_SET_LOCAL_LONG,
+        [OP_GET_GLOBAL_LONG]       = &&label_OP_GET_GLOBAL_LONG,
+        [OP_DEFINE_GLOBAL_LONG]    = &&label_OP_DEFINE_GLOBAL_LONG,
+        [OP_SET_GLOBAL_LONG]       = &&label_OP_SET_GLOBAL_LONG,
+        [OP_JUMP_LONG]             = &&label_OP_JUMP_LONG,
+        [OP_JUMP_IF_FALSE_LONG]    = &&label_OP_JUMP_IF_FALSE_LONG,
+        [OP_JUMP_IF_TRUE_LONG]     = &&label_OP_JUMP_IF_TRUE_LONG,
+        [OP_LOOP_LONG]             = &&label_OP_LOOP_LONG,
+        [OP_GET_UPVALUE_LONG]      = &&label_OP_GET_UPVALUE_LONG,
+        [OP_SET_UPVALUE_LONG]      = &&label_OP_SET_UPVALUE_LONG,
+        [OP_GET_PROPERTY_LONG]     = &&label_OP_GET_PROPERTY_LONG,
+        [OP_SET_PROPERTY_LONG]     = &&label_OP_SET_PROPERTY_LONG,
+        [OP_GET_SUPER_LONG]        = &&label_OP_GET_SUPER_LONG,
+        [OP_INVOKE_LONG]           = &&label_OP_INVOKE_LONG,
+        [OP_SUPER_INVOKE_LONG]     = &&label_OP_SUPER_INVOKE_LONG,
+        [OP_CLOSURE_LONG]          = &&label_OP_CLOSURE_LONG,
+        [OP_CLASS_LONG]            = &&label_OP_CLASS_LONG,
+        [OP_METHOD_LONG]           = &&label_OP_METHOD_LONG,
+        [OP_GET_LOCAL_0]           = &&label_OP_GET_LOCAL_0,
+        [OP_GET_LOCAL_1]           = &&label_OP_GET_LOCAL_1,
+        [OP_GET_LOCAL_2]           = &&label_OP_GET_LOCAL_2,
+        [OP_GET_LOCAL_3]           = &&label_OP_GET_LOCAL_3,
+        [OP_ADD_LOCAL_CONST]       = &&label_OP_ADD_LOCAL_CONST,
+        [OP_INCREMENT_LOCAL]       = &&label_OP_INCREMENT_LOCAL,
+        [OP_LESS_LOCAL_LOCAL_JUMP] = &&label_OP_LESS_LOCAL_LOCAL_JUMP,
+        [OP_GREATER_NUM]           = &&label_OP_GREATER_NUM,
+        [OP_LESS_NUM]              = &&label_OP_LESS_NUM,
+        [OP_ADD_NUM]               = &&label_OP_ADD_NUM,
+        [OP_SUBTRACT_NUM]          = &&label_OP_SUBTRACT_NUM,
+        [OP_MULTIPLY_NUM]          = &&label_OP_MULTIPLY_NUM,
+        [OP_DIVIDE_NUM]            = &&label_OP_DIVIDE_NUM,
+    };
+
+    // Profiling sends every opcode through the profiler before its handler
+    static void *profileTable[] = {
+        [0 ... PROFILE_OPCODES - 1] = &&label_profile,
+    };
+    // clang-format on
+
+    void **handlers = vm->profiler != NULL ? profileTable : dispatchTable;
+
+// Every handler ends by jumping straight to the next handler, giving each
+// opcode its own indirect branch for the predictor to learn.
+#define DISPATCH()                                                                       \
+    do {                                                                                 \
+        TRACE_INSTRUCTION();                                                             \
+        goto *handlers[READ_BYTE()];                                                     \
+    } while (false)
+
+#define CASE(opcode) label_##opcode:
+#define NEXT() DISPATCH()
+#else
+#define CASE(opcode) case opcode:
+#define NEXT() break
+#endif // THREADED_DISPATCH
+
+    LOAD_FRAME();
+
+    if (vm->profiler != NULL) {
+        profilePause(vm->profiler);
+    }
+
+#ifdef THREADED_DISPATCH
+    DISPATCH();
+
+label_profile:
+    STORE_FRAME();
+    profileInstruction(vm, vm->profiler, ip[-1]);
+    goto *dispatchTable[ip[-1]];
+#else
+    for (;;) {
+        TRACE_INSTRUCTION();
+
+        uint8_t instruction = READ_BYTE();
+
+        if (vm->profiler != NULL) {
+            STORE_FRAME();
+            profileInstruction(vm, vm->profiler, instruction);
+        }
+
+        switch (instruction) {
+#endif // THREADED_DISPATCH
+            CASE(OP_CONSTANT) {
+                Value constant = READ_CONSTANT();
+                push(vm, constant);
+                NEXT();
             }
-            case OP_GREATER:
-                BINARY_OP(BOOL_VAL, >);
-                break;
-            case OP_LESS:
-                BINARY_OP(BOOL_VAL, <);
-                break;
-            case OP_ADD: {
-                if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
+            CASE(OP_NIL) {
+                push(vm, NIL_VAL);
+                NEXT();
+            }
+            CASE(OP_TRUE) {
+                push(vm, BOOL_VAL(true));
+                NEXT();
+            }
+            CASE(OP_FALSE) {
+                push(vm, BOOL_VAL(false));
+                NEXT();
+            }
+            CASE(OP_POP) {
+                pop(vm);
+                NEXT();
+            }
+            CASE(OP_GET_LOCAL) {
+                uint8_t slot = READ_BYTE();
+                push(vm, slots[slot]);
+                NEXT();
+            }
+            CASE(OP_GET_GLOBAL) {
+                uint16_t slot = READ_SHORT();
+                Value value = vm->globalValues[slot];
+
+                if (IS_UNDEFINED(value)) {
+                    RUNTIME_ERROR("Undefined variable '%s'.",
+                                  vm->globalNames[slot]->chars);
+                }
+
+                push(vm, value);
+                NEXT();
+            }
+            CASE(OP_DEFINE_GLOBAL) {
+                uint16_t slot = READ_SHORT();
+                vm->globalValues[slot] = pop(vm);
+                NEXT();
+            }
+            CASE(OP_SET_LOCAL) {
+                uint8_t slot = READ_BYTE();
+                slots[slot] = peek(vm, 0);
+                NEXT();
+            }
+            CASE(OP_SET_GLOBAL) {
+                uint16_t slot = READ_SHORT();
+
+                if (IS_UNDEFINED(vm->globalValues[slot])) {
+                    RUNTIME_ERROR("Undefined variable '%s'.",
+                                  vm->globalNames[slot]->chars);
+                }
+
+                vm->globalValues[slot] = peek(vm, 0);
+                NEXT();
+            }
+            CASE(OP_GET_UPVALUE) {
+                uint8_t slot = READ_BYTE();
+                push(vm, *frame->closure->upvalues[slot]->location);
+                NEXT();
+            }
+            CASE(OP_SET_UPVALUE) {
+                uint8_t slot = READ_BYTE();
+                *frame->closure->upvalues[slot]->location = peek(vm, 0);
+                writeBarrier(vm, peek(vm, 0));
+                NEXT();
+            }
+            CASE(OP_GET_PROPERTY) {
+                GET_PROPERTY(READ_STRING());
+                NEXT();
+            }
+            CASE(OP_SET_PROPERTY) {
+                SET_PROPERTY(READ_STRING());
+                NEXT();
+            }
+            CASE(OP_GET_SUPER) {
+                GET_SUPER(READ_STRING());
+                NEXT();
+            }
+            CASE(OP_EQUAL) {
+                // Flattening ropes allocates so the operands are popped after
+                bool equal = equalValues(vm, compiler, peek(vm, 1), peek(vm, 0));
+                vm->stackTop -= 2;
+                push(vm, BOOL_VAL(equal));
+                NEXT();
+            }
+            CASE(OP_GREATER) {
+                BINARY_OP(BOOL_VAL, >, OP_GREATER_NUM);
+                NEXT();
+            }
+            CASE(OP_LESS) {
+                BINARY_OP(BOOL_VAL, <, OP_LESS_NUM);
+                NEXT();
+            }
+            CASE(OP_ADD) {
+                if (isText(peek(vm, 0)) && isText(peek(vm, 1))) {
                     concatenate(vm, compiler);
+
+                    // Doubling a string needs no loop to exhaust the heap
+                    if (vm->heapExhausted) {
+                        RUNTIME_ERROR("Out of memory.");
+                    }
                 } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
                     double b = AS_NUMBER(pop(vm));
                     double a = AS_NUMBER(pop(vm));
                     push(vm, NUMBER_VAL(a + b));
+                    QUICKEN(OP_ADD_NUM);
                 } else {
-                    runtimeError(vm, "Operands must be two numbers or two strings.");
-                    return INTERPRETER_RUNTIME_ERR;
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
                 }
-                break;
+                NEXT();
             }
-            case OP_SUBTRACT:
-                BINARY_OP(NUMBER_VAL, -);
-                break;
-            case OP_MULTIPLY:
-                BINARY_OP(NUMBER_VAL, *);
-                break;
-            case OP_DIVIDE:
-                BINARY_OP(NUMBER_VAL, /);
-                break;
-            case OP_NOT:
+            CASE(OP_SUBTRACT) {
+                BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT_NUM);
+                NEXT();
+            }
+            CASE(OP_MULTIPLY) {
+                BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM);
+                NEXT();
+            }
+            CASE(OP_DIVIDE) {
+                BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUM);
+                NEXT();
+            }
+            CASE(OP_NOT) {
                 push(vm, BOOL_VAL(isFalsey(pop(vm))));
-                break;
-            case OP_NEGATE: {
+                NEXT();
+            }
+            CASE(OP_NEGATE) {
                 if (!IS_NUMBER(peek(vm, 0))) {
-                    runtimeError(vm, "Operand must be a number.");
-                    return INTERPRETER_RUNTIME_ERR;
+                    RUNTIME_ERROR("Operand must be a number.");
                 }
                 push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
-                break;
+                NEXT();
             }
-            case OP_PRINT: {
-                printValue(pop(vm));
-                printf("\n");
-                break;
+            CASE(OP_PRINT) {
+                STORE_FRAME();
+                Value value = printable(vm, compiler, peek(vm, 0), 0);
+                pop(vm);
+                fprintValue(vm->out, value);
+                fputc('\n', vm->out);
+                NEXT();
             }
-            case OP_JUMP: {
+            CASE(OP_JUMP) {
                 uint16_t offset = READ_SHORT();
-                frame->ip += offset;
-                break;
+                ip += offset;
+                NEXT();
             }
-            case OP_JUMP_IF_FALSE: {
+            CASE(OP_JUMP_IF_FALSE) {
                 uint16_t offset = READ_SHORT();
 
                 if (isFalsey(peek(vm, 0))) {
-                    frame->ip += offset;
+                    ip += offset;
                 }
 
-                break;
+                NEXT();
             }
-            case OP_LOOP: {
+            CASE(OP_JUMP_IF_TRUE) {
                 uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
-                break;
-            }
-            case OP_CALL: {
-                uint8_t argCount = READ_BYTE();
 
-                if (!callValue(vm, compiler, peek(vm, argCount), argCount)) {
-                    return INTERPRETER_RUNTIME_ERR;
+                if (!isFalsey(peek(vm, 0))) {
+                    ip += offset;
                 }
 
-                frame = &vm->frames[vm->frameCount - 1];
-                break;
+                NEXT();
             }
-            case OP_INVOKE: {
-                ObjString *method = READ_STRING();
-                uint8_t argCount = READ_BYTE();
+            CASE(OP_LOOP) {
+                uint16_t offset = READ_SHORT();
+                ip -= offset;
 
-                if (!invoke(vm, compiler, method, argCount)) {
-                    return INTERPRETER_RUNTIME_ERR;
+                if (vm->heapExhausted) {
+                    RUNTIME_ERROR("Out of memory.");
                 }
-
-                frame = &vm->frames[vm->frameCount - 1];
-                break;
+#ifdef CLOX_JIT
+                // Hot loops move to machine code at their next iteration
+                if (vm->jit && !frame->closure->func->jit.failed &&
+                    ++frame->closure->func->jit.hotness >= vm->jitThreshold) {
+                    LEAVE_STACK();
+                }
+#endif // CLOX_JIT
+                NEXT();
             }
-            case OP_SUPER_INVOKE: {
-                ObjString *method = READ_STRING();
+            CASE(OP_CALL) {
                 uint8_t argCount = READ_BYTE();
-                ObjClass *superclass = AS_CLASS(pop(vm));
+                STORE_FRAME();
 
-                if (!invokeFromClass(vm, superclass, method, argCount)) {
+                if (!callValue(vm, compiler, peek(vm, argCount), argCount)) {
                     return INTERPRETER_RUNTIME_ERR;
                 }
 
-                frame = &vm->frames[vm->frameCount - 1];
-                break;
+                LOAD_FRAME();
+                LEAVE_STACK();
+                NEXT();
             }
-            case OP_CLOSURE: {
-                ObjFunction *func = AS_FUNCTION(READ_CONSTANT());
-                ObjClosure *closure = newClosure(vm, compiler, func);
-                push(vm, OBJ_VAL(closure));
-
-                for (size_t idx = 0; idx < closure->upvalueCount; idx++) {
-                    uint8_t isLocal = READ_BYTE();
-                    uint8_t index = READ_BYTE();
-
-                    if (isLocal) {
-                        closure->upvalues[idx] =
-                            captureUpvalue(vm, compiler, frame->slots + index);
-                    } else {
-                        closure->upvalues[idx] = frame->closure->upvalues[index];
-                    }
-                }
-
-                break;
+            CASE(OP_INVOKE) {
+                INVOKE(READ_STRING());
+                NEXT();
+            }
+            CASE(OP_SUPER_INVOKE) {
+                SUPER_INVOKE(READ_STRING());
+                NEXT();
+            }
+            CASE(OP_CLOSURE) {
+                CLOSURE(AS_FUNCTION(READ_CONSTANT()));
+                NEXT();
             }
-            case OP_CLOSE_UPVALUE:
+            CASE(OP_CLOSE_UPVALUE) {
                 closeUpvalues(vm, vm->stackTop - 1);
                 pop(vm);
-                break;
-            case OP_RETURN: {
+                NEXT();
+            }
+            CASE(OP_RETURN) {
                 Value result = pop(vm);
-                closeUpvalues(vm, frame->slots);
+                closeUpvalues(vm, slots);
                 vm->frameCount -= 1;
 
                 if (vm->frameCount == 0) {
@@ -563,41 +1672,836 @@ static InterpreterResult run(VM *vm, Compiler *compiler) {
                     return INTERPRETER_OK;
                 }
 
-                vm->stackTop = frame->slots;
+                vm->stackTop = slots;
                 push(vm, result);
-                frame = &vm->frames[vm->frameCount - 1];
-                break;
+                LOAD_FRAME();
+                LEAVE_STACK();
+                NEXT();
             }
-            case OP_CLASS:
+            CASE(OP_CLASS) {
                 push(vm, OBJ_VAL(newClass(vm, compiler, READ_STRING())));
-                break;
-            case OP_INHERIT: {
+                NEXT();
+            }
+            CASE(OP_INHERIT) {
                 Value superclass = peek(vm, 1);
 
                 if (!IS_CLASS(superclass)) {
-                    runtimeError(vm, "Superclass must be a class.");
-                    return INTERPRETER_RUNTIME_ERR;
+                    RUNTIME_ERROR("Superclass must be a class.");
                 }
 
                 ObjClass *subclass = AS_CLASS(peek(vm, 0));
                 tableAddAll(vm, compiler, &AS_CLASS(superclass)->methods,
                             &subclass->methods);
+                subclass->version += 1;
 
                 pop(vm); // Pop subclass
-                break;
+                NEXT();
             }
-            case OP_METHOD:
+            CASE(OP_METHOD) {
                 defineMethod(vm, compiler, READ_STRING());
-                break;
+                NEXT();
+            }
+            CASE(OP_LIST) {
+                uint8_t count = READ_BYTE();
+                STORE_FRAME();
+                buildList(vm, compiler, count);
+                NEXT();
+            }
+            CASE(OP_GET_INDEX) {
+                STORE_FRAME();
+
+                if (!getIndex(vm)) {
+                    return INTERPRETER_RUNTIME_ERR;
+                }
+
+                NEXT();
+            }
+            CASE(OP_SET_INDEX) {
+                STORE_FRAME();
+
+                if (!setIndex(vm)) {
+                    return INTERPRETER_RUNTIME_ERR;
+                }
+
+                NEXT();
+            }
+            CASE(OP_CONSTANT_LONG) {
+                push(vm, constants[READ_LONG()]);
+                NEXT();
+            }
+            CASE(OP_GET_LOCAL_LONG) {
+                uint16_t slot = READ_SHORT();
+                push(vm, slots[slot]);
+                NEXT();
+            }
+            CASE(OP_SET_LOCAL_LONG) {
+                uint16_t slot = READ_SHORT();
+                slots[slot] = peek(vm, 0);
+                NEXT();
+            }
+            CASE(OP_GET_GLOBAL_LONG) {
+                uint32_t slot = READ_LONG();
+                Value value = vm->globalValues[slot];
+
+                if (IS_UNDEFINED(value)) {
+                    RUNTIME_ERROR("Undefined variable '%s'.",
+                                  vm->globalNames[slot]->chars);
+                }
+
+                push(vm, value);
+                NEXT();
+            }
+            CASE(OP_DEFINE_GLOBAL_LONG) {
+                uint32_t slot = READ_LONG();
+                vm->globalValues[slot] = pop(vm);
+                NEXT();
+            }
+            CASE(OP_SET_GLOBAL_LONG) {
+                uint32_t slot = READ_LONG();
+
+                if (IS_UNDEFINED(vm->globalValues[slot])) {
+                    RUNTIME_ERROR("Undefined variable '%s'.",
+                                  vm->globalNames[slot]->chars);
+                }
+
+                vm->globalValues[slot] = peek(vm, 0);
+                NEXT();
+            }
+            CASE(OP_JUMP_LONG) {
+                uint32_t offset = READ_LONG();
+                ip += offset;
+                NEXT();
+            }
+            CASE(OP_JUMP_IF_FALSE_LONG) {
+                uint32_t offset = READ_LONG();
+
+                if (isFalsey(peek(vm, 0))) {
+                    ip += offset;
+                }
+
+                NEXT();
+            }
+            CASE(OP_JUMP_IF_TRUE_LONG) {
+                uint32_t offset = READ_LONG();
+
+                if (!isFalsey(peek(vm, 0))) {
+                    ip += offset;
+                }
+
+                NEXT();
+            }
+            CASE(OP_LOOP_LONG) {
+                uint32_t offset = READ_LONG();
+                ip -= offset;
+
+                if (vm->heapExhausted) {
+                    RUNTIME_ERROR("Out of memory.");
+                }
+#ifdef CLOX_JIT
+                if (vm->jit && !frame->closure->func->jit.failed &&
+                    ++frame->closure->func->jit.hotness >= vm->jitThreshold) {
+                    LEAVE_STACK();
+                }
+#endif // CLOX_JIT
+                NEXT();
+            }
+            CASE(OP_GET_UPVALUE_LONG) {
+                uint16_t slot = READ_SHORT();
+                push(vm, *frame->closure->upvalues[slot]->location);
+                NEXT();
+            }
+            CASE(OP_SET_UPVALUE_LONG) {
+                uint16_t slot = READ_SHORT();
+                *frame->closure->upvalues[slot]->location = peek(vm, 0);
+                writeBarrier(vm, peek(vm, 0));
+                NEXT();
+            }
+            CASE(OP_GET_PROPERTY_LONG) {
+                GET_PROPERTY(READ_STRING_LONG());
+                NEXT();
+            }
+            CASE(OP_SET_PROPERTY_LONG) {
+                SET_PROPERTY(READ_STRING_LONG());
+                NEXT();
+            }
+            CASE(OP_GET_SUPER_LONG) {
+                GET_SUPER(READ_STRING_LONG());
+                NEXT();
+            }
+            CASE(OP_INVOKE_LONG) {
+                INVOKE(READ_STRING_LONG());
+                NEXT();
+            }
+            CASE(OP_SUPER_INVOKE_LONG) {
+                SUPER_INVOKE(READ_STRING_LONG());
+                NEXT();
+            }
+            CASE(OP_CLOSURE_LONG) {
+                CLOSURE(AS_FUNCTION(constants[READ_LONG()]));
+                NEXT();
+            }
+            CASE(OP_CLASS_LONG) {
+                push(vm, OBJ_VAL(newClass(vm, compiler, READ_STRING_LONG())));
+                NEXT();
+            }
+            CASE(OP_METHOD_LONG) {
+                defineMethod(vm, compiler, READ_STRING_LONG());
+                NEXT();
+            }
+            CASE(OP_GET_LOCAL_0) {
+                push(vm, slots[0]);
+                NEXT();
+            }
+            CASE(OP_GET_LOCAL_1) {
+                push(vm, slots[1]);
+                NEXT();
+            }
+            CASE(OP_GET_LOCAL_2) {
+                push(vm, slots[2]);
+                NEXT();
+            }
+            CASE(OP_GET_LOCAL_3) {
+                push(vm, slots[3]);
+                NEXT();
+            }
+            CASE(OP_ADD_LOCAL_CONST) {
+                Value local = slots[READ_BYTE()];
+                Value constant = READ_CONSTANT();
+
+                if (!IS_NUMBER(local)) {
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                }
+
+                push(vm, NUMBER_VAL(AS_NUMBER(local) + AS_NUMBER(constant)));
+                NEXT();
+            }
+            CASE(OP_INCREMENT_LOCAL) {
+                Value *local = &slots[READ_BYTE()];
+                Value constant = READ_CONSTANT();
+
+                if (!IS_NUMBER(*local)) {
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                }
+
+                *local = NUMBER_VAL(AS_NUMBER(*local) + AS_NUMBER(constant));
+                NEXT();
+            }
+            CASE(OP_LESS_LOCAL_LOCAL_JUMP) {
+                Value a = slots[READ_BYTE()];
+                Value b = slots[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+
+                if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                    RUNTIME_ERROR("Operands must be numbers.");
+                }
+
+                if (!(AS_NUMBER(a) < AS_NUMBER(b))) {
+                    ip += offset;
+                }
+
+                NEXT();
+            }
+            CASE(OP_GREATER_NUM) {
+                NUMBER_OP(BOOL_VAL, >, OP_GREATER);
+                NEXT();
+            }
+            CASE(OP_LESS_NUM) {
+                NUMBER_OP(BOOL_VAL, <, OP_LESS);
+                NEXT();
+            }
+            CASE(OP_ADD_NUM) {
+                NUMBER_OP(NUMBER_VAL, +, OP_ADD);
+                NEXT();
+            }
+            CASE(OP_SUBTRACT_NUM) {
+                NUMBER_OP(NUMBER_VAL, -, OP_SUBTRACT);
+                NEXT();
+            }
+            CASE(OP_MULTIPLY_NUM) {
+                NUMBER_OP(NUMBER_VAL, *, OP_MULTIPLY);
+                NEXT();
+            }
+            CASE(OP_DIVIDE_NUM) {
+                NUMBER_OP(NUMBER_VAL, /, OP_DIVIDE);
+                NEXT();
+            }
+#ifndef THREADED_DISPATCH
         }
     }
+#endif // THREADED_DISPATCH
+
+#undef LOAD_FRAME
+#undef STORE_FRAME
+#undef LEAVE_STACK
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef READ_SHORT
+#undef READ_LONG
 #undef READ_STRING
+#undef READ_STRING_LONG
+#undef READ_CACHE
+#undef RUNTIME_ERROR
+#undef QUICKEN
 #undef BINARY_OP
+#undef NUMBER_OP
+#undef GET_PROPERTY
+#undef SET_PROPERTY
+#undef GET_SUPER
+#undef INVOKE
+#undef SUPER_INVOKE
+#undef CLOSURE
+#undef TRACE_INSTRUCTION
+#undef DISPATCH
+#undef CASE
+#undef NEXT
+}
+
+#ifdef CLOX_JIT
+JitStatus jitCall(VM *vm, uint8_t argCount) {
+    size_t frameCount = vm->frameCount;
+
+    if (!callValue(vm, NULL, peek(vm, argCount), argCount)) {
+        return JIT_ERROR;
+    }
+
+    return vm->frameCount == frameCount ? JIT_CONTINUE : JIT_SWITCH;
+}
+
+JitStatus jitInvoke(VM *vm, ObjString *name, uint8_t argCount, InlineCache *cache) {
+    size_t frameCount = vm->frameCount;
+
+    if (!invoke(vm, NULL, name, argCount, cache)) {
+        return JIT_ERROR;
+    }
+
+    return vm->frameCount == frameCount ? JIT_CONTINUE : JIT_SWITCH;
 }
 
+JitStatus jitGetProperty(VM *vm, ObjString *name, InlineCache *cache) {
+    if (!IS_INSTANCE(peek(vm, 0))) {
+        runtimeError(vm, "Only instances have properties.");
+        return JIT_ERROR;
+    }
+
+    ObjInstance *instance = AS_INSTANCE(peek(vm, 0));
+    InlineCacheEntry scratch;
+    InlineCacheEntry *entry = lookupProperty(vm, instance, name, cache, &scratch);
+
+    if (entry == NULL) {
+        runtimeError(vm, "Undefined property '%s'.", name->chars);
+        return JIT_ERROR;
+    }
+
+    if (entry->method == NULL) {
+        vm->stackTop[-1] = instance->fields[entry->slot];
+    } else {
+        ObjBoundMethod *bound = newBoundMethod(vm, NULL, peek(vm, 0), entry->method);
+        vm->stackTop[-1] = OBJ_VAL(bound);
+    }
+
+    return JIT_CONTINUE;
+}
+
+JitStatus jitSetProperty(VM *vm, ObjString *name, InlineCache *cache) {
+    if (!IS_INSTANCE(peek(vm, 1))) {
+        runtimeError(vm, "Only instances have fields.");
+        return JIT_ERROR;
+    }
+
+    setProperty(vm, NULL, AS_INSTANCE(peek(vm, 1)), name, peek(vm, 0), cache);
+
+    Value value = pop(vm);
+    pop(vm);
+    push(vm, value);
+    return JIT_CONTINUE;
+}
+
+JitStatus jitList(VM *vm, uint8_t count) {
+    buildList(vm, NULL, count);
+    return JIT_CONTINUE;
+}
+
+JitStatus jitGetIndex(VM *vm) { return getIndex(vm) ? JIT_CONTINUE : JIT_ERROR; }
+
+JitStatus jitSetIndex(VM *vm) { return setIndex(vm) ? JIT_CONTINUE : JIT_ERROR; }
+
+JitStatus jitSetUpvalue(VM *vm, uint16_t slot) {
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    *frame->closure->upvalues[slot]->location = peek(vm, 0);
+    writeBarrier(vm, peek(vm, 0));
+    return JIT_CONTINUE;
+}
+
+JitStatus jitCloseUpvalue(VM *vm) {
+    closeUpvalues(vm, vm->stackTop - 1);
+    pop(vm);
+    return JIT_CONTINUE;
+}
+
+JitStatus jitReturn(VM *vm) {
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    Value result = pop(vm);
+    closeUpvalues(vm, frame->slots);
+    vm->frameCount -= 1;
+
+    if (vm->frameCount == 0) {
+        pop(vm);
+        return JIT_DONE;
+    }
+
+    vm->stackTop = frame->slots;
+    push(vm, result);
+    return JIT_SWITCH;
+}
+
+JitStatus jitPrint(VM *vm) {
+    Value value = printable(vm, NULL, peek(vm, 0), 0);
+    pop(vm);
+    fprintValue(vm->out, value);
+    fputc('\n', vm->out);
+    return JIT_CONTINUE;
+}
+
+/**
+ * @brief Runs the machine code of the current frame until control leaves it,
+ * finishing in the stack interpreter when the code bails out.
+ */
+static InterpreterResult runJit(VM *vm, Compiler *compiler) {
+    switch (jitEnter(vm)) {
+        case JIT_DEOPT:
+            return runStack(vm, compiler);
+        case JIT_ERROR:
+            return INTERPRETER_RUNTIME_ERR;
+        case JIT_DONE:
+            return INTERPRETER_OK;
+        default:
+            break;
+    }
+
+#ifdef CLOX_REGISTER_VM
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+
+    if (IS_REGISTER_FRAME(frame)) {
+        resumeRegisters(vm, frame);
+    }
+#endif // CLOX_REGISTER_VM
+
+    return INTERPRETER_SWITCH;
+}
+#endif // CLOX_JIT
+
+#ifdef CLOX_REGISTER_VM
+/**
+ * @brief Executes register code until the script returns, fails or control
+ * reaches a frame with stack bytecode.
+ */
+static InterpreterResult runRegisters(VM *vm, Compiler *compiler) {
+    // Same caching scheme as `runStack()', with `pc' standing in for `ip'.
+    CallFrame *frame;
+    RegInstr *pc;
+    RegInstr instr;
+    Value *slots;
+    Value *constants;
+
+#define LOAD_FRAME()                                                                     \
+    do {                                                                                 \
+        frame = &vm->frames[vm->frameCount - 1];                                         \
+        pc = frame->pc;                                                                  \
+        slots = frame->slots;                                                            \
+        constants = frame->closure->func->chunk.constants.values;                        \
+    } while (false)
+
+#define STORE_FRAME() (frame->pc = pc)
+
+#define LEAVE_FOR_STACK()                                                                \
+    do {                                                                                 \
+        if (!IS_REGISTER_FRAME(frame)) {                                                 \
+            return INTERPRETER_SWITCH;                                                   \
+        }                                                                                \
+    } while (false)
+
+#define RK(operand)                                                                      \
+    ((operand) < RK_CONSTANT ? slots[(operand)] : constants[(operand) - RK_CONSTANT])
+
+#define RUNTIME_ERROR(...)                                                               \
+    do {                                                                                 \
+        STORE_FRAME();                                                                   \
+        runtimeError(vm, __VA_ARGS__);                                                   \
+        return INTERPRETER_RUNTIME_ERR;                                                  \
+    } while (false)
+
+#define BINARY_OP(valueType, op)                                                         \
+    do {                                                                                 \
+        Value b = RK(instr.b);                                                           \
+        Value c = RK(instr.c);                                                           \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c)) {                                            \
+            RUNTIME_ERROR("Operands must be numbers.");                                  \
+        }                                                                                \
+        slots[instr.a] = valueType(AS_NUMBER(b) op AS_NUMBER(c));                        \
+    } while (false)
+
+#define BRANCH_OP(op, taken)                                                             \
+    do {                                                                                 \
+        Value b = RK(instr.b);                                                           \
+        Value c = RK(instr.c);                                                           \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c)) {                                            \
+            RUNTIME_ERROR("Operands must be numbers.");                                  \
+        }                                                                                \
+        if ((AS_NUMBER(b) op AS_NUMBER(c)) == (taken)) {                                 \
+            pc += instr.d;                                                               \
+        }                                                                                \
+    } while (false)
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_INSTRUCTION()                                                              \
+    do {                                                                                 \
+        printf("          ");                                                            \
+        for (Value *slot = slots; slot < vm->stackTop; slot++) {                         \
+            printf("[ ");                                                                \
+            printValue(*slot);                                                           \
+            printf(" ]");                                                                \
+        }                                                                                \
+        printf("\n");                                                                    \
+        disassembleRegInstruction(&frame->closure->func->reg,                            \
+                                  &frame->closure->func->chunk,                          \
+                                  (size_t)(pc - frame->closure->func->reg.code));        \
+    } while (false)
+#else
+#define TRACE_INSTRUCTION() ((void)0)
+#endif // DEBUG_TRACE_EXECUTION
+
+#ifdef THREADED_DISPATCH
+    // clang-format off
+    static void *dispatchTable[] = {
+        [REG_MOVE]                = &&label_REG_MOVE,
+        [REG_NIL]                 = &&label_REG_NIL,
+        [REG_TRUE]                = &&label_REG_TRUE,
+        [REG_FALSE]               = &&label_REG_FALSE,
+        [REG_GET_GLOBAL]          = &&label_REG_GET_GLOBAL,
+        [REG_DEFINE_GLOBAL]       = &&label_REG_DEFINE_GLOBAL,
+        [REG_SET_GLOBAL]          = &&label_REG_SET_GLOBAL,
+        [REG_GET_UPVALUE]         = &&label_REG_GET_UPVALUE,
+        [REG_SET_UPVALUE]         = &&label_REG_SET_UPVALUE,
+        [REG_EQUAL]               = &&label_REG_EQUAL,
+        [REG_GREATER]             = &&label_REG_GREATER,
+        [REG_LESS]                = &&label_REG_LESS,
+        [REG_ADD]                 = &&label_REG_ADD,
+        [REG_SUBTRACT]            = &&label_REG_SUBTRACT,
+        [REG_MULTIPLY]            = &&label_REG_MULTIPLY,
+        [REG_DIVIDE]              = &&label_REG_DIVIDE,
+        [REG_NOT]                 = &&label_REG_NOT,
+        [REG_NEGATE]              = &&label_REG_NEGATE,
+        [REG_PRINT]               = &&label_REG_PRINT,
+        [REG_JUMP]                = &&label_REG_JUMP,
+        [REG_JUMP_IF_FALSE]       = &&label_REG_JUMP_IF_FALSE,
+        [REG_JUMP_IF_TRUE]        = &&label_REG_JUMP_IF_TRUE,
+        [REG_JUMP_IF_EQUAL]       = &&label_REG_JUMP_IF_EQUAL,
+        [REG_JUMP_IF_NOT_EQUAL]   = &&label_REG_JUMP_IF_NOT_EQUAL,
+        [REG_JUMP_IF_GREATER]     = &&label_REG_JUMP_IF_GREATER,
+        [REG_JUMP_IF_NOT_GREATER] = &&label_REG_JUMP_IF_NOT_GREATER,
+        [REG_JUMP_IF_LESS]        = &&label_REG_JUMP_IF_LESS,
+        [REG_JUMP_IF_NOT_LESS]    = &&label_REG_JUMP_IF_NOT_LESS,
+        [REG_CALL]                = &&label_REG_CALL,
+        [REG_RETURN]              = &&label_REG_RETURN,
+    };
+    // clang-format on
+
+#define DISPATCH()                                                                       \
+    do {                                                                                 \
+        TRACE_INSTRUCTION();                                                             \
+        instr = *pc++;                                                                   \
+        goto *dispatchTable[instr.op];                                                   \
+    } while (false)
+
+#define CASE(opcode) label_##opcode:
+#define NEXT() DISPATCH()
+#else
+#define CASE(opcode) case opcode:
+#define NEXT() break
+#endif // THREADED_DISPATCH
+
+    LOAD_FRAME();
+
+#ifdef THREADED_DISPATCH
+    DISPATCH();
+#else
+    for (;;) {
+        TRACE_INSTRUCTION();
+        instr = *pc++;
+
+        switch (instr.op) {
+#endif // THREADED_DISPATCH
+            CASE(REG_MOVE) {
+                slots[instr.a] = RK(instr.b);
+                NEXT();
+            }
+            CASE(REG_NIL) {
+                slots[instr.a] = NIL_VAL;
+                NEXT();
+            }
+            CASE(REG_TRUE) {
+                slots[instr.a] = BOOL_VAL(true);
+                NEXT();
+            }
+            CASE(REG_FALSE) {
+                slots[instr.a] = BOOL_VAL(false);
+                NEXT();
+            }
+            CASE(REG_GET_GLOBAL) {
+                Value value = vm->globalValues[instr.b];
+
+                if (IS_UNDEFINED(value)) {
+                    RUNTIME_ERROR("Undefined variable '%s'.",
+                                  vm->globalNames[instr.b]->chars);
+                }
+
+                slots[instr.a] = value;
+                NEXT();
+            }
+            CASE(REG_DEFINE_GLOBAL) {
+                vm->globalValues[instr.b] = RK(instr.c);
+                NEXT();
+            }
+            CASE(REG_SET_GLOBAL) {
+                if (IS_UNDEFINED(vm->globalValues[instr.b])) {
+                    RUNTIME_ERROR("Undefined variable '%s'.",
+                                  vm->globalNames[instr.b]->chars);
+                }
+
+                vm->globalValues[instr.b] = RK(instr.c);
+                NEXT();
+            }
+            CASE(REG_GET_UPVALUE) {
+                slots[instr.a] = *frame->closure->upvalues[instr.b]->location;
+                NEXT();
+            }
+            CASE(REG_SET_UPVALUE) {
+                Value value = RK(instr.c);
+                *frame->closure->upvalues[instr.b]->location = value;
+                writeBarrier(vm, value);
+                NEXT();
+            }
+            CASE(REG_EQUAL) {
+                STORE_FRAME();
+                slots[instr.a] =
+                    BOOL_VAL(equalValues(vm, compiler, RK(instr.b), RK(instr.c)));
+                NEXT();
+            }
+            CASE(REG_GREATER) {
+                BINARY_OP(BOOL_VAL, >);
+                NEXT();
+            }
+            CASE(REG_LESS) {
+                BINARY_OP(BOOL_VAL, <);
+                NEXT();
+            }
+            CASE(REG_ADD) {
+                Value b = RK(instr.b);
+                Value c = RK(instr.c);
+
+                if (IS_NUMBER(b) && IS_NUMBER(c)) {
+                    slots[instr.a] = NUMBER_VAL(AS_NUMBER(b) + AS_NUMBER(c));
+                } else if (isText(b) && isText(c)) {
+                    // Both operands live in registers or constants and stay
+                    // reachable while the result is allocated
+                    STORE_FRAME();
+                    Obj *result = concatText(vm, compiler, AS_OBJ(b), AS_OBJ(c));
+                    slots[instr.a] = OBJ_VAL(result);
+                } else {
+                    RUNTIME_ERROR("Operands must be two numbers or two strings.");
+                }
+
+                NEXT();
+            }
+            CASE(REG_SUBTRACT) {
+                BINARY_OP(NUMBER_VAL, -);
+                NEXT();
+            }
+            CASE(REG_MULTIPLY) {
+                BINARY_OP(NUMBER_VAL, *);
+                NEXT();
+            }
+            CASE(REG_DIVIDE) {
+                BINARY_OP(NUMBER_VAL, /);
+                NEXT();
+            }
+            CASE(REG_NOT) {
+                slots[instr.a] = BOOL_VAL(isFalsey(RK(instr.b)));
+                NEXT();
+            }
+            CASE(REG_NEGATE) {
+                Value value = RK(instr.b);
+
+                if (!IS_NUMBER(value)) {
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+
+                slots[instr.a] = NUMBER_VAL(-AS_NUMBER(value));
+                NEXT();
+            }
+            CASE(REG_PRINT) {
+                STORE_FRAME();
+                fprintValue(vm->out, printable(vm, compiler, RK(instr.b), 0));
+                fputc('\n', vm->out);
+                NEXT();
+            }
+            CASE(REG_JUMP) {
+                pc += instr.d;
+
+                if (vm->heapExhausted && instr.d < 0) {
+                    RUNTIME_ERROR("Out of memory.");
+                }
+
+                NEXT();
+            }
+            CASE(REG_JUMP_IF_FALSE) {
+                if (isFalsey(RK(instr.b))) {
+                    pc += instr.d;
+                }
+
+                NEXT();
+            }
+            CASE(REG_JUMP_IF_TRUE) {
+                if (!isFalsey(RK(instr.b))) {
+                    pc += instr.d;
+                }
+
+                NEXT();
+            }
+            CASE(REG_JUMP_IF_EQUAL) {
+                STORE_FRAME();
+
+                if (equalValues(vm, compiler, RK(instr.b), RK(instr.c))) {
+                    pc += instr.d;
+                }
+
+                NEXT();
+            }
+            CASE(REG_JUMP_IF_NOT_EQUAL) {
+                STORE_FRAME();
+
+                if (!equalValues(vm, compiler, RK(instr.b), RK(instr.c))) {
+                    pc += instr.d;
+                }
+
+                NEXT();
+            }
+            CASE(REG_JUMP_IF_GREATER) {
+                BRANCH_OP(>, true);
+                NEXT();
+            }
+            CASE(REG_JUMP_IF_NOT_GREATER) {
+                BRANCH_OP(>, false);
+                NEXT();
+            }
+            CASE(REG_JUMP_IF_LESS) {
+                BRANCH_OP(<, true);
+                NEXT();
+            }
+            CASE(REG_JUMP_IF_NOT_LESS) {
+                BRANCH_OP(<, false);
+                NEXT();
+            }
+            CASE(REG_CALL) {
+                STORE_FRAME();
+
+                // Calls see the callee and its arguments as the stack top
+                vm->stackTop = slots + instr.a + instr.b + 1;
+
+                if (!callValue(vm, compiler, slots[instr.a], (uint8_t)instr.b)) {
+                    return INTERPRETER_RUNTIME_ERR;
+                }
+
+                // Natives and initializer-less classes complete in place
+                LOAD_FRAME();
+                LEAVE_FOR_STACK();
+                resumeRegisters(vm, frame);
+                NEXT();
+            }
+            CASE(REG_RETURN) {
+                Value result = RK(instr.b);
+                closeUpvalues(vm, slots);
+                vm->frameCount -= 1;
+
+                if (vm->frameCount == 0) {
+                    // Exit interpreter
+                    vm->stackTop = slots;
+                    return INTERPRETER_OK;
+                }
+
+                *slots = result;
+                vm->stackTop = slots + 1;
+                LOAD_FRAME();
+                LEAVE_FOR_STACK();
+                resumeRegisters(vm, frame);
+                NEXT();
+            }
+#ifndef THREADED_DISPATCH
+        }
+    }
+#endif // THREADED_DISPATCH
+
+#undef LOAD_FRAME
+#undef STORE_FRAME
+#undef LEAVE_FOR_STACK
+#undef RK
+#undef RUNTIME_ERROR
+#undef BINARY_OP
+#undef BRANCH_OP
+#undef TRACE_INSTRUCTION
+#undef DISPATCH
+#undef CASE
+#undef NEXT
+}
+#endif // CLOX_REGISTER_VM
+
+/**
+ * @brief Runs the current frame in the tier its function is compiled for.
+ */
+static InterpreterResult runFrame(VM *vm, Compiler *compiler) {
+#ifdef CLOX_REGISTER_VM
+    if (IS_REGISTER_FRAME(&vm->frames[vm->frameCount - 1])) {
+        return runRegisters(vm, compiler);
+    }
+#endif // CLOX_REGISTER_VM
+
+#ifdef CLOX_JIT
+    if (jitReady(vm, compiler, vm->frames[vm->frameCount - 1].closure->func)) {
+        return runJit(vm, compiler);
+    }
+#endif // CLOX_JIT
+
+    return runStack(vm, compiler);
+}
+
+/**
+ * @brief Runs the tier matching the current frame, handing control back and
+ * forth as calls and returns cross between stack code, register code and
+ * machine code.
+ */
+static InterpreterResult run(VM *vm, Compiler *compiler) {
+    jmp_buf jump;
+    jmp_buf *enclosing = vm->outOfMemory;
+    InterpreterResult result;
+    vm->outOfMemory = &jump;
+
+    if (setjmp(jump) != 0) {
+        runtimeError(vm, "Out of memory.");
+        result = INTERPRETER_RUNTIME_ERR;
+    } else {
+        do {
+            result = runFrame(vm, compiler);
+        } while (result == INTERPRETER_SWITCH);
+    }
+
+    vm->outOfMemory = enclosing;
+    return result;
+}
+
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif // THREADED_DISPATCH
+
 InterpreterResult interpret(VM *vm, Scanner *scanner, const char *source) {
     ObjFunction *func = compile(scanner, source, vm);
 
@@ -605,11 +2509,18 @@ InterpreterResult interpret(VM *vm, Scanner *scanner, const char *source) {
         return INTERPRETER_COMPILE_ERR;
     }
 
+    return interpretFunction(vm, func);
+}
+
+InterpreterResult interpretFunction(VM *vm, ObjFunction *func) {
     push(vm, OBJ_VAL(func));
     ObjClosure *closure = newClosure(vm, NULL, func);
     pop(vm);
     push(vm, OBJ_VAL(closure));
-    call(vm, closure, 0);
+
+    if (!call(vm, closure, 0)) {
+        return INTERPRETER_RUNTIME_ERR;
+    }
 
     return run(vm, NULL);
 }